@@ -56,6 +56,24 @@
  * and unset BUILD_CPUMAP (number must be a power of 2 for netronome) */
 #define RSS_QUEUE_NUMBERS   32
 
+/* Set to 1 to send the packets that are not bypassed to the AF_XDP
+ * socket of their rx queue instead of the kernel stack. This is the
+ * filter to use with the af-xdp capture, it is built as
+ * xdp_filter_afxdp.bpf. The queue selects the socket, so there is no
+ * CPU redirect and no queue rewrite in this mode. */
+#ifndef AF_XDP_REDIRECT
+#define AF_XDP_REDIRECT     0
+#endif
+/* Increase XSKS_MAX_QUEUES if ever you have more than 64 queues */
+#define XSKS_MAX_QUEUES     64
+
+#if AF_XDP_REDIRECT
+#undef BUILD_CPUMAP
+#define BUILD_CPUMAP        0
+#undef RSS_QUEUE_NUMBERS
+#define RSS_QUEUE_NUMBERS   0
+#endif
+
 /* no vlan tracking: set it to 0 if you don't use VLAN for tracking. Can
  * also be used as workaround of some hardware offload issue */
 #define VLAN_TRACKING    1
@@ -130,6 +148,21 @@ struct bpf_map_def SEC("maps") tls_bypass_count = {
 };
 #endif
 
+#if AF_XDP_REDIRECT
+/* AF_XDP sockets of Suricata, indexed by rx queue */
+struct bpf_map_def SEC("maps") xsks_map = {
+    .type = BPF_MAP_TYPE_XSKMAP,
+    .key_size = sizeof(int),
+    .value_size = sizeof(int),
+    .max_entries = XSKS_MAX_QUEUES,
+};
+
+/* go to the kernel stack if no socket is bound to the queue */
+#define XDP_TO_SURICATA(ctx) bpf_redirect_map(&xsks_map, (ctx)->rx_queue_index, XDP_PASS)
+#else
+#define XDP_TO_SURICATA(ctx) XDP_PASS
+#endif
+
 #if BUILD_CPUMAP
 /* Special map type that can XDP_REDIRECT frames to another CPU */
 struct bpf_map_def SEC("maps") cpu_map = {
@@ -258,7 +291,7 @@ static int __always_inline filter_ipv4(struct xdp_md *ctx, void *data, __u64 nh_
 #endif
 
     if ((void *)(iph + 1) > data_end)
-        return XDP_PASS;
+        return XDP_TO_SURICATA(ctx);
 
     if (iph->protocol == IPPROTO_TCP) {
         tuple.ip_proto = 1;
@@ -270,11 +303,11 @@ static int __always_inline filter_ipv4(struct xdp_md *ctx, void *data, __u64 nh_
 
     dport = get_dport(iph + 1, data_end, iph->protocol);
     if (dport == -1)
-        return XDP_PASS;
+        return XDP_TO_SURICATA(ctx);
 
     sport = get_sport(iph + 1, data_end, iph->protocol);
     if (sport == -1)
-        return XDP_PASS;
+        return XDP_TO_SURICATA(ctx);
 
     tuple.port16[0] = (__u16)sport;
     tuple.port16[1] = (__u16)dport;
@@ -363,7 +396,7 @@ static int __always_inline filter_ipv4(struct xdp_md *ctx, void *data, __u64 nh_
         cpu_dest = *cpu_selected;
         return bpf_redirect_map(&cpu_map, cpu_dest, 0);
     } else {
-        return XDP_PASS;
+        return XDP_TO_SURICATA(ctx);
     }
 #else
 #if RSS_QUEUE_NUMBERS
@@ -372,7 +405,7 @@ static int __always_inline filter_ipv4(struct xdp_md *ctx, void *data, __u64 nh_
     xdp_hash = SuperFastHash((char *)&xdp_hash, 4, INITVAL + iph->protocol);
     ctx->rx_queue_index = xdp_hash % RSS_QUEUE_NUMBERS;
 #endif
-    return XDP_PASS;
+    return XDP_TO_SURICATA(ctx);
 #endif
 }
 
@@ -400,15 +433,15 @@ static int __always_inline filter_ipv6(struct xdp_md *ctx, void *data, __u64 nh_
     if ((void *)(ip6h + 1) > data_end)
         return 0;
     if (!((ip6h->nexthdr == IPPROTO_UDP) || (ip6h->nexthdr == IPPROTO_TCP)))
-        return XDP_PASS;
+        return XDP_TO_SURICATA(ctx);
 
     dport = get_dport(ip6h + 1, data_end, ip6h->nexthdr);
     if (dport == -1)
-        return XDP_PASS;
+        return XDP_TO_SURICATA(ctx);
 
     sport = get_sport(ip6h + 1, data_end, ip6h->nexthdr);
     if (sport == -1)
-        return XDP_PASS;
+        return XDP_TO_SURICATA(ctx);
 
     if (ip6h->nexthdr == IPPROTO_TCP) {
         tuple.ip_proto = 1;
@@ -465,7 +498,7 @@ static int __always_inline filter_ipv6(struct xdp_md *ctx, void *data, __u64 nh_
         cpu_dest = *cpu_selected;
         return bpf_redirect_map(&cpu_map, cpu_dest, 0);
     } else {
-        return XDP_PASS;
+        return XDP_TO_SURICATA(ctx);
     }
 #else
 #if RSS_QUEUE_NUMBERS
@@ -478,7 +511,7 @@ static int __always_inline filter_ipv6(struct xdp_md *ctx, void *data, __u64 nh_
     ctx->rx_queue_index = xdp_hash % RSS_QUEUE_NUMBERS;
 #endif
 
-    return XDP_PASS;
+    return XDP_TO_SURICATA(ctx);
 #endif
 }
 
@@ -510,7 +543,7 @@ int SEC("xdp") xdp_hashfilter(struct xdp_md *ctx)
 
     nh_off = sizeof(*eth);
     if (data + nh_off > data_end)
-        return XDP_PASS;
+        return XDP_TO_SURICATA(ctx);
 
     h_proto = eth->h_proto;
 
@@ -520,7 +553,7 @@ int SEC("xdp") xdp_hashfilter(struct xdp_md *ctx)
         vhdr = data + nh_off;
         nh_off += sizeof(struct vlan_hdr);
         if (data + nh_off > data_end)
-            return XDP_PASS;
+            return XDP_TO_SURICATA(ctx);
         h_proto = vhdr->h_vlan_encapsulated_proto;
 #if VLAN_TRACKING
         vlan0 = vhdr->h_vlan_TCI & 0x0fff;
@@ -534,7 +567,7 @@ int SEC("xdp") xdp_hashfilter(struct xdp_md *ctx)
         vhdr = data + nh_off;
         nh_off += sizeof(struct vlan_hdr);
         if (data + nh_off > data_end)
-            return XDP_PASS;
+            return XDP_TO_SURICATA(ctx);
         h_proto = vhdr->h_vlan_encapsulated_proto;
 #if VLAN_TRACKING
         vlan1 = vhdr->h_vlan_TCI & 0x0fff;
@@ -548,7 +581,7 @@ int SEC("xdp") xdp_hashfilter(struct xdp_md *ctx)
     else if (h_proto == __constant_htons(ETH_P_IPV6))
         return filter_ipv6(ctx, data, nh_off, data_end, vlan0, vlan1);
 
-    return XDP_PASS;
+    return XDP_TO_SURICATA(ctx);
 }
 
 char __license[] SEC("license") = "GPL";
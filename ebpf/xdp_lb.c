@@ -70,6 +70,113 @@ struct bpf_map_def SEC("maps") cpus_count = {
     .max_entries	= 1,
 };
 
+#ifdef ADAPTIVE_LB
+/* Number of IP pairs remembered by the adaptive load balancer */
+#define LB_FLOW_TABLE_SIZE 65536
+/* Number of slots of lb_pairs_seen, must be a power of 2 */
+#define LB_PAIRS_SEEN_SIZE 262144
+/* Generations of lb_pairs_seen last 2^35 ns, about 34 seconds */
+#define LB_GENERATION_SHIFT 35
+
+/* Load of the worker running on each CPU, published by Suricata. The
+ * map is indexed like cpus_available. */
+struct bpf_map_def SEC("maps") cpus_load = {
+    .type		= BPF_MAP_TYPE_ARRAY,
+    .key_size	= sizeof(__u32),
+    .value_size	= sizeof(__u32),
+    .max_entries	= CPUMAP_MAX_CPUS,
+};
+
+/* Index in cpus_available of the CPU selected for an IP pair */
+struct bpf_map_def SEC("maps") lb_flow_table = {
+    .type		= BPF_MAP_TYPE_LRU_HASH,
+    .key_size	= sizeof(__u64),
+    .value_size	= sizeof(__u32),
+    .max_entries	= LB_FLOW_TABLE_SIZE,
+};
+
+/* Candidate picked by the IP pairs recently seen, indexed by a hash of the
+ * IP pair. An IP pair evicted from lb_flow_table while still active gets
+ * the same CPU again instead of being moved mid flow. The value is
+ * generation << 1 | second candidate picked. */
+struct bpf_map_def SEC("maps") lb_pairs_seen = {
+    .type		= BPF_MAP_TYPE_ARRAY,
+    .key_size	= sizeof(__u32),
+    .value_size	= sizeof(__u32),
+    .max_entries	= LB_PAIRS_SEEN_SIZE,
+};
+
+#define LB_STATS_EVICTED 0
+#define LB_STATS_MAX     1
+
+/* Per CPU counters. LB_STATS_EVICTED: misses in lb_flow_table for an IP pair
+ * recently seen, mostly active IP pairs that had been evicted. If this grows,
+ * LB_FLOW_TABLE_SIZE is too small. */
+struct bpf_map_def SEC("maps") lb_stats = {
+    .type		= BPF_MAP_TYPE_PERCPU_ARRAY,
+    .key_size	= sizeof(__u32),
+    .value_size	= sizeof(__u64),
+    .max_entries	= LB_STATS_MAX,
+};
+#endif
+
+/* Return the index in cpus_available of the CPU handling an IP pair.
+ *
+ * In adaptive mode, an IP pair already seen keeps its CPU. A new one goes
+ * to the least loaded of two candidate CPUs derived from the hash. Using two
+ * candidates instead of the global minimum prevents all the new IP pairs seen
+ * between two load updates to hit the same CPU.
+ *
+ * lb_flow_table is an LRU map, so with more active IP pairs than it can
+ * hold some are evicted. On a miss, an IP pair seen during the current or
+ * the previous generation gets the candidate it picked before from
+ * lb_pairs_seen. Two IP pairs sharing a slot can then pick the same
+ * candidate index, which is one of their own two CPUs either way. */
+static __u32 __always_inline select_cpu(__u64 pair_key, __u32 cpu_hash, __u32 cpu_max)
+{
+#ifdef ADAPTIVE_LB
+    __u32 first = cpu_hash % cpu_max;
+    __u32 second = (cpu_hash >> 16) % cpu_max;
+    if (second == first)
+        second = (first + 1) % cpu_max;
+
+    __u32 gen = (__u32)(bpf_ktime_get_ns() >> LB_GENERATION_SHIFT) & 0x7fffffff;
+    __u32 slot_idx = (cpu_hash ^ (__u32)pair_key) & (LB_PAIRS_SEEN_SIZE - 1);
+    __u32 *slot = bpf_map_lookup_elem(&lb_pairs_seen, &slot_idx);
+
+    __u32 *known = bpf_map_lookup_elem(&lb_flow_table, &pair_key);
+    if (known && *known < cpu_max) {
+        /* refreshed once per generation to limit the writes */
+        if (slot && (*slot >> 1) != gen)
+            *slot = (gen << 1) | (*known != first);
+        return *known;
+    }
+
+    __u32 selected = first;
+    if (slot && *slot != 0 && ((gen - (*slot >> 1)) & 0x7fffffff) <= 1) {
+        /* evicted from lb_flow_table while active, keep its CPU */
+        if (*slot & 1)
+            selected = second;
+        __u32 key = LB_STATS_EVICTED;
+        __u64 *evicted = bpf_map_lookup_elem(&lb_stats, &key);
+        if (evicted)
+            *evicted += 1;
+    } else {
+        __u32 *first_load = bpf_map_lookup_elem(&cpus_load, &first);
+        __u32 *second_load = bpf_map_lookup_elem(&cpus_load, &second);
+        if (first_load && second_load && *second_load < *first_load)
+            selected = second;
+    }
+
+    if (slot)
+        *slot = (gen << 1) | (selected != first);
+    bpf_map_update_elem(&lb_flow_table, &pair_key, &selected, BPF_ANY);
+    return selected;
+#else
+    return cpu_hash % cpu_max;
+#endif
+}
+
 static int __always_inline hash_ipv4(void *data, void *data_end)
 {
     struct iphdr *iph = data;
@@ -82,12 +189,15 @@ static int __always_inline hash_ipv4(void *data, void *data_end)
     __u32 *cpu_selected;
     __u32 cpu_hash;
 
+    __u64 pair_key;
+
     /* IP-pairs hit same CPU */
     cpu_hash = iph->saddr + iph->daddr;
+    pair_key = ((__u64)cpu_hash << 32) | (iph->saddr ^ iph->daddr);
     cpu_hash = SuperFastHash((char *)&cpu_hash, 4, INITVAL);
 
     if (cpu_max && *cpu_max) {
-        cpu_dest = cpu_hash % *cpu_max;
+        cpu_dest = select_cpu(pair_key, cpu_hash, *cpu_max);
         cpu_selected = bpf_map_lookup_elem(&cpus_available, &cpu_dest);
         if (!cpu_selected)
             return XDP_ABORTED;
@@ -109,16 +219,23 @@ static int __always_inline hash_ipv6(void *data, void *data_end)
     __u32 *cpu_max = bpf_map_lookup_elem(&cpus_count, &key0);
     __u32 *cpu_selected;
     __u32 cpu_hash;
+    __u32 pair_xor;
+    __u64 pair_key;
 
     /* IP-pairs hit same CPU */
     cpu_hash  = ip6h->saddr.s6_addr32[0] + ip6h->daddr.s6_addr32[0];
     cpu_hash += ip6h->saddr.s6_addr32[1] + ip6h->daddr.s6_addr32[1];
     cpu_hash += ip6h->saddr.s6_addr32[2] + ip6h->daddr.s6_addr32[2];
     cpu_hash += ip6h->saddr.s6_addr32[3] + ip6h->daddr.s6_addr32[3];
+    pair_xor  = ip6h->saddr.s6_addr32[0] ^ ip6h->daddr.s6_addr32[0];
+    pair_xor ^= ip6h->saddr.s6_addr32[1] ^ ip6h->daddr.s6_addr32[1];
+    pair_xor ^= ip6h->saddr.s6_addr32[2] ^ ip6h->daddr.s6_addr32[2];
+    pair_xor ^= ip6h->saddr.s6_addr32[3] ^ ip6h->daddr.s6_addr32[3];
+    pair_key = ((__u64)cpu_hash << 32) | pair_xor;
     cpu_hash = SuperFastHash((char *)&cpu_hash, 4, INITVAL);
 
     if (cpu_max && *cpu_max) {
-        cpu_dest = cpu_hash % *cpu_max;
+        cpu_dest = select_cpu(pair_key, cpu_hash, *cpu_max);
         cpu_selected = bpf_map_lookup_elem(&cpus_available, &cpu_dest);
         if (!cpu_selected)
             return XDP_ABORTED;
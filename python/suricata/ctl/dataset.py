@@ -0,0 +1,171 @@
+# Copyright (C) 2022 Open Information Security Foundation
+#
+# You can copy, redistribute or modify this Program under the terms of
+# the GNU General Public License version 2 as published by the Free
+# Software Foundation.
+
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# version 2 along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+# 02110-1301, USA.
+
+"""Compile dataset files into the compact binary format.
+
+The format is described in src/datasets-compact.h. The file is loaded
+by Suricata with mmap instead of being parsed into a hash table at
+startup.
+"""
+
+from __future__ import print_function
+
+import base64
+import binascii
+import logging
+import struct
+import sys
+
+logger = logging.getLogger("dataset")
+
+MAGIC = b"SCDSCMP1"
+VERSION = 1
+BOM = 0x01020304
+FLAG_REP = 1
+INDEX_CNT = 65536 + 1
+
+# enum DatasetTypes
+TYPES = {
+    "string": (1, 0),
+    "md5": (2, 16),
+    "sha256": (3, 32),
+}
+
+HEADER = struct.Struct("<8sIIIIIIQQQQQ")
+
+
+class InvalidDataError(Exception):
+    pass
+
+
+def register_args(parser):
+    subparser = parser.add_subparsers(help="sub-command help")
+    compile_parser = subparser.add_parser("compile",
+            help="Compile a dataset file into the compact format")
+    compile_parser.add_argument("-t", "--type", required=True,
+            choices=sorted(TYPES.keys()), help="dataset type")
+    compile_parser.add_argument("input", help="dataset file to read")
+    compile_parser.add_argument("output", help="compact dataset file to write")
+    compile_parser.set_defaults(func=compile_cmd)
+
+
+def parse_rep(value):
+    try:
+        rep = int(value, 10)
+    except ValueError:
+        raise InvalidDataError("invalid reputation value: %s" % (value))
+    if rep < 0 or rep > 65535:
+        raise InvalidDataError("reputation value out of range: %s" % (value))
+    return rep
+
+
+def parse_line(set_type, line):
+    """ Parse a line in the format used by the dataset load/state files.
+    Returns a (key, rep) tuple, rep being None if not set. """
+    parts = line.split(",")
+    if len(parts) > 2:
+        raise InvalidDataError("invalid line: %s" % (line))
+    rep = parse_rep(parts[1]) if len(parts) == 2 else None
+
+    if set_type == "string":
+        try:
+            key = base64.b64decode(parts[0].encode(), validate=True)
+        except (binascii.Error, ValueError):
+            raise InvalidDataError("bad base64 encoding: %s" % (parts[0]))
+    else:
+        key_size = TYPES[set_type][1]
+        if len(parts[0]) != key_size * 2:
+            raise InvalidDataError("bad %s: %s" % (set_type, parts[0]))
+        try:
+            key = binascii.unhexlify(parts[0])
+        except (binascii.Error, TypeError):
+            raise InvalidDataError("bad %s: %s" % (set_type, parts[0]))
+    return key, rep
+
+
+def key_prefix(key):
+    prefix = 0
+    if len(key) > 0:
+        prefix = bytearray(key[:1])[0] << 8
+    if len(key) > 1:
+        prefix |= bytearray(key[1:2])[0]
+    return prefix
+
+
+def build(set_type, entries):
+    """ Build the compact file contents from a dict of key -> rep. """
+    type_id, key_size = TYPES[set_type]
+    has_rep = any(rep is not None for rep in entries.values())
+    flags = FLAG_REP if has_rep else 0
+    keys = sorted(entries.keys())
+
+    index = [0] * INDEX_CNT
+    for key in keys:
+        index[key_prefix(key) + 1] += 1
+    for i in range(1, INDEX_CNT):
+        index[i] += index[i - 1]
+
+    records = bytearray()
+    data = bytearray()
+    if set_type == "string":
+        record_size = 8
+        for key in keys:
+            records += struct.pack("<Q", len(data))
+            data += struct.pack("<IH", len(key), entries[key] or 0)
+            data += key
+    else:
+        record_size = key_size + (2 if has_rep else 0)
+        for key in keys:
+            records += key
+            if has_rep:
+                records += struct.pack("<H", entries[key] or 0)
+
+    index_offset = HEADER.size
+    records_offset = index_offset + INDEX_CNT * 8
+    data_offset = records_offset + len(records)
+
+    header = HEADER.pack(MAGIC, BOM, VERSION, type_id, flags, key_size,
+            record_size, len(keys), index_offset, records_offset,
+            data_offset, len(data))
+    return b"".join([header, struct.pack("<%dQ" % (INDEX_CNT), *index),
+        bytes(records), bytes(data)])
+
+
+def load(set_type, fileobj):
+    entries = {}
+    for lineno, line in enumerate(fileobj, 1):
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            key, rep = parse_line(set_type, line)
+        except InvalidDataError as err:
+            raise InvalidDataError("line %d: %s" % (lineno, err))
+        entries[key] = rep
+    return entries
+
+
+def compile_cmd(args):
+    try:
+        with open(args.input, "r") as fileobj:
+            entries = load(args.type, fileobj)
+    except InvalidDataError as err:
+        logger.error("%s: %s", args.input, err)
+        sys.exit(1)
+    with open(args.output, "wb") as fileobj:
+        fileobj.write(build(args.type, entries))
+    logger.info("Wrote %d %s records to %s", len(entries), args.type,
+            args.output)
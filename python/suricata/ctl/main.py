@@ -19,7 +19,7 @@ import os
 import argparse
 import logging
 
-from suricata.ctl import filestore, loghandler
+from suricata.ctl import filestore, dataset, loghandler
 
 def init_logger():
     """ Initialize logging, use colour if on a tty. """
@@ -38,6 +38,8 @@ def main():
     subparsers = parser.add_subparsers(help='sub-command help')
     fs_parser = subparsers.add_parser("filestore", help="Filestore related commands")
     filestore.register_args(parser=fs_parser)
+    ds_parser = subparsers.add_parser("dataset", help="Dataset related commands")
+    dataset.register_args(parser=ds_parser)
     args = parser.parse_args()
     try:
         func = args.func
@@ -0,0 +1,43 @@
+from __future__ import print_function
+
+import struct
+import unittest
+
+from suricata.ctl import dataset
+
+class CompileTestCase(unittest.TestCase):
+
+    def test_parse_line(self):
+        self.assertEqual(dataset.parse_line("string", "dGVzdA=="),
+                (b"test", None))
+        self.assertEqual(dataset.parse_line("string", "dGVzdA==,10"),
+                (b"test", 10))
+        self.assertEqual(dataset.parse_line("md5", "00" * 16),
+                (b"\x00" * 16, None))
+
+        with self.assertRaises(dataset.InvalidDataError):
+            dataset.parse_line("md5", "00" * 15)
+        with self.assertRaises(dataset.InvalidDataError):
+            dataset.parse_line("sha256", "zz" * 32)
+        with self.assertRaises(dataset.InvalidDataError):
+            dataset.parse_line("string", "dGVzdA==,70000")
+
+    def test_build(self):
+        entries = {b"\xee" * 16: 20, b"\x11" * 16: 10}
+        buf = dataset.build("md5", entries)
+        header = dataset.HEADER.unpack_from(buf)
+        self.assertEqual(header[0], dataset.MAGIC)
+        self.assertEqual(header[4], dataset.FLAG_REP)
+        self.assertEqual(header[6], 18)
+        self.assertEqual(header[7], 2)
+
+        index = struct.unpack_from("<%dQ" % (dataset.INDEX_CNT), buf,
+                header[8])
+        self.assertEqual(index[0x1111], 0)
+        self.assertEqual(index[0x1112], 1)
+        self.assertEqual(index[0xeeef], 2)
+        self.assertEqual(index[-1], 2)
+
+        records = buf[header[9]:header[10]]
+        self.assertEqual(records[:16], b"\x11" * 16)
+        self.assertEqual(struct.unpack_from("<H", records, 16)[0], 10)
@@ -89,6 +89,7 @@ class SuricataSC:
                 "pcap-last-processed",
                 "pcap-interrupt",
                 "iface-list",
+                "dataset-stats",
                 ]
         self.fn_commands = [
                 "pcap-file",
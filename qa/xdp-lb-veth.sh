@@ -0,0 +1,193 @@
+#!/bin/sh
+#
+# Drive the adaptive XDP load balancer (ebpf/xdp_lb_adaptive.bpf) through a
+# veth pair and check how the IP pairs have been spread over the CPUs. Exits
+# with 1 if an IP pair wasn't steered, a CPU got no IP pairs, or the CPUs
+# handling the heavy IP pairs didn't get less new IP pairs than the others.
+#
+# Usage: qa/xdp-lb-veth.sh <suricata binary> <suricata.yaml> <xdp_lb_adaptive.bpf> [threads]
+#
+# Needs root, python3, bpftool and a kernel supporting cpumap redirect in
+# generic XDP mode. The af-packet and threading sections of the yaml are
+# overridden to capture on the veth pair with one worker per CPU of the
+# redirect set.
+
+set -e
+
+if [ $# -lt 3 ]; then
+    echo "Usage: $0 <suricata binary> <suricata.yaml> <xdp_lb_adaptive.bpf> [threads]"
+    exit 1
+fi
+
+SURICATA=$1
+CONF=$(realpath "$2")
+BPF=$(realpath "$3")
+THREADS=${4:-4}
+LAST_CPU=$((THREADS - 1))
+IFACE=xdplb0
+PEER=xdplb1
+WORKDIR=$(mktemp -d)
+PID=""
+
+cleanup() {
+    if [ -n "$PID" ]; then
+        kill "$PID" 2>/dev/null || true
+        wait "$PID" 2>/dev/null || true
+    fi
+    ip link del "$IFACE" 2>/dev/null || true
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT INT TERM
+
+ip link add "$IFACE" type veth peer name "$PEER"
+ip link set "$IFACE" up
+ip link set "$PEER" up
+
+cat > "$WORKDIR/suricata.yaml" <<EOF
+%YAML 1.1
+---
+include: $CONF
+
+af-packet:
+  - interface: $IFACE
+    threads: $THREADS
+    cluster-id: 97
+    cluster-type: cluster_cpu
+    xdp-mode: soft
+    xdp-filter-file: $BPF
+    xdp-cpu-redirect: ["0-$LAST_CPU"]
+    use-mmap: yes
+
+threading:
+  set-cpu-affinity: yes
+  cpu-affinity:
+    - worker-cpu-set:
+        cpu: [ "0-$LAST_CPU" ]
+        mode: "exclusive"
+EOF
+
+"$SURICATA" -c "$WORKDIR/suricata.yaml" -l "$WORKDIR" --af-packet="$IFACE" \
+    --runmode workers > "$WORKDIR/suricata.out" 2>&1 &
+PID=$!
+
+# wait for the XDP program to be attached and the workers to be running
+for i in $(seq 1 60); do
+    if grep -q "Engine started" "$WORKDIR/suricata.out"; then
+        break
+    fi
+    if ! kill -0 "$PID" 2>/dev/null; then
+        cat "$WORKDIR/suricata.out"
+        exit 1
+    fi
+    sleep 1
+done
+
+# Send UDP packets for 1024 IP pairs. The first 2 pairs carry most of the
+# traffic: the CPUs handling them must then get less new pairs.
+python3 - "$PEER" "$WORKDIR/pairs.txt" <<'EOF'
+import random
+import socket
+import struct
+import sys
+import time
+
+def checksum(data):
+    s = sum(struct.unpack("!%dH" % (len(data) // 2), data))
+    s = (s >> 16) + (s & 0xffff)
+    s += s >> 16
+    return ~s & 0xffff
+
+def frame(src, dst, sport, dport):
+    payload = bytes(256)
+    udp = struct.pack("!HHHH", sport, dport, 8 + len(payload), 0) + payload
+    ip = struct.pack("!BBHHHBBH4s4s", 0x45, 0, 20 + len(udp), 0, 0, 64, 17, 0,
+                     socket.inet_aton(src), socket.inet_aton(dst))
+    ip = ip[:10] + struct.pack("!H", checksum(ip)) + ip[12:]
+    eth = b"\x02\x00\x00\x00\x00\x01" + b"\x02\x00\x00\x00\x00\x02" + b"\x08\x00"
+    return eth + ip + udp
+
+sock = socket.socket(socket.AF_PACKET, socket.SOCK_RAW)
+sock.bind((sys.argv[1], 0))
+rnd = random.Random(42)
+pairs = [("10.%d.%d.%d" % (rnd.randrange(256), rnd.randrange(256), rnd.randrange(1, 255)),
+          "172.16.%d.%d" % (rnd.randrange(256), rnd.randrange(1, 255))) for _ in range(1024)]
+with open(sys.argv[2], "w") as f:
+    for s, d in pairs:
+        f.write("%s %s\n" % (s, d))
+heavy = [frame(s, d, 1024, 53) for s, d in pairs[:2]]
+
+# new pairs come in rounds so the workers publish their load in between
+for start in range(0, len(pairs), 128):
+    for s, d in pairs[start:start + 128]:
+        sock.send(frame(s, d, 1024, 53))
+        for f in heavy:
+            for _ in range(32):
+                sock.send(f)
+    time.sleep(1.5)
+EOF
+
+sleep 2
+bpftool -j map dump name cpus_load > "$WORKDIR/cpus_load.json"
+bpftool -j map dump name lb_flow_table > "$WORKDIR/lb_flow_table.json"
+bpftool -j map dump name lb_stats > "$WORKDIR/lb_stats.json"
+
+python3 - "$WORKDIR" "$THREADS" <<'EOF'
+import collections
+import json
+import socket
+import sys
+
+workdir, threads = sys.argv[1], int(sys.argv[2])
+
+def le(hexbytes):
+    return int.from_bytes(bytes(int(b, 16) for b in hexbytes), "little")
+
+def pair_key(src, dst):
+    # same key as hash_ipv4() in xdp_lb.c, addresses read as host order u32
+    s = int.from_bytes(socket.inet_aton(src), "little")
+    d = int.from_bytes(socket.inet_aton(dst), "little")
+    return (((s + d) & 0xffffffff) << 32) | (s ^ d)
+
+with open(workdir + "/cpus_load.json") as f:
+    load = {le(e["key"]): le(e["value"]) for e in json.load(f)}
+with open(workdir + "/lb_flow_table.json") as f:
+    table = {le(e["key"]): le(e["value"]) for e in json.load(f)}
+with open(workdir + "/lb_stats.json") as f:
+    evicted = sum(le(v["value"]) for e in json.load(f) for v in e["values"])
+with open(workdir + "/pairs.txt") as f:
+    pairs = [line.split() for line in f]
+
+errors = []
+cpus = []
+for s, d in pairs:
+    idx = table.get(pair_key(s, d))
+    if idx is None:
+        errors.append("IP pair %s-%s not in lb_flow_table" % (s, d))
+    cpus.append(idx)
+
+heavy_cpus = set(idx for idx in cpus[:2] if idx is not None)
+light = collections.Counter(idx for idx in cpus[2:] if idx is not None)
+
+print("== CPU index: load, new IP pairs")
+for idx in range(threads):
+    print("%d: %d, %d%s" % (idx, load.get(idx, 0), light[idx],
+                            " (heavy)" if idx in heavy_cpus else ""))
+print("== IP pairs evicted from lb_flow_table: %d" % evicted)
+
+for idx in range(threads):
+    if light[idx] == 0:
+        errors.append("CPU index %d got no IP pairs" % idx)
+other = [light[idx] for idx in range(threads) if idx not in heavy_cpus]
+if other:
+    avg_other = sum(other) / len(other)
+    for idx in heavy_cpus:
+        if light[idx] >= avg_other:
+            errors.append("CPU index %d handles a heavy IP pair but got %d new IP pairs, "
+                          "the others %.1f on average" % (idx, light[idx], avg_other))
+if evicted:
+    errors.append("%d IP pairs evicted from lb_flow_table" % evicted)
+
+for e in errors:
+    print("FAIL: " + e)
+sys.exit(1 if errors else 0)
+EOF
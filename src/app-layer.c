@@ -40,6 +40,7 @@
 #include "flow.h"
 #include "flow-util.h"
 #include "flow-private.h"
+#include "flow-cost.h"
 #include "ippair.h"
 #include "util-debug.h"
 #include "util-print.h"
@@ -627,19 +628,8 @@ detect_error:
     SCReturnInt(-2);
 }
 
-/** \brief handle TCP data for the app-layer.
- *
- *  First run protocol detection and then when the protocol is known invoke
- *  the app layer parser.
- *
- *  \param stream ptr-to-ptr to stream object. Might change if flow dir is
- *                reversed.
- */
-int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
-                          Packet *p, Flow *f,
-                          TcpSession *ssn, TcpStream **stream,
-                          uint8_t *data, uint32_t data_len,
-                          uint8_t flags)
+static int HandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx, Packet *p, Flow *f,
+        TcpSession *ssn, TcpStream **stream, uint8_t *data, uint32_t data_len, uint8_t flags)
 {
     SCEnter();
 
@@ -785,6 +775,29 @@ int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     SCReturnInt(r);
 }
 
+/** \brief handle TCP data for the app-layer.
+ *
+ *  First run protocol detection and then when the protocol is known invoke
+ *  the app layer parser.
+ *
+ *  \param stream ptr-to-ptr to stream object. Might change if flow dir is
+ *                reversed.
+ */
+int AppLayerHandleTCPData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
+                          Packet *p, Flow *f,
+                          TcpSession *ssn, TcpStream **stream,
+                          uint8_t *data, uint32_t data_len,
+                          uint8_t flags)
+{
+    if (!g_flow_cost_enabled)
+        return HandleTCPData(tv, ra_ctx, p, f, ssn, stream, data, data_len, flags);
+
+    const uint64_t start = UtilCpuGetTicks();
+    int r = HandleTCPData(tv, ra_ctx, p, f, ssn, stream, data, data_len, flags);
+    FlowCostAddTicks(f, FLOW_COST_APPLAYER, UtilCpuGetTicks() - start);
+    return r;
+}
+
 /**
  *  \brief Handle a app layer UDP message
  *
@@ -58,10 +58,71 @@ enum {
     STATS_TYPE_AVERAGE = 2,
     STATS_TYPE_MAXIMUM = 3,
     STATS_TYPE_FUNC = 4,
+    STATS_TYPE_HISTOGRAM = 5,
 
-    STATS_TYPE_MAX = 5,
+    STATS_TYPE_MAX = 6,
+};
+
+/* Histogram counters use log-linear buckets: values below 8 have a bucket
+ * each, above that each power of 2 is split in 8 buckets. The error on a
+ * value read back from a bucket is below 12.5%. Values are capped at 2^40. */
+#define STATS_HISTOGRAM_SUB_BITS    3
+#define STATS_HISTOGRAM_SUB_COUNT   (1 << STATS_HISTOGRAM_SUB_BITS)
+#define STATS_HISTOGRAM_MAX_VALUE   ((UINT64_C(1) << 40) - 1)
+#define STATS_HISTOGRAM_BUCKETS     ((40 - STATS_HISTOGRAM_SUB_BITS + 1) * STATS_HISTOGRAM_SUB_COUNT)
+
+/* records output for a histogram counter, using consecutive global ids */
+enum {
+    STATS_HISTOGRAM_COUNT = 0,
+    STATS_HISTOGRAM_P50,
+    STATS_HISTOGRAM_P90,
+    STATS_HISTOGRAM_P99,
+    STATS_HISTOGRAM_P999,
+    STATS_HISTOGRAM_MAX,
+
+    STATS_HISTOGRAM_OUTPUTS,
+};
+
+static const struct {
+    const char *suffix;
+    uint32_t permille;
+} stats_histogram_outputs[STATS_HISTOGRAM_OUTPUTS] = {
+    { "count", 0 },
+    { "p50", 500 },
+    { "p90", 900 },
+    { "p99", 990 },
+    { "p999", 999 },
+    { "max", 1000 },
 };
 
+/**
+ * \brief names of the records of a histogram counter, and the buckets of
+ *        all threads merged together
+ */
+typedef struct StatsHistogramMerge_ {
+    char *names[STATS_HISTOGRAM_OUTPUTS];
+    /** StatsOutput() call the merged buckets belong to */
+    uint32_t pass;
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[STATS_HISTOGRAM_BUCKETS];
+} StatsHistogramMerge;
+
+/**
+ * \brief copy of a counter of a thread, as last read by the stats thread
+ */
+typedef struct StatsThreadCounter_ {
+    int type;
+    uint16_t gid;
+    int64_t value;
+    uint64_t updates;
+    const char *name;
+    uint64_t (*Func)(void);
+    /** histogram counters only */
+    uint64_t *buckets;
+    StatsHistogramMerge *hist;
+} StatsThreadCounter;
+
 /**
  * \brief per thread store of counters
  */
@@ -74,6 +135,13 @@ typedef struct StatsThreadStore_ {
     StatsPublicThreadContext **head;
     uint32_t size;
 
+    /** counters of the thread indexed by local id, and the publication
+     *  sequence they were read at */
+    StatsThreadCounter *counters;
+    uint16_t counters_size;
+    uint32_t seq;
+    bool synced;
+
     struct StatsThreadStore_ *next;
 } StatsThreadStore;
 
@@ -104,9 +172,21 @@ bool stats_decoder_events = true;
 const char *stats_decoder_events_prefix = "decoder.event";
 /**< add stream events as stats? disabled by default */
 bool stats_stream_events = false;
+/** register the latency histogram counters? disabled by default */
+static bool stats_latency_histograms = false;
+/** number of StatsOutput() calls, used to reset the histogram merges */
+static uint32_t stats_output_pass = 0;
+
+/** shared memory export of the counters totals, if enabled */
+static const char *stats_shm_filename = NULL;
+static int stats_shm_fd = -1;
+static StatsShmHeader *stats_shm = NULL;
+static size_t stats_shm_size = 0;
 
 static int StatsOutput(ThreadVars *tv);
+static void StatsShmClose(void);
 static int StatsThreadRegister(const char *thread_name, StatsPublicThreadContext *);
+static StatsHistogramMerge *StatsHistogramLookup(const char *name);
 void StatsReleaseCounters(StatsCounter *head);
 
 /** stats table is filled each interval and passed to the
@@ -122,9 +202,21 @@ bool StatsEnabled(void)
     return stats_enabled;
 }
 
+/**
+ * \brief Are the latency histograms of the engine to be registered?
+ *
+ * Measuring latencies takes timestamps in the hot paths, so the
+ * histogram counters are only registered when asked for in the config.
+ */
+bool StatsLatencyHistogramsEnabled(void)
+{
+    return stats_enabled && stats_latency_histograms;
+}
+
 static void StatsPublicThreadContextInit(StatsPublicThreadContext *t)
 {
     SCMutexInit(&t->m, NULL);
+    SC_ATOMIC_INIT(t->seq);
 }
 
 static void StatsPublicThreadContextCleanup(StatsPublicThreadContext *t)
@@ -231,6 +323,94 @@ void StatsSetUI64(ThreadVars *tv, uint16_t id, uint64_t x)
     return;
 }
 
+/** \internal
+ *  \brief Get the bucket of a value in a histogram
+ */
+static inline uint32_t StatsHistogramBucket(uint64_t x)
+{
+    if (x < STATS_HISTOGRAM_SUB_COUNT)
+        return (uint32_t)x;
+    if (x > STATS_HISTOGRAM_MAX_VALUE)
+        x = STATS_HISTOGRAM_MAX_VALUE;
+
+    const uint32_t shift = (63 - __builtin_clzll(x)) - STATS_HISTOGRAM_SUB_BITS;
+    return (shift + 1) * STATS_HISTOGRAM_SUB_COUNT +
+           (uint32_t)((x >> shift) & (STATS_HISTOGRAM_SUB_COUNT - 1));
+}
+
+/** \internal
+ *  \brief Get the highest value falling in a histogram bucket
+ */
+static uint64_t StatsHistogramBucketHigh(uint32_t bucket)
+{
+    if (bucket < STATS_HISTOGRAM_SUB_COUNT)
+        return bucket;
+
+    const uint32_t shift = bucket / STATS_HISTOGRAM_SUB_COUNT - 1;
+    const uint64_t low = (uint64_t)(STATS_HISTOGRAM_SUB_COUNT +
+                                    bucket % STATS_HISTOGRAM_SUB_COUNT) << shift;
+    return low + (UINT64_C(1) << shift) - 1;
+}
+
+/** \internal
+ *  \brief Compute the values of the records of a histogram counter
+ *
+ *  \param buckets histogram buckets
+ *  \param count   number of values in the buckets
+ *  \param max     largest value added
+ *  \param values  array of STATS_HISTOGRAM_OUTPUTS values to fill
+ */
+static void StatsHistogramValues(const uint64_t *buckets, uint64_t count, uint64_t max,
+        int64_t *values)
+{
+    values[STATS_HISTOGRAM_COUNT] = count;
+
+    for (int o = STATS_HISTOGRAM_COUNT + 1; o < STATS_HISTOGRAM_OUTPUTS; o++) {
+        const uint32_t permille = stats_histogram_outputs[o].permille;
+        if (count == 0 || permille >= 1000) {
+            values[o] = count ? max : 0;
+            continue;
+        }
+
+        /* smallest value that 'permille' of the values are less or equal to */
+        const uint64_t rank = MAX((count * permille + 999) / 1000, 1);
+        uint64_t seen = 0;
+        uint64_t v = max;
+        for (uint32_t b = 0; b < STATS_HISTOGRAM_BUCKETS; b++) {
+            seen += buckets[b];
+            if (seen >= rank) {
+                v = StatsHistogramBucketHigh(b);
+                break;
+            }
+        }
+        values[o] = MIN(v, max);
+    }
+}
+
+/**
+ * \brief Adds a value to a histogram counter
+ *
+ * \param id  Index of the histogram counter in the counter array
+ * \param x   Value to add, e.g. a latency in microseconds
+ */
+void StatsHistogramAdd(ThreadVars *tv, uint16_t id, uint64_t x)
+{
+    StatsPrivateThreadContext *pca = &tv->perf_private_ctx;
+#if defined(UNITTESTS) || defined(FUZZ)
+    if (pca->initialized == 0)
+        return;
+#endif
+#ifdef DEBUG
+    BUG_ON((id < 1) || (id > pca->size));
+    BUG_ON(pca->head[id].buckets == NULL);
+#endif
+    StatsLocalCounter *c = &pca->head[id];
+    c->buckets[StatsHistogramBucket(x)]++;
+    if ((int64_t)x > c->value)
+        c->value = x;
+    c->updates++;
+}
+
 static ConfNode *GetConfig(void) {
     ConfNode *stats = ConfGetNode("stats");
     if (stats != NULL)
@@ -288,12 +468,28 @@ static void StatsInitCtxPreOutput(void)
         if (ret) {
             stats_stream_events = (b == 1);
         }
+        ret = ConfGetChildValueBool(stats, "latency-histograms", &b);
+        if (ret) {
+            stats_latency_histograms = (b == 1);
+        }
 
         const char *prefix = NULL;
         if (ConfGet("stats.decoder-events-prefix", &prefix) != 1) {
             prefix = "decoder.event";
         }
         stats_decoder_events_prefix = prefix;
+
+        ConfNode *shm = ConfNodeLookupChild(stats, "shm");
+        if (shm != NULL && ConfNodeChildValueIsTrue(shm, "enabled")) {
+            stats_shm_filename = ConfNodeLookupChildValue(shm, "filename");
+            if (stats_shm_filename == NULL) {
+                /* per instance, so that instances don't overwrite each other */
+                static char default_filename[64];
+                snprintf(default_filename, sizeof(default_filename),
+                        "/dev/shm/suricata-stats.%d", (int)getpid());
+                stats_shm_filename = default_filename;
+            }
+        }
     }
     SCReturn;
 }
@@ -312,9 +508,10 @@ static void StatsInitCtxPostOutput(void)
     if (stats_enabled && !OutputStatsLoggersRegistered()) {
         stats_loggers_active = 0;
 
-        /* if the unix command socket is enabled we do the background
-         * stats sync just in case someone runs 'dump-counters' */
-        if (!ConfUnixSocketIsEnable()) {
+        /* if the unix command socket or the shared memory export are
+         * enabled we do the background stats sync just in case someone
+         * runs 'dump-counters' or reads the export file */
+        if (!ConfUnixSocketIsEnable() && stats_shm_filename == NULL) {
             SCLogWarning(SC_WARN_NO_STATS_LOGGERS, "stats are enabled but no loggers are active");
             stats_enabled = false;
             SCReturn;
@@ -342,6 +539,13 @@ static void StatsReleaseCtx(void)
     while (sts != NULL) {
         if (sts->head != NULL)
             SCFree(sts->head);
+        if (sts->counters != NULL) {
+            for (uint16_t i = 1; i <= sts->counters_size; i++) {
+                if (sts->counters[i].buckets != NULL)
+                    SCFree(sts->counters[i].buckets);
+            }
+            SCFree(sts->counters);
+        }
 
         temp = sts->next;
         SCFree(sts);
@@ -370,6 +574,7 @@ static void StatsReleaseCtx(void)
         stats_table.stats = NULL;
     }
     memset(&stats_table, 0, sizeof(stats_table));
+    StatsShmClose();
     SCMutexUnlock(&stats_table_mutex);
 
     return;
@@ -556,6 +761,8 @@ static void *StatsWakeupThread(void *arg)
 static void StatsReleaseCounter(StatsCounter *pc)
 {
     if (pc != NULL) {
+        if (pc->buckets != NULL)
+            SCFree(pc->buckets);
         SCFree(pc);
     }
 
@@ -608,6 +815,14 @@ static uint16_t StatsRegisterQualifiedCounter(const char *name, const char *tm_n
         return 0;
     memset(pc, 0, sizeof(StatsCounter));
 
+    if (type_q == STATS_TYPE_HISTOGRAM) {
+        pc->buckets = SCCalloc(STATS_HISTOGRAM_BUCKETS, sizeof(uint64_t));
+        if (pc->buckets == NULL) {
+            SCFree(pc);
+            return 0;
+        }
+    }
+
     /* assign a unique id to this StatsCounter.  The id is local to this
      * thread context.  Please note that the id start from 1, and not 0 */
     pc->id = ++(pctx->curr_id);
@@ -638,16 +853,184 @@ static void StatsCopyCounterValue(StatsLocalCounter *pcae)
 
     pc->value = pcae->value;
     pc->updates = pcae->updates;
+    if (pcae->buckets != NULL) {
+        memcpy(pc->buckets, pcae->buckets, STATS_HISTOGRAM_BUCKETS * sizeof(uint64_t));
+    }
     return;
 }
 
+/** max attempts to read the counters of a thread that keeps publishing */
+#define STATS_SYNC_MAX_TRIES 100
+
+/** \internal
+ *  \brief Copy the counters published by a thread into its store
+ *
+ *  The values are read without lock: the read is retried if the thread
+ *  published new values meanwhile, after a short sleep if it's publishing.
+ *  If no consistent read succeeds in STATS_SYNC_MAX_TRIES attempts, the
+ *  values of the previous sync are kept for this interval. A thread that
+ *  published nothing since the last call is not read again, only its
+ *  function counters are updated.
+ *
+ *  \retval 0 on success, -1 on memory allocation failure
+ */
+static int StatsThreadStoreSync(StatsThreadStore *sts)
+{
+    StatsPublicThreadContext *ctx = sts->ctx;
+
+    /* counters can be registered after the first sync */
+    const uint16_t size = ctx->curr_id;
+    if (sts->counters == NULL || size > sts->counters_size) {
+        StatsThreadCounter *counters =
+                SCRealloc(sts->counters, (size + 1) * sizeof(StatsThreadCounter));
+        if (counters == NULL)
+            return -1;
+        const uint16_t old_size = sts->counters == NULL ? 0 : sts->counters_size;
+        memset(counters + old_size + 1, 0, (size - old_size) * sizeof(StatsThreadCounter));
+        if (sts->counters == NULL)
+            memset(counters, 0, sizeof(StatsThreadCounter));
+        sts->counters = counters;
+        sts->counters_size = size;
+        sts->synced = false;
+        for (const StatsCounter *pc = ctx->head; pc != NULL; pc = pc->next) {
+            if (pc->id <= old_size || pc->id > size)
+                continue;
+            StatsThreadCounter *c = &sts->counters[pc->id];
+            c->type = pc->type;
+            c->gid = pc->gid;
+            c->name = pc->name;
+            c->Func = pc->Func;
+            if (pc->type == STATS_TYPE_HISTOGRAM) {
+                c->hist = StatsHistogramLookup(pc->name);
+                c->buckets = SCCalloc(STATS_HISTOGRAM_BUCKETS, sizeof(uint64_t));
+                if (c->hist == NULL || c->buckets == NULL) {
+                    c->type = 0;
+                }
+            }
+        }
+    }
+
+    for (int tries = 0; tries < STATS_SYNC_MAX_TRIES; tries++) {
+        const uint32_t seq = SC_ATOMIC_GET(ctx->seq);
+        if (sts->synced && seq == sts->seq)
+            break;
+        /* thread is publishing */
+        if (seq & 1) {
+            SleepUsec(1);
+            continue;
+        }
+
+        for (const StatsCounter *pc = ctx->head; pc != NULL; pc = pc->next) {
+            if (pc->id > sts->counters_size)
+                continue;
+            StatsThreadCounter *c = &sts->counters[pc->id];
+            c->value = pc->value;
+            c->updates = pc->updates;
+            if (c->buckets != NULL) {
+                memcpy(c->buckets, pc->buckets, STATS_HISTOGRAM_BUCKETS * sizeof(uint64_t));
+            }
+        }
+        hw_barrier();
+        if (seq == SC_ATOMIC_GET(ctx->seq)) {
+            sts->seq = seq;
+            sts->synced = true;
+            break;
+        }
+    }
+
+    for (uint16_t i = 1; i <= sts->counters_size; i++) {
+        StatsThreadCounter *c = &sts->counters[i];
+        if (c->type == STATS_TYPE_FUNC && c->Func != NULL)
+            c->value = c->Func();
+    }
+    return 0;
+}
+
+/** \internal
+ *  \brief Create the shared memory export file for 'nstats' counters
+ */
+static int StatsShmOpen(uint32_t nstats)
+{
+    size_t size = sizeof(StatsShmHeader) + nstats * sizeof(StatsShmRecord);
+
+    /* the file is in a world writable directory by default: remove what a
+     * previous run left and create it exclusively, so that a planted file
+     * or symlink can't redirect the writes */
+    if (unlink(stats_shm_filename) != 0 && errno != ENOENT) {
+        SCLogError(SC_ERR_FOPEN, "failed to remove old stats export file %s: %s",
+                stats_shm_filename, strerror(errno));
+        return -1;
+    }
+    int fd = open(stats_shm_filename, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0644);
+    if (fd < 0) {
+        SCLogError(SC_ERR_FOPEN, "failed to open stats export file %s: %s",
+                stats_shm_filename, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, size) != 0) {
+        SCLogError(SC_ERR_FOPEN, "failed to size stats export file %s: %s",
+                stats_shm_filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to map stats export file %s: %s",
+                stats_shm_filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    stats_shm_fd = fd;
+    stats_shm_size = size;
+    stats_shm = map;
+    stats_shm->magic = STATS_SHM_MAGIC;
+    stats_shm->version = STATS_SHM_VERSION;
+    stats_shm->nstats = nstats;
+    SCLogConfig("exporting stats to %s", stats_shm_filename);
+    return 0;
+}
+
+/** \internal
+ *  \brief Write the totals of the stats table to the export file
+ */
+static void StatsShmUpdate(const StatsTable *st)
+{
+    StatsShmRecord *records = (StatsShmRecord *)(stats_shm + 1);
+
+    stats_shm->seq++;
+    hw_barrier();
+    for (uint32_t i = 0; i < stats_shm->nstats; i++) {
+        const StatsRecord *r = &st->stats[i];
+        if (r->name == NULL)
+            continue;
+        if (records[i].name[0] == '\0')
+            strlcpy(records[i].name, r->name, sizeof(records[i].name));
+        records[i].value = r->value;
+    }
+    stats_shm->ts = (uint64_t)time(NULL);
+    hw_barrier();
+    stats_shm->seq++;
+}
+
+static void StatsShmClose(void)
+{
+    if (stats_shm == NULL)
+        return;
+    munmap(stats_shm, stats_shm_size);
+    close(stats_shm_fd);
+    unlink(stats_shm_filename);
+    stats_shm = NULL;
+    stats_shm_fd = -1;
+    stats_shm_size = 0;
+}
+
 /**
  * \brief The output interface for the Stats API
  */
 static int StatsOutput(ThreadVars *tv)
 {
-    const StatsThreadStore *sts = NULL;
-    const StatsCounter *pc = NULL;
+    StatsThreadStore *sts = NULL;
     void *td = stats_thread_data;
 
     if (counters_global_id == 0)
@@ -678,6 +1061,9 @@ static int StatsOutput(ThreadVars *tv)
         stats_table.start_time = stats_start_time;
         gettimeofday(&stats_table.process_start_time, 0);
 
+        if (stats_shm_filename != NULL && StatsShmOpen(stats_table.nstats) != 0) {
+            stats_shm_filename = NULL;
+        }
     }
 
     const uint16_t max_id = counters_global_id;
@@ -690,12 +1076,14 @@ static int StatsOutput(ThreadVars *tv)
         int type;
         int64_t value;
         uint64_t updates;
+        StatsHistogramMerge *hist;
     } merge_table[max_id];
     memset(&merge_table, 0x00,
            max_id * sizeof(struct CountersMergeTable));
 
     int thread = stats_ctx->sts_cnt - 1;
     StatsRecord *table = stats_table.stats;
+    stats_output_pass++;
 
     /* Loop through the thread counter stores. The global counters
      * are in a separate store inside this list. */
@@ -706,45 +1094,52 @@ static int StatsOutput(ThreadVars *tv)
 
         SCLogDebug("Thread %d %s ctx %p", thread, sts->name, sts->ctx);
 
-        /* temporary table for quickly storing the counters for this
-         * thread store, so that we can post process them outside
-         * of the thread store lock */
-        struct CountersMergeTable thread_table[max_id];
-        memset(&thread_table, 0x00,
-                max_id * sizeof(struct CountersMergeTable));
-
-        SCMutexLock(&sts->ctx->m);
-        pc = sts->ctx->head;
-        while (pc != NULL) {
-            SCLogDebug("Counter %s (%u:%u) value %"PRIu64,
-                    pc->name, pc->id, pc->gid, pc->value);
-
-            thread_table[pc->gid].type = pc->type;
-            switch (pc->type) {
-                case STATS_TYPE_FUNC:
-                    if (pc->Func != NULL)
-                        thread_table[pc->gid].value = pc->Func();
-                    break;
-                case STATS_TYPE_AVERAGE:
-                default:
-                    thread_table[pc->gid].value = pc->value;
-                    break;
-            }
-            thread_table[pc->gid].updates = pc->updates;
-            table[pc->gid].name = pc->name;
-
-            pc = pc->next;
+        if (StatsThreadStoreSync(sts) != 0) {
+            SCLogError(SC_ERR_MEM_ALLOC, "could not alloc memory for stats");
+            return -1;
         }
-        SCMutexUnlock(&sts->ctx->m);
 
-        /* update merge table */
-        for (uint16_t c = 0; c < max_id; c++) {
-            struct CountersMergeTable *e = &thread_table[c];
-            /* thread only sets type if it has a counter
-             * of this type. */
+        for (uint16_t i = 1; i <= sts->counters_size; i++) {
+            const StatsThreadCounter *e = &sts->counters[i];
+            const uint16_t c = e->gid;
             if (e->type == 0)
                 continue;
 
+            if (e->type == STATS_TYPE_HISTOGRAM) {
+                /* merge the buckets, reset at the first thread of this pass */
+                StatsHistogramMerge *h = e->hist;
+                if (h->pass != stats_output_pass) {
+                    memset(h->buckets, 0, sizeof(h->buckets));
+                    h->count = 0;
+                    h->max = 0;
+                    h->pass = stats_output_pass;
+                }
+                for (uint32_t b = 0; b < STATS_HISTOGRAM_BUCKETS; b++) {
+                    h->buckets[b] += e->buckets[b];
+                }
+                h->count += e->updates;
+                if ((uint64_t)e->value > h->max)
+                    h->max = (uint64_t)e->value;
+                merge_table[c].type = e->type;
+                merge_table[c].hist = h;
+
+                int64_t values[STATS_HISTOGRAM_OUTPUTS];
+                StatsHistogramValues(e->buckets, e->updates, (uint64_t)e->value, values);
+                for (int o = 0; o < STATS_HISTOGRAM_OUTPUTS; o++) {
+                    table[c + o].name = h->names[o];
+
+                    StatsRecord *r = &stats_table.tstats[(thread * stats_table.nstats) + c + o];
+                    r->pvalue = r->value;
+                    r->value = values[o];
+                    r->name = h->names[o];
+                    r->tm_name = sts->name;
+                }
+                continue;
+            }
+
+            table[c].name = e->name;
+
+            /* update merge table */
             switch (e->type) {
                 case STATS_TYPE_MAXIMUM:
                     if (e->value > merge_table[c].value)
@@ -760,22 +1155,14 @@ static int StatsOutput(ThreadVars *tv)
             }
             merge_table[c].updates += e->updates;
             merge_table[c].type = e->type;
-        }
-
-        /* update per thread stats table */
-        for (uint16_t c = 0; c < max_id; c++) {
-            struct CountersMergeTable *e = &thread_table[c];
-            /* thread only sets type if it has a counter
-             * of this type. */
-            if (e->type == 0)
-                continue;
 
+            /* update per thread stats table */
             uint32_t offset = (thread * stats_table.nstats) + c;
             StatsRecord *r = &stats_table.tstats[offset];
             /* xfer previous value to pvalue and reset value */
             r->pvalue = r->value;
             r->value = 0;
-            r->name = table[c].name;
+            r->name = e->name;
             r->tm_name = sts->name;
 
             switch (e->type) {
@@ -818,6 +1205,23 @@ static int StatsOutput(ThreadVars *tv)
         }
     }
 
+    /* histogram records are computed from the buckets of all threads */
+    for (uint16_t x = 0; x < max_id; x++) {
+        const StatsHistogramMerge *h = merge_table[x].hist;
+        if (merge_table[x].type != STATS_TYPE_HISTOGRAM || h == NULL)
+            continue;
+
+        int64_t values[STATS_HISTOGRAM_OUTPUTS];
+        StatsHistogramValues(h->buckets, h->count, h->max, values);
+        for (int o = 0; o < STATS_HISTOGRAM_OUTPUTS; o++) {
+            table[x + o].value = values[o];
+        }
+    }
+
+    if (stats_shm != NULL) {
+        StatsShmUpdate(&stats_table);
+    }
+
     /* invoke logger(s) */
     if (stats_loggers_active) {
         OutputStatsLog(tv, td, &stats_table);
@@ -1004,6 +1408,29 @@ uint16_t StatsRegisterMaxCounter(const char *name, struct ThreadVars_ *tv)
     return id;
 }
 
+/**
+ * \brief Registers a counter, whose values are distributed in a histogram.
+ *
+ * The counter is output as the records "<name>.count", "<name>.p50",
+ * "<name>.p90", "<name>.p99", "<name>.p999" and "<name>.max". Values are
+ * added with StatsHistogramAdd().
+ *
+ * \param name Name of the counter, to be registered
+ * \param tv    Pointer to the ThreadVars instance for which the counter would
+ *              be registered
+ *
+ * \retval the counter id for the newly registered counter, or the already
+ *         present counter
+ */
+uint16_t StatsRegisterHistogramCounter(const char *name, struct ThreadVars_ *tv)
+{
+    uint16_t id = StatsRegisterQualifiedCounter(name,
+            (tv->thread_group_name != NULL) ? tv->thread_group_name : tv->printable_name,
+            &tv->perf_public_ctx,
+            STATS_TYPE_HISTOGRAM, NULL);
+    return id;
+}
+
 /**
  * \brief Registers a counter, which represents a global value
  *
@@ -1031,6 +1458,8 @@ uint16_t StatsRegisterGlobalCounter(const char *name, uint64_t (*Func)(void))
 typedef struct CountersIdType_ {
     uint16_t id;
     const char *string;
+    /** output names and merged buckets, for histogram counters */
+    StatsHistogramMerge *hist;
 } CountersIdType;
 
 static uint32_t CountersIdHashFunc(HashTable *ht, void *data, uint16_t datalen)
@@ -1070,8 +1499,59 @@ static char CountersIdHashCompareFunc(void *data1, uint16_t datalen1,
     return 0;
 }
 
+static void StatsHistogramMergeFree(StatsHistogramMerge *h)
+{
+    for (int o = 0; o < STATS_HISTOGRAM_OUTPUTS; o++) {
+        if (h->names[o] != NULL)
+            SCFree(h->names[o]);
+    }
+    SCFree(h);
+}
+
+static StatsHistogramMerge *StatsHistogramMergeAlloc(const char *name)
+{
+    StatsHistogramMerge *h = SCCalloc(1, sizeof(*h));
+    if (h == NULL)
+        return NULL;
+
+    for (int o = 0; o < STATS_HISTOGRAM_OUTPUTS; o++) {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "%s.%s", name, stats_histogram_outputs[o].suffix);
+        h->names[o] = SCStrdup(buf);
+        if (h->names[o] == NULL) {
+            StatsHistogramMergeFree(h);
+            return NULL;
+        }
+    }
+    return h;
+}
+
+/** \internal
+ *  \brief Get the merge of a histogram counter registered by a thread
+ */
+static StatsHistogramMerge *StatsHistogramLookup(const char *name)
+{
+    StatsHistogramMerge *h = NULL;
+
+    if (stats_ctx == NULL)
+        return NULL;
+
+    SCMutexLock(&stats_ctx->sts_lock);
+    if (stats_ctx->counters_id_hash != NULL) {
+        CountersIdType t = { 0, name, NULL };
+        CountersIdType *id = HashTableLookup(stats_ctx->counters_id_hash, &t, sizeof(t));
+        if (id != NULL)
+            h = id->hist;
+    }
+    SCMutexUnlock(&stats_ctx->sts_lock);
+    return h;
+}
+
 static void CountersIdHashFreeFunc(void *data)
 {
+    CountersIdType *t = (CountersIdType *)data;
+    if (t->hist != NULL)
+        StatsHistogramMergeFree(t->hist);
     SCFree(data);
 }
 
@@ -1106,13 +1586,19 @@ static int StatsThreadRegister(const char *thread_name, StatsPublicThreadContext
     }
     StatsCounter *pc = pctx->head;
     while (pc != NULL) {
-        CountersIdType t = { 0, pc->name }, *id = NULL;
+        CountersIdType t = { 0, pc->name, NULL }, *id = NULL;
         id = HashTableLookup(stats_ctx->counters_id_hash, &t, sizeof(t));
         if (id == NULL) {
             id = SCCalloc(1, sizeof(*id));
             BUG_ON(id == NULL);
             id->id = counters_global_id++;
             id->string = pc->name;
+            /* a histogram is output as several records with consecutive ids */
+            if (pc->type == STATS_TYPE_HISTOGRAM) {
+                id->hist = StatsHistogramMergeAlloc(pc->name);
+                BUG_ON(id->hist == NULL);
+                counters_global_id += STATS_HISTOGRAM_OUTPUTS - 1;
+            }
             BUG_ON(HashTableAdd(stats_ctx->counters_id_hash, id, sizeof(*id)) < 0);
         }
         pc->gid = id->id;
@@ -1183,6 +1669,13 @@ static int StatsGetCounterArrayRange(uint16_t s_id, uint16_t e_id,
     while ((pc != NULL) && (pc->id <= e_id)) {
         pca->head[i].pc = pc;
         pca->head[i].id = pc->id;
+        if (pc->type == STATS_TYPE_HISTOGRAM) {
+            pca->head[i].buckets = SCCalloc(STATS_HISTOGRAM_BUCKETS, sizeof(uint64_t));
+            if (pca->head[i].buckets == NULL) {
+                pca->size = i - 1;
+                return -1;
+            }
+        }
         pc = pc->next;
         i++;
     }
@@ -1236,12 +1729,25 @@ int StatsUpdateCounterArray(StatsPrivateThreadContext *pca, StatsPublicThreadCon
         return -1;
     }
 
-    SCMutexLock(&pctx->m);
+    /* Counters without updates since the last sync are skipped, so a
+     * thread without updates leaves the sequence as is and isn't read
+     * again by the stats thread. The sequence is odd while the values are
+     * copied, so the stats thread can read them without lock and retry if
+     * they changed under it. */
+    bool publishing = false;
     StatsLocalCounter *pcae = pca->head;
     for (uint32_t i = 1; i <= pca->size; i++) {
+        if (pcae[i].updates == pcae[i].pc->updates)
+            continue;
+        if (!publishing) {
+            (void)SC_ATOMIC_ADD(pctx->seq, 1);
+            publishing = true;
+        }
         StatsCopyCounterValue(&pcae[i]);
     }
-    SCMutexUnlock(&pctx->m);
+    if (publishing) {
+        (void)SC_ATOMIC_ADD(pctx->seq, 1);
+    }
 
     pctx->perf_flag = 0;
     return 1;
@@ -1265,6 +1771,23 @@ uint64_t StatsGetLocalCounterValue(ThreadVars *tv, uint16_t id)
     return pca->head[id].value;
 }
 
+/**
+ * \brief Get the local id of a counter registered by a thread
+ *
+ * \param tv   Pointer to the ThreadVars owning the counter
+ * \param name Name of the counter, e.g. "decoder.pkts"
+ *
+ * \retval id of the counter, 0 if the thread has no counter by this name
+ */
+uint16_t StatsGetCounterIdByName(ThreadVars *tv, const char *name)
+{
+    for (StatsCounter *pc = tv->perf_public_ctx.head; pc != NULL; pc = pc->next) {
+        if (strcmp(name, pc->name) == 0)
+            return pc->id;
+    }
+    return 0;
+}
+
 /**
  * \brief Releases the resources alloted by the Stats API
  */
@@ -1301,6 +1824,10 @@ static void StatsReleasePrivateThreadContext(StatsPrivateThreadContext *pca)
 {
     if (pca != NULL) {
         if (pca->head != NULL) {
+            for (uint32_t i = 1; i <= pca->size; i++) {
+                if (pca->head[i].buckets != NULL)
+                    SCFree(pca->head[i].buckets);
+            }
             SCFree(pca->head);
             pca->head = NULL;
             pca->size = 0;
@@ -1568,6 +2095,321 @@ static int StatsTestCounterValues11(void)
     PASS;
 }
 
+static int StatsTestCounterGetId12(void)
+{
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    uint16_t id1 = RegisterCounter("t1", "c1", &tv.perf_public_ctx);
+    uint16_t id2 = RegisterCounter("t2", "c2", &tv.perf_public_ctx);
+
+    FAIL_IF_NOT(StatsGetCounterIdByName(&tv, "t1") == id1);
+    FAIL_IF_NOT(StatsGetCounterIdByName(&tv, "t2") == id2);
+    FAIL_IF_NOT(StatsGetCounterIdByName(&tv, "t3") == 0);
+
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+    StatsAddUI64(&tv, id2, 42);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, StatsGetCounterIdByName(&tv, "t2")) == 42);
+
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv.perf_private_ctx);
+
+    PASS;
+}
+
+static int StatsTestPublishDelta13(void)
+{
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    uint16_t id1 = RegisterCounter("t1", "c1", &tv.perf_public_ctx);
+    uint16_t id2 = RegisterCounter("t2", "c2", &tv.perf_public_ctx);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+
+    /* nothing updated, nothing published */
+    StatsUpdateCounterArray(&tv.perf_private_ctx, &tv.perf_public_ctx);
+    FAIL_IF_NOT(SC_ATOMIC_GET(tv.perf_public_ctx.seq) == 0);
+
+    StatsAddUI64(&tv, id1, 10);
+    StatsUpdateCounterArray(&tv.perf_private_ctx, &tv.perf_public_ctx);
+    FAIL_IF_NOT(SC_ATOMIC_GET(tv.perf_public_ctx.seq) == 2);
+
+    StatsThreadStore sts;
+    memset(&sts, 0, sizeof(sts));
+    sts.ctx = &tv.perf_public_ctx;
+    FAIL_IF(StatsThreadStoreSync(&sts) != 0);
+    FAIL_IF_NOT(sts.seq == 2);
+    FAIL_IF_NOT(sts.counters[id1].value == 10);
+    FAIL_IF_NOT(sts.counters[id2].value == 0);
+
+    StatsAddUI64(&tv, id2, 5);
+    StatsUpdateCounterArray(&tv.perf_private_ctx, &tv.perf_public_ctx);
+    FAIL_IF_NOT(SC_ATOMIC_GET(tv.perf_public_ctx.seq) == 4);
+    FAIL_IF(StatsThreadStoreSync(&sts) != 0);
+    FAIL_IF_NOT(sts.seq == 4);
+    FAIL_IF_NOT(sts.counters[id1].value == 10);
+    FAIL_IF_NOT(sts.counters[id2].value == 5);
+
+    SCFree(sts.counters);
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv.perf_private_ctx);
+
+    PASS;
+}
+
+static int StatsTestLateRegister17(void)
+{
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    uint16_t id1 = RegisterCounter("t1", "c1", &tv.perf_public_ctx);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+    StatsAddUI64(&tv, id1, 10);
+    StatsUpdateCounterArray(&tv.perf_private_ctx, &tv.perf_public_ctx);
+
+    StatsThreadStore sts;
+    memset(&sts, 0, sizeof(sts));
+    sts.ctx = &tv.perf_public_ctx;
+    FAIL_IF(StatsThreadStoreSync(&sts) != 0);
+    FAIL_IF_NOT(sts.counters_size == 1);
+
+    /* counter registered after the first sync */
+    uint16_t id2 = RegisterCounter("t2", "c2", &tv.perf_public_ctx);
+    StatsReleasePrivateThreadContext(&tv.perf_private_ctx);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+    FAIL_IF(StatsThreadStoreSync(&sts) != 0);
+    FAIL_IF_NOT(sts.counters_size == 2);
+    FAIL_IF_NOT(sts.counters[id1].value == 10);
+    FAIL_IF_NOT(sts.counters[id2].value == 0);
+    FAIL_IF_NOT(sts.counters[id2].name != NULL && strcmp(sts.counters[id2].name, "t2") == 0);
+
+    StatsAddUI64(&tv, id2, 5);
+    StatsUpdateCounterArray(&tv.perf_private_ctx, &tv.perf_public_ctx);
+    FAIL_IF(StatsThreadStoreSync(&sts) != 0);
+    FAIL_IF_NOT(sts.counters[id2].value == 5);
+
+    SCFree(sts.counters);
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv.perf_private_ctx);
+
+    PASS;
+}
+
+/** \test a thread that stays in the middle of publishing doesn't hold up
+ *        the stats thread, the previous values are kept */
+static int StatsTestSyncPublishing19(void)
+{
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    uint16_t id1 = RegisterCounter("t1", "c1", &tv.perf_public_ctx);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+    StatsAddUI64(&tv, id1, 10);
+    StatsUpdateCounterArray(&tv.perf_private_ctx, &tv.perf_public_ctx);
+
+    StatsThreadStore sts;
+    memset(&sts, 0, sizeof(sts));
+    sts.ctx = &tv.perf_public_ctx;
+    FAIL_IF(StatsThreadStoreSync(&sts) != 0);
+    FAIL_IF_NOT(sts.counters[id1].value == 10);
+
+    /* publication started but not finished */
+    (void)SC_ATOMIC_ADD(tv.perf_public_ctx.seq, 1);
+    tv.perf_public_ctx.head->value = 20;
+    FAIL_IF(StatsThreadStoreSync(&sts) != 0);
+    FAIL_IF_NOT(sts.seq == 2);
+    FAIL_IF_NOT(sts.counters[id1].value == 10);
+
+    (void)SC_ATOMIC_ADD(tv.perf_public_ctx.seq, 1);
+    FAIL_IF(StatsThreadStoreSync(&sts) != 0);
+    FAIL_IF_NOT(sts.seq == 4);
+    FAIL_IF_NOT(sts.counters[id1].value == 20);
+
+    SCFree(sts.counters);
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv.perf_private_ctx);
+
+    PASS;
+}
+
+/** \test the export file doesn't follow a symlink planted at its path */
+static int StatsTestShmOpen18(void)
+{
+    char dir[] = "/tmp/suricata-stats-test-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+    char target[64], link[64];
+    snprintf(target, sizeof(target), "%s/target", dir);
+    snprintf(link, sizeof(link), "%s/stats", dir);
+
+    FILE *fp = fopen(target, "w");
+    FAIL_IF_NULL(fp);
+    fputs("keep", fp);
+    fclose(fp);
+    FAIL_IF(symlink(target, link) != 0);
+
+    const char *filename = stats_shm_filename;
+    stats_shm_filename = link;
+    FAIL_IF(StatsShmOpen(4) != 0);
+
+    struct stat st;
+    FAIL_IF(lstat(link, &st) != 0);
+    FAIL_IF_NOT(S_ISREG(st.st_mode));
+    FAIL_IF(stat(target, &st) != 0);
+    FAIL_IF_NOT(st.st_size == 4);
+    FAIL_IF_NOT(stats_shm->nstats == 4);
+
+    StatsShmClose();
+    FAIL_IF(lstat(link, &st) == 0);
+    stats_shm_filename = filename;
+    unlink(target);
+    rmdir(dir);
+    PASS;
+}
+
+static int StatsTestHistogramBuckets14(void)
+{
+    /* bucket boundaries: values below 8 are exact, then 8 buckets per
+     * power of 2 */
+    for (uint64_t v = 0; v < 16; v++) {
+        FAIL_IF_NOT(StatsHistogramBucket(v) == v);
+    }
+    FAIL_IF_NOT(StatsHistogramBucket(16) == 16);
+    FAIL_IF_NOT(StatsHistogramBucket(17) == 16);
+    FAIL_IF_NOT(StatsHistogramBucket(18) == 17);
+    FAIL_IF_NOT(StatsHistogramBucketHigh(16) == 17);
+    FAIL_IF_NOT(StatsHistogramBucketHigh(23) == 31);
+    FAIL_IF_NOT(StatsHistogramBucket(32) == 24);
+    FAIL_IF_NOT(StatsHistogramBucket(UINT64_MAX) == STATS_HISTOGRAM_BUCKETS - 1);
+    FAIL_IF_NOT(StatsHistogramBucketHigh(STATS_HISTOGRAM_BUCKETS - 1) ==
+                STATS_HISTOGRAM_MAX_VALUE);
+
+    /* every value falls in a bucket whose range holds it, within 12.5% */
+    for (uint64_t v = 1; v < (UINT64_C(1) << 40); v = v * 3 + 1) {
+        uint32_t b = StatsHistogramBucket(v);
+        FAIL_IF(b >= STATS_HISTOGRAM_BUCKETS);
+        FAIL_IF(StatsHistogramBucketHigh(b) < v);
+        FAIL_IF(b > 0 && StatsHistogramBucketHigh(b - 1) >= v);
+        FAIL_IF(StatsHistogramBucketHigh(b) - v > v / 8);
+    }
+    PASS;
+}
+
+static int StatsTestHistogramValues15(void)
+{
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    uint16_t id = StatsRegisterQualifiedCounter("h1", "c1", &tv.perf_public_ctx,
+            STATS_TYPE_HISTOGRAM, NULL);
+    FAIL_IF(id == 0);
+    StatsGetAllCountersArray(&tv.perf_public_ctx, &tv.perf_private_ctx);
+
+    /* 1..1000 plus one outlier */
+    for (uint64_t v = 1; v <= 1000; v++) {
+        StatsHistogramAdd(&tv, id, v);
+    }
+    StatsHistogramAdd(&tv, id, 100000);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, id) == 100000);
+
+    StatsUpdateCounterArray(&tv.perf_private_ctx, &tv.perf_public_ctx);
+    const StatsCounter *pc = tv.perf_public_ctx.head;
+    FAIL_IF_NOT(pc->updates == 1001);
+
+    int64_t values[STATS_HISTOGRAM_OUTPUTS];
+    StatsHistogramValues(pc->buckets, pc->updates, (uint64_t)pc->value, values);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_COUNT] == 1001);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_P50] >= 501 && values[STATS_HISTOGRAM_P50] <= 501 * 9 / 8);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_P90] >= 901 && values[STATS_HISTOGRAM_P90] <= 901 * 9 / 8);
+    /* rank 992 and 1000: capped by the highest value of the bucket */
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_P99] >= 991 && values[STATS_HISTOGRAM_P99] <= 1023);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_P999] >= 1000 && values[STATS_HISTOGRAM_P999] <= 1023);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_MAX] == 100000);
+
+    /* a histogram with a single value reports it exactly */
+    uint64_t buckets[STATS_HISTOGRAM_BUCKETS];
+    memset(buckets, 0, sizeof(buckets));
+    buckets[StatsHistogramBucket(300)] = 1;
+    StatsHistogramValues(buckets, 1, 300, values);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_P50] == 300);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_P999] == 300);
+
+    /* empty */
+    memset(buckets, 0, sizeof(buckets));
+    StatsHistogramValues(buckets, 0, 0, values);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_COUNT] == 0);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_P99] == 0);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_MAX] == 0);
+
+    StatsReleaseCounters(tv.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv.perf_private_ctx);
+
+    PASS;
+}
+
+static int StatsTestHistogramMerge16(void)
+{
+    ThreadVars tv1, tv2;
+    memset(&tv1, 0, sizeof(ThreadVars));
+    memset(&tv2, 0, sizeof(ThreadVars));
+
+    uint16_t id1 = StatsRegisterQualifiedCounter("h1", "c1", &tv1.perf_public_ctx,
+            STATS_TYPE_HISTOGRAM, NULL);
+    uint16_t id2 = StatsRegisterQualifiedCounter("h1", "c1", &tv2.perf_public_ctx,
+            STATS_TYPE_HISTOGRAM, NULL);
+    StatsGetAllCountersArray(&tv1.perf_public_ctx, &tv1.perf_private_ctx);
+    StatsGetAllCountersArray(&tv2.perf_public_ctx, &tv2.perf_private_ctx);
+
+    /* one thread sees fast values, the other the slow tail */
+    for (int i = 0; i < 990; i++) {
+        StatsHistogramAdd(&tv1, id1, 10);
+    }
+    for (int i = 0; i < 10; i++) {
+        StatsHistogramAdd(&tv2, id2, 5000);
+    }
+    StatsUpdateCounterArray(&tv1.perf_private_ctx, &tv1.perf_public_ctx);
+    StatsUpdateCounterArray(&tv2.perf_private_ctx, &tv2.perf_public_ctx);
+
+    StatsHistogramMerge *h = StatsHistogramMergeAlloc("h1");
+    FAIL_IF_NULL(h);
+    FAIL_IF_NOT(strcmp(h->names[STATS_HISTOGRAM_P999], "h1.p999") == 0);
+
+    StatsThreadStore sts[2];
+    memset(sts, 0, sizeof(sts));
+    sts[0].ctx = &tv1.perf_public_ctx;
+    sts[1].ctx = &tv2.perf_public_ctx;
+    for (int t = 0; t < 2; t++) {
+        FAIL_IF(StatsThreadStoreSync(&sts[t]) != 0);
+        /* no stats context in the tests: merge as StatsOutput() does */
+        const StatsThreadCounter *c = &sts[t].counters[1];
+        FAIL_IF_NULL(c->buckets);
+        for (uint32_t b = 0; b < STATS_HISTOGRAM_BUCKETS; b++) {
+            h->buckets[b] += c->buckets[b];
+        }
+        h->count += c->updates;
+        h->max = MAX(h->max, (uint64_t)c->value);
+    }
+
+    int64_t values[STATS_HISTOGRAM_OUTPUTS];
+    StatsHistogramValues(h->buckets, h->count, h->max, values);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_COUNT] == 1000);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_P50] == 10);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_P99] == 10);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_P999] == 5000);
+    FAIL_IF_NOT(values[STATS_HISTOGRAM_MAX] == 5000);
+
+    for (int t = 0; t < 2; t++) {
+        SCFree(sts[t].counters[1].buckets);
+        SCFree(sts[t].counters);
+    }
+    StatsHistogramMergeFree(h);
+    StatsReleaseCounters(tv1.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv1.perf_private_ctx);
+    StatsReleaseCounters(tv2.perf_public_ctx.head);
+    StatsReleasePrivateThreadContext(&tv2.perf_private_ctx);
+
+    PASS;
+}
+
 #endif
 
 void StatsRegisterTests(void)
@@ -1584,5 +2426,13 @@ void StatsRegisterTests(void)
     UtRegisterTest("StatsTestUpdateGlobalCounter10",
                    StatsTestUpdateGlobalCounter10);
     UtRegisterTest("StatsTestCounterValues11", StatsTestCounterValues11);
+    UtRegisterTest("StatsTestCounterGetId12", StatsTestCounterGetId12);
+    UtRegisterTest("StatsTestPublishDelta13", StatsTestPublishDelta13);
+    UtRegisterTest("StatsTestHistogramBuckets14", StatsTestHistogramBuckets14);
+    UtRegisterTest("StatsTestHistogramValues15", StatsTestHistogramValues15);
+    UtRegisterTest("StatsTestHistogramMerge16", StatsTestHistogramMerge16);
+    UtRegisterTest("StatsTestLateRegister17", StatsTestLateRegister17);
+    UtRegisterTest("StatsTestShmOpen18", StatsTestShmOpen18);
+    UtRegisterTest("StatsTestSyncPublishing19", StatsTestSyncPublishing19);
 #endif
 }
@@ -25,6 +25,8 @@
 #ifndef __COUNTERS_H__
 #define __COUNTERS_H__
 
+#include "util-atomic.h"
+
 /* forward declaration of the ThreadVars structure */
 struct ThreadVars_;
 
@@ -44,6 +46,9 @@ typedef struct StatsCounter_ {
     int64_t value;      /**< sum of updates/increments, or 'set' value */
     uint64_t updates;   /**< number of updates (for avg) */
 
+    /* histogram buckets, for STATS_TYPE_HISTOGRAM only */
+    uint64_t *buckets;
+
     /* when using type STATS_TYPE_Q_FUNC this function is called once
      * to get the counter value, regardless of how many threads there are. */
     uint64_t (*Func)(void);
@@ -68,7 +73,11 @@ typedef struct StatsPublicThreadContext_ {
     /* holds the total no of counters already assigned for this perf context */
     uint16_t curr_id;
 
-    /* mutex to prevent simultaneous access during update_counter/output_stat */
+    /* sequence of the values published in the counters list: odd while the
+     * thread is updating them. Lets the stats thread read them without lock */
+    SC_ATOMIC_DECLARE(uint32_t, seq);
+
+    /* mutex to prevent simultaneous access during registration and cleanup */
     SCMutex m;
 } StatsPublicThreadContext;
 
@@ -88,6 +97,10 @@ typedef struct StatsLocalCounter_ {
 
     /* no of times the local counter has been updated */
     uint64_t updates;
+
+    /* histogram buckets, for STATS_TYPE_HISTOGRAM only. 'value' then holds
+     * the largest value added and 'updates' the number of values */
+    uint64_t *buckets;
 } StatsLocalCounter;
 
 /**
@@ -103,6 +116,36 @@ typedef struct StatsPrivateThreadContext_ {
     int initialized;
 } StatsPrivateThreadContext;
 
+/** magic of the shared memory stats export file */
+#define STATS_SHM_MAGIC     0x54534353 /* "SCST" */
+#define STATS_SHM_VERSION   1
+#define STATS_SHM_NAME_LEN  120
+
+/**
+ * \brief Header of the shared memory stats export file
+ *
+ * The header is followed by 'nstats' StatsShmRecord. A reader copies the
+ * records when 'seq' is even, then checks that 'seq' did not change.
+ */
+typedef struct StatsShmHeader_ {
+    uint32_t magic;
+    uint32_t version;
+    /** incremented before and after each update: odd during an update */
+    uint32_t seq;
+    /** number of records following the header */
+    uint32_t nstats;
+    /** time of the last update, in seconds since the epoch */
+    uint64_t ts;
+} StatsShmHeader;
+
+/**
+ * \brief Total of a counter in the shared memory stats export file
+ */
+typedef struct StatsShmRecord_ {
+    char name[STATS_SHM_NAME_LEN];
+    uint64_t value;
+} StatsShmRecord;
+
 /* the initialization functions */
 void StatsInit(void);
 void StatsSetupPostConfigPreOutput(void);
@@ -110,6 +153,7 @@ void StatsSetupPostConfigPostOutput(void);
 void StatsSpawnThreads(void);
 void StatsRegisterTests(void);
 bool StatsEnabled(void);
+bool StatsLatencyHistogramsEnabled(void);
 
 /* functions used to free the resources alloted by the Stats API */
 void StatsReleaseResources(void);
@@ -118,6 +162,7 @@ void StatsReleaseResources(void);
 uint16_t StatsRegisterCounter(const char *, struct ThreadVars_ *);
 uint16_t StatsRegisterAvgCounter(const char *, struct ThreadVars_ *);
 uint16_t StatsRegisterMaxCounter(const char *, struct ThreadVars_ *);
+uint16_t StatsRegisterHistogramCounter(const char *, struct ThreadVars_ *);
 uint16_t StatsRegisterGlobalCounter(const char *cname, uint64_t (*Func)(void));
 
 /* functions used to update local counter values */
@@ -125,10 +170,12 @@ void StatsAddUI64(struct ThreadVars_ *, uint16_t, uint64_t);
 void StatsSetUI64(struct ThreadVars_ *, uint16_t, uint64_t);
 void StatsIncr(struct ThreadVars_ *, uint16_t);
 void StatsDecr(struct ThreadVars_ *, uint16_t);
+void StatsHistogramAdd(struct ThreadVars_ *, uint16_t, uint64_t);
 
 /* utility functions */
 int StatsUpdateCounterArray(StatsPrivateThreadContext *, StatsPublicThreadContext *);
 uint64_t StatsGetLocalCounterValue(struct ThreadVars_ *, uint16_t);
+uint16_t StatsGetCounterIdByName(struct ThreadVars_ *, const char *);
 int StatsSetupPrivate(struct ThreadVars_ *);
 void StatsThreadCleanup(struct ThreadVars_ *);
 
@@ -0,0 +1,659 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * IPv4/IPv6 prefix datasets.
+ *
+ * Prefixes are kept in a SCLpmBuilder per address family. Lookups use
+ * compiled SCLpm tables that are rebuilt from the builders on commit and
+ * published with an atomic pointer swap, so lookups take no locks.
+ *
+ * Replaced tables are freed once no lookup can still use them: a thread
+ * doing a lookup records the current epoch in its reader slot and clears
+ * it when done. After publishing new tables the epoch is bumped and the
+ * writer waits for the slots that still hold an older epoch.
+ *
+ * Updates from rules and the unix socket are batched: a commit right
+ * after a rebuild is deferred until DATASET_CIDR_COMMIT_INTERVAL_MS has
+ * passed and is then done by the next commit or lookup.
+ *
+ * The LPM value is the reputation value + 1, as 0 means 'no match'.
+ */
+
+#include "suricata-common.h"
+#include "datasets-cidr.h"
+#include "tm-threads.h"
+#include "util-lpm.h"
+#include "util-byte.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#define DATASET_CIDR_V4 0
+#define DATASET_CIDR_V6 1
+
+/** min time between rebuilds for deferred commits */
+#define DATASET_CIDR_COMMIT_INTERVAL_MS 100
+
+typedef struct DatasetCidrTables_ {
+    SCLpm *lpm[2];
+} DatasetCidrTables;
+
+struct DatasetCidr_ {
+    /** serializes builder updates and rebuilds */
+    SCMutex build_lock;
+    SCLpmBuilder *builder[2];
+    bool dirty;        /**< builders changed since the last build */
+    uint64_t built_ms; /**< time of the last build */
+
+    /** commit deferred, to be done by the next commit or lookup */
+    SC_ATOMIC_DECLARE(bool, pending);
+    /** compiled tables used by the lookups */
+    SC_ATOMIC_DECLARE(DatasetCidrTables *, tables);
+
+    uint64_t memcap;
+    SC_ATOMIC_DECLARE(uint64_t, memuse);
+};
+
+/** per thread reader slot */
+typedef struct DatasetCidrReader_ {
+    /** epoch + 1 at the start of the lookup in progress, 0 if none */
+    SC_ATOMIC_DECLARE(uint64_t, epoch);
+    TAILQ_ENTRY(DatasetCidrReader_) next;
+} DatasetCidrReader;
+
+static SC_ATOMIC_DECLARE(uint64_t, dataset_cidr_epoch);
+/** protects the reader list. Also held by lookups of threads that
+ *  failed to set up a reader slot. */
+static SCMutex dataset_cidr_readers_lock = SCMUTEX_INITIALIZER;
+static TAILQ_HEAD(, DatasetCidrReader_) dataset_cidr_readers =
+        TAILQ_HEAD_INITIALIZER(dataset_cidr_readers);
+
+static pthread_key_t dataset_cidr_reader_key;
+static pthread_once_t dataset_cidr_reader_key_once = PTHREAD_ONCE_INIT;
+static thread_local DatasetCidrReader *t_dataset_cidr_reader = NULL;
+
+static void DatasetCidrReaderFree(void *ptr)
+{
+    DatasetCidrReader *r = ptr;
+
+    SCMutexLock(&dataset_cidr_readers_lock);
+    TAILQ_REMOVE(&dataset_cidr_readers, r, next);
+    SCMutexUnlock(&dataset_cidr_readers_lock);
+
+    SCFreeAligned(r);
+}
+
+static void DatasetCidrReaderKeyCreate(void)
+{
+    if (pthread_key_create(&dataset_cidr_reader_key, DatasetCidrReaderFree) != 0) {
+        FatalError(SC_ERR_THREAD_INIT, "failed to create dataset reader key");
+    }
+}
+
+static DatasetCidrReader *DatasetCidrReaderSetup(void)
+{
+    pthread_once(&dataset_cidr_reader_key_once, DatasetCidrReaderKeyCreate);
+
+    DatasetCidrReader *r = SCMallocAligned(sizeof(*r), CLS);
+    if (unlikely(r == NULL))
+        return NULL;
+    memset(r, 0, sizeof(*r));
+    SC_ATOMIC_INIT(r->epoch);
+
+    SCMutexLock(&dataset_cidr_readers_lock);
+    TAILQ_INSERT_TAIL(&dataset_cidr_readers, r, next);
+    SCMutexUnlock(&dataset_cidr_readers_lock);
+
+    pthread_setspecific(dataset_cidr_reader_key, r);
+    t_dataset_cidr_reader = r;
+    return r;
+}
+
+/** \internal
+ *  \brief wait until no lookup uses tables replaced before the call
+ */
+static void DatasetCidrSynchronize(void)
+{
+    const uint64_t epoch = SC_ATOMIC_ADD(dataset_cidr_epoch, 1);
+
+    /* lookups that started after the epoch change see the new tables */
+    SCMutexLock(&dataset_cidr_readers_lock);
+    DatasetCidrReader *r;
+    TAILQ_FOREACH (r, &dataset_cidr_readers, next) {
+        uint64_t e;
+        while ((e = SC_ATOMIC_GET(r->epoch)) != 0 && e <= epoch + 1) {
+            SleepUsec(1);
+        }
+    }
+    SCMutexUnlock(&dataset_cidr_readers_lock);
+}
+
+static void DatasetCidrTablesFree(DatasetCidrTables *t)
+{
+    if (t == NULL)
+        return;
+    for (int i = 0; i < 2; i++)
+        SCLpmFree(t->lpm[i]);
+    SCFree(t);
+}
+
+static uint64_t DatasetCidrTimeMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static inline int FamilyIdx(int family)
+{
+    return family == AF_INET ? DATASET_CIDR_V4 : DATASET_CIDR_V6;
+}
+
+static uint64_t DatasetCidrMemuseCalc(const DatasetCidr *c)
+{
+    uint64_t size = sizeof(*c);
+    for (int i = 0; i < 2; i++)
+        size += SCLpmBuilderMemorySize(c->builder[i]);
+    const DatasetCidrTables *t = SC_ATOMIC_GET(c->tables);
+    if (t != NULL) {
+        size += sizeof(*t);
+        for (int i = 0; i < 2; i++)
+            size += SCLpmMemorySize(t->lpm[i]);
+    }
+    return size;
+}
+
+DatasetCidr *DatasetCidrNew(uint64_t memcap)
+{
+    DatasetCidr *c = SCCalloc(1, sizeof(*c));
+    if (c == NULL)
+        return NULL;
+    SCMutexInit(&c->build_lock, NULL);
+    SC_ATOMIC_INIT(c->pending);
+    SC_ATOMIC_INITPTR(c->tables);
+    SC_ATOMIC_INIT(c->memuse);
+    c->memcap = memcap;
+    c->dirty = true;
+
+    c->builder[DATASET_CIDR_V4] = SCLpmBuilderNew(32);
+    c->builder[DATASET_CIDR_V6] = SCLpmBuilderNew(128);
+    if (c->builder[DATASET_CIDR_V4] == NULL || c->builder[DATASET_CIDR_V6] == NULL)
+        goto error;
+    if (DatasetCidrCommit(c) < 0)
+        goto error;
+    return c;
+
+error:
+    DatasetCidrFree(c);
+    return NULL;
+}
+
+void DatasetCidrFree(DatasetCidr *c)
+{
+    if (c == NULL)
+        return;
+    DatasetCidrTablesFree(SC_ATOMIC_GET(c->tables));
+    for (int i = 0; i < 2; i++)
+        SCLpmBuilderFree(c->builder[i]);
+    SCMutexDestroy(&c->build_lock);
+    SCFree(c);
+}
+
+/**
+ *  \brief parse "addr[/netmask]"
+ *
+ *  Without a netmask the address is a host prefix (/32 or /128).
+ *
+ *  \param addr output buffer, 16 bytes. Host bits are cleared.
+ *  \retval 0 ok
+ *  \retval -1 invalid
+ */
+int DatasetCidrParse(const char *str, int *family, uint8_t *addr, uint8_t *netmask)
+{
+    char buf[64];
+    if (strlcpy(buf, str, sizeof(buf)) >= sizeof(buf))
+        return -1;
+
+    char *mask = strchr(buf, '/');
+    if (mask != NULL)
+        *mask++ = '\0';
+
+    uint8_t max;
+    memset(addr, 0, 16);
+    if (inet_pton(AF_INET, buf, addr) == 1) {
+        *family = AF_INET;
+        max = 32;
+    } else if (inet_pton(AF_INET6, buf, addr) == 1) {
+        *family = AF_INET6;
+        max = 128;
+    } else {
+        return -1;
+    }
+
+    *netmask = max;
+    if (mask != NULL) {
+        if (StringParseU8RangeCheck(netmask, 10, 0, mask, 0, max) <= 0)
+            return -1;
+    }
+
+    /* clear host bits */
+    for (uint32_t bit = *netmask; bit < max; bit++)
+        addr[bit >> 3] &= (uint8_t)~(0x80 >> (bit & 7));
+    return 0;
+}
+
+/**
+ *  \brief add a prefix. Not visible to lookups until committed.
+ *
+ *  \retval 1 added
+ *  \retval 0 already in the set, reputation updated
+ *  \retval -1 error, e.g. memcap reached
+ */
+int DatasetCidrAdd(DatasetCidr *c, int family, const uint8_t *addr, uint8_t netmask,
+        const DataRepType *rep)
+{
+    const uint32_t value = (rep ? rep->value : 0) + 1;
+
+    SCMutexLock(&c->build_lock);
+    if (c->memcap > 0 && SC_ATOMIC_GET(c->memuse) >= c->memcap) {
+        SCMutexUnlock(&c->build_lock);
+        return -1;
+    }
+    int r = SCLpmBuilderAdd(c->builder[FamilyIdx(family)], addr, netmask, value);
+    if (r >= 0)
+        c->dirty = true;
+    SC_ATOMIC_SET(c->memuse, DatasetCidrMemuseCalc(c));
+    SCMutexUnlock(&c->build_lock);
+    return r;
+}
+
+/**
+ *  \brief remove a prefix. Lookups are updated when committed.
+ *
+ *  \retval 1 removed
+ *  \retval -1 not found
+ */
+int DatasetCidrRemove(DatasetCidr *c, int family, const uint8_t *addr, uint8_t netmask)
+{
+    SCMutexLock(&c->build_lock);
+    int r = SCLpmBuilderRemove(c->builder[FamilyIdx(family)], addr, netmask);
+    if (r == 1)
+        c->dirty = true;
+    SC_ATOMIC_SET(c->memuse, DatasetCidrMemuseCalc(c));
+    SCMutexUnlock(&c->build_lock);
+    return r == 1 ? 1 : -1;
+}
+
+/** \internal
+ *  \brief compile the builders and publish the result
+ *  \note build_lock must be held */
+static int DatasetCidrBuild(DatasetCidr *c)
+{
+    if (!c->dirty) {
+        SC_ATOMIC_SET(c->pending, false);
+        return 0;
+    }
+
+    DatasetCidrTables *t = SCCalloc(1, sizeof(*t));
+    if (t == NULL)
+        return -1;
+    for (int i = 0; i < 2; i++) {
+        t->lpm[i] = SCLpmBuild(c->builder[i]);
+        if (t->lpm[i] == NULL) {
+            DatasetCidrTablesFree(t);
+            return -1;
+        }
+    }
+
+    DatasetCidrTables *old = SC_ATOMIC_GET(c->tables);
+    SC_ATOMIC_SET(c->tables, t);
+    c->dirty = false;
+    c->built_ms = DatasetCidrTimeMs();
+    SC_ATOMIC_SET(c->pending, false);
+    SC_ATOMIC_SET(c->memuse, DatasetCidrMemuseCalc(c));
+
+    if (old != NULL) {
+        DatasetCidrSynchronize();
+        DatasetCidrTablesFree(old);
+    }
+    return 0;
+}
+
+/** \brief compile the builders and make the result visible to lookups */
+int DatasetCidrCommit(DatasetCidr *c)
+{
+    SCMutexLock(&c->build_lock);
+    int r = DatasetCidrBuild(c);
+    SCMutexUnlock(&c->build_lock);
+    return r;
+}
+
+/**
+ *  \brief commit, batching frequent updates
+ *
+ *  If the tables were built less than DATASET_CIDR_COMMIT_INTERVAL_MS ago
+ *  the commit is deferred. It's done by the next commit or by
+ *  DatasetCidrCommitPending after the interval, so bursts of updates lead
+ *  to a single rebuild.
+ */
+int DatasetCidrCommitDeferred(DatasetCidr *c)
+{
+    int r = 0;
+    SCMutexLock(&c->build_lock);
+    if (DatasetCidrTimeMs() - c->built_ms >= DATASET_CIDR_COMMIT_INTERVAL_MS) {
+        r = DatasetCidrBuild(c);
+    } else if (c->dirty) {
+        SC_ATOMIC_SET(c->pending, true);
+    }
+    SCMutexUnlock(&c->build_lock);
+    return r;
+}
+
+/**
+ *  \brief do a deferred commit if it's due
+ *
+ *  Builds the tables and waits for the readers of the old ones, so this
+ *  is called periodically from the unix socket thread, never from the
+ *  packet path.
+ *
+ *  \retval 1 tables rebuilt
+ *  \retval 0 nothing to do or not due yet
+ *  \retval -1 build failed, the pending updates stay in the builders
+ */
+int DatasetCidrCommitPending(DatasetCidr *c)
+{
+    if (!SC_ATOMIC_GET(c->pending))
+        return 0;
+
+    int r = 0;
+    SCMutexLock(&c->build_lock);
+    if (SC_ATOMIC_GET(c->pending) &&
+            DatasetCidrTimeMs() - c->built_ms >= DATASET_CIDR_COMMIT_INTERVAL_MS) {
+        r = DatasetCidrBuild(c) < 0 ? -1 : 1;
+    }
+    SCMutexUnlock(&c->build_lock);
+    return r;
+}
+
+/**
+ *  \brief longest prefix match lookup
+ *
+ *  \param data IPv4 (4 bytes) or IPv6 (16 bytes) address in network order
+ *  \param rep if not NULL, set to the reputation value of the prefix
+ *  \retval 1 found
+ *  \retval 0 not found
+ *  \retval -1 data is not an IPv4 or IPv6 address
+ */
+int DatasetCidrLookup(
+        DatasetCidr *c, const uint8_t *data, const uint32_t data_len, DataRepType *rep)
+{
+    int idx;
+    if (data_len == 4)
+        idx = DATASET_CIDR_V4;
+    else if (data_len == 16)
+        idx = DATASET_CIDR_V6;
+    else
+        return -1;
+
+    DatasetCidrReader *r = t_dataset_cidr_reader;
+    if (unlikely(r == NULL))
+        r = DatasetCidrReaderSetup();
+
+    uint32_t value;
+    if (likely(r != NULL)) {
+        SC_ATOMIC_SET(r->epoch, SC_ATOMIC_GET(dataset_cidr_epoch) + 1);
+        const DatasetCidrTables *t = SC_ATOMIC_GET(c->tables);
+        value = SCLpmLookup(t->lpm[idx], data);
+        SC_ATOMIC_SET(r->epoch, 0);
+    } else {
+        SCMutexLock(&dataset_cidr_readers_lock);
+        const DatasetCidrTables *t = SC_ATOMIC_GET(c->tables);
+        value = SCLpmLookup(t->lpm[idx], data);
+        SCMutexUnlock(&dataset_cidr_readers_lock);
+    }
+
+    if (value == 0)
+        return 0;
+    if (rep != NULL)
+        rep->value = (uint16_t)(value - 1);
+    return 1;
+}
+
+struct DatasetCidrWalkCtx {
+    DatasetCidrWalkFunc Func;
+    void *ctx;
+    int family;
+};
+
+static int DatasetCidrWalkCb(const uint8_t *key, uint8_t netmask, uint32_t value, void *ctx)
+{
+    struct DatasetCidrWalkCtx *wctx = ctx;
+    DataRepType rep = { .value = (uint16_t)(value - 1) };
+    return wctx->Func(wctx->ctx, wctx->family, key, netmask, &rep);
+}
+
+/** \brief call \a Func for each prefix in the set, IPv4 first */
+int DatasetCidrWalk(DatasetCidr *c, DatasetCidrWalkFunc Func, void *ctx)
+{
+    struct DatasetCidrWalkCtx wctx = { .Func = Func, .ctx = ctx, .family = AF_INET };
+    int r;
+
+    SCMutexLock(&c->build_lock);
+    r = SCLpmBuilderWalk(c->builder[DATASET_CIDR_V4], DatasetCidrWalkCb, &wctx);
+    if (r == 0) {
+        wctx.family = AF_INET6;
+        r = SCLpmBuilderWalk(c->builder[DATASET_CIDR_V6], DatasetCidrWalkCb, &wctx);
+    }
+    SCMutexUnlock(&c->build_lock);
+    return r;
+}
+
+uint32_t DatasetCidrCount(DatasetCidr *c)
+{
+    SCMutexLock(&c->build_lock);
+    uint32_t cnt = SCLpmBuilderCount(c->builder[DATASET_CIDR_V4]) +
+                   SCLpmBuilderCount(c->builder[DATASET_CIDR_V6]);
+    SCMutexUnlock(&c->build_lock);
+    return cnt;
+}
+
+uint64_t DatasetCidrMemuse(DatasetCidr *c)
+{
+    return SC_ATOMIC_GET(c->memuse);
+}
+
+#ifdef UNITTESTS
+static int DatasetCidrAddStr(DatasetCidr *c, const char *str, uint16_t rep_value)
+{
+    int family;
+    uint8_t addr[16];
+    uint8_t netmask;
+    if (DatasetCidrParse(str, &family, addr, &netmask) < 0)
+        return -2;
+    DataRepType rep = { .value = rep_value };
+    return DatasetCidrAdd(c, family, addr, netmask, &rep);
+}
+
+static int DatasetCidrTest01(void)
+{
+    int family;
+    uint8_t addr[16];
+    uint8_t netmask;
+
+    FAIL_IF(DatasetCidrParse("10.1.2.3/8", &family, addr, &netmask) != 0);
+    FAIL_IF_NOT(family == AF_INET);
+    FAIL_IF_NOT(netmask == 8);
+    FAIL_IF_NOT(addr[0] == 10 && addr[1] == 0 && addr[2] == 0 && addr[3] == 0);
+    FAIL_IF(DatasetCidrParse("10.1.2.3", &family, addr, &netmask) != 0);
+    FAIL_IF_NOT(netmask == 32);
+    FAIL_IF(DatasetCidrParse("2001:db8::1/33", &family, addr, &netmask) != 0);
+    FAIL_IF_NOT(family == AF_INET6);
+    FAIL_IF_NOT(netmask == 33);
+    FAIL_IF(DatasetCidrParse("10.1.2.3/33", &family, addr, &netmask) == 0);
+    FAIL_IF(DatasetCidrParse("10.1.2.3/", &family, addr, &netmask) == 0);
+    FAIL_IF(DatasetCidrParse("10.1.2.3/8x", &family, addr, &netmask) == 0);
+    FAIL_IF(DatasetCidrParse("2001:db8::1/129", &family, addr, &netmask) == 0);
+    FAIL_IF(DatasetCidrParse("example.com", &family, addr, &netmask) == 0);
+    PASS;
+}
+
+static int DatasetCidrTest02(void)
+{
+    DatasetCidr *c = DatasetCidrNew(0);
+    FAIL_IF_NULL(c);
+
+    FAIL_IF(DatasetCidrAddStr(c, "10.0.0.0/8", 1) != 1);
+    FAIL_IF(DatasetCidrAddStr(c, "10.10.0.0/16", 2) != 1);
+    FAIL_IF(DatasetCidrAddStr(c, "2001:db8::/32", 3) != 1);
+    FAIL_IF(DatasetCidrAddStr(c, "10.10.0.0/16", 4) != 0);
+
+    uint8_t v4[4] = { 10, 10, 1, 1 };
+    DataRepType rep = { .value = 0 };
+    /* not committed yet */
+    FAIL_IF(DatasetCidrLookup(c, v4, 4, &rep) != 0);
+    FAIL_IF(DatasetCidrCommit(c) != 0);
+    FAIL_IF(DatasetCidrCount(c) != 3);
+
+    FAIL_IF(DatasetCidrLookup(c, v4, 4, &rep) != 1);
+    FAIL_IF_NOT(rep.value == 4);
+    v4[1] = 11;
+    FAIL_IF(DatasetCidrLookup(c, v4, 4, &rep) != 1);
+    FAIL_IF_NOT(rep.value == 1);
+    v4[0] = 11;
+    FAIL_IF(DatasetCidrLookup(c, v4, 4, &rep) != 0);
+    FAIL_IF(DatasetCidrLookup(c, v4, 3, &rep) != -1);
+
+    struct in6_addr v6;
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8:ffff::1", &v6) != 1);
+    FAIL_IF(DatasetCidrLookup(c, (uint8_t *)&v6, 16, &rep) != 1);
+    FAIL_IF_NOT(rep.value == 3);
+
+    int family;
+    uint8_t addr[16];
+    uint8_t netmask;
+    FAIL_IF(DatasetCidrParse("2001:db8::/32", &family, addr, &netmask) != 0);
+    FAIL_IF(DatasetCidrRemove(c, family, addr, netmask) != 1);
+    FAIL_IF(DatasetCidrRemove(c, family, addr, netmask) != -1);
+    FAIL_IF(DatasetCidrCommit(c) != 0);
+    FAIL_IF(DatasetCidrLookup(c, (uint8_t *)&v6, 16, &rep) != 0);
+
+    DatasetCidrFree(c);
+    PASS;
+}
+
+/** \test deferred commits are batched and not done by lookups */
+static int DatasetCidrTest03(void)
+{
+    DatasetCidr *c = DatasetCidrNew(0);
+    FAIL_IF_NULL(c);
+    const DatasetCidrTables *t = SC_ATOMIC_GET(c->tables);
+    FAIL_IF_NULL(t);
+
+    FAIL_IF(DatasetCidrAddStr(c, "10.0.0.0/8", 1) != 1);
+    FAIL_IF(DatasetCidrCommitDeferred(c) != 0);
+    FAIL_IF(DatasetCidrAddStr(c, "10.10.0.0/16", 2) != 1);
+    FAIL_IF(DatasetCidrCommitDeferred(c) != 0);
+    /* tables were just built by DatasetCidrNew */
+    FAIL_IF_NOT(SC_ATOMIC_GET(c->pending));
+    FAIL_IF_NOT(SC_ATOMIC_GET(c->tables) == t);
+
+    uint8_t v4[4] = { 10, 10, 1, 1 };
+    DataRepType rep = { .value = 0 };
+    FAIL_IF(DatasetCidrLookup(c, v4, 4, &rep) != 0);
+    FAIL_IF_NULL(t_dataset_cidr_reader);
+    FAIL_IF_NOT(SC_ATOMIC_GET(t_dataset_cidr_reader->epoch) == 0);
+
+    /* not due yet */
+    FAIL_IF(DatasetCidrCommitPending(c) != 0);
+    FAIL_IF_NOT(SC_ATOMIC_GET(c->tables) == t);
+
+    /* lookups never build, even once the interval passed */
+    c->built_ms -= DATASET_CIDR_COMMIT_INTERVAL_MS;
+    FAIL_IF(DatasetCidrLookup(c, v4, 4, &rep) != 0);
+    FAIL_IF_NOT(SC_ATOMIC_GET(c->pending));
+    FAIL_IF_NOT(SC_ATOMIC_GET(c->tables) == t);
+
+    /* the periodic commit builds both updates */
+    FAIL_IF(DatasetCidrCommitPending(c) != 1);
+    FAIL_IF(DatasetCidrLookup(c, v4, 4, &rep) != 1);
+    FAIL_IF_NOT(rep.value == 2);
+    FAIL_IF(SC_ATOMIC_GET(c->pending));
+    FAIL_IF(SC_ATOMIC_GET(c->tables) == t);
+
+    /* nothing changed, no rebuild */
+    t = SC_ATOMIC_GET(c->tables);
+    FAIL_IF(DatasetCidrCommit(c) != 0);
+    FAIL_IF_NOT(SC_ATOMIC_GET(c->tables) == t);
+
+    DatasetCidrFree(c);
+    PASS;
+}
+
+struct DatasetCidrTestCtx {
+    DatasetCidr *c;
+    SC_ATOMIC_DECLARE(bool, stop);
+    uint64_t found;
+};
+
+static void *DatasetCidrTestReader(void *arg)
+{
+    struct DatasetCidrTestCtx *ctx = arg;
+    uint8_t v4[4] = { 10, 1, 1, 1 };
+    while (!SC_ATOMIC_GET(ctx->stop)) {
+        if (DatasetCidrLookup(ctx->c, v4, 4, NULL) == 1)
+            ctx->found++;
+    }
+    return NULL;
+}
+
+/** \test lookups of other threads while the tables are replaced */
+static int DatasetCidrTest04(void)
+{
+    struct DatasetCidrTestCtx ctx = { .c = DatasetCidrNew(0), .found = 0 };
+    FAIL_IF_NULL(ctx.c);
+    SC_ATOMIC_INIT(ctx.stop);
+    FAIL_IF(DatasetCidrAddStr(ctx.c, "10.0.0.0/8", 1) != 1);
+    FAIL_IF(DatasetCidrCommit(ctx.c) != 0);
+
+    pthread_t t;
+    FAIL_IF(pthread_create(&t, NULL, DatasetCidrTestReader, &ctx) != 0);
+    for (int i = 0; i < 100; i++) {
+        char str[32];
+        snprintf(str, sizeof(str), "192.168.%d.0/24", i);
+        FAIL_IF(DatasetCidrAddStr(ctx.c, str, 2) != 1);
+        FAIL_IF(DatasetCidrCommit(ctx.c) != 0);
+    }
+    SC_ATOMIC_SET(ctx.stop, true);
+    pthread_join(t, NULL);
+    FAIL_IF(DatasetCidrCount(ctx.c) != 101);
+
+    DatasetCidrFree(ctx.c);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DatasetCidrRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DatasetCidrTest01", DatasetCidrTest01);
+    UtRegisterTest("DatasetCidrTest02", DatasetCidrTest02);
+    UtRegisterTest("DatasetCidrTest03", DatasetCidrTest03);
+    UtRegisterTest("DatasetCidrTest04", DatasetCidrTest04);
+#endif /* UNITTESTS */
+}
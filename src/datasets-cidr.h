@@ -0,0 +1,55 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * IPv4/IPv6 prefix datasets with longest prefix match lookups.
+ */
+
+#ifndef __DATASETS_CIDR_H__
+#define __DATASETS_CIDR_H__
+
+#include "datasets-reputation.h"
+
+typedef struct DatasetCidr_ DatasetCidr;
+
+DatasetCidr *DatasetCidrNew(uint64_t memcap);
+void DatasetCidrFree(DatasetCidr *c);
+
+int DatasetCidrParse(const char *str, int *family, uint8_t *addr, uint8_t *netmask);
+
+int DatasetCidrAdd(DatasetCidr *c, int family, const uint8_t *addr, uint8_t netmask,
+        const DataRepType *rep);
+int DatasetCidrRemove(DatasetCidr *c, int family, const uint8_t *addr, uint8_t netmask);
+int DatasetCidrCommit(DatasetCidr *c);
+int DatasetCidrCommitDeferred(DatasetCidr *c);
+int DatasetCidrCommitPending(DatasetCidr *c);
+
+int DatasetCidrLookup(
+        DatasetCidr *c, const uint8_t *data, const uint32_t data_len, DataRepType *rep);
+
+typedef int (*DatasetCidrWalkFunc)(
+        void *ctx, int family, const uint8_t *addr, uint8_t netmask, const DataRepType *rep);
+int DatasetCidrWalk(DatasetCidr *c, DatasetCidrWalkFunc Func, void *ctx);
+
+uint32_t DatasetCidrCount(DatasetCidr *c);
+uint64_t DatasetCidrMemuse(DatasetCidr *c);
+
+void DatasetCidrRegisterTests(void);
+
+#endif /* __DATASETS_CIDR_H__ */
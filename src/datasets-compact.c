@@ -0,0 +1,541 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Compact, read-only datasets backed by a mmap'd sorted array.
+ *
+ * The file is mapped read-only and shared, so multiple sets (e.g. of
+ * different tenants) and multiple processes using the same file share
+ * the page cache instead of each building a private hash table. Within
+ * the process a mapping is reference counted and reused for sets loading
+ * the same (unchanged) file.
+ */
+
+#include "suricata-common.h"
+#include "datasets.h"
+#include "datasets-compact.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+struct DatasetCompact_ {
+    char path[PATH_MAX];
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    uint32_t refcnt;
+
+    uint8_t *map;
+    size_t map_size;
+
+    const DatasetCompactHeader *hdr;
+    const uint64_t *index;
+    const uint8_t *records;
+    const uint8_t *data;
+
+    struct DatasetCompact_ *next;
+};
+
+/** size of the per entry header in the string data section: len + rep */
+#define STRING_ENTRY_HDR_SIZE 6
+
+static SCMutex compact_lock = SCMUTEX_INITIALIZER;
+static DatasetCompact *compact_maps = NULL;
+
+static uint32_t DatasetCompactKeySize(enum DatasetTypes type)
+{
+    switch (type) {
+        case DATASET_TYPE_MD5:
+            return 16;
+        case DATASET_TYPE_SHA256:
+            return 32;
+        default:
+            return 0;
+    }
+}
+
+/** \brief check if the file at \a path starts with the compact magic */
+bool DatasetCompactIsCompact(const char *path)
+{
+    char magic[DATASET_COMPACT_MAGIC_LEN];
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return false;
+    size_t r = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+
+    return (r == sizeof(magic) && memcmp(magic, DATASET_COMPACT_MAGIC, sizeof(magic)) == 0);
+}
+
+static bool DatasetCompactRangeValid(const DatasetCompact *c, uint64_t offset, uint64_t size)
+{
+    return (offset <= c->map_size && size <= c->map_size - offset);
+}
+
+/** \brief validate the header and the prefix index of a mapped file */
+static int DatasetCompactValidate(DatasetCompact *c, enum DatasetTypes type)
+{
+    if (c->map_size < sizeof(DatasetCompactHeader))
+        return -1;
+
+    const DatasetCompactHeader *hdr = (const DatasetCompactHeader *)c->map;
+    if (memcmp(hdr->magic, DATASET_COMPACT_MAGIC, DATASET_COMPACT_MAGIC_LEN) != 0)
+        return -1;
+    if (hdr->bom != DATASET_COMPACT_BOM) {
+        SCLogError(SC_ERR_DATASET, "dataset file '%s' has wrong byte order", c->path);
+        return -1;
+    }
+    if (hdr->version != DATASET_COMPACT_VERSION) {
+        SCLogError(SC_ERR_DATASET, "dataset file '%s' has unsupported version %u", c->path,
+                hdr->version);
+        return -1;
+    }
+    if (hdr->type != (uint32_t)type) {
+        SCLogError(SC_ERR_DATASET, "dataset file '%s' is of type %u, expected %u", c->path,
+                hdr->type, type);
+        return -1;
+    }
+    if (hdr->key_size != DatasetCompactKeySize(type))
+        return -1;
+
+    uint32_t record_size;
+    if (type == DATASET_TYPE_STRING) {
+        record_size = sizeof(uint64_t);
+    } else {
+        record_size = hdr->key_size;
+        if (hdr->flags & DATASET_COMPACT_FLAG_REP)
+            record_size += sizeof(uint16_t);
+    }
+    if (hdr->record_size != record_size)
+        return -1;
+
+    if ((hdr->index_offset % sizeof(uint64_t)) != 0 ||
+            (hdr->records_offset % sizeof(uint64_t)) != 0)
+        return -1;
+    if (!DatasetCompactRangeValid(
+                c, hdr->index_offset, DATASET_COMPACT_INDEX_CNT * sizeof(uint64_t)))
+        return -1;
+    if (hdr->count > (c->map_size / record_size) ||
+            !DatasetCompactRangeValid(c, hdr->records_offset, hdr->count * record_size))
+        return -1;
+    if (!DatasetCompactRangeValid(c, hdr->data_offset, hdr->data_size))
+        return -1;
+
+    c->hdr = hdr;
+    c->index = (const uint64_t *)(c->map + hdr->index_offset);
+    c->records = c->map + hdr->records_offset;
+    c->data = c->map + hdr->data_offset;
+
+    /* the index must be monotonic and end at the record count, so that
+     * lookups never have to range check it. */
+    uint64_t prev = 0;
+    for (uint32_t i = 0; i < DATASET_COMPACT_INDEX_CNT; i++) {
+        if (c->index[i] < prev || c->index[i] > hdr->count)
+            return -1;
+        prev = c->index[i];
+    }
+    if (c->index[DATASET_COMPACT_INDEX_CNT - 1] != hdr->count)
+        return -1;
+
+    return 0;
+}
+
+/**
+ *  \brief map a compact dataset file
+ *
+ *  If the same file is already mapped for another set it is reused.
+ *
+ *  \retval c compact set or NULL on error
+ */
+DatasetCompact *DatasetCompactOpen(const char *path, enum DatasetTypes type)
+{
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        SCLogError(SC_ERR_DATASET, "open '%s' failed: %s", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        SCLogError(SC_ERR_DATASET, "fstat '%s' failed: %s", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    SCMutexLock(&compact_lock);
+    for (DatasetCompact *c = compact_maps; c != NULL; c = c->next) {
+        if (c->dev == st.st_dev && c->ino == st.st_ino && c->size == st.st_size &&
+                c->mtime == st.st_mtime && c->hdr->type == (uint32_t)type) {
+            c->refcnt++;
+            SCLogDebug("reusing mapping of '%s' for '%s'", c->path, path);
+            SCMutexUnlock(&compact_lock);
+            close(fd);
+            return c;
+        }
+    }
+
+    DatasetCompact *c = SCCalloc(1, sizeof(*c));
+    if (c == NULL)
+        goto error;
+    strlcpy(c->path, path, sizeof(c->path));
+    c->dev = st.st_dev;
+    c->ino = st.st_ino;
+    c->size = st.st_size;
+    c->mtime = st.st_mtime;
+    c->map_size = (size_t)st.st_size;
+
+    if (c->map_size == 0) {
+        SCLogError(SC_ERR_DATASET, "dataset file '%s' is empty", path);
+        goto error;
+    }
+    void *map = mmap(NULL, c->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        SCLogError(SC_ERR_DATASET, "mmap '%s' failed: %s", path, strerror(errno));
+        goto error;
+    }
+    c->map = map;
+
+    if (DatasetCompactValidate(c, type) < 0) {
+        SCLogError(SC_ERR_DATASET, "dataset file '%s' is not a valid compact dataset", path);
+        goto error;
+    }
+
+    /* lookups are random access in the records, but the index is hot */
+    (void)madvise(c->map, c->map_size, MADV_RANDOM);
+    (void)madvise(c->map, c->hdr->records_offset, MADV_WILLNEED);
+
+    c->refcnt = 1;
+    c->next = compact_maps;
+    compact_maps = c;
+    SCMutexUnlock(&compact_lock);
+    close(fd);
+    return c;
+
+error:
+    if (c != NULL) {
+        if (c->map != NULL)
+            munmap(c->map, c->map_size);
+        SCFree(c);
+    }
+    SCMutexUnlock(&compact_lock);
+    close(fd);
+    return NULL;
+}
+
+void DatasetCompactClose(DatasetCompact *c)
+{
+    if (c == NULL)
+        return;
+
+    SCMutexLock(&compact_lock);
+    if (--c->refcnt > 0) {
+        SCMutexUnlock(&compact_lock);
+        return;
+    }
+
+    DatasetCompact *prev = NULL;
+    for (DatasetCompact *cur = compact_maps; cur != NULL; cur = cur->next) {
+        if (cur == c) {
+            if (prev != NULL)
+                prev->next = c->next;
+            else
+                compact_maps = c->next;
+            break;
+        }
+        prev = cur;
+    }
+    SCMutexUnlock(&compact_lock);
+
+    munmap(c->map, c->map_size);
+    SCFree(c);
+}
+
+static inline uint32_t KeyPrefix(const uint8_t *data, const uint32_t data_len)
+{
+    uint32_t p = 0;
+    if (data_len > 0)
+        p = (uint32_t)data[0] << 8;
+    if (data_len > 1)
+        p |= data[1];
+    return p;
+}
+
+/** \brief get string entry \a idx
+ *  \retval false if the entry points outside of the data section */
+static inline bool GetStringEntry(
+        const DatasetCompact *c, uint64_t idx, const uint8_t **ptr, uint32_t *len, uint16_t *rep)
+{
+    uint64_t offset;
+    memcpy(&offset, c->records + idx * sizeof(uint64_t), sizeof(offset));
+    if (offset > c->hdr->data_size || c->hdr->data_size - offset < STRING_ENTRY_HDR_SIZE)
+        return false;
+
+    const uint8_t *e = c->data + offset;
+    memcpy(len, e, sizeof(*len));
+    memcpy(rep, e + sizeof(*len), sizeof(*rep));
+    if (*len > c->hdr->data_size - offset - STRING_ENTRY_HDR_SIZE)
+        return false;
+    *ptr = e + STRING_ENTRY_HDR_SIZE;
+    return true;
+}
+
+static int LookupString(
+        const DatasetCompact *c, const uint8_t *data, const uint32_t data_len, DataRepType *rep)
+{
+    const uint32_t p = KeyPrefix(data, data_len);
+    uint64_t lo = c->index[p];
+    uint64_t hi = c->index[p + 1];
+
+    while (lo < hi) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        const uint8_t *ptr;
+        uint32_t len;
+        uint16_t v;
+        if (!GetStringEntry(c, mid, &ptr, &len, &v))
+            return 0;
+
+        int r = memcmp(ptr, data, MIN(len, data_len));
+        if (r == 0)
+            r = (len > data_len) - (len < data_len);
+        if (r == 0) {
+            if (rep != NULL)
+                rep->value = v;
+            return 1;
+        } else if (r < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0;
+}
+
+static int LookupFixed(
+        const DatasetCompact *c, const uint8_t *data, const uint32_t data_len, DataRepType *rep)
+{
+    if (data_len != c->hdr->key_size)
+        return 0;
+
+    const uint32_t p = KeyPrefix(data, data_len);
+    const uint32_t record_size = c->hdr->record_size;
+    uint64_t lo = c->index[p];
+    uint64_t hi = c->index[p + 1];
+
+    while (lo < hi) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        const uint8_t *rec = c->records + mid * record_size;
+
+        int r = memcmp(rec, data, data_len);
+        if (r == 0) {
+            if (rep != NULL) {
+                rep->value = 0;
+                if (c->hdr->flags & DATASET_COMPACT_FLAG_REP)
+                    memcpy(&rep->value, rec + data_len, sizeof(rep->value));
+            }
+            return 1;
+        } else if (r < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return 0;
+}
+
+/**
+ *  \brief look up \a data in the compact set
+ *  \param rep optional, set to the reputation value if found
+ *  \retval 0 not found
+ *  \retval 1 found
+ */
+int DatasetCompactLookup(const DatasetCompact *c, const uint8_t *data, const uint32_t data_len,
+        DataRepType *rep)
+{
+    if (c->hdr->count == 0)
+        return 0;
+
+    if (c->hdr->type == DATASET_TYPE_STRING)
+        return LookupString(c, data, data_len, rep);
+    return LookupFixed(c, data, data_len, rep);
+}
+
+/**
+ *  \brief call \a Func for each record in the set
+ *  \retval 0 ok
+ *  \retval -1 a record is invalid or \a Func returned an error
+ */
+int DatasetCompactWalk(const DatasetCompact *c, DatasetCompactWalkFunc Func, void *ctx)
+{
+    for (uint64_t i = 0; i < c->hdr->count; i++) {
+        const uint8_t *ptr;
+        uint32_t len;
+        if (c->hdr->type == DATASET_TYPE_STRING) {
+            uint16_t rep;
+            if (!GetStringEntry(c, i, &ptr, &len, &rep))
+                return -1;
+        } else {
+            ptr = c->records + i * c->hdr->record_size;
+            len = c->hdr->key_size;
+        }
+        if (Func(ctx, ptr, len) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+uint64_t DatasetCompactCount(const DatasetCompact *c)
+{
+    return c->hdr->count;
+}
+
+uint64_t DatasetCompactMappedSize(const DatasetCompact *c)
+{
+    return (uint64_t)c->map_size;
+}
+
+/** \brief get the number of bytes of the mapping that are currently
+ *         resident in memory.
+ *
+ *  As the mapping is shared, these pages are accounted to the page cache
+ *  and shared with any other process mapping the same file. */
+uint64_t DatasetCompactResidentSize(const DatasetCompact *c)
+{
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t pages = (c->map_size + page_size - 1) / page_size;
+
+    unsigned char *vec = SCMalloc(pages);
+    if (vec == NULL)
+        return 0;
+    if (mincore(c->map, c->map_size, vec) != 0) {
+        SCFree(vec);
+        return 0;
+    }
+    uint64_t resident = 0;
+    for (size_t i = 0; i < pages; i++) {
+        if (vec[i] & 1)
+            resident += page_size;
+    }
+    SCFree(vec);
+    return MIN(resident, (uint64_t)c->map_size);
+}
+
+#ifdef UNITTESTS
+/** \internal \brief write a md5 compact file with two records with rep
+ *  and return the path in \a path */
+static int DatasetCompactWriteTestFile(char *path, size_t path_size, bool corrupt)
+{
+    uint8_t recs[2][18];
+    memset(recs, 0, sizeof(recs));
+    memset(recs[0], 0x11, 16);
+    recs[0][16] = 10;
+    memset(recs[1], 0xee, 16);
+    recs[1][16] = 20;
+
+    DatasetCompactHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, DATASET_COMPACT_MAGIC, DATASET_COMPACT_MAGIC_LEN);
+    hdr.bom = DATASET_COMPACT_BOM;
+    hdr.version = DATASET_COMPACT_VERSION;
+    hdr.type = DATASET_TYPE_MD5;
+    hdr.flags = DATASET_COMPACT_FLAG_REP;
+    hdr.key_size = 16;
+    hdr.record_size = 18;
+    hdr.count = 2;
+    hdr.index_offset = sizeof(hdr);
+    hdr.records_offset = hdr.index_offset + DATASET_COMPACT_INDEX_CNT * sizeof(uint64_t);
+    hdr.data_offset = hdr.records_offset + sizeof(recs);
+    hdr.data_size = 0;
+
+    strlcpy(path, "/tmp/suricata-dataset-compact-XXXXXX", path_size);
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+    FILE *fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        return -1;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    for (uint32_t i = 0; i < DATASET_COMPACT_INDEX_CNT; i++) {
+        uint64_t v = (i <= 0x1111) ? 0 : (i <= 0xeeee ? 1 : 2);
+        if (corrupt && i == 0x2000)
+            v = 5;
+        fwrite(&v, sizeof(v), 1, fp);
+    }
+    fwrite(recs, sizeof(recs), 1, fp);
+    fclose(fp);
+    return 0;
+}
+
+static int DatasetCompactTest01(void)
+{
+    char path[PATH_MAX];
+    FAIL_IF(DatasetCompactWriteTestFile(path, sizeof(path), false) != 0);
+    FAIL_IF_NOT(DatasetCompactIsCompact(path));
+
+    DatasetCompact *c = DatasetCompactOpen(path, DATASET_TYPE_MD5);
+    FAIL_IF_NULL(c);
+    FAIL_IF(DatasetCompactCount(c) != 2);
+
+    uint8_t key[16];
+    DataRepType rep = { .value = 0 };
+    memset(key, 0x11, sizeof(key));
+    FAIL_IF(DatasetCompactLookup(c, key, sizeof(key), &rep) != 1);
+    FAIL_IF(rep.value != 10);
+    memset(key, 0xee, sizeof(key));
+    FAIL_IF(DatasetCompactLookup(c, key, sizeof(key), &rep) != 1);
+    FAIL_IF(rep.value != 20);
+    memset(key, 0x12, sizeof(key));
+    FAIL_IF(DatasetCompactLookup(c, key, sizeof(key), NULL) != 0);
+    /* wrong key size */
+    FAIL_IF(DatasetCompactLookup(c, key, 15, NULL) != 0);
+
+    /* same file is mapped only once */
+    DatasetCompact *c2 = DatasetCompactOpen(path, DATASET_TYPE_MD5);
+    FAIL_IF(c2 != c);
+    DatasetCompactClose(c2);
+    DatasetCompactClose(c);
+    FAIL_IF_NOT_NULL(compact_maps);
+    unlink(path);
+    PASS;
+}
+
+/** \test reject type mismatch and corrupt index */
+static int DatasetCompactTest02(void)
+{
+    char path[PATH_MAX];
+    FAIL_IF(DatasetCompactWriteTestFile(path, sizeof(path), false) != 0);
+    FAIL_IF_NOT_NULL(DatasetCompactOpen(path, DATASET_TYPE_SHA256));
+    unlink(path);
+
+    FAIL_IF(DatasetCompactWriteTestFile(path, sizeof(path), true) != 0);
+    FAIL_IF_NOT_NULL(DatasetCompactOpen(path, DATASET_TYPE_MD5));
+    unlink(path);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DatasetCompactRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DatasetCompactTest01", DatasetCompactTest01);
+    UtRegisterTest("DatasetCompactTest02", DatasetCompactTest02);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,90 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Compact, read-only datasets. The set is stored in a binary file generated
+ * offline (see `suricatactl dataset compile`) and mmap'd at load time.
+ */
+
+#ifndef __DATASETS_COMPACT_H__
+#define __DATASETS_COMPACT_H__
+
+#include "datasets.h"
+#include "datasets-reputation.h"
+
+/** magic at the start of a compact dataset file */
+#define DATASET_COMPACT_MAGIC       "SCDSCMP1"
+#define DATASET_COMPACT_MAGIC_LEN   8
+#define DATASET_COMPACT_VERSION     1
+/** byte order marker, files are always written little endian */
+#define DATASET_COMPACT_BOM         0x01020304U
+
+/** records are followed by a 16 bit reputation value */
+#define DATASET_COMPACT_FLAG_REP    BIT_U32(0)
+
+/** the prefix index has an entry per 16 bit key prefix, plus a terminator */
+#define DATASET_COMPACT_INDEX_CNT   (65536 + 1)
+
+/** on disk header. All offsets are relative to the start of the file.
+ *
+ *  Layout:
+ *  - header
+ *  - prefix index: DATASET_COMPACT_INDEX_CNT uint64_t record numbers. The
+ *    records for key prefix 'p' are [index[p], index[p+1]).
+ *  - records, sorted by key:
+ *    - md5/sha256: key_size bytes of key, followed by the 16 bit rep
+ *      value if DATASET_COMPACT_FLAG_REP is set.
+ *    - string: uint64_t offset into the data section.
+ *  - data (string only): per entry a uint32_t len, uint16_t rep and len
+ *    bytes of raw (decoded) data.
+ */
+typedef struct DatasetCompactHeader_ {
+    char magic[DATASET_COMPACT_MAGIC_LEN];
+    uint32_t bom;
+    uint32_t version;
+    uint32_t type;          /**< enum DatasetTypes */
+    uint32_t flags;
+    uint32_t key_size;      /**< 16 md5, 32 sha256, 0 string */
+    uint32_t record_size;
+    uint64_t count;
+    uint64_t index_offset;
+    uint64_t records_offset;
+    uint64_t data_offset;
+    uint64_t data_size;
+} DatasetCompactHeader;
+
+typedef struct DatasetCompact_ DatasetCompact;
+
+bool DatasetCompactIsCompact(const char *path);
+DatasetCompact *DatasetCompactOpen(const char *path, enum DatasetTypes type);
+void DatasetCompactClose(DatasetCompact *c);
+
+int DatasetCompactLookup(const DatasetCompact *c, const uint8_t *data, const uint32_t data_len,
+        DataRepType *rep);
+
+typedef int (*DatasetCompactWalkFunc)(void *ctx, const uint8_t *data, const uint32_t data_len);
+int DatasetCompactWalk(const DatasetCompact *c, DatasetCompactWalkFunc Func, void *ctx);
+
+uint64_t DatasetCompactCount(const DatasetCompact *c);
+uint64_t DatasetCompactMappedSize(const DatasetCompact *c);
+uint64_t DatasetCompactResidentSize(const DatasetCompact *c);
+
+void DatasetCompactRegisterTests(void);
+
+#endif /* __DATASETS_COMPACT_H__ */
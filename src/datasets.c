@@ -27,12 +27,17 @@
 #include "datasets-string.h"
 #include "datasets-md5.h"
 #include "datasets-sha256.h"
+#include "datasets-compact.h"
+#include "datasets-cidr.h"
 #include "datasets-reputation.h"
 #include "util-thash.h"
+#include "util-hash-lookup3.h"
 #include "util-print.h"
 #include "util-base64.h"    // decode base64
 #include "util-byte.h"
 #include "util-misc.h"
+#include "util-validate.h"
+#include "util-unittest.h"
 
 SCMutex sets_lock = SCMUTEX_INITIALIZER;
 static Dataset *sets = NULL;
@@ -57,9 +62,26 @@ enum DatasetTypes DatasetGetTypeFromString(const char *s)
         return DATASET_TYPE_SHA256;
     if (strcasecmp("string", s) == 0)
         return DATASET_TYPE_STRING;
+    if (strcasecmp("cidr", s) == 0)
+        return DATASET_TYPE_CIDR;
     return DATASET_TYPE_NOTSET;
 }
 
+const char *DatasetGetTypeString(enum DatasetTypes type)
+{
+    switch (type) {
+        case DATASET_TYPE_MD5:
+            return "md5";
+        case DATASET_TYPE_SHA256:
+            return "sha256";
+        case DATASET_TYPE_STRING:
+            return "string";
+        case DATASET_TYPE_CIDR:
+            return "cidr";
+    }
+    return "unknown";
+}
+
 static Dataset *DatasetAlloc(const char *name)
 {
     Dataset *set = SCCalloc(1, sizeof(*set));
@@ -69,6 +91,198 @@ static Dataset *DatasetAlloc(const char *name)
     return set;
 }
 
+static void DatasetFree(Dataset *set)
+{
+    if (set->hash) {
+        THashShutdown(set->hash);
+    }
+    DatasetCompactClose(set->compact);
+    DatasetCidrFree(set->cidr);
+    if (set->prefilter) {
+        SCFree(set->prefilter->counters);
+        SCFree(set->prefilter);
+    }
+    SCFreeAligned(set->prefilter_stats);
+    SCFree(set);
+}
+
+/** number of counters of the prefilter checked per data */
+#define DATASET_PREFILTER_HASHES 3
+
+/** \brief get the counters of data
+ *
+ *  The indexes are derived from a single hashlittle2 pass, as
+ *  h1 + i * h2. */
+static inline void DatasetPrefilterIndexes(const DatasetPrefilter *pf, const uint8_t *data,
+        const uint32_t data_len, uint32_t idx[DATASET_PREFILTER_HASHES])
+{
+    uint32_t h1 = 0;
+    uint32_t h2 = 0;
+    hashlittle2(data, data_len, &h1, &h2);
+    for (uint32_t i = 0; i < DATASET_PREFILTER_HASHES; i++) {
+        idx[i] = (h1 + i * h2) % pf->size;
+    }
+}
+
+/** \brief test if data may be in the filter */
+static bool DatasetPrefilterTest(DatasetPrefilter *pf, const uint8_t *data, const uint32_t data_len)
+{
+    uint32_t idx[DATASET_PREFILTER_HASHES];
+    DatasetPrefilterIndexes(pf, data, data_len, idx);
+    for (uint32_t i = 0; i < DATASET_PREFILTER_HASHES; i++) {
+        if (SC_ATOMIC_GET(pf->counters[idx[i]].cnt) == 0)
+            return false;
+    }
+    return true;
+}
+
+/** \brief increment the counters of data. Saturated counters stay at their
+ *         max, as their real value is unknown. */
+static void DatasetPrefilterIncr(DatasetPrefilter *pf, const uint8_t *data, const uint32_t data_len)
+{
+    uint32_t idx[DATASET_PREFILTER_HASHES];
+    DatasetPrefilterIndexes(pf, data, data_len, idx);
+    for (uint32_t i = 0; i < DATASET_PREFILTER_HASHES; i++) {
+        DatasetPrefilterCounter *c = &pf->counters[idx[i]];
+        uint16_t cnt = SC_ATOMIC_GET(c->cnt);
+        while (cnt != UINT16_MAX && !SC_ATOMIC_CAS(&c->cnt, cnt, cnt + 1))
+            ;
+    }
+}
+
+static void DatasetPrefilterDecr(DatasetPrefilter *pf, const uint8_t *data, const uint32_t data_len)
+{
+    uint32_t idx[DATASET_PREFILTER_HASHES];
+    DatasetPrefilterIndexes(pf, data, data_len, idx);
+    for (uint32_t i = 0; i < DATASET_PREFILTER_HASHES; i++) {
+        DatasetPrefilterCounter *c = &pf->counters[idx[i]];
+        uint16_t cnt = SC_ATOMIC_GET(c->cnt);
+        DEBUG_VALIDATE_BUG_ON(cnt == 0);
+        while (cnt != 0 && cnt != UINT16_MAX && !SC_ATOMIC_CAS(&c->cnt, cnt, cnt - 1))
+            ;
+    }
+}
+
+static inline DatasetPrefilterStats *DatasetPrefilterStatsSlot(Dataset *set)
+{
+    static SC_ATOMIC_DECLARE(uint32_t, slots);
+    static thread_local int slot = -1;
+    if (unlikely(slot == -1)) {
+        slot = (int)(SC_ATOMIC_ADD(slots, 1) % DATASET_PREFILTER_STATS_SLOTS);
+    }
+    return &set->prefilter_stats[slot];
+}
+
+/** \brief consult the prefilter
+ *  \retval false data is not in the set
+ *  \retval true data may be in the set */
+static inline bool DatasetPrefilterLookup(Dataset *set, const uint8_t *data, const uint32_t data_len)
+{
+    if (set->prefilter == NULL)
+        return true;
+    if (DatasetPrefilterTest(set->prefilter, data, data_len))
+        return true;
+    (void)SC_ATOMIC_ADD(DatasetPrefilterStatsSlot(set)->skipped, 1);
+    return false;
+}
+
+/** \brief account a lookup that passed the prefilter but missed the set */
+static inline void DatasetPrefilterFalsePositive(Dataset *set, const uint32_t data_len)
+{
+    if (set->prefilter != NULL) {
+        (void)SC_ATOMIC_ADD(DatasetPrefilterStatsSlot(set)->false_positives, 1);
+    }
+}
+
+/** \brief add data to the prefilter
+ *  \note to be called before adding data to the set, so that lookups
+ *        never miss data that is in the set */
+static int DatasetPrefilterAdd(Dataset *set, const uint8_t *data, const uint32_t data_len)
+{
+    if (set->prefilter == NULL)
+        return 0;
+    DatasetPrefilterIncr(set->prefilter, data, data_len);
+    return 0;
+}
+
+static int DatasetPrefilterAddCb(void *ctx, const uint8_t *data, const uint32_t data_len)
+{
+    return DatasetPrefilterAdd((Dataset *)ctx, data, data_len);
+}
+
+/** \brief remove data from the prefilter
+ *  \note to be called after removing data from the set, or if adding data
+ *        to the set failed */
+static void DatasetPrefilterRemove(Dataset *set, const uint8_t *data, const uint32_t data_len)
+{
+    if (set->prefilter == NULL)
+        return;
+    DatasetPrefilterDecr(set->prefilter, data, data_len);
+}
+
+/** \brief set up the optional prefilter
+ *
+ *  Configured by 'prefilter' and 'prefilter-size' in the set's yaml section,
+ *  falling back to 'datasets.defaults'.
+ */
+static int DatasetPrefilterSetup(Dataset *set)
+{
+    char cnf_name[128];
+    int enabled = 0;
+    uint64_t size = DATASET_PREFILTER_DEFAULT_SIZE;
+    const char *str = NULL;
+
+    snprintf(cnf_name, sizeof(cnf_name), "datasets.%s.prefilter", set->name);
+    if (ConfGetBool(cnf_name, &enabled) != 1) {
+        (void)ConfGetBool("datasets.defaults.prefilter", &enabled);
+    }
+    if (!enabled)
+        return 0;
+
+    /* the filter only knows exact keys, so it can't answer prefix lookups */
+    if (set->type == DATASET_TYPE_CIDR) {
+        SCLogConfig("dataset: %s prefilter not supported for cidr sets", set->name);
+        return 0;
+    }
+
+    snprintf(cnf_name, sizeof(cnf_name), "datasets.%s.prefilter-size", set->name);
+    if (ConfGet(cnf_name, &str) == 1 || ConfGet("datasets.defaults.prefilter-size", &str) == 1) {
+        if (ParseSizeStringU64(str, &size) < 0 || size < 1024 || size > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "dataset %s: invalid prefilter-size '%s'",
+                    set->name, str);
+            return -1;
+        }
+    }
+
+    /* 16 bit counters so that removals stay reliable */
+    set->prefilter = SCCalloc(1, sizeof(*set->prefilter));
+    if (set->prefilter == NULL)
+        return -1;
+    set->prefilter->size = (uint32_t)(size / sizeof(DatasetPrefilterCounter));
+    set->prefilter->counters = SCCalloc(set->prefilter->size, sizeof(DatasetPrefilterCounter));
+    if (set->prefilter->counters == NULL)
+        return -1;
+    set->prefilter_stats = SCMallocAligned(
+            DATASET_PREFILTER_STATS_SLOTS * sizeof(DatasetPrefilterStats), CLS);
+    if (set->prefilter_stats == NULL)
+        return -1;
+    memset(set->prefilter_stats, 0, DATASET_PREFILTER_STATS_SLOTS * sizeof(DatasetPrefilterStats));
+
+    SCLogConfig("dataset: %s prefilter enabled, %" PRIu64 " bytes", set->name, size);
+    return 0;
+}
+
+void DatasetGetPrefilterStats(const Dataset *set, DatasetPrefilterStatsResult *res)
+{
+    memset(res, 0, sizeof(*res));
+    if (set->prefilter_stats == NULL)
+        return;
+    for (int i = 0; i < DATASET_PREFILTER_STATS_SLOTS; i++) {
+        res->skipped += SC_ATOMIC_GET(set->prefilter_stats[i].skipped);
+        res->false_positives += SC_ATOMIC_GET(set->prefilter_stats[i].false_positives);
+    }
+}
+
 static Dataset *DatasetSearchByName(const char *name)
 {
     Dataset *set = sets;
@@ -111,6 +325,13 @@ static int HexToRaw(const uint8_t *in, size_t ins, uint8_t *out, size_t outs)
     return 0;
 }
 
+static uint64_t DatasetTimeDiffMs(const struct timeval *start, const struct timeval *end)
+{
+    int64_t usec = (int64_t)(end->tv_sec - start->tv_sec) * 1000000 +
+                   (int64_t)(end->tv_usec - start->tv_usec);
+    return usec > 0 ? (uint64_t)usec / 1000 : 0;
+}
+
 static int ParseRepLine(const char *in, size_t ins, DataRepType *rep_out)
 {
     SCLogDebug("in '%s'", in);
@@ -156,12 +377,47 @@ static int ParseRepLine(const char *in, size_t ins, DataRepType *rep_out)
     return 0;
 }
 
+/** \brief map a compact (binary) dataset file
+ *
+ *  Compact sets are read-only: they can't be combined with 'state' or
+ *  'save'. Data added at runtime goes into the regular hash.
+ */
+static int DatasetLoadCompact(Dataset *set)
+{
+    if (strlen(set->save) > 0) {
+        SCLogError(SC_ERR_DATASET, "dataset %s: compact file '%s' can't be used with state/save",
+                set->name, set->load);
+        return -1;
+    }
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    set->compact = DatasetCompactOpen(set->load, set->type);
+    if (set->compact == NULL)
+        return -1;
+    if (set->prefilter != NULL &&
+            DatasetCompactWalk(set->compact, DatasetPrefilterAddCb, set) < 0)
+        return -1;
+    gettimeofday(&end, NULL);
+
+    SCLogConfig("dataset: %s mapped %" PRIu64 " records in %" PRIu64 "ms: "
+                "%" PRIu64 " bytes mapped, %" PRIu64 " bytes resident",
+            set->name, DatasetCompactCount(set->compact), DatasetTimeDiffMs(&start, &end),
+            DatasetCompactMappedSize(set->compact), DatasetCompactResidentSize(set->compact));
+    return 0;
+}
+
 static int DatasetLoadMd5(Dataset *set)
 {
     if (strlen(set->load) == 0)
         return 0;
 
+    if (DatasetCompactIsCompact(set->load))
+        return DatasetLoadCompact(set);
+
     SCLogConfig("dataset: %s loading from '%s'", set->name, set->load);
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
     const char *fopen_mode = "r";
     if (strlen(set->save) > 0 && strcmp(set->save, set->load) == 0) {
         fopen_mode = "a+";
@@ -222,7 +478,9 @@ static int DatasetLoadMd5(Dataset *set)
     THashConsolidateMemcap(set->hash);
 
     fclose(fp);
-    SCLogConfig("dataset: %s loaded %u records", set->name, cnt);
+    gettimeofday(&end, NULL);
+    SCLogConfig("dataset: %s loaded %u records in %" PRIu64 "ms, using %" PRIu64 " bytes",
+            set->name, cnt, DatasetTimeDiffMs(&start, &end), SC_ATOMIC_GET(set->hash->memuse));
     return 0;
 }
 
@@ -231,7 +489,12 @@ static int DatasetLoadSha256(Dataset *set)
     if (strlen(set->load) == 0)
         return 0;
 
+    if (DatasetCompactIsCompact(set->load))
+        return DatasetLoadCompact(set);
+
     SCLogConfig("dataset: %s loading from '%s'", set->name, set->load);
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
     const char *fopen_mode = "r";
     if (strlen(set->save) > 0 && strcmp(set->save, set->load) == 0) {
         fopen_mode = "a+";
@@ -288,7 +551,9 @@ static int DatasetLoadSha256(Dataset *set)
     THashConsolidateMemcap(set->hash);
 
     fclose(fp);
-    SCLogConfig("dataset: %s loaded %u records", set->name, cnt);
+    gettimeofday(&end, NULL);
+    SCLogConfig("dataset: %s loaded %u records in %" PRIu64 "ms, using %" PRIu64 " bytes",
+            set->name, cnt, DatasetTimeDiffMs(&start, &end), SC_ATOMIC_GET(set->hash->memuse));
     return 0;
 }
 
@@ -297,7 +562,12 @@ static int DatasetLoadString(Dataset *set)
     if (strlen(set->load) == 0)
         return 0;
 
+    if (DatasetCompactIsCompact(set->load))
+        return DatasetLoadCompact(set);
+
     SCLogConfig("dataset: %s loading from '%s'", set->name, set->load);
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
     const char *fopen_mode = "r";
     if (strlen(set->save) > 0 && strcmp(set->save, set->load) == 0) {
         fopen_mode = "a+";
@@ -368,7 +638,75 @@ static int DatasetLoadString(Dataset *set)
     THashConsolidateMemcap(set->hash);
 
     fclose(fp);
-    SCLogConfig("dataset: %s loaded %u records", set->name, cnt);
+    gettimeofday(&end, NULL);
+    SCLogConfig("dataset: %s loaded %u records in %" PRIu64 "ms, using %" PRIu64 " bytes",
+            set->name, cnt, DatasetTimeDiffMs(&start, &end), SC_ATOMIC_GET(set->hash->memuse));
+    return 0;
+}
+
+/** \brief load a cidr set
+ *
+ *  Line format is "addr[/netmask][,rep]". All lines are added first, then
+ *  the lookup tables are built once.
+ */
+static int DatasetLoadCidr(Dataset *set)
+{
+    if (strlen(set->load) == 0)
+        return 0;
+
+    SCLogConfig("dataset: %s loading from '%s'", set->name, set->load);
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    const char *fopen_mode = "r";
+    if (strlen(set->save) > 0 && strcmp(set->save, set->load) == 0) {
+        fopen_mode = "a+";
+    }
+
+    FILE *fp = fopen(set->load, fopen_mode);
+    if (fp == NULL) {
+        SCLogError(SC_ERR_DATASET, "fopen '%s' failed: %s",
+                set->load, strerror(errno));
+        return -1;
+    }
+
+    uint32_t cnt = 0;
+    char line[1024];
+    while (fgets(line, (int)sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strlen(line) == 0)
+            continue;
+        SCLogDebug("line: '%s'", line);
+
+        DataRepType rep = { .value = 0 };
+        char *r = strchr(line, ',');
+        if (r != NULL) {
+            *r++ = '\0';
+            if (ParseRepLine(r, strlen(r), &rep) < 0)
+                FatalError(SC_ERR_FATAL, "bad rep for dataset %s/%s",
+                        set->name, set->load);
+        }
+
+        int family;
+        uint8_t addr[16];
+        uint8_t netmask;
+        if (DatasetCidrParse(line, &family, addr, &netmask) < 0)
+            FatalError(SC_ERR_FATAL, "bad address '%s' for dataset %s/%s",
+                    line, set->name, set->load);
+
+        if (DatasetCidrAdd(set->cidr, family, addr, netmask, &rep) < 0)
+            FatalError(SC_ERR_FATAL, "dataset data add failed %s/%s",
+                    set->name, set->load);
+        cnt++;
+    }
+    fclose(fp);
+
+    if (DatasetCidrCommit(set->cidr) < 0) {
+        SCLogError(SC_ERR_DATASET, "dataset %s: failed to build lookup table", set->name);
+        return -1;
+    }
+    gettimeofday(&end, NULL);
+    SCLogConfig("dataset: %s loaded %u records in %" PRIu64 "ms, using %" PRIu64 " bytes",
+            set->name, cnt, DatasetTimeDiffMs(&start, &end), DatasetCidrMemuse(set->cidr));
     return 0;
 }
 
@@ -492,6 +830,9 @@ Dataset *DatasetGet(const char *name, enum DatasetTypes type, const char *save,
         SCLogDebug("set \'%s\' loading \'%s\' from \'%s\'", set->name, load, set->load);
     }
 
+    if (DatasetPrefilterSetup(set) < 0)
+        goto out_err;
+
     char cnf_name[128];
     snprintf(cnf_name, sizeof(cnf_name), "datasets.%s.hash", name);
 
@@ -525,6 +866,13 @@ Dataset *DatasetGet(const char *name, enum DatasetTypes type, const char *save,
             if (DatasetLoadSha256(set) < 0)
                 goto out_err;
             break;
+        case DATASET_TYPE_CIDR:
+            set->cidr = DatasetCidrNew(memcap > 0 ? memcap : default_memcap);
+            if (set->cidr == NULL)
+                goto out_err;
+            if (DatasetLoadCidr(set) < 0)
+                goto out_err;
+            break;
     }
 
     SCLogDebug("set %p/%s type %u save %s load %s",
@@ -537,10 +885,7 @@ Dataset *DatasetGet(const char *name, enum DatasetTypes type, const char *save,
     return set;
 out_err:
     if (set) {
-        if (set->hash) {
-            THashShutdown(set->hash);
-        }
-        SCFree(set);
+        DatasetFree(set);
     }
     SCMutexUnlock(&sets_lock);
     return NULL;
@@ -599,8 +944,7 @@ void DatasetPostReloadCleanup(void)
         } else {
             sets = next;
         }
-        THashShutdown(cur->hash);
-        SCFree(cur);
+        DatasetFree(cur);
         cur = next;
     }
     SCMutexUnlock(&sets_lock);
@@ -731,6 +1075,15 @@ int DatasetsInit(void)
                 SCLogDebug("dataset %s: id %d type %s", set_name, n, set_type->val);
                 dset->from_yaml = true;
                 n++;
+
+            } else if (strcmp(set_type->val, "cidr") == 0) {
+                Dataset *dset = DatasetGet(set_name, DATASET_TYPE_CIDR, save, load,
+                        memcap > 0 ? memcap : default_memcap, 0);
+                if (dset == NULL)
+                    FatalError(SC_ERR_FATAL, "failed to setup dataset for %s", set_name);
+                SCLogDebug("dataset %s: id %d type %s", set_name, n, set_type->val);
+                dset->from_yaml = true;
+                n++;
             }
 
             list_pos++;
@@ -748,8 +1101,7 @@ void DatasetsDestroy(void)
     while (set) {
         SCLogDebug("destroying set %s", set->name);
         Dataset *next = set->next;
-        THashShutdown(set->hash);
-        SCFree(set);
+        DatasetFree(set);
         set = next;
     }
     sets = NULL;
@@ -757,6 +1109,30 @@ void DatasetsDestroy(void)
     SCLogDebug("destroying datasets done: %p", sets);
 }
 
+/** \brief call \a Func for each (visible) set, with the sets locked */
+void DatasetsWalk(void (*Func)(const Dataset *set, void *ctx), void *ctx)
+{
+    SCMutexLock(&sets_lock);
+    for (Dataset *set = sets; set != NULL; set = set->next) {
+        if (set->hidden)
+            continue;
+        Func(set, ctx);
+    }
+    SCMutexUnlock(&sets_lock);
+}
+
+/** \brief do the deferred commits of cidr sets that are due. Not to be
+ *         called from packet threads, see DatasetCidrCommitPending */
+void DatasetsCommitPending(void)
+{
+    SCMutexLock(&sets_lock);
+    for (Dataset *set = sets; set != NULL; set = set->next) {
+        if (set->type == DATASET_TYPE_CIDR && set->cidr != NULL)
+            (void)DatasetCidrCommitPending(set->cidr);
+    }
+    SCMutexUnlock(&sets_lock);
+}
+
 static int SaveCallback(void *ctx, const uint8_t *data, const uint32_t data_len)
 {
     FILE *fp = ctx;
@@ -777,6 +1153,18 @@ static int Md5AsAscii(const void *s, char *out, size_t out_size)
     return strlen(out);
 }
 
+static int CidrSaveCallback(
+        void *ctx, int family, const uint8_t *addr, uint8_t netmask, const DataRepType *rep)
+{
+    FILE *fp = ctx;
+    char str[INET6_ADDRSTRLEN];
+    if (inet_ntop(family, addr, str, sizeof(str)) == NULL)
+        return -1;
+    if (fprintf(fp, "%s/%u,%u\n", str, netmask, rep->value) < 0)
+        return -1;
+    return 0;
+}
+
 static int Sha256AsAscii(const void *s, char *out, size_t out_size)
 {
     const Sha256Type *sha = s;
@@ -812,6 +1200,9 @@ void DatasetsSave(void)
             case DATASET_TYPE_SHA256:
                 THashWalk(set->hash, Sha256AsAscii, SaveCallback, fp);
                 break;
+            case DATASET_TYPE_CIDR:
+                (void)DatasetCidrWalk(set->cidr, CidrSaveCallback, fp);
+                break;
         }
 
         fclose(fp);
@@ -954,15 +1345,30 @@ int DatasetLookup(Dataset *set, const uint8_t *data, const uint32_t data_len)
     if (set == NULL)
         return -1;
 
+    if (!DatasetPrefilterLookup(set, data, data_len))
+        return 0;
+
+    if (set->compact != NULL && DatasetCompactLookup(set->compact, data, data_len, NULL) == 1)
+        return 1;
+
+    int r = -1;
     switch (set->type) {
         case DATASET_TYPE_STRING:
-            return DatasetLookupString(set, data, data_len);
+            r = DatasetLookupString(set, data, data_len);
+            break;
         case DATASET_TYPE_MD5:
-            return DatasetLookupMd5(set, data, data_len);
+            r = DatasetLookupMd5(set, data, data_len);
+            break;
         case DATASET_TYPE_SHA256:
-            return DatasetLookupSha256(set, data, data_len);
+            r = DatasetLookupSha256(set, data, data_len);
+            break;
+        case DATASET_TYPE_CIDR:
+            r = DatasetCidrLookup(set->cidr, data, data_len, NULL);
+            break;
     }
-    return -1;
+    if (r == 0)
+        DatasetPrefilterFalsePositive(set, data_len);
+    return r;
 }
 
 DataRepResultType DatasetLookupwRep(Dataset *set, const uint8_t *data, const uint32_t data_len,
@@ -972,14 +1378,32 @@ DataRepResultType DatasetLookupwRep(Dataset *set, const uint8_t *data, const uin
     if (set == NULL)
         return rrep;
 
+    if (!DatasetPrefilterLookup(set, data, data_len))
+        return rrep;
+
+    if (set->compact != NULL &&
+            DatasetCompactLookup(set->compact, data, data_len, &rrep.rep) == 1) {
+        rrep.found = true;
+        return rrep;
+    }
+
     switch (set->type) {
         case DATASET_TYPE_STRING:
-            return DatasetLookupStringwRep(set, data, data_len, rep);
+            rrep = DatasetLookupStringwRep(set, data, data_len, rep);
+            break;
         case DATASET_TYPE_MD5:
-            return DatasetLookupMd5wRep(set, data, data_len, rep);
+            rrep = DatasetLookupMd5wRep(set, data, data_len, rep);
+            break;
         case DATASET_TYPE_SHA256:
-            return DatasetLookupSha256wRep(set, data, data_len, rep);
+            rrep = DatasetLookupSha256wRep(set, data, data_len, rep);
+            break;
+        case DATASET_TYPE_CIDR:
+            if (DatasetCidrLookup(set->cidr, data, data_len, &rrep.rep) == 1)
+                rrep.found = true;
+            break;
     }
+    if (!rrep.found)
+        DatasetPrefilterFalsePositive(set, data_len);
     return rrep;
 }
 
@@ -1098,20 +1522,59 @@ static int DatasetAddSha256(Dataset *set, const uint8_t *data, const uint32_t da
     return -1;
 }
 
+/** \brief add a prefix to a cidr set and update the lookup tables. Updates
+ *         in quick succession are batched into a single rebuild. */
+static int DatasetAddCidr(Dataset *set, int family, const uint8_t *addr, uint8_t netmask,
+        const DataRepType *rep)
+{
+    int r = DatasetCidrAdd(set->cidr, family, addr, netmask, rep);
+    if (r >= 0 && DatasetCidrCommitDeferred(set->cidr) < 0)
+        return -1;
+    return r;
+}
+
+/** \brief add a single address (host prefix) to a cidr set */
+static int DatasetAddCidrHost(
+        Dataset *set, const uint8_t *data, const uint32_t data_len, const DataRepType *rep)
+{
+    if (data_len == 4)
+        return DatasetAddCidr(set, AF_INET, data, 32, rep);
+    if (data_len == 16)
+        return DatasetAddCidr(set, AF_INET6, data, 128, rep);
+    return -2;
+}
+
 int DatasetAdd(Dataset *set, const uint8_t *data, const uint32_t data_len)
 {
     if (set == NULL)
         return -1;
 
+    /* already part of the read-only compact set */
+    if (set->compact != NULL && DatasetCompactLookup(set->compact, data, data_len, NULL) == 1)
+        return 0;
+
+    /* the filter is updated first, so that it never misses data that a
+     * lookup can find in the set */
+    (void)DatasetPrefilterAdd(set, data, data_len);
+
+    int r = -1;
     switch (set->type) {
         case DATASET_TYPE_STRING:
-            return DatasetAddString(set, data, data_len);
+            r = DatasetAddString(set, data, data_len);
+            break;
         case DATASET_TYPE_MD5:
-            return DatasetAddMd5(set, data, data_len);
+            r = DatasetAddMd5(set, data, data_len);
+            break;
         case DATASET_TYPE_SHA256:
-            return DatasetAddSha256(set, data, data_len);
+            r = DatasetAddSha256(set, data, data_len);
+            break;
+        case DATASET_TYPE_CIDR:
+            r = DatasetAddCidrHost(set, data, data_len, NULL);
+            break;
     }
-    return -1;
+    if (r != 1)
+        DatasetPrefilterRemove(set, data, data_len);
+    return r;
 }
 
 static int DatasetAddwRep(Dataset *set, const uint8_t *data, const uint32_t data_len,
@@ -1120,15 +1583,26 @@ static int DatasetAddwRep(Dataset *set, const uint8_t *data, const uint32_t data
     if (set == NULL)
         return -1;
 
+    (void)DatasetPrefilterAdd(set, data, data_len);
+
+    int r = -1;
     switch (set->type) {
         case DATASET_TYPE_STRING:
-            return DatasetAddStringwRep(set, data, data_len, rep);
+            r = DatasetAddStringwRep(set, data, data_len, rep);
+            break;
         case DATASET_TYPE_MD5:
-            return DatasetAddMd5wRep(set, data, data_len, rep);
+            r = DatasetAddMd5wRep(set, data, data_len, rep);
+            break;
         case DATASET_TYPE_SHA256:
-            return DatasetAddSha256wRep(set, data, data_len, rep);
+            r = DatasetAddSha256wRep(set, data, data_len, rep);
+            break;
+        case DATASET_TYPE_CIDR:
+            r = DatasetAddCidrHost(set, data, data_len, rep);
+            break;
     }
-    return -1;
+    if (r != 1)
+        DatasetPrefilterRemove(set, data, data_len);
+    return r;
 }
 
 /** \brief add serialized data to set
@@ -1153,7 +1627,7 @@ int DatasetAddSerialized(Dataset *set, const char *string)
                 return -2;
             }
 
-            return DatasetAddString(set, decoded, num_decoded);
+            return DatasetAdd(set, decoded, num_decoded);
         }
         case DATASET_TYPE_MD5: {
             if (strlen(string) != 32)
@@ -1161,7 +1635,7 @@ int DatasetAddSerialized(Dataset *set, const char *string)
             uint8_t hash[16];
             if (HexToRaw((const uint8_t *)string, 32, hash, sizeof(hash)) < 0)
                 return -2;
-            return DatasetAddMd5(set, hash, 16);
+            return DatasetAdd(set, hash, 16);
         }
         case DATASET_TYPE_SHA256: {
             if (strlen(string) != 64)
@@ -1169,7 +1643,26 @@ int DatasetAddSerialized(Dataset *set, const char *string)
             uint8_t hash[32];
             if (HexToRaw((const uint8_t *)string, 64, hash, sizeof(hash)) < 0)
                 return -2;
-            return DatasetAddSha256(set, hash, 32);
+            return DatasetAdd(set, hash, 32);
+        }
+        case DATASET_TYPE_CIDR: {
+            /* "addr[/netmask][,rep]" */
+            char buf[128];
+            if (strlcpy(buf, string, sizeof(buf)) >= sizeof(buf))
+                return -2;
+            DataRepType rep = { .value = 0 };
+            char *r = strchr(buf, ',');
+            if (r != NULL) {
+                *r++ = '\0';
+                if (ParseRepLine(r, strlen(r), &rep) < 0)
+                    return -2;
+            }
+            int family;
+            uint8_t addr[16];
+            uint8_t netmask;
+            if (DatasetCidrParse(buf, &family, addr, &netmask) < 0)
+                return -2;
+            return DatasetAddCidr(set, family, addr, netmask, &rep);
         }
     }
     return -1;
@@ -1216,6 +1709,33 @@ static int DatasetRemoveSha256(Dataset *set, const uint8_t *data, const uint32_t
     return THashRemoveFromHash(set->hash, &lookup);
 }
 
+static int DatasetRemove(Dataset *set, const uint8_t *data, const uint32_t data_len)
+{
+    /* entries of the compact set are read-only */
+    if (set->compact != NULL && DatasetCompactLookup(set->compact, data, data_len, NULL) == 1)
+        return -1;
+
+    int r = -1;
+    switch (set->type) {
+        case DATASET_TYPE_STRING:
+            r = DatasetRemoveString(set, data, data_len);
+            break;
+        case DATASET_TYPE_MD5:
+            r = DatasetRemoveMd5(set, data, data_len);
+            break;
+        case DATASET_TYPE_SHA256:
+            r = DatasetRemoveSha256(set, data, data_len);
+            break;
+        case DATASET_TYPE_CIDR:
+            /* prefixes are removed through DatasetRemoveSerialized */
+            break;
+    }
+    /* after the removal from the set, see DatasetAdd */
+    if (r == 1)
+        DatasetPrefilterRemove(set, data, data_len);
+    return r;
+}
+
 /** \brief remove serialized data from set
  *  \retval int 1 removed
  *  \retval int 0 found but busy (not removed)
@@ -1237,7 +1757,7 @@ int DatasetRemoveSerialized(Dataset *set, const char *string)
                 return -2;
             }
 
-            return DatasetRemoveString(set, decoded, num_decoded);
+            return DatasetRemove(set, decoded, num_decoded);
         }
         case DATASET_TYPE_MD5: {
             if (strlen(string) != 32)
@@ -1245,7 +1765,7 @@ int DatasetRemoveSerialized(Dataset *set, const char *string)
             uint8_t hash[16];
             if (HexToRaw((const uint8_t *)string, 32, hash, sizeof(hash)) < 0)
                 return -2;
-            return DatasetRemoveMd5(set, hash, 16);
+            return DatasetRemove(set, hash, 16);
         }
         case DATASET_TYPE_SHA256: {
             if (strlen(string) != 64)
@@ -1253,8 +1773,112 @@ int DatasetRemoveSerialized(Dataset *set, const char *string)
             uint8_t hash[32];
             if (HexToRaw((const uint8_t *)string, 64, hash, sizeof(hash)) < 0)
                 return -2;
-            return DatasetRemoveSha256(set, hash, 32);
+            return DatasetRemove(set, hash, 32);
+        }
+        case DATASET_TYPE_CIDR: {
+            int family;
+            uint8_t addr[16];
+            uint8_t netmask;
+            if (DatasetCidrParse(string, &family, addr, &netmask) < 0)
+                return -2;
+            if (DatasetCidrRemove(set->cidr, family, addr, netmask) < 0)
+                return -1;
+            if (DatasetCidrCommitDeferred(set->cidr) < 0)
+                return -1;
+            return 1;
         }
     }
     return -1;
 }
+
+#ifdef UNITTESTS
+static DatasetPrefilter *DatasetPrefilterTestNew(uint32_t size)
+{
+    DatasetPrefilter *pf = SCCalloc(1, sizeof(*pf));
+    if (pf == NULL)
+        return NULL;
+    pf->size = size;
+    pf->counters = SCCalloc(size, sizeof(DatasetPrefilterCounter));
+    if (pf->counters == NULL) {
+        SCFree(pf);
+        return NULL;
+    }
+    return pf;
+}
+
+static void DatasetPrefilterTestFree(DatasetPrefilter *pf)
+{
+    SCFree(pf->counters);
+    SCFree(pf);
+}
+
+/** \test add, lookup and remove */
+static int DatasetPrefilterTest01(void)
+{
+    DatasetPrefilter *pf = DatasetPrefilterTestNew(1024);
+    FAIL_IF_NULL(pf);
+
+    const uint8_t a[] = "suricata.io";
+    const uint8_t b[] = "example.com";
+    FAIL_IF(DatasetPrefilterTest(pf, a, sizeof(a) - 1));
+
+    DatasetPrefilterIncr(pf, a, sizeof(a) - 1);
+    FAIL_IF_NOT(DatasetPrefilterTest(pf, a, sizeof(a) - 1));
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < pf->size; i++)
+        sum += SC_ATOMIC_GET(pf->counters[i].cnt);
+    FAIL_IF_NOT(sum == DATASET_PREFILTER_HASHES);
+
+    /* added twice, still there after one remove */
+    DatasetPrefilterIncr(pf, a, sizeof(a) - 1);
+    DatasetPrefilterIncr(pf, b, sizeof(b) - 1);
+    DatasetPrefilterDecr(pf, a, sizeof(a) - 1);
+    FAIL_IF_NOT(DatasetPrefilterTest(pf, a, sizeof(a) - 1));
+    FAIL_IF_NOT(DatasetPrefilterTest(pf, b, sizeof(b) - 1));
+
+    DatasetPrefilterDecr(pf, a, sizeof(a) - 1);
+    DatasetPrefilterDecr(pf, b, sizeof(b) - 1);
+    for (uint32_t i = 0; i < pf->size; i++)
+        FAIL_IF_NOT(SC_ATOMIC_GET(pf->counters[i].cnt) == 0);
+    FAIL_IF(DatasetPrefilterTest(pf, a, sizeof(a) - 1));
+    FAIL_IF(DatasetPrefilterTest(pf, b, sizeof(b) - 1));
+
+    DatasetPrefilterTestFree(pf);
+    PASS;
+}
+
+/** \test no false negatives when the filter is loaded, and removing half of
+ *        the data keeps the other half */
+static int DatasetPrefilterTest02(void)
+{
+    DatasetPrefilter *pf = DatasetPrefilterTestNew(16384);
+    FAIL_IF_NULL(pf);
+
+    for (uint32_t i = 0; i < 4096; i++)
+        DatasetPrefilterIncr(pf, (const uint8_t *)&i, sizeof(i));
+    for (uint32_t i = 0; i < 4096; i++)
+        FAIL_IF_NOT(DatasetPrefilterTest(pf, (const uint8_t *)&i, sizeof(i)));
+
+    for (uint32_t i = 0; i < 4096; i += 2)
+        DatasetPrefilterDecr(pf, (const uint8_t *)&i, sizeof(i));
+    for (uint32_t i = 1; i < 4096; i += 2)
+        FAIL_IF_NOT(DatasetPrefilterTest(pf, (const uint8_t *)&i, sizeof(i)));
+
+    /* data never added mostly misses */
+    uint32_t hits = 0;
+    for (uint32_t i = 4096; i < 8192; i++)
+        hits += DatasetPrefilterTest(pf, (const uint8_t *)&i, sizeof(i));
+    FAIL_IF_NOT(hits < 4096 / 10);
+
+    DatasetPrefilterTestFree(pf);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void DatasetRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DatasetPrefilterTest01", DatasetPrefilterTest01);
+    UtRegisterTest("DatasetPrefilterTest02", DatasetPrefilterTest02);
+#endif /* UNITTESTS */
+}
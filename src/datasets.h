@@ -32,8 +32,38 @@ enum DatasetTypes {
     DATASET_TYPE_STRING = 1,
     DATASET_TYPE_MD5,
     DATASET_TYPE_SHA256,
+    DATASET_TYPE_CIDR,
 };
 
+/** prefilter counters are sharded over this many cache lines to avoid all
+ *  worker threads updating the same one. */
+#define DATASET_PREFILTER_STATS_SLOTS 16
+/** default prefilter memory size in bytes */
+#define DATASET_PREFILTER_DEFAULT_SIZE (1024 * 1024)
+
+typedef struct DatasetPrefilterStats_ {
+    SC_ATOMIC_DECLARE(uint64_t, skipped);         /**< lookups answered by the filter */
+    SC_ATOMIC_DECLARE(uint64_t, false_positives); /**< filter hit, set miss */
+} __attribute__((aligned(CLS))) DatasetPrefilterStats;
+
+/** counter of the prefilter. Lookups run concurrently with adds and
+ *  removes, so all access is atomic. */
+typedef struct DatasetPrefilterCounter_ {
+    SC_ATOMIC_DECLARE(uint16_t, cnt);
+} DatasetPrefilterCounter;
+
+/** prefilter: array of 16 bit counters. Data in the set increments the
+ *  counters at a few indexes derived from its hash. */
+typedef struct DatasetPrefilter_ {
+    uint32_t size; /**< number of counters */
+    DatasetPrefilterCounter *counters;
+} DatasetPrefilter;
+
+typedef struct DatasetPrefilterStatsResult_ {
+    uint64_t skipped;
+    uint64_t false_positives;
+} DatasetPrefilterStatsResult;
+
 #define DATASET_NAME_MAX_LEN 63
 typedef struct Dataset {
     char name[DATASET_NAME_MAX_LEN + 1];
@@ -42,6 +72,13 @@ typedef struct Dataset {
     bool from_yaml;                     /* Mark whether the set was retrieved from YAML */
     bool hidden;                        /* Mark the old sets hidden in case of reload */
     THashTableContext *hash;
+    struct DatasetCompact_ *compact;    /* read-only mmap'd set, if loaded from compact file */
+    struct DatasetCidr_ *cidr;          /* prefixes of a 'cidr' set, which has no hash */
+
+    /* optional prefilter consulted before the set itself, so
+     * that most misses don't need to hash and lock the THash. */
+    DatasetPrefilter *prefilter;
+    DatasetPrefilterStats *prefilter_stats;
 
     char load[PATH_MAX];
     char save[PATH_MAX];
@@ -50,6 +87,7 @@ typedef struct Dataset {
 } Dataset;
 
 enum DatasetTypes DatasetGetTypeFromString(const char *s);
+const char *DatasetGetTypeString(enum DatasetTypes type);
 Dataset *DatasetFind(const char *name, enum DatasetTypes type);
 Dataset *DatasetGet(const char *name, enum DatasetTypes type, const char *save, const char *load,
         uint64_t memcap, uint32_t hashsize);
@@ -58,7 +96,13 @@ int DatasetLookup(Dataset *set, const uint8_t *data, const uint32_t data_len);
 DataRepResultType DatasetLookupwRep(Dataset *set, const uint8_t *data, const uint32_t data_len,
         const DataRepType *rep);
 
+void DatasetGetPrefilterStats(const Dataset *set, DatasetPrefilterStatsResult *res);
+void DatasetsWalk(void (*Func)(const Dataset *set, void *ctx), void *ctx);
+void DatasetsCommitPending(void);
+
 int DatasetAddSerialized(Dataset *set, const char *string);
 int DatasetRemoveSerialized(Dataset *set, const char *string);
 
+void DatasetRegisterTests(void);
+
 #endif /* __DATASETS_H__ */
@@ -580,6 +580,10 @@ const struct DecodeEvents_ DEvents[] = {
             "decoder.nsh.unknown_payload",
             NSH_UNKNOWN_PAYLOAD,
     },
+    {
+            "decoder.tunnel_invalid",
+            GENERIC_TUNNEL_INVALID,
+    },
     {
             "decoder.too_many_layers",
             GENERIC_TOO_MANY_LAYERS,
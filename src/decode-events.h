@@ -217,6 +217,7 @@ enum {
     NSH_UNKNOWN_PAYLOAD,
 
     /* generic events */
+    GENERIC_TUNNEL_INVALID, /**< inner packet of an in place decoded tunnel is invalid */
     GENERIC_TOO_MANY_LAYERS,
 
     /* END OF DECODE EVENTS ON SINGLE PACKET */
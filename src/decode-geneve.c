@@ -252,13 +252,8 @@ int DecodeGeneve(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, const uint8_t
 
     /* Set-up and process inner packet if it is a supported ethertype */
     if (decode_tunnel_proto != DECODE_TUNNEL_UNSET) {
-        Packet *tp = PacketTunnelPktSetup(
-                tv, dtv, p, pkt + geneve_hdr_len, len - geneve_hdr_len, decode_tunnel_proto);
-
-        if (tp != NULL) {
-            PKT_SET_SRC(tp, PKT_SRC_DECODER_GENEVE);
-            PacketEnqueueNoLock(&tv->decode_pq, tp);
-        }
+        PacketTunnelDecode(tv, dtv, p, pkt + geneve_hdr_len, len - geneve_hdr_len,
+                decode_tunnel_proto, PKT_SRC_DECODER_GENEVE);
     }
 
     return TM_ECODE_OK;
@@ -490,6 +485,91 @@ static int DecodeGeneveTest05(void)
     PacketFree(p);
     PASS;
 }
+
+static int DecodeGeneveTest06(void)
+{
+    uint8_t raw_geneve[] = {
+        0x32, 0x10, 0x17, 0xc1, 0x00, 0x3c, 0x87, 0x51,             /* UDP header */
+        0x04, 0x00, 0x08, 0x00, 0x00, 0x00, 0x25, 0x00,             /* Geneve fixed header */
+        0x01, 0x08, 0x00, 0x01, 0x11, 0x11, 0x11, 0x11,             /* Geneve variable options */
+        0x01, 0x08, 0x00, 0x01, 0x11, 0x11, 0x11, 0x11,             /* Geneve variable options */
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00, 0x40, 0x11, /* IPv4 hdr */
+        0x44, 0x45, 0x0a, 0x60, 0x00, 0x0a, 0xb9, 0x1b, 0x73, 0x06, 0x00, 0x35, 0x30, 0x39, 0x00,
+        0x08, 0x98, 0xe4 /* UDP probe src port 53 */
+    };
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+
+    DecodeGeneveConfigPorts(GENEVE_DEFAULT_PORT_S);
+    decoder_tunnel_inplace = true;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+
+    FlowInitConfig(FLOW_QUIET);
+    DecodeUDP(&tv, &dtv, p, raw_geneve, sizeof(raw_geneve));
+
+    /* no pseudo packet, p holds the inner packet */
+    FAIL_IF(tv.decode_pq.top != NULL);
+    FAIL_IF_NOT(p->flags & PKT_TUNNEL_INPLACE);
+    FAIL_IF_NULL(p->ip4h);
+    FAIL_IF(p->udph != (UDPHdr *)(raw_geneve + 52));
+    FAIL_IF_NOT(p->sp == 53);
+    FAIL_IF_NOT(p->recursion_level == 1);
+    FAIL_IF_NOT(p->tunnel_outer.sp == 0x3210);
+    FAIL_IF_NOT(p->tunnel_outer.dp == GENEVE_DEFAULT_PORT);
+    FAIL_IF_NOT(p->tunnel_outer.proto == IPPROTO_UDP);
+
+    decoder_tunnel_inplace = false;
+    FlowShutdown();
+    PacketFree(p);
+    PASS;
+}
+
+static int DecodeGeneveTest07(void)
+{
+    uint8_t raw_geneve[] = {
+        0x32, 0x10, 0x17, 0xc1, 0x00, 0x34, 0x87, 0x51,             /* UDP header */
+        0x04, 0x00, 0x08, 0x00, 0x00, 0x00, 0x25, 0x00,             /* Geneve fixed header */
+        0x01, 0x08, 0x00, 0x01, 0x11, 0x11, 0x11, 0x11,             /* Geneve variable options */
+        0x01, 0x08, 0x00, 0x01, 0x11, 0x11, 0x11, 0x11,             /* Geneve variable options */
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00, 0x40, 0x11, /* IPv4 hdr */
+        0x44, 0x45, 0x0a, 0x60, 0x00, 0x0a, 0xb9, 0x1b, 0x73, 0x06  /* truncated */
+    };
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+
+    DecodeGeneveConfigPorts(GENEVE_DEFAULT_PORT_S);
+    decoder_tunnel_inplace = true;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+
+    FlowInitConfig(FLOW_QUIET);
+    DecodeUDP(&tv, &dtv, p, raw_geneve, sizeof(raw_geneve));
+
+    /* the outer packet is kept */
+    FAIL_IF(tv.decode_pq.top != NULL);
+    FAIL_IF(p->flags & PKT_TUNNEL_INPLACE);
+    FAIL_IF_NOT_NULL(p->ip4h);
+    FAIL_IF(p->udph != (UDPHdr *)raw_geneve);
+    FAIL_IF_NOT(p->sp == 0x3210);
+    FAIL_IF_NOT(p->dp == GENEVE_DEFAULT_PORT);
+    FAIL_IF_NOT(p->proto == IPPROTO_UDP);
+    FAIL_IF_NOT(p->recursion_level == 0);
+    FAIL_IF_NOT(ENGINE_ISSET_EVENT(p, GENERIC_TUNNEL_INVALID));
+
+    decoder_tunnel_inplace = false;
+    FlowShutdown();
+    PacketFree(p);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 void DecodeGeneveRegisterTests(void)
@@ -500,5 +580,7 @@ void DecodeGeneveRegisterTests(void)
     UtRegisterTest("DecodeGeneveTest03 -- VLAN+IPv4 DNS Request", DecodeGeneveTest03);
     UtRegisterTest("DecodeGeneveTest04 -- Non-standard port configuration", DecodeGeneveTest04);
     UtRegisterTest("DecodeGeneveTest05 -- Inconsistent Geneve hdr option lens", DecodeGeneveTest05);
+    UtRegisterTest("DecodeGeneveTest06 -- IPv4 DNS Request in place", DecodeGeneveTest06);
+    UtRegisterTest("DecodeGeneveTest07 -- Truncated IPv4 in place", DecodeGeneveTest07);
 #endif /* UNITTESTS */
 }
@@ -35,6 +35,7 @@
 #include "decode.h"
 #include "decode-events.h"
 #include "decode-gre.h"
+#include "flow.h"
 
 #include "util-validate.h"
 #include "util-unittest.h"
@@ -206,12 +207,8 @@ int DecodeGRE(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, const uint8_t *p
     {
         case ETHERNET_TYPE_IP:
         {
-            Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                    len - header_len, DECODE_TUNNEL_IPV4);
-            if (tp != NULL) {
-                PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                PacketEnqueueNoLock(&tv->decode_pq,tp);
-            }
+            PacketTunnelDecode(tv, dtv, p, pkt + header_len, len - header_len, DECODE_TUNNEL_IPV4,
+                    PKT_SRC_DECODER_GRE);
             break;
         }
 
@@ -220,34 +217,22 @@ int DecodeGRE(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, const uint8_t *p
             if (gre_pptp_h && !gre_pptp_h->payload_length)
                 return TM_ECODE_OK;
 
-            Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                    len - header_len, DECODE_TUNNEL_PPP);
-            if (tp != NULL) {
-                PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                PacketEnqueueNoLock(&tv->decode_pq,tp);
-            }
+            PacketTunnelDecode(tv, dtv, p, pkt + header_len, len - header_len, DECODE_TUNNEL_PPP,
+                    PKT_SRC_DECODER_GRE);
             break;
         }
 
         case ETHERNET_TYPE_IPV6:
         {
-            Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                    len - header_len, DECODE_TUNNEL_IPV6);
-            if (tp != NULL) {
-                PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                PacketEnqueueNoLock(&tv->decode_pq,tp);
-            }
+            PacketTunnelDecode(tv, dtv, p, pkt + header_len, len - header_len, DECODE_TUNNEL_IPV6,
+                    PKT_SRC_DECODER_GRE);
             break;
         }
 
         case ETHERNET_TYPE_VLAN:
         {
-            Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                    len - header_len, DECODE_TUNNEL_VLAN);
-            if (tp != NULL) {
-                PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                PacketEnqueueNoLock(&tv->decode_pq,tp);
-            }
+            PacketTunnelDecode(tv, dtv, p, pkt + header_len, len - header_len, DECODE_TUNNEL_VLAN,
+                    PKT_SRC_DECODER_GRE);
             break;
         }
 
@@ -257,26 +242,18 @@ int DecodeGRE(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, const uint8_t *p
             // Type I:  0|0|0|0|0|00000|000000000|00000
             // Type II: 0|0|0|1|0|00000|000000000|00000
             //                Seq
-            Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                    len - header_len,
+            PacketTunnelDecode(tv, dtv, p, pkt + header_len, len - header_len,
                     GRE_FLAG_ISSET_SQ(p->greh) == 0 ?
                             DECODE_TUNNEL_ERSPANI :
-                            DECODE_TUNNEL_ERSPANII);
-            if (tp != NULL) {
-                PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                PacketEnqueueNoLock(&tv->decode_pq,tp);
-            }
+                            DECODE_TUNNEL_ERSPANII,
+                    PKT_SRC_DECODER_GRE);
             break;
         }
 
         case ETHERNET_TYPE_BRIDGE:
         {
-            Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + header_len,
-                    len - header_len, DECODE_TUNNEL_ETHERNET);
-            if (tp != NULL) {
-                PKT_SET_SRC(tp, PKT_SRC_DECODER_GRE);
-                PacketEnqueueNoLock(&tv->decode_pq,tp);
-            }
+            PacketTunnelDecode(tv, dtv, p, pkt + header_len, len - header_len,
+                    DECODE_TUNNEL_ETHERNET, PKT_SRC_DECODER_GRE);
             break;
         }
 
@@ -382,6 +359,90 @@ static int DecodeGREtest03 (void)
     SCFree(p);
     PASS;
 }
+
+/**
+ * \test DecodeGREtest04 tests decoding the inner packet in place
+ */
+static int DecodeGREtest04 (void)
+{
+    uint8_t raw_ip_gre[] = {
+        0x45, 0x00, 0x00, 0x34, 0x00, 0x01, 0x00, 0x00, 0x40, 0x2f,
+        0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02, /* IPv4 hdr */
+        0x00, 0x00, 0x08, 0x00, /* GRE hdr, IPv4 */
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00, 0x40, 0x11,
+        0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, 0xc0, 0xa8, 0x01, 0x02, /* inner IPv4 hdr */
+        0x00, 0x35, 0x30, 0x39, 0x00, 0x08, 0x00, 0x00 /* inner UDP src port 53 */
+    };
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    decoder_tunnel_inplace = true;
+
+    FlowInitConfig(FLOW_QUIET);
+    DecodeIPV4(&tv, &dtv, p, raw_ip_gre, sizeof(raw_ip_gre));
+
+    FAIL_IF(tv.decode_pq.top != NULL);
+    FAIL_IF_NOT(p->flags & PKT_TUNNEL_INPLACE);
+    FAIL_IF_NOT(p->recursion_level == 1);
+    FAIL_IF_NULL(p->udph);
+    FAIL_IF_NOT(p->proto == IPPROTO_UDP);
+    FAIL_IF_NOT(p->sp == 53);
+    FAIL_IF_NOT(GET_IPV4_SRC_ADDR_U32(p) == htonl(0xc0a80101));
+    FAIL_IF_NOT(p->tunnel_outer.proto == IPPROTO_GRE);
+    FAIL_IF_NOT(p->tunnel_outer.src.addr_data32[0] == htonl(0x0a000001));
+    FAIL_IF(ENGINE_ISSET_EVENT(p, GENERIC_TUNNEL_INVALID));
+
+    decoder_tunnel_inplace = false;
+    FlowShutdown();
+    PacketFree(p);
+    PASS;
+}
+
+/**
+ * \test DecodeGREtest05 tests that the outer packet is kept if the inner
+ *       packet of an in place decoded tunnel is invalid
+ */
+static int DecodeGREtest05 (void)
+{
+    uint8_t raw_ip_gre[] = {
+        0x45, 0x00, 0x00, 0x2c, 0x00, 0x01, 0x00, 0x00, 0x40, 0x2f,
+        0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02, /* IPv4 hdr */
+        0x00, 0x00, 0x08, 0x00, /* GRE hdr, IPv4 */
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00, 0x40, 0x11,
+        0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, 0xc0, 0xa8, 0x01, 0x02 /* truncated inner IPv4 */
+    };
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    decoder_tunnel_inplace = true;
+
+    FlowInitConfig(FLOW_QUIET);
+    DecodeIPV4(&tv, &dtv, p, raw_ip_gre, sizeof(raw_ip_gre));
+
+    FAIL_IF(tv.decode_pq.top != NULL);
+    FAIL_IF(p->flags & PKT_TUNNEL_INPLACE);
+    FAIL_IF(p->flags & PKT_IS_INVALID);
+    FAIL_IF_NOT(p->recursion_level == 0);
+    FAIL_IF_NOT(p->proto == IPPROTO_GRE);
+    FAIL_IF_NOT(p->ip4h == (IPV4Hdr *)raw_ip_gre);
+    FAIL_IF_NOT(p->greh == (GREHdr *)(raw_ip_gre + 20));
+    FAIL_IF_NOT(GET_IPV4_SRC_ADDR_U32(p) == htonl(0x0a000001));
+    FAIL_IF_NOT(GET_IPV4_DST_ADDR_U32(p) == htonl(0x0a000002));
+    FAIL_IF_NOT(ENGINE_ISSET_EVENT(p, GENERIC_TUNNEL_INVALID));
+
+    decoder_tunnel_inplace = false;
+    FlowShutdown();
+    PacketFree(p);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -394,6 +455,8 @@ void DecodeGRERegisterTests(void)
     UtRegisterTest("DecodeGREtest01", DecodeGREtest01);
     UtRegisterTest("DecodeGREtest02", DecodeGREtest02);
     UtRegisterTest("DecodeGREtest03", DecodeGREtest03);
+    UtRegisterTest("DecodeGREtest04", DecodeGREtest04);
+    UtRegisterTest("DecodeGREtest05", DecodeGREtest05);
 #endif /* UNITTESTS */
 }
 /**
@@ -532,6 +532,11 @@ int DecodeIPV4(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
     }
     p->proto = IPV4_GET_IPPROTO(p);
 
+    if (p->capture_flags & PKT_CAPTURE_IPV4_CSUM_OK) {
+        p->level3_comp_csum = 0;
+        StatsIncr(tv, dtv->counter_ipv4_csum_offload);
+    }
+
     /* If a fragment, pass off for re-assembly. */
     if (unlikely(IPV4_GET_IPOFFSET(p) > 0 || IPV4_GET_MF(p) == 1)) {
         Packet *rp = Defrag(tv, dtv, p);
@@ -1321,7 +1326,7 @@ static int DecodeIPV4DefragTest01(void)
     }
 
     PACKET_RECYCLE(tp);
-    SCFree(tp);
+    PacketFree(tp);
 
 end:
     DefragDestroy();
@@ -1451,7 +1456,7 @@ static int DecodeIPV4DefragTest02(void)
 
     result = 1;
     PACKET_RECYCLE(tp);
-    SCFree(tp);
+    PacketFree(tp);
 
 end:
     DefragDestroy();
@@ -1606,7 +1611,7 @@ static int DecodeIPV4DefragTest03(void)
     }
 
     PACKET_RECYCLE(tp);
-    SCFree(tp);
+    PacketFree(tp);
 
 end:
     DefragDestroy();
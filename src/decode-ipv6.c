@@ -576,6 +576,7 @@ int DecodeIPV6(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, const uint8_t *
     if (!PacketIncreaseCheckLayers(p)) {
         return TM_ECODE_FAILED;
     }
+    const uint8_t recursion_level = p->recursion_level;
     /* do the actual decoding */
     int ret = DecodeIPV6Packet (tv, dtv, p, pkt, len);
     if (unlikely(ret < 0)) {
@@ -643,6 +644,10 @@ int DecodeIPV6(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, const uint8_t *
             IPV6_SET_L4PROTO (p, IPV6_GET_NH(p));
             break;
     }
+    /* a tunnel was decoded in place, p is now the inner packet */
+    if (unlikely(p->recursion_level != recursion_level))
+        return TM_ECODE_OK;
+
     p->proto = IPV6_GET_L4PROTO (p);
 
     /* Pass to defragger if a fragment. */
@@ -816,7 +821,7 @@ end:
     pkt = PacketDequeueNoLock(&tv.decode_pq);
     while (pkt != NULL) {
         PACKET_RECYCLE(pkt);
-        SCFree(pkt);
+        PacketFree(pkt);
         pkt = PacketDequeueNoLock(&tv.decode_pq);
     }
     DefragDestroy();
@@ -41,13 +41,106 @@
 #include "util-profiling.h"
 #include "pkt-var.h"
 #include "host.h"
+#ifdef UNITTESTS
+#include "util-cpu.h"
+#include "util-byte.h"
+#endif
 
 #define SET_OPTS(dst, src) \
     (dst).type = (src).type; \
     (dst).len  = (src).len; \
     (dst).data = (src).data
 
-static void DecodeTCPOptions(Packet *p, const uint8_t *pkt, uint16_t pktlen)
+#define SET_OPT(dst, opt)                                                                          \
+    (dst).type = (opt)[0];                                                                         \
+    (dst).len = (opt)[1];                                                                          \
+    (dst).data = (opt) + 2
+
+/** options layout of most ACK packets: NOP NOP TS */
+#define TCP_OPT_LAYOUT_TS_LEN 12
+static const uint8_t tcp_opt_layout_ts[TCP_OPT_LAYOUT_TS_LEN] = {
+    TCP_OPT_NOP, TCP_OPT_NOP, TCP_OPT_TS, TCP_OPT_TS_LEN, 0, 0, 0, 0, 0, 0, 0, 0
+};
+static const uint8_t tcp_opt_layout_ts_mask[TCP_OPT_LAYOUT_TS_LEN] = {
+    0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/** options layout of most SYN and SYN/ACK packets: MSS SACKOK TS NOP WS */
+#define TCP_OPT_LAYOUT_SYN_LEN 20
+static const uint8_t tcp_opt_layout_syn[TCP_OPT_LAYOUT_SYN_LEN] = {
+    TCP_OPT_MSS, TCP_OPT_MSS_LEN, 0, 0,
+    TCP_OPT_SACKOK, TCP_OPT_SACKOK_LEN,
+    TCP_OPT_TS, TCP_OPT_TS_LEN, 0, 0, 0, 0, 0, 0, 0, 0,
+    TCP_OPT_NOP,
+    TCP_OPT_WS, TCP_OPT_WS_LEN, 0
+};
+static const uint8_t tcp_opt_layout_syn_mask[TCP_OPT_LAYOUT_SYN_LEN] = {
+    0xff, 0xff, 0, 0,
+    0xff, 0xff,
+    0xff, 0xff, 0, 0, 0, 0, 0, 0, 0, 0,
+    0xff,
+    0xff, 0xff, 0
+};
+
+/** \internal
+ *  \brief compare the options to a layout, ignoring the option values
+ *
+ *  \param len multiple of 4
+ */
+static inline bool DecodeTCPOptionsLayoutMatch(
+        const uint8_t *pkt, const uint8_t *layout, const uint8_t *mask, const uint16_t len)
+{
+    uint32_t diff = 0;
+    for (uint16_t i = 0; i < len; i += 4) {
+        uint32_t d, l, m;
+        memcpy(&d, pkt + i, sizeof(d));
+        memcpy(&l, layout + i, sizeof(l));
+        memcpy(&m, mask + i, sizeof(m));
+        diff |= (d & m) ^ l;
+    }
+    return diff == 0;
+}
+
+static inline void DecodeTCPOptionTimestamp(Packet *p, const uint8_t *data)
+{
+    uint32_t values[2];
+    memcpy(&values, data, sizeof(values));
+    p->tcpvars.ts_val = SCNtohl(values[0]);
+    p->tcpvars.ts_ecr = SCNtohl(values[1]);
+    p->tcpvars.ts_set = true;
+}
+
+/** \internal
+ *  \brief decode the options if they are in one of the common layouts
+ *
+ *  The layouts have valid lengths and no duplicates, so no events are set.
+ *
+ *  \retval true options decoded
+ *  \retval false options need the generic parser
+ */
+static inline bool DecodeTCPOptionsCommon(Packet *p, const uint8_t *pkt, uint16_t pktlen)
+{
+    if (pktlen == TCP_OPT_LAYOUT_TS_LEN) {
+        if (DecodeTCPOptionsLayoutMatch(
+                    pkt, tcp_opt_layout_ts, tcp_opt_layout_ts_mask, TCP_OPT_LAYOUT_TS_LEN)) {
+            DecodeTCPOptionTimestamp(p, pkt + 4);
+            return true;
+        }
+    } else if (pktlen == TCP_OPT_LAYOUT_SYN_LEN) {
+        if (DecodeTCPOptionsLayoutMatch(
+                    pkt, tcp_opt_layout_syn, tcp_opt_layout_syn_mask, TCP_OPT_LAYOUT_SYN_LEN)) {
+            SET_OPT(p->tcpvars.mss, pkt);
+            SET_OPT(p->tcpvars.sackok, pkt + 4);
+            p->tcpvars.sackok.data = NULL;
+            DecodeTCPOptionTimestamp(p, pkt + 8);
+            SET_OPT(p->tcpvars.ws, pkt + 17);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void DecodeTCPOptionsGeneric(Packet *p, const uint8_t *pkt, uint16_t pktlen)
 {
     uint8_t tcp_opt_cnt = 0;
     TCPOpt tcp_opts[TCP_OPTMAX];
@@ -128,11 +221,7 @@ static void DecodeTCPOptions(Packet *p, const uint8_t *pkt, uint16_t pktlen)
                         if (p->tcpvars.ts_set) {
                             ENGINE_SET_EVENT(p,TCP_OPT_DUPLICATE);
                         } else {
-                            uint32_t values[2];
-                            memcpy(&values, tcp_opts[tcp_opt_cnt].data, sizeof(values));
-                            p->tcpvars.ts_val = SCNtohl(values[0]);
-                            p->tcpvars.ts_ecr = SCNtohl(values[1]);
-                            p->tcpvars.ts_set = true;
+                            DecodeTCPOptionTimestamp(p, tcp_opts[tcp_opt_cnt].data);
                         }
                     }
                     break;
@@ -212,6 +301,13 @@ static void DecodeTCPOptions(Packet *p, const uint8_t *pkt, uint16_t pktlen)
     }
 }
 
+static void DecodeTCPOptions(Packet *p, const uint8_t *pkt, uint16_t pktlen)
+{
+    if (likely(DecodeTCPOptionsCommon(p, pkt, pktlen)))
+        return;
+    DecodeTCPOptionsGeneric(p, pkt, pktlen);
+}
+
 static int DecodeTCPPacket(ThreadVars *tv, Packet *p, const uint8_t *pkt, uint16_t len)
 {
     if (unlikely(len < TCP_HEADER_LEN)) {
@@ -259,6 +355,13 @@ int DecodeTCP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
         return TM_ECODE_FAILED;
     }
 
+    /* checksum validated by the NIC, so the stream engine doesn't
+     * compute it */
+    if (p->capture_flags & PKT_CAPTURE_L4_CSUM_OK) {
+        p->level4_comp_csum = 0;
+        StatsIncr(tv, dtv->counter_tcp_csum_offload);
+    }
+
 #ifdef DEBUG
     SCLogDebug("TCP sp: %" PRIu32 " -> dp: %" PRIu32 " - HLEN: %" PRIu32 " LEN: %" PRIu32 " %s%s%s%s%s%s",
         GET_TCP_SRC_PORT(p), GET_TCP_DST_PORT(p), TCP_GET_HLEN(p), len,
@@ -565,6 +668,181 @@ end:
     SCFree(p);
     return retval;
 }
+
+/** \test common options layouts decode the same as with the generic parser */
+static int TCPOptionsCommonTest01(void)
+{
+    static const uint8_t opts_ts[] = { 0x01, 0x01, 0x08, 0x0a, 0x00, 0x62, 0x88, 0x28, 0x00, 0x00,
+        0x12, 0x34 };
+    static const uint8_t opts_syn[] = { 0x02, 0x04, 0x05, 0xb4, 0x04, 0x02, 0x08, 0x0a, 0x00, 0x62,
+        0x88, 0x28, 0x00, 0x00, 0x12, 0x34, 0x01, 0x03, 0x03, 0x07 };
+    /* SYN layout with a bad WS len */
+    static const uint8_t opts_bad[] = { 0x02, 0x04, 0x05, 0xb4, 0x04, 0x02, 0x08, 0x0a, 0x00, 0x62,
+        0x88, 0x28, 0x00, 0x00, 0x12, 0x34, 0x01, 0x03, 0x04, 0x07 };
+
+    Packet *p1 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p1);
+    Packet *p2 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p2);
+
+    FAIL_IF_NOT(DecodeTCPOptionsCommon(p1, opts_ts, sizeof(opts_ts)));
+    DecodeTCPOptionsGeneric(p2, opts_ts, sizeof(opts_ts));
+    FAIL_IF(memcmp(&p1->tcpvars, &p2->tcpvars, sizeof(TCPVars)) != 0);
+    FAIL_IF_NOT(p1->tcpvars.ts_set);
+    FAIL_IF_NOT(p1->tcpvars.ts_val == 0x00628828);
+    FAIL_IF_NOT(p1->tcpvars.ts_ecr == 0x00001234);
+    PACKET_RECYCLE(p1);
+    PACKET_RECYCLE(p2);
+
+    FAIL_IF_NOT(DecodeTCPOptionsCommon(p1, opts_syn, sizeof(opts_syn)));
+    DecodeTCPOptionsGeneric(p2, opts_syn, sizeof(opts_syn));
+    FAIL_IF(memcmp(&p1->tcpvars, &p2->tcpvars, sizeof(TCPVars)) != 0);
+    FAIL_IF_NOT(p1->tcpvars.mss.type == TCP_OPT_MSS);
+    FAIL_IF_NOT(p1->tcpvars.sackok.type == TCP_OPT_SACKOK);
+    FAIL_IF_NOT(p1->tcpvars.ws.type == TCP_OPT_WS);
+    FAIL_IF_NOT(*p1->tcpvars.ws.data == 7);
+    PACKET_RECYCLE(p1);
+
+    FAIL_IF(DecodeTCPOptionsCommon(p1, opts_bad, sizeof(opts_bad)));
+    DecodeTCPOptions(p1, opts_bad, sizeof(opts_bad));
+    FAIL_IF_NOT(ENGINE_ISSET_EVENT(p1, TCP_OPT_INVALID_LEN));
+
+    PACKET_RECYCLE(p1);
+    PACKET_RECYCLE(p2);
+    SCFree(p1);
+    SCFree(p2);
+    PASS;
+}
+
+/** \test checksum validated by the capture hardware is not computed again */
+static int TCPCaptureCsumTest01(void)
+{
+    /* bad checksum */
+    static uint8_t raw_tcp[] = { 0xda, 0xc1, 0x00, 0x50, 0xb6, 0x21, 0x7f, 0x58, 0x00, 0x00, 0x00,
+        0x00, 0x50, 0x10, 0x16, 0xd0, 0x00, 0x01, 0x00, 0x00 };
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    IPV4Hdr ip4h;
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&ip4h, 0, sizeof(IPV4Hdr));
+    p->src.family = AF_INET;
+    p->dst.family = AF_INET;
+    p->ip4h = &ip4h;
+    FlowInitConfig(FLOW_QUIET);
+
+    FAIL_IF(DecodeTCP(&tv, &dtv, p, raw_tcp, sizeof(raw_tcp)) != TM_ECODE_OK);
+    FAIL_IF_NOT(p->level4_comp_csum == -1);
+    PACKET_RECYCLE(p);
+
+    p->src.family = AF_INET;
+    p->dst.family = AF_INET;
+    p->ip4h = &ip4h;
+    p->capture_flags |= PKT_CAPTURE_L4_CSUM_OK;
+    FAIL_IF(DecodeTCP(&tv, &dtv, p, raw_tcp, sizeof(raw_tcp)) != TM_ECODE_OK);
+    FAIL_IF_NOT(p->level4_comp_csum == 0);
+
+    PACKET_RECYCLE(p);
+    FlowShutdown();
+    SCFree(p);
+    PASS;
+}
+
+/** \internal
+ *  \brief build an ethernet + ipv4 + tcp frame
+ *  \retval len frame length
+ */
+static uint16_t TCPTestBuildFrame(uint8_t *buf, const uint8_t *opts, uint8_t opts_len,
+        uint8_t flags, uint16_t payload_len)
+{
+    static const uint8_t eth[] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x0a, 0x0b, 0x0c,
+        0x0d, 0x0e, 0x08, 0x00 };
+    const uint16_t tcp_len = TCP_HEADER_LEN + opts_len;
+    const uint16_t ip_len = IPV4_HEADER_LEN + tcp_len + payload_len;
+
+    memcpy(buf, eth, sizeof(eth));
+    uint8_t *ip = buf + ETHERNET_HEADER_LEN;
+    const uint8_t iph[IPV4_HEADER_LEN] = { 0x45, 0x00, ip_len >> 8, ip_len & 0xff, 0x12, 0x34,
+        0x40, 0x00, 0x40, IPPROTO_TCP, 0x00, 0x00, 10, 0, 0, 1, 10, 0, 0, 2 };
+    memcpy(ip, iph, sizeof(iph));
+    uint8_t *tcp = ip + IPV4_HEADER_LEN;
+    const uint8_t tcph[TCP_HEADER_LEN] = { 0xda, 0xc1, 0x00, 0x50, 0xb6, 0x21, 0x7f, 0x58, 0x8a,
+        0xaf, 0x01, 0x02, (tcp_len / 4) << 4, flags, 0x16, 0xd0, 0x00, 0x00, 0x00, 0x00 };
+    memcpy(tcp, tcph, sizeof(tcph));
+    memcpy(tcp + TCP_HEADER_LEN, opts, opts_len);
+    memset(tcp + tcp_len, 'A', payload_len);
+    return ETHERNET_HEADER_LEN + ip_len;
+}
+
+/**
+ * \test TCPDecodeBenchmark01 measure cycles per packet for decoding
+ *       ethernet, ipv4 and tcp of synthetic packets: a SYN, ACKs with
+ *       timestamps and an ACK with SACK.
+ *
+ *       Only registered if SC_UNITTEST_BENCHMARKS is set. Uses 100000
+ *       packets by default, set SC_DECODE_BENCH_PACKETS to use more, e.g.:
+ *       SC_UNITTEST_BENCHMARKS=1 SC_DECODE_BENCH_PACKETS=10000000 \
+ *           suricata -u -U TCPDecodeBenchmark01
+ */
+static int TCPDecodeBenchmark01(void)
+{
+    static const uint8_t opts_syn[] = { 0x02, 0x04, 0x05, 0xb4, 0x04, 0x02, 0x08, 0x0a, 0x00, 0x62,
+        0x88, 0x28, 0x00, 0x00, 0x00, 0x00, 0x01, 0x03, 0x03, 0x07 };
+    static const uint8_t opts_ts[] = { 0x01, 0x01, 0x08, 0x0a, 0x00, 0x62, 0x88, 0x28, 0x00, 0x00,
+        0x12, 0x34 };
+    static const uint8_t opts_sack[] = { 0x01, 0x01, 0x08, 0x0a, 0x00, 0x62, 0x88, 0x28, 0x00,
+        0x00, 0x12, 0x34, 0x01, 0x01, 0x05, 0x0a, 0xf1, 0x59, 0x13, 0xfc, 0xf1, 0x59, 0x1f, 0x64 };
+    uint8_t frames[4][ETHERNET_HEADER_LEN + IPV4_HEADER_LEN + TCP_HEADER_LEN + TCP_OPTLENMAX + 64];
+    uint16_t frames_len[4];
+
+    uint32_t cnt = 100000;
+    const char *env = getenv("SC_DECODE_BENCH_PACKETS");
+    if (env != NULL) {
+        FAIL_IF(StringParseUint32(&cnt, 10, 0, env) <= 0);
+        FAIL_IF(cnt == 0);
+    }
+
+    frames_len[0] = TCPTestBuildFrame(frames[0], opts_syn, sizeof(opts_syn), TH_SYN, 0);
+    frames_len[1] = TCPTestBuildFrame(frames[1], opts_ts, sizeof(opts_ts), TH_ACK | TH_PUSH, 64);
+    frames_len[2] = TCPTestBuildFrame(frames[2], opts_ts, sizeof(opts_ts), TH_ACK, 0);
+    frames_len[3] = TCPTestBuildFrame(frames[3], opts_sack, sizeof(opts_sack), TH_ACK, 0);
+
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    FlowInitConfig(FLOW_QUIET);
+
+    /* cost of resetting the packet, not counted as decoding */
+    uint64_t start = UtilCpuGetTicks();
+    for (uint32_t i = 0; i < cnt; i++) {
+        PACKET_RECYCLE(p);
+    }
+    const uint64_t recycle_ticks = UtilCpuGetTicks() - start;
+
+    uint64_t sum = 0;
+    start = UtilCpuGetTicks();
+    for (uint32_t i = 0; i < cnt; i++) {
+        const uint32_t f = i & 3;
+        DecodeEthernet(&tv, &dtv, p, frames[f], frames_len[f]);
+        sum += p->tcpvars.ts_val;
+        PACKET_RECYCLE(p);
+    }
+    const uint64_t ticks = UtilCpuGetTicks() - start;
+
+    /* every frame has a valid timestamp option */
+    FAIL_IF_NOT(sum == (uint64_t)cnt * 0x00628828);
+    SCLogInfo("%u packets: %" PRIu64 " ticks per packet (%" PRIu64 " with packet reset)", cnt,
+            (ticks > recycle_ticks ? ticks - recycle_ticks : 0) / cnt, ticks / cnt);
+
+    FlowShutdown();
+    SCFree(p);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 void DecodeTCPRegisterTests(void)
@@ -582,6 +860,11 @@ void DecodeTCPRegisterTests(void)
     UtRegisterTest("TCPGetWscaleTest02", TCPGetWscaleTest02);
     UtRegisterTest("TCPGetWscaleTest03", TCPGetWscaleTest03);
     UtRegisterTest("TCPGetSackTest01", TCPGetSackTest01);
+    UtRegisterTest("TCPOptionsCommonTest01", TCPOptionsCommonTest01);
+    UtRegisterTest("TCPCaptureCsumTest01", TCPCaptureCsumTest01);
+    if (UtBenchmarksEnabled()) {
+        UtRegisterTest("TCPDecodeBenchmark01", TCPDecodeBenchmark01);
+    }
 #endif /* UNITTESTS */
 }
 /**
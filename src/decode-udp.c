@@ -82,6 +82,11 @@ int DecodeUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
         return TM_ECODE_FAILED;
     }
 
+    if (p->capture_flags & PKT_CAPTURE_L4_CSUM_OK) {
+        p->level4_comp_csum = 0;
+        StatsIncr(tv, dtv->counter_udp_csum_offload);
+    }
+
     SCLogDebug("UDP sp: %" PRIu32 " -> dp: %" PRIu32 " - HLEN: %" PRIu32 " LEN: %" PRIu32 "",
         UDP_GET_SRC_PORT(p), UDP_GET_DST_PORT(p), UDP_HEADER_LEN, p->payload_len);
 
@@ -97,8 +102,10 @@ int DecodeUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
     if (DecodeGeneveEnabledForPort(p->sp, p->dp) &&
             unlikely(DecodeGeneve(tv, dtv, p, p->payload, p->payload_len) == TM_ECODE_OK)) {
         /* Here we have a Geneve packet and don't need to handle app
-         * layer */
-        FlowSetupPacket(p);
+         * layer. If it was decoded in place the inner decoder set up
+         * the flow. */
+        if (!(p->flags & PKT_TUNNEL_INPLACE))
+            FlowSetupPacket(p);
         return TM_ECODE_OK;
     }
 
@@ -106,8 +113,10 @@ int DecodeUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
     if (DecodeVXLANEnabledForPort(p->sp, p->dp) &&
             unlikely(DecodeVXLAN(tv, dtv, p, p->payload, p->payload_len) == TM_ECODE_OK)) {
         /* Here we have a VXLAN packet and don't need to handle app
-         * layer */
-        FlowSetupPacket(p);
+         * layer. If it was decoded in place the inner decoder set up
+         * the flow. */
+        if (!(p->flags & PKT_TUNNEL_INPLACE))
+            FlowSetupPacket(p);
         return TM_ECODE_OK;
     }
 
@@ -52,6 +52,7 @@
 #include "conf.h"
 #include "decode.h"
 #include "decode-teredo.h"
+#include "defrag.h"
 #include "util-debug.h"
 #include "util-mem.h"
 #include "app-layer-detect-proto.h"
@@ -67,6 +68,7 @@
 #include "output.h"
 #include "output-flow.h"
 #include "flow-storage.h"
+#include "flow-cost.h"
 #include "util-validate.h"
 
 uint32_t default_packet_size = 0;
@@ -74,6 +76,7 @@ extern bool stats_decoder_events;
 extern const char *stats_decoder_events_prefix;
 extern bool stats_stream_events;
 uint8_t decoder_max_layers = PKT_DEFAULT_MAX_DECODED_LAYERS;
+bool decoder_tunnel_inplace = false;
 uint16_t packet_alert_max = PACKET_ALERT_MAX;
 
 /**
@@ -134,7 +137,11 @@ static int DecodeTunnel(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, const
 void PacketFree(Packet *p)
 {
     PACKET_DESTRUCTOR(p);
-    SCFree(p);
+    if (p->slab != NULL) {
+        PacketPoolSlabRelease(p->slab);
+    } else {
+        SCFree(p);
+    }
 }
 
 /**
@@ -149,6 +156,9 @@ void PacketDecodeFinalize(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
     if (p->flags & PKT_IS_INVALID) {
         StatsIncr(tv, dtv->counter_invalid);
     }
+    if (p->decode_ticks != 0) {
+        p->decode_ticks = UtilCpuGetTicks() - p->decode_ticks;
+    }
 }
 
 void PacketUpdateEngineEventCounters(ThreadVars *tv,
@@ -368,6 +378,118 @@ Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *pare
     SCReturnPtr(p, "Packet");
 }
 
+/** Packet::ethh up to and including Packet::payload_len: the header
+ *  pointers and layer vars that in place tunnel decoding replaces */
+#define PACKET_TUNNEL_HDRS_OFFSET offsetof(Packet, ethh)
+#define PACKET_TUNNEL_HDRS_LEN                                                                     \
+    (offsetof(Packet, payload_len) + sizeof(((Packet *)0)->payload_len) - PACKET_TUNNEL_HDRS_OFFSET)
+
+/** outer layers of a packet, to restore them if the inner packet of an in
+ *  place decoded tunnel is invalid */
+typedef struct PacketTunnelSaved_ {
+    Address src;
+    Address dst;
+    Port sp;
+    Port dp;
+    uint8_t proto;
+    uint8_t capture_flags;
+    uint8_t vlan_idx;
+    uint16_t vlan_id[2];
+    uint32_t flags;
+    uint8_t hdrs[PACKET_TUNNEL_HDRS_LEN];
+} PacketTunnelSaved;
+
+/**
+ *  \brief Decode the inner packet of a tunnel
+ *
+ *  If decoder.tunnel-in-place is enabled the inner packet replaces the
+ *  outer layers in \a p. The outer addresses, ports and protocol are kept
+ *  in Packet::tunnel_outer. Otherwise a pseudo packet is set up and queued
+ *  for processing after \a p.
+ *
+ *  \param p packet containing the tunnel
+ *  \param pkt inner packet data, pointing into the data of \a p
+ *  \param len inner packet data length
+ *  \param proto protocol of the tunneled packet
+ *  \param pkt_src source to set on the pseudo packet
+ */
+void PacketTunnelDecode(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, const uint8_t *pkt,
+        uint32_t len, enum DecodeTunnelProto proto, enum PktSrcEnum pkt_src)
+{
+    if (!decoder_tunnel_inplace) {
+        Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt, len, proto);
+        if (tp != NULL) {
+            PKT_SET_SRC(tp, pkt_src);
+            PacketEnqueueNoLock(&tv->decode_pq, tp);
+        }
+        return;
+    }
+
+    PacketTunnelSaved saved;
+    COPY_ADDRESS(&p->src, &saved.src);
+    COPY_ADDRESS(&p->dst, &saved.dst);
+    saved.sp = p->sp;
+    saved.dp = p->dp;
+    saved.proto = p->proto;
+    saved.capture_flags = p->capture_flags;
+    saved.vlan_idx = p->vlan_idx;
+    saved.vlan_id[0] = p->vlan_id[0];
+    saved.vlan_id[1] = p->vlan_id[1];
+    saved.flags = p->flags;
+    memcpy(saved.hdrs, (uint8_t *)p + PACKET_TUNNEL_HDRS_OFFSET, PACKET_TUNNEL_HDRS_LEN);
+
+    /* with nested tunnels keep the outermost headers */
+    if (!(p->flags & PKT_TUNNEL_INPLACE)) {
+        COPY_ADDRESS(&p->src, &p->tunnel_outer.src);
+        COPY_ADDRESS(&p->dst, &p->tunnel_outer.dst);
+        p->tunnel_outer.sp = p->sp;
+        p->tunnel_outer.dp = p->dp;
+        p->tunnel_outer.proto = p->proto;
+        p->flags |= PKT_TUNNEL_INPLACE;
+    }
+
+    /* forget the outer layers, the inner packet is decoded as if it
+     * was a tunnel pseudo packet */
+    CLEAR_ADDR(&p->src);
+    CLEAR_ADDR(&p->dst);
+    p->sp = 0;
+    p->dp = 0;
+    p->proto = 0;
+    CLEAR_IPV4_PACKET(p);
+    CLEAR_IPV6_PACKET(p);
+    CLEAR_UDP_PACKET(p);
+    p->greh = NULL;
+    p->ethh = NULL;
+    p->vlan_id[0] = 0;
+    p->vlan_id[1] = 0;
+    p->vlan_idx = 0;
+    p->payload = NULL;
+    p->payload_len = 0;
+    /* offload results only apply to the outer headers */
+    p->capture_flags = 0;
+    p->recursion_level++;
+
+    if (DecodeTunnel(tv, dtv, p, pkt, len, proto) != TM_ECODE_OK) {
+        SCLogDebug("in place tunnel packet is invalid");
+
+        /* continue with the outer packet, like when a tunnel pseudo packet
+         * fails to decode. The events of the inner layers are kept. */
+        COPY_ADDRESS(&saved.src, &p->src);
+        COPY_ADDRESS(&saved.dst, &p->dst);
+        p->sp = saved.sp;
+        p->dp = saved.dp;
+        p->proto = saved.proto;
+        p->capture_flags = saved.capture_flags;
+        p->vlan_idx = saved.vlan_idx;
+        p->vlan_id[0] = saved.vlan_id[0];
+        p->vlan_id[1] = saved.vlan_id[1];
+        p->flags = saved.flags;
+        memcpy((uint8_t *)p + PACKET_TUNNEL_HDRS_OFFSET, saved.hdrs, PACKET_TUNNEL_HDRS_LEN);
+        p->recursion_level--;
+        ENGINE_SET_EVENT(p, GENERIC_TUNNEL_INVALID);
+    }
+}
+
 /**
  *  \brief Setup a pseudo packet (reassembled frags)
  *
@@ -558,6 +680,9 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
     dtv->counter_max_mac_addrs_dst = StatsRegisterMaxCounter("decoder.max_mac_addrs_dst", tv);
     dtv->counter_erspan = StatsRegisterMaxCounter("decoder.erspan", tv);
     dtv->counter_nsh = StatsRegisterMaxCounter("decoder.nsh", tv);
+    dtv->counter_ipv4_csum_offload = StatsRegisterCounter("decoder.ipv4_csum_offload", tv);
+    dtv->counter_tcp_csum_offload = StatsRegisterCounter("decoder.tcp_csum_offload", tv);
+    dtv->counter_udp_csum_offload = StatsRegisterCounter("decoder.udp_csum_offload", tv);
     dtv->counter_flow_memcap = StatsRegisterCounter("flow.memcap", tv);
 
     dtv->counter_tcp_active_sessions = StatsRegisterCounter("tcp.active_sessions", tv);
@@ -573,6 +698,7 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
     dtv->counter_flow_get_used_eval_reject = StatsRegisterCounter("flow.get_used_eval_reject", tv);
     dtv->counter_flow_get_used_eval_busy = StatsRegisterCounter("flow.get_used_eval_busy", tv);
     dtv->counter_flow_get_used_failed = StatsRegisterCounter("flow.get_used_failed", tv);
+    dtv->counter_flow_shard_cross_queue = StatsRegisterCounter("flow.shard_cross_queue", tv);
 
     dtv->counter_flow_spare_sync_avg = StatsRegisterAvgCounter("flow.wrk.spare_sync_avg", tv);
     dtv->counter_flow_spare_sync = StatsRegisterCounter("flow.wrk.spare_sync", tv);
@@ -648,8 +774,13 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
 }
 
 void DecodeUpdatePacketCounters(ThreadVars *tv,
-                                const DecodeThreadVars *dtv, const Packet *p)
+                                const DecodeThreadVars *dtv, Packet *p)
 {
+    /* decoding starts here, PacketDecodeFinalize() turns this into the
+     * decode time */
+    if (g_flow_cost_enabled)
+        p->decode_ticks = UtilCpuGetTicks();
+
     StatsIncr(tv, dtv->counter_pkts);
     //StatsIncr(tv, dtv->counter_pkts_per_sec);
     StatsAddUI64(tv, dtv->counter_bytes, GET_PKT_LEN(p));
@@ -697,6 +828,15 @@ DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv)
         return NULL;
     }
 
+    if (DefragThreadLocalEnabled()) {
+        dtv->defrag = DefragThreadContextNew();
+        if (dtv->defrag == NULL) {
+            SCLogError(SC_ERR_THREAD_INIT, "initializing defrag for thread failed");
+            DecodeThreadVarsFree(tv, dtv);
+            return NULL;
+        }
+    }
+
     return dtv;
 }
 
@@ -709,6 +849,9 @@ void DecodeThreadVarsFree(ThreadVars *tv, DecodeThreadVars *dtv)
         if (dtv->output_flow_thread_data != NULL)
             OutputFlowLogThreadDeinit(tv, dtv->output_flow_thread_data);
 
+        if (dtv->defrag != NULL)
+            DefragThreadContextFree(dtv->defrag);
+
         SCFree(dtv);
     }
 }
@@ -844,6 +987,11 @@ void DecodeGlobalConfig(void)
             decoder_max_layers = (uint8_t)value;
         }
     }
+    int inplace = 0;
+    if (ConfGetBool("decoder.tunnel-in-place", &inplace) == 1 && inplace) {
+        decoder_tunnel_inplace = true;
+        SCLogConfig("decoding tunnels in place");
+    }
     PacketAlertGetMaxConfig();
 }
 
@@ -67,6 +67,7 @@ enum PktSrcEnum {
 #include "source-ipfw.h"
 #include "source-pcap.h"
 #include "source-af-packet.h"
+#include "source-af-xdp.h"
 #include "source-netmap.h"
 #include "source-windivert.h"
 #ifdef HAVE_DPDK
@@ -111,6 +112,7 @@ struct DetectionEngineThreadCtx_;
 typedef struct AppLayerThreadCtx_ AppLayerThreadCtx;
 
 struct PktPool_;
+struct PktPoolSlab_;
 
 /* declare these here as they are called from the
  * PACKET_RECYCLE and PACKET_CLEANUP macro's. */
@@ -422,6 +424,15 @@ enum PacketDropReason {
 /* forward declaration since Packet struct definition requires this */
 struct PacketQueue_;
 
+/** outer headers of a tunnel that was decoded in place */
+typedef struct PacketTunnelOuter_ {
+    Address src;
+    Address dst;
+    Port sp;
+    Port dp;
+    uint8_t proto;
+} PacketTunnelOuter;
+
 /* sizes of the members:
  * src: 17 bytes
  * dst: 17 bytes
@@ -498,6 +509,9 @@ typedef struct Packet_
 #ifdef AF_PACKET
         AFPPacketVars afp_v;
 #endif
+#ifdef HAVE_AF_XDP
+        AFXDPPacketVars afxdp_v;
+#endif
 #ifdef HAVE_NETMAP
         NetmapPacketVars netmap_v;
 #endif
@@ -602,6 +616,10 @@ typedef struct Packet_
     /** packet number in the pcap file, matches wireshark */
     uint64_t pcap_cnt;
 
+    /** ticks spent decoding the packet, only set if flow cost
+     *  accounting is enabled */
+    uint64_t decode_ticks;
+
 
     /* engine events */
     PacketEngineEvents events;
@@ -623,6 +641,10 @@ typedef struct Packet_
     /* enum PacketDropReason::PKT_DROP_REASON_* as uint8_t for compactness */
     uint8_t drop_reason;
 
+    /* offload results of the capture hardware */
+    uint8_t capture_flags;
+    /* coccinelle: Packet:capture_flags:PKT_CAPTURE_ */
+
     /* tunnel/encapsulation handling */
     struct Packet_ *root; /* in case of tunnel this is a ptr
                            * to the 'real' packet, the one we
@@ -630,6 +652,9 @@ typedef struct Packet_
                            * It should always point to the lowest
                            * packet in a encapsulated packet */
 
+    /* outermost tunnel headers if PKT_TUNNEL_INPLACE is set */
+    PacketTunnelOuter tunnel_outer;
+
     /** mutex to protect access to:
      *  - tunnel_rtv_cnt
      *  - tunnel_tpr_cnt
@@ -647,6 +672,9 @@ typedef struct Packet_
      * the packet to its owner's stack. If NULL, then allocated with malloc.
      */
     struct PktPool_ *pool;
+    /* Block of preallocated packets this packet is part of, NULL if the
+     * packet was allocated on its own. */
+    struct PktPoolSlab_ *slab;
 
 #ifdef PROFILING
     PktProfiling *profile;
@@ -713,6 +741,11 @@ typedef struct DecodeThreadVars_
     uint16_t counter_erspan;
     uint16_t counter_nsh;
 
+    /** checksums validated by the capture hardware */
+    uint16_t counter_ipv4_csum_offload;
+    uint16_t counter_tcp_csum_offload;
+    uint16_t counter_udp_csum_offload;
+
     /** frag stats - defrag runs in the context of the decoder. */
     uint16_t counter_defrag_ipv4_fragments;
     uint16_t counter_defrag_ipv4_reassembled;
@@ -737,6 +770,7 @@ typedef struct DecodeThreadVars_
     uint16_t counter_flow_get_used_eval_reject;
     uint16_t counter_flow_get_used_eval_busy;
     uint16_t counter_flow_get_used_failed;
+    uint16_t counter_flow_shard_cross_queue;
 
     uint16_t counter_flow_spare_sync;
     uint16_t counter_flow_spare_sync_empty;
@@ -749,6 +783,9 @@ typedef struct DecodeThreadVars_
      * flow recycle during lookups */
     void *output_flow_thread_data;
 
+    /** thread local defrag context, NULL if the global one is used */
+    struct DefragContext_ *defrag;
+
 } DecodeThreadVars;
 
 typedef struct CaptureStats_ {
@@ -824,6 +861,7 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         (p)->ts.tv_usec = 0;                                                                       \
         (p)->datalink = 0;                                                                         \
         (p)->drop_reason = 0;                                                                      \
+        (p)->capture_flags = 0;                                                                    \
         (p)->action = 0;                                                                           \
         if ((p)->pktvar != NULL) {                                                                 \
             PktVarFree((p)->pktvar);                                                               \
@@ -867,6 +905,7 @@ void CaptureStatsSetup(ThreadVars *tv, CaptureStats *s);
         (p)->alerts.suppressed = 0;                                                                \
         (p)->alerts.drop.action = 0;                                                               \
         (p)->pcap_cnt = 0;                                                                         \
+        (p)->decode_ticks = 0;                                                                     \
         (p)->tunnel_rtv_cnt = 0;                                                                   \
         (p)->tunnel_tpr_cnt = 0;                                                                   \
         (p)->events.cnt = 0;                                                                       \
@@ -999,6 +1038,8 @@ enum DecodeTunnelProto {
 
 Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *parent,
                              const uint8_t *pkt, uint32_t len, enum DecodeTunnelProto proto);
+void PacketTunnelDecode(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, const uint8_t *pkt,
+        uint32_t len, enum DecodeTunnelProto proto, enum PktSrcEnum pkt_src);
 Packet *PacketDefragPktSetup(Packet *parent, const uint8_t *pkt, uint32_t len, uint8_t proto);
 void PacketDefragPktSetupParent(Packet *parent);
 void DecodeRegisterPerfCounters(DecodeThreadVars *, ThreadVars *);
@@ -1020,7 +1061,7 @@ void PacketSwap(Packet *p);
 DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *);
 void DecodeThreadVarsFree(ThreadVars *, DecodeThreadVars *);
 void DecodeUpdatePacketCounters(ThreadVars *tv,
-                                const DecodeThreadVars *dtv, const Packet *p);
+                                const DecodeThreadVars *dtv, Packet *p);
 const char *PacketDropReasonToString(enum PacketDropReason r);
 
 /* decoder functions */
@@ -1168,7 +1209,9 @@ void DecodeUnregisterCounters(void);
 
 /** Flag to indicate that packet header or contents should not be inspected */
 #define PKT_NOPACKET_INSPECTION BIT_U32(0)
-// vacancy
+/** Packet is the inner packet of a tunnel decoded in place, the outer
+ *  headers are in Packet::tunnel_outer */
+#define PKT_TUNNEL_INPLACE BIT_U32(1)
 
 /** Flag to indicate that packet contents should not be inspected */
 #define PKT_NOPAYLOAD_INSPECTION BIT_U32(2)
@@ -1234,6 +1277,16 @@ void DecodeUnregisterCounters(void);
 #define PKT_FIRST_ALERTS BIT_U32(29)
 #define PKT_FIRST_TAG    BIT_U32(30)
 
+/* Packet::capture_flags: set by the capture method from the offload
+ * results of the NIC. They only apply to the outer headers, so they
+ * are not copied to tunnel packets. */
+/** NIC validated the IPv4 header checksum */
+#define PKT_CAPTURE_IPV4_CSUM_OK  BIT_U8(0)
+/** NIC validated the TCP or UDP checksum */
+#define PKT_CAPTURE_L4_CSUM_OK    BIT_U8(1)
+/** NIC stripped the vlan header, vlan_id[0] is from the capture metadata */
+#define PKT_CAPTURE_VLAN_STRIPPED BIT_U8(2)
+
 /** \brief return 1 if the packet is a pseudo packet */
 #define PKT_IS_PSEUDOPKT(p) \
     ((p)->flags & (PKT_PSEUDO_STREAM_END|PKT_PSEUDO_DETECTLOG_FLUSH))
@@ -1242,6 +1295,7 @@ void DecodeUnregisterCounters(void);
 
 #define PKT_DEFAULT_MAX_DECODED_LAYERS 16
 extern uint8_t decoder_max_layers;
+extern bool decoder_tunnel_inplace;
 
 static inline bool PacketIncreaseCheckLayers(Packet *p)
 {
@@ -385,7 +385,7 @@ typedef struct DefragHashKey6_ {
  *  id
  *  vlan_id
  */
-static inline uint32_t DefragHashGetKey(Packet *p)
+static inline uint32_t DefragHashGetHash(Packet *p)
 {
     uint32_t key;
 
@@ -403,7 +403,7 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[1] = p->vlan_id[1];
 
         uint32_t hash = hashword(dhk.u32, 4, defrag_config.hash_rand);
-        key = hash % defrag_config.hash_size;
+        key = hash;
     } else if (p->ip6h != NULL) {
         DefragHashKey6 dhk;
         if (DefragHashRawAddressIPv6GtU32(p->src.addr_data32, p->dst.addr_data32)) {
@@ -430,13 +430,18 @@ static inline uint32_t DefragHashGetKey(Packet *p)
         dhk.vlan_id[1] = p->vlan_id[1];
 
         uint32_t hash = hashword(dhk.u32, 10, defrag_config.hash_rand);
-        key = hash % defrag_config.hash_size;
+        key = hash;
     } else
         key = 0;
 
     return key;
 }
 
+static inline uint32_t DefragHashGetKey(Packet *p)
+{
+    return DefragHashGetHash(p) % defrag_config.hash_size;
+}
+
 /* Since two or more trackers can have the same hash key, we need to compare
  * the tracker with the current tracker key. */
 #define CMP_DEFRAGTRACKER(d1,d2,id) \
@@ -764,3 +769,195 @@ static DefragTracker *DefragTrackerGetUsedDefragTracker(void)
 }
 
 
+
+/** \internal
+ *  \brief check if a thread local tracker can be discarded
+ *
+ *  Trackers in use are never discarded. This happens when reassembly of
+ *  a tracker leads to decoding a tunnel that contains fragments. */
+static inline bool DefragThreadTrackerTimedOut(DefragTracker *dt, struct timeval *ts)
+{
+    if (SC_ATOMIC_GET(dt->use_cnt) > 0)
+        return false;
+    return dt->remove || !timercmp(&dt->timeout, ts, >);
+}
+
+static inline void DefragThreadHashInsert(DefragContext *dc, DefragTracker *dt, uint32_t row)
+{
+    dt->hprev = NULL;
+    dt->hnext = dc->trackers[row];
+    if (dt->hnext != NULL)
+        dt->hnext->hprev = dt;
+    dc->trackers[row] = dt;
+}
+
+static inline void DefragThreadHashUnlink(DefragContext *dc, DefragTracker *dt, uint32_t row)
+{
+    if (dt->hprev != NULL)
+        dt->hprev->hnext = dt->hnext;
+    else
+        dc->trackers[row] = dt->hnext;
+    if (dt->hnext != NULL)
+        dt->hnext->hprev = dt->hprev;
+    dt->hnext = NULL;
+    dt->hprev = NULL;
+}
+
+/** \internal
+ *  \brief clear a thread local tracker and keep it for reuse, or free
+ *         it if the context has enough spare trackers */
+static void DefragThreadTrackerRecycle(DefragContext *dc, DefragTracker *dt)
+{
+    if (dc->spare_cnt >= dc->spare_max) {
+        DefragTrackerFree(dt);
+        return;
+    }
+    DefragTrackerClearMemory(dt);
+    dt->hnext = dc->spare;
+    dc->spare = dt;
+    dc->spare_cnt++;
+}
+
+/**
+ *  \brief time out trackers of a thread local context
+ *
+ *  \param dc thread local defrag context
+ *  \param ts timestamp
+ *  \param rows number of hash rows to check, continuing where the
+ *         last call stopped
+ *
+ *  \retval cnt number of timed out trackers
+ */
+uint32_t DefragThreadHashTimeout(DefragContext *dc, struct timeval *ts, uint32_t rows)
+{
+    uint32_t cnt = 0;
+
+    while (rows--) {
+        const uint32_t row = dc->timeout_idx;
+        if (++dc->timeout_idx >= dc->trackers_size)
+            dc->timeout_idx = 0;
+
+        DefragTracker *dt = dc->trackers[row];
+        while (dt != NULL) {
+            DefragTracker *next = dt->hnext;
+            if (DefragThreadTrackerTimedOut(dt, ts)) {
+                DefragThreadHashUnlink(dc, dt, row);
+                DefragThreadTrackerRecycle(dc, dt);
+                cnt++;
+            }
+            dt = next;
+        }
+    }
+    return cnt;
+}
+
+static DefragTracker *DefragThreadTrackerGetNew(DefragContext *dc, Packet *p)
+{
+    if (dc->spare == NULL) {
+        DefragTracker *dt = DefragTrackerAlloc();
+        if (dt != NULL)
+            return dt;
+
+        /* memcap reached, see if this thread has trackers to spare */
+        DefragThreadHashTimeout(dc, &p->ts, dc->trackers_size);
+        if (dc->spare == NULL) {
+            ExceptionPolicyApply(p, defrag_config.memcap_policy, PKT_DROP_REASON_DEFRAG_MEMCAP);
+            return NULL;
+        }
+    }
+
+    DefragTracker *dt = dc->spare;
+    dc->spare = dt->hnext;
+    dc->spare_cnt--;
+    dt->hnext = NULL;
+    return dt;
+}
+
+/**
+ *  \brief get a tracker from the table of a thread local context
+ *
+ *  No locking is done, the table is only used by the owning thread.
+ *  Expired trackers found in the row are discarded on the way.
+ *
+ *  \retval dt tracker or NULL, release with DefragThreadTrackerRelease()
+ */
+DefragTracker *DefragGetTrackerFromThreadHash(DefragContext *dc, Packet *p)
+{
+    const uint32_t row = DefragHashGetHash(p) % dc->trackers_size;
+
+    DefragTracker *dt = dc->trackers[row];
+    while (dt != NULL) {
+        DefragTracker *next = dt->hnext;
+        if (DefragThreadTrackerTimedOut(dt, &p->ts)) {
+            DefragThreadHashUnlink(dc, dt, row);
+            DefragThreadTrackerRecycle(dc, dt);
+        } else if (DefragTrackerCompare(dt, p) != 0) {
+            /* move to the front of the row to reward active trackers */
+            if (dt->hprev != NULL) {
+                DefragThreadHashUnlink(dc, dt, row);
+                DefragThreadHashInsert(dc, dt, row);
+            }
+            (void) DefragTrackerIncrUsecnt(dt);
+            return dt;
+        }
+        dt = next;
+    }
+
+    dt = DefragThreadTrackerGetNew(dc, p);
+    if (dt == NULL)
+        return NULL;
+
+    DefragTrackerInit(dt, p);
+    dt->dc = dc;
+    DefragThreadHashInsert(dc, dt, row);
+    return dt;
+}
+
+/**
+ *  \brief release a thread local tracker, discarding it if it was
+ *         marked for removal
+ *
+ *  \param p packet the tracker was looked up for
+ */
+void DefragThreadTrackerRelease(DefragContext *dc, DefragTracker *dt, Packet *p)
+{
+    (void) DefragTrackerDecrUsecnt(dt);
+    if (dt->remove && SC_ATOMIC_GET(dt->use_cnt) == 0) {
+        DefragThreadHashUnlink(dc, dt, DefragHashGetHash(p) % dc->trackers_size);
+        DefragThreadTrackerRecycle(dc, dt);
+    }
+}
+
+/** \brief set up the tracker table of a thread local context */
+int DefragThreadHashInit(DefragContext *dc)
+{
+    dc->trackers_size = defrag_config.hash_size;
+    dc->trackers = SCCalloc(dc->trackers_size, sizeof(DefragTracker *));
+    if (dc->trackers == NULL)
+        return -1;
+    return 0;
+}
+
+/** \brief free the trackers and the table of a thread local context */
+void DefragThreadHashFree(DefragContext *dc)
+{
+    if (dc->trackers != NULL) {
+        for (uint32_t u = 0; u < dc->trackers_size; u++) {
+            DefragTracker *dt = dc->trackers[u];
+            while (dt != NULL) {
+                DefragTracker *next = dt->hnext;
+                DefragTrackerFree(dt);
+                dt = next;
+            }
+        }
+        SCFree(dc->trackers);
+        dc->trackers = NULL;
+    }
+
+    while (dc->spare != NULL) {
+        DefragTracker *dt = dc->spare;
+        dc->spare = dt->hnext;
+        DefragTrackerFree(dt);
+    }
+    dc->spare_cnt = 0;
+}
@@ -100,6 +100,12 @@ void DefragTrackerClearMemory(DefragTracker *);
 void DefragTrackerMoveToSpare(DefragTracker *);
 uint32_t DefragTrackerSpareQueueGetSize(void);
 
+int DefragThreadHashInit(DefragContext *);
+void DefragThreadHashFree(DefragContext *);
+DefragTracker *DefragGetTrackerFromThreadHash(DefragContext *, Packet *);
+void DefragThreadTrackerRelease(DefragContext *, DefragTracker *, Packet *);
+uint32_t DefragThreadHashTimeout(DefragContext *, struct timeval *, uint32_t);
+
 int DefragTrackerSetMemcap(uint64_t);
 uint64_t DefragTrackerGetMemcap(void);
 uint64_t DefragTrackerGetMemuse(void);
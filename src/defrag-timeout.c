@@ -110,7 +110,7 @@ static uint32_t DefragTrackerHashRowTimeout(DefragTrackerHashRow *hb, DefragTrac
 }
 
 /**
- *  \brief time out tracker from the hash
+ *  \brief time out tracker from the hash and the thread local contexts
  *
  *  \param ts timestamp
  *
@@ -139,6 +139,9 @@ uint32_t DefragTimeoutHash(struct timeval *ts)
         DRLOCK_UNLOCK(hb);
     }
 
+    /* trackers of thread local contexts of idle threads */
+    cnt += DefragThreadContextsTimeout(ts);
+
     return cnt;
 }
 
@@ -50,6 +50,7 @@
 #include "stream-tcp-reassemble.h"
 #include "util-host-os-info.h"
 #include "util-validate.h"
+#include "util-cpu.h"
 
 #include "defrag.h"
 #include "defrag-hash.h"
@@ -67,6 +68,11 @@
 
 #define DEFAULT_DEFRAG_HASH_SIZE 0xffff
 #define DEFAULT_DEFRAG_POOL_SIZE 0xffff
+#define DEFAULT_DEFRAG_FRAG_DATA_PREALLOC 1024
+
+/** Number of tracker table rows checked for timeouts per fragment in
+ *  a thread local context. */
+#define DEFRAG_THREAD_TIMEOUT_ROWS 8
 
 /**
  * Default timeout (in seconds) before a defragmentation tracker will
@@ -103,6 +109,39 @@ static uint8_t default_policy = DEFRAG_POLICY_BSD;
  * context. */
 static DefragContext *defrag_context;
 
+/** Use per thread contexts instead of the global one. */
+static bool defrag_thread_local = false;
+
+/** defrag.max-frags, shared by all thread local contexts */
+static uint32_t defrag_thread_max_frags = DEFAULT_DEFRAG_POOL_SIZE;
+/** fragments held by the thread local contexts */
+static SC_ATOMIC_DECLARE(uint32_t, defrag_thread_frags);
+/** number of shares the preallocations are split in for the thread local
+ *  contexts, one per online CPU */
+static uint32_t defrag_thread_shares = 1;
+
+/** thread local contexts, for the flow manager to time out their trackers */
+static DefragContext *defrag_thread_contexts = NULL;
+static SCMutex defrag_thread_contexts_lock = SCMUTEX_INITIALIZER;
+
+#define DEFRAG_POOL_LOCK(dc)                                                                       \
+    do {                                                                                           \
+        if (!(dc)->per_thread)                                                                     \
+            SCMutexLock(&(dc)->frag_pool_lock);                                                    \
+    } while (0)
+#define DEFRAG_POOL_UNLOCK(dc)                                                                     \
+    do {                                                                                           \
+        if (!(dc)->per_thread)                                                                     \
+            SCMutexUnlock(&(dc)->frag_pool_lock);                                                  \
+    } while (0)
+
+/** \internal
+ *  \brief get the context the fragments of a tracker belong to */
+static inline DefragContext *DefragTrackerGetContext(const DefragTracker *tracker)
+{
+    return tracker->dc != NULL ? tracker->dc : defrag_context;
+}
+
 RB_GENERATE(IP_FRAGMENTS, Frag_, rb, DefragRbFragCompare);
 
 /**
@@ -127,15 +166,58 @@ DumpFrags(DefragTracker *tracker)
 
 /**
  * \brief Reset a frag for reuse in a pool.
+ *
+ * Must be called with the pools of the context locked.
  */
 static void
-DefragFragReset(Frag *frag)
+DefragFragReset(DefragContext *dc, Frag *frag)
 {
-    if (frag->pkt != NULL)
-        SCFree(frag->pkt);
+    if (frag->pkt != NULL) {
+        if (frag->pkt_pooled)
+            PoolReturn(dc->frag_data_pool, frag->pkt);
+        else
+            SCFree(frag->pkt);
+    }
     memset(frag, 0, sizeof(*frag));
 }
 
+/**
+ * \brief Reset a frag and return it to the pool of its context.
+ *
+ * Must be called with the pools of the context locked.
+ */
+static void
+DefragFragRelease(DefragContext *dc, Frag *frag)
+{
+    DefragFragReset(dc, frag);
+    PoolReturn(dc->frag_pool, frag);
+    if (dc->per_thread)
+        (void) SC_ATOMIC_SUB(defrag_thread_frags, 1);
+}
+
+/**
+ * \brief Get a frag from the pool of a context.
+ *
+ * The pools of thread local contexts can each hold defrag.max-frags,
+ * so these take from a budget shared by all threads first.
+ *
+ * Must be called with the pools of the context locked.
+ */
+static Frag *
+DefragFragGet(DefragContext *dc)
+{
+    if (dc->per_thread) {
+        if (SC_ATOMIC_ADD(defrag_thread_frags, 1) >= defrag_thread_max_frags) {
+            (void) SC_ATOMIC_SUB(defrag_thread_frags, 1);
+            return NULL;
+        }
+    }
+    Frag *frag = PoolGet(dc->frag_pool);
+    if (frag == NULL && dc->per_thread)
+        (void) SC_ATOMIC_SUB(defrag_thread_frags, 1);
+    return frag;
+}
+
 /**
  * \brief Allocate a new frag for use in a pool.
  */
@@ -148,6 +230,16 @@ DefragFragInit(void *data, void *initdata)
     return 1;
 }
 
+/**
+ * \brief Init a fragment data buffer, nothing to do as it will be
+ * overwritten with the fragment.
+ */
+static int
+DefragFragDataInit(void *data, void *initdata)
+{
+    return 1;
+}
+
 /**
  * \brief Free all frags associated with a tracker.
  */
@@ -155,17 +247,17 @@ void
 DefragTrackerFreeFrags(DefragTracker *tracker)
 {
     Frag *frag, *tmp;
+    DefragContext *dc = DefragTrackerGetContext(tracker);
 
     /* Lock the frag pool as we'll be return items to it. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
+    DEFRAG_POOL_LOCK(dc);
 
     RB_FOREACH_SAFE(frag, IP_FRAGMENTS, &tracker->fragment_tree, tmp) {
         RB_REMOVE(IP_FRAGMENTS, &tracker->fragment_tree, frag);
-        DefragFragReset(frag);
-        PoolReturn(defrag_context->frag_pool, frag);
+        DefragFragRelease(dc, frag);
     }
 
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    DEFRAG_POOL_UNLOCK(dc);
 }
 
 /**
@@ -175,13 +267,14 @@ DefragTrackerFreeFrags(DefragTracker *tracker)
  *     NULL will be returned.
  */
 static DefragContext *
-DefragContextNew(void)
+DefragContextAlloc(bool per_thread)
 {
     DefragContext *dc;
 
     dc = SCCalloc(1, sizeof(*dc));
     if (unlikely(dc == NULL))
         return NULL;
+    dc->per_thread = per_thread;
 
     /* Initialize the pool of trackers. */
     intmax_t tracker_pool_size;
@@ -194,7 +287,25 @@ DefragContextNew(void)
     if (!ConfGetInt("defrag.max-frags", &frag_pool_size) || frag_pool_size == 0) {
         frag_pool_size = DEFAULT_DEFRAG_POOL_SIZE;
     }
+    /* Initialize the arena of fragment data buffers. Fragments that
+     * don't fit in a buffer are allocated separately. */
+    intmax_t frag_data_prealloc;
+    if (!ConfGetInt("defrag.frag-data-prealloc", &frag_data_prealloc) ||
+            frag_data_prealloc < 0) {
+        frag_data_prealloc = DEFAULT_DEFRAG_FRAG_DATA_PREALLOC;
+    }
+    if (frag_data_prealloc > frag_pool_size) {
+        frag_data_prealloc = frag_pool_size;
+    }
     intmax_t frag_pool_prealloc = frag_pool_size / 2;
+    if (per_thread) {
+        /* each thread gets its share of the data arena, and keeps its
+         * fragment preallocation in line with it */
+        if (frag_data_prealloc > 0) {
+            frag_data_prealloc = MAX(frag_data_prealloc / defrag_thread_shares, 1);
+        }
+        frag_pool_prealloc = frag_data_prealloc;
+    }
     dc->frag_pool = PoolInit(frag_pool_size, frag_pool_prealloc,
         sizeof(Frag),
         NULL, DefragFragInit, dc, NULL, NULL);
@@ -202,6 +313,28 @@ DefragContextNew(void)
             FatalError(SC_ERR_FATAL,
                        "Defrag: Failed to initialize fragment pool.");
     }
+    dc->frag_data_size = default_packet_size ? default_packet_size : DEFAULT_PACKET_SIZE;
+    /* The arena doesn't grow, so its size is accounted against the
+     * memcap once. Fragment data that doesn't fit is allocated per
+     * fragment. */
+    const uint64_t arena_size = (uint64_t)frag_data_prealloc * dc->frag_data_size;
+    if (arena_size > 0 && !(DEFRAG_CHECK_MEMCAP(arena_size))) {
+        SCLogWarning(SC_ERR_DEFRAG_INIT,
+                "defrag: fragment data arena of %" PRIu64 " bytes exceeds "
+                "defrag.memcap, allocating fragment data per fragment. "
+                "Memcap: %" PRIu64 ", memuse %" PRIu64 ".",
+                arena_size, SC_ATOMIC_GET(defrag_config.memcap), DefragTrackerGetMemuse());
+        frag_data_prealloc = 0;
+    } else if (arena_size > 0) {
+        dc->frag_data_pool = PoolInit((uint32_t)frag_data_prealloc, (uint32_t)frag_data_prealloc,
+                dc->frag_data_size, NULL, DefragFragDataInit, dc, NULL, NULL);
+        if (dc->frag_data_pool == NULL) {
+                FatalError(SC_ERR_FATAL,
+                           "Defrag: Failed to initialize fragment data pool.");
+        }
+        (void) SC_ATOMIC_ADD(defrag_memuse, arena_size);
+        dc->frag_data_arena_size = arena_size;
+    }
     if (SCMutexInit(&dc->frag_pool_lock, NULL) != 0) {
             FatalError(SC_ERR_FATAL,
                        "Defrag: Failed to initialize frag pool mutex.");
@@ -230,10 +363,18 @@ DefragContextNew(void)
     SCLogDebug("\tPreallocated defrag trackers: %"PRIuMAX, tracker_pool_size);
     SCLogDebug("\tMaximum fragments: %"PRIuMAX, (uintmax_t)frag_pool_size);
     SCLogDebug("\tPreallocated fragments: %"PRIuMAX, (uintmax_t)frag_pool_prealloc);
+    SCLogDebug("\tPreallocated fragment data: %"PRIuMAX" x %"PRIu32" bytes",
+            (uintmax_t)frag_data_prealloc, dc->frag_data_size);
 
     return dc;
 }
 
+static DefragContext *
+DefragContextNew(void)
+{
+    return DefragContextAlloc(false);
+}
+
 static void
 DefragContextDestroy(DefragContext *dc)
 {
@@ -241,9 +382,117 @@ DefragContextDestroy(DefragContext *dc)
         return;
 
     PoolFree(dc->frag_pool);
+    PoolFree(dc->frag_data_pool);
+    (void) SC_ATOMIC_SUB(defrag_memuse, dc->frag_data_arena_size);
+    SCMutexDestroy(&dc->frag_pool_lock);
     SCFree(dc);
 }
 
+bool DefragThreadLocalEnabled(void)
+{
+    return defrag_thread_local;
+}
+
+/**
+ * \brief Create a defrag context for a decode thread.
+ *
+ * Only valid if the capture method sends all fragments of a packet to
+ * the same thread, e.g. when load balancing on the IP pair.
+ */
+DefragContext *DefragThreadContextNew(void)
+{
+    DefragContext *dc = DefragContextAlloc(true);
+    if (dc == NULL)
+        return NULL;
+    if (DefragThreadHashInit(dc) != 0) {
+        DefragContextDestroy(dc);
+        return NULL;
+    }
+    dc->spare_max = MAX(defrag_config.prealloc / defrag_thread_shares, 1);
+
+    SCMutexLock(&defrag_thread_contexts_lock);
+    dc->next = defrag_thread_contexts;
+    defrag_thread_contexts = dc;
+    SCMutexUnlock(&defrag_thread_contexts_lock);
+    return dc;
+}
+
+void DefragThreadContextFree(DefragContext *dc)
+{
+    if (dc == NULL)
+        return;
+
+    SCMutexLock(&defrag_thread_contexts_lock);
+    DefragContext **pdc = &defrag_thread_contexts;
+    while (*pdc != NULL && *pdc != dc)
+        pdc = &(*pdc)->next;
+    if (*pdc != NULL)
+        *pdc = dc->next;
+    SCMutexUnlock(&defrag_thread_contexts_lock);
+
+    /* trackers return their fragments to the pools, free them first */
+    DefragThreadHashFree(dc);
+    DefragContextDestroy(dc);
+}
+
+/** \internal
+ *  \brief lock a thread local context for use by its own thread
+ *
+ *  Reassembly can lead to decoding a tunnel with fragments, so the owning
+ *  thread can get here again while holding the lock. */
+static inline void DefragThreadContextLock(DefragContext *dc)
+{
+    if (dc->lock_depth++ == 0)
+        SCMutexLock(&dc->frag_pool_lock);
+}
+
+static inline void DefragThreadContextUnlock(DefragContext *dc)
+{
+    if (--dc->lock_depth == 0)
+        SCMutexUnlock(&dc->frag_pool_lock);
+}
+
+/**
+ * \brief Time out the trackers of the thread local contexts.
+ *
+ * Called by the flow manager, so that a thread that doesn't see fragments
+ * anymore doesn't hold on to its trackers, fragments and memcap. Contexts
+ * in use are skipped, their thread times them out itself.
+ *
+ * \retval cnt number of timed out trackers
+ */
+uint32_t DefragThreadContextsTimeout(struct timeval *ts)
+{
+    uint32_t cnt = 0;
+
+    SCMutexLock(&defrag_thread_contexts_lock);
+    for (DefragContext *dc = defrag_thread_contexts; dc != NULL; dc = dc->next) {
+        if (SCMutexTrylock(&dc->frag_pool_lock) != 0)
+            continue;
+        cnt += DefragThreadHashTimeout(dc, ts, dc->trackers_size);
+        SCMutexUnlock(&dc->frag_pool_lock);
+    }
+    SCMutexUnlock(&defrag_thread_contexts_lock);
+    return cnt;
+}
+
+/**
+ * \internal
+ * \brief Allocate the final packet buffer for the reassembled packet
+ * up front, so data copied into it isn't copied again when it grows
+ * past the inline packet buffer.
+ */
+static int
+DefragPktReserve(Packet *rp, size_t len)
+{
+    if (len > default_packet_size && rp->ext_pkt == NULL) {
+        rp->ext_pkt = SCMalloc(MAX_PAYLOAD_SIZE);
+        if (unlikely(rp->ext_pkt == NULL))
+            return -1;
+    }
+    return 0;
+}
+
 /**
  * Attempt to re-assemble a packet.
  *
@@ -271,6 +520,10 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
         goto error_remove_tracker;
     }
 
+    /* offset of the data in the first fragment, used to size the
+     * reassembled packet */
+    const size_t data_offset = first->data_offset;
+
     /* Check that we have all the data. Relies on the fact that
      * fragments are inserted if frag_offset order. */
     Frag *frag = NULL;
@@ -297,6 +550,8 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
     rp->flags |= PKT_REBUILT_FRAGMENT;
     rp->recursion_level = p->recursion_level;
+    if (DefragPktReserve(rp, data_offset + len) != 0)
+        goto error_remove_tracker;
 
     int fragmentable_offset = 0;
     int fragmentable_len = 0;
@@ -397,6 +652,10 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
         goto error_remove_tracker;
     }
 
+    /* offset of the data in the first fragment, used to size the
+     * reassembled packet */
+    const size_t data_offset = first->data_offset;
+
     /* Check that we have all the data. Relies on the fact that
      * fragments are inserted if frag_offset order. */
     size_t len = 0;
@@ -426,14 +685,15 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
 
     /* Allocate a Packet for the reassembled packet.  On failure we
      * SCFree all the resources held by this tracker. */
-    rp = PacketDefragPktSetup(p, (uint8_t *)p->ip6h,
-            IPV6_GET_PLEN(p) + sizeof(IPV6Hdr), 0);
+    rp = PacketDefragPktSetup(p, NULL, 0, 0);
     if (rp == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate packet for "
                 "fragmentation re-assembly, dumping fragments.");
         goto error_remove_tracker;
     }
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
+    if (DefragPktReserve(rp, data_offset + len) != 0)
+        goto error_remove_tracker;
 
     int unfragmentable_len = 0;
     int fragmentable_offset = 0;
@@ -562,6 +822,8 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
     /* Address family */
     int af = tracker->af;
 
+    DefragContext *dc = DefragTrackerGetContext(tracker);
+
     /* settings for updating a payload when an ip6 fragment with
      * unfragmentable exthdrs are encountered. */
     uint32_t ip6_nh_set_offset = 0;
@@ -800,10 +1062,9 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
              * onto it. */
             if (prev->skip || prev->ltrim >= prev->data_len) {
                 RB_REMOVE(IP_FRAGMENTS, &tracker->fragment_tree, prev);
-                DefragFragReset(prev);
-                SCMutexLock(&defrag_context->frag_pool_lock);
-                PoolReturn(defrag_context->frag_pool, prev);
-                SCMutexUnlock(&defrag_context->frag_pool_lock);
+                DEFRAG_POOL_LOCK(dc);
+                DefragFragRelease(dc, prev);
+                DEFRAG_POOL_UNLOCK(dc);
             }
             break;
         }
@@ -815,10 +1076,14 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
         goto done;
     }
 
-    /* Allocate fragment and insert. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-    Frag *new = PoolGet(defrag_context->frag_pool);
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    /* Allocate fragment and its data buffer and insert. */
+    DEFRAG_POOL_LOCK(dc);
+    Frag *new = DefragFragGet(dc);
+    if (new != NULL && dc->frag_data_pool != NULL && GET_PKT_LEN(p) <= dc->frag_data_size) {
+        new->pkt = PoolGet(dc->frag_data_pool);
+        new->pkt_pooled = (new->pkt != NULL);
+    }
+    DEFRAG_POOL_UNLOCK(dc);
     if (new == NULL) {
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
@@ -827,11 +1092,12 @@ DefragInsertFrag(ThreadVars *tv, DecodeThreadVars *dtv, DefragTracker *tracker,
         }
         goto done;
     }
-    new->pkt = SCMalloc(GET_PKT_LEN(p));
+    if (new->pkt == NULL)
+        new->pkt = SCMalloc(GET_PKT_LEN(p));
     if (new->pkt == NULL) {
-        SCMutexLock(&defrag_context->frag_pool_lock);
-        PoolReturn(defrag_context->frag_pool, new);
-        SCMutexUnlock(&defrag_context->frag_pool_lock);
+        DEFRAG_POOL_LOCK(dc);
+        DefragFragRelease(dc, new);
+        DEFRAG_POOL_UNLOCK(dc);
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
         } else {
@@ -1040,6 +1306,25 @@ Defrag(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
         }
     }
 
+    if (dtv != NULL && dtv->defrag != NULL) {
+        /* thread local: only contended when the flow manager times out
+         * the trackers of this context */
+        DefragContext *dc = dtv->defrag;
+        DefragThreadContextLock(dc);
+        DefragThreadHashTimeout(dc, &p->ts, DEFRAG_THREAD_TIMEOUT_ROWS);
+
+        tracker = DefragGetTrackerFromThreadHash(dc, p);
+        if (tracker == NULL) {
+            DefragThreadContextUnlock(dc);
+            return NULL;
+        }
+
+        Packet *rp = DefragInsertFrag(tv, dtv, tracker, p);
+        DefragThreadTrackerRelease(dc, tracker, p);
+        DefragThreadContextUnlock(dc);
+        return rp;
+    }
+
     /* return a locked tracker or NULL */
     tracker = DefragGetTracker(tv, dtv, p);
     if (tracker == NULL)
@@ -1062,6 +1347,10 @@ DefragInit(void)
     /* Load the defrag-per-host lookup. */
     DefragPolicyLoadFromConfig();
 
+    /* Set up the memcap first, the fragment data arena counts
+     * against it. */
+    DefragInitConfig(false);
+
     /* Allocate the DefragContext. */
     defrag_context = DefragContextNew();
     if (defrag_context == NULL) {
@@ -1070,7 +1359,23 @@ DefragInit(void)
     }
 
     DefragSetDefaultTimeout(defrag_context->timeout);
-    DefragInitConfig(false);
+
+    intmax_t max_frags;
+    if (!ConfGetInt("defrag.max-frags", &max_frags) || max_frags <= 0 ||
+            max_frags > UINT32_MAX) {
+        max_frags = DEFAULT_DEFRAG_POOL_SIZE;
+    }
+    defrag_thread_max_frags = (uint32_t)max_frags;
+    SC_ATOMIC_INIT(defrag_thread_frags);
+
+    int enabled = 0;
+    if (ConfGetBool("defrag.thread-local", &enabled) == 1 && enabled) {
+        defrag_thread_local = true;
+        defrag_thread_shares = MAX(UtilCpuGetNumProcessorsOnline(), 1);
+        SCLogConfig("defrag: using per thread trackers");
+    } else {
+        defrag_thread_local = false;
+    }
 }
 
 void DefragDestroy(void)
@@ -1276,7 +1581,7 @@ static int DefragInOrderSimpleTest(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     DefragDestroy();
     PASS;
@@ -1328,7 +1633,7 @@ static int DefragReverseSimpleTest(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     DefragDestroy();
     PASS;
@@ -1379,7 +1684,7 @@ static int IPV6DefragInOrderSimpleTest(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     DefragDestroy();
     PASS;
@@ -1429,7 +1734,7 @@ static int IPV6DefragReverseSimpleTest(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     DefragDestroy();
     PASS;
@@ -1535,7 +1840,7 @@ static int DefragDoSturgesNovakTest(int policy, u_char *expected,
     FAIL_IF(IPV4_GET_IPLEN(reassembled) != 20 + 192);
 
     FAIL_IF(memcmp(GET_PKT_DATA(reassembled) + 20, expected, expected_len) != 0);
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     /* Make sure all frags were returned back to the pool. */
     FAIL_IF(defrag_context->frag_pool->outstanding != 0);
@@ -1646,7 +1951,7 @@ static int IPV6DefragDoSturgesNovakTest(int policy, u_char *expected,
 
     FAIL_IF(IPV6_GET_PLEN(reassembled) != 192);
 
-    SCFree(reassembled);
+    PacketFree(reassembled);
 
     /* Make sure all frags were returned to the pool. */
     FAIL_IF(defrag_context->frag_pool->outstanding != 0);
@@ -2205,7 +2510,7 @@ static int DefragVlanTest(void)
     /* With no VLAN IDs set, packets should re-assemble. */
     FAIL_IF((r = Defrag(NULL, NULL, p1)) != NULL);
     FAIL_IF((r = Defrag(NULL, NULL, p2)) == NULL);
-    SCFree(r);
+    PacketFree(r);
 
     /* With mismatched VLANs, packets should not re-assemble. */
     p1->vlan_id[0] = 1;
@@ -2237,7 +2542,7 @@ static int DefragVlanQinQTest(void)
     /* With no VLAN IDs set, packets should re-assemble. */
     FAIL_IF((r = Defrag(NULL, NULL, p1)) != NULL);
     FAIL_IF((r = Defrag(NULL, NULL, p2)) == NULL);
-    SCFree(r);
+    PacketFree(r);
 
     /* With mismatched VLANs, packets should not re-assemble. */
     p1->vlan_id[0] = 1;
@@ -2333,7 +2638,7 @@ static int DefragMfIpv4Test(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(p);
+    PacketFree(p);
     DefragDestroy();
     PASS;
 }
@@ -2376,7 +2681,7 @@ static int DefragMfIpv6Test(void)
     SCFree(p1);
     SCFree(p2);
     SCFree(p3);
-    SCFree(p);
+    PacketFree(p);
     DefragDestroy();
     PASS;
 }
@@ -2460,12 +2765,151 @@ static int DefragTestJeremyLinux(void)
     for (i = 0; i < 4; i++) {
         SCFree(packets[i]);
     }
-    SCFree(r);
+    PacketFree(r);
 
     DefragDestroy();
     PASS;
 }
 
+/**
+ * Simple in order reassembly using a thread local context.
+ */
+static int DefragThreadLocalTest(void)
+{
+    DecodeThreadVars dtv;
+    int id = 12;
+
+    memset(&dtv, 0, sizeof(dtv));
+    DefragInit();
+    dtv.defrag = DefragThreadContextNew();
+    FAIL_IF_NULL(dtv.defrag);
+
+    Packet *p1 = BuildTestPacket(IPPROTO_ICMP, id, 0, 1, 'A', 8);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = BuildTestPacket(IPPROTO_ICMP, id, 1, 1, 'B', 8);
+    FAIL_IF_NULL(p2);
+    Packet *p3 = BuildTestPacket(IPPROTO_ICMP, id, 2, 0, 'C', 3);
+    FAIL_IF_NULL(p3);
+
+    FAIL_IF(Defrag(NULL, &dtv, p1) != NULL);
+    /* fragment data is stored in the thread's arena */
+    FAIL_IF(dtv.defrag->frag_pool->outstanding != 1);
+    FAIL_IF(dtv.defrag->frag_data_pool->outstanding != 1);
+    FAIL_IF(defrag_context->frag_pool->outstanding != 0);
+    FAIL_IF(Defrag(NULL, &dtv, p2) != NULL);
+
+    Packet *reassembled = Defrag(NULL, &dtv, p3);
+    FAIL_IF_NULL(reassembled);
+    FAIL_IF(IPV4_GET_IPLEN(reassembled) != 39);
+    FAIL_IF(GET_PKT_DATA(reassembled)[20] != 'A');
+    FAIL_IF(GET_PKT_DATA(reassembled)[28] != 'B');
+    FAIL_IF(GET_PKT_DATA(reassembled)[36] != 'C');
+
+    /* tracker is recycled, all fragments are returned */
+    FAIL_IF(dtv.defrag->spare_cnt != 1);
+    FAIL_IF(dtv.defrag->frag_pool->outstanding != 0);
+    FAIL_IF(dtv.defrag->frag_data_pool->outstanding != 0);
+
+    SCFree(p1);
+    SCFree(p2);
+    SCFree(p3);
+    PacketFree(reassembled);
+
+    DefragThreadContextFree(dtv.defrag);
+    DefragDestroy();
+    PASS;
+}
+
+/**
+ * The thread local contexts share defrag.max-frags and count their
+ * fragment data arena against the memcap.
+ */
+static int DefragThreadLocalMaxFragsTest(void)
+{
+    DecodeThreadVars dtv1, dtv2;
+
+    memset(&dtv1, 0, sizeof(dtv1));
+    memset(&dtv2, 0, sizeof(dtv2));
+    DefragInit();
+    defrag_thread_max_frags = 1;
+
+    const uint64_t memuse = DefragTrackerGetMemuse();
+    dtv1.defrag = DefragThreadContextNew();
+    FAIL_IF_NULL(dtv1.defrag);
+    FAIL_IF(dtv1.defrag->frag_data_arena_size == 0);
+    FAIL_IF(DefragTrackerGetMemuse() != memuse + dtv1.defrag->frag_data_arena_size);
+    dtv2.defrag = DefragThreadContextNew();
+    FAIL_IF_NULL(dtv2.defrag);
+
+    Packet *p1 = BuildTestPacket(IPPROTO_ICMP, 1, 0, 1, 'A', 8);
+    FAIL_IF_NULL(p1);
+    Packet *p2 = BuildTestPacket(IPPROTO_ICMP, 2, 0, 1, 'B', 8);
+    FAIL_IF_NULL(p2);
+
+    FAIL_IF(Defrag(NULL, &dtv1, p1) != NULL);
+    FAIL_IF(dtv1.defrag->frag_pool->outstanding != 1);
+
+    /* the budget is used up by the other thread */
+    FAIL_IF(Defrag(NULL, &dtv2, p2) != NULL);
+    FAIL_IF_NOT(ENGINE_ISSET_EVENT(p2, IPV4_FRAG_IGNORED));
+    FAIL_IF(dtv2.defrag->frag_pool->outstanding != 0);
+
+    /* freeing the first thread's fragments returns the budget */
+    DefragThreadContextFree(dtv1.defrag);
+    FAIL_IF(SC_ATOMIC_GET(defrag_thread_frags) != 0);
+
+    DefragThreadContextFree(dtv2.defrag);
+    FAIL_IF(DefragTrackerGetMemuse() != memuse);
+
+    SCFree(p1);
+    SCFree(p2);
+    DefragDestroy();
+    PASS;
+}
+
+/**
+ * The flow manager times out the trackers of a thread that doesn't see
+ * fragments anymore, returning its share of defrag.max-frags.
+ */
+static int DefragThreadLocalTimeoutTest(void)
+{
+    DecodeThreadVars dtv;
+
+    memset(&dtv, 0, sizeof(dtv));
+    DefragInit();
+    dtv.defrag = DefragThreadContextNew();
+    FAIL_IF_NULL(dtv.defrag);
+    FAIL_IF(dtv.defrag->spare_max == 0);
+
+    Packet *p = BuildTestPacket(IPPROTO_ICMP, 1, 0, 1, 'A', 8);
+    FAIL_IF_NULL(p);
+    FAIL_IF(Defrag(NULL, &dtv, p) != NULL);
+    FAIL_IF(SC_ATOMIC_GET(defrag_thread_frags) != 1);
+    FAIL_IF(dtv.defrag->lock_depth != 0);
+
+    /* not expired yet */
+    struct timeval ts = p->ts;
+    FAIL_IF(DefragThreadContextsTimeout(&ts) != 0);
+    FAIL_IF(SC_ATOMIC_GET(defrag_thread_frags) != 1);
+
+    /* context in use by its thread is skipped */
+    ts.tv_sec += dtv.defrag->timeout + 1;
+    DefragThreadContextLock(dtv.defrag);
+    FAIL_IF(DefragThreadContextsTimeout(&ts) != 0);
+    DefragThreadContextUnlock(dtv.defrag);
+
+    FAIL_IF(DefragThreadContextsTimeout(&ts) != 1);
+    FAIL_IF(SC_ATOMIC_GET(defrag_thread_frags) != 0);
+    FAIL_IF(dtv.defrag->frag_pool->outstanding != 0);
+    FAIL_IF(dtv.defrag->spare_cnt != 1);
+
+    SCFree(p);
+    DefragThreadContextFree(dtv.defrag);
+    FAIL_IF_NOT_NULL(defrag_thread_contexts);
+    DefragDestroy();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void DefragRegisterTests(void)
@@ -2510,5 +2954,8 @@ void DefragRegisterTests(void)
     UtRegisterTest("DefragTestBadProto", DefragTestBadProto);
 
     UtRegisterTest("DefragTestJeremyLinux", DefragTestJeremyLinux);
+    UtRegisterTest("DefragThreadLocalTest", DefragThreadLocalTest);
+    UtRegisterTest("DefragThreadLocalMaxFragsTest", DefragThreadLocalMaxFragsTest);
+    UtRegisterTest("DefragThreadLocalTimeoutTest", DefragThreadLocalTimeoutTest);
 #endif /* UNITTESTS */
 }
@@ -28,14 +28,32 @@
 #include "util-pool.h"
 
 /**
- * A context for an instance of a fragmentation re-assembler, in case
- * we ever need more than one.
+ * A context for an instance of a fragmentation re-assembler. There is
+ * a global one, and one per decode thread if defrag.thread-local is
+ * enabled.
  */
 typedef struct DefragContext_ {
     Pool *frag_pool; /**< Pool of fragments. */
-    SCMutex frag_pool_lock;
+    Pool *frag_data_pool; /**< Pool of fragment data buffers. */
+    SCMutex frag_pool_lock; /**< Protects the pools. If thread local, held by the
+                             *   owning thread while it uses the context and by the
+                             *   flow manager while it times out trackers. */
+    uint32_t frag_data_size; /**< Size of the fragment data buffers. */
+    uint64_t frag_data_arena_size; /**< Bytes of the arena, counted in the memcap. */
 
     time_t timeout; /**< Default timeout. */
+
+    bool per_thread; /**< Context is owned by a single thread. */
+
+    /* tracker table of a thread local context, no locking */
+    struct DefragTracker_ **trackers;
+    uint32_t trackers_size;
+    uint32_t timeout_idx; /**< next row to check for timeouts */
+    struct DefragTracker_ *spare; /**< recycled trackers, linked by hnext */
+    uint32_t spare_cnt;
+    uint32_t spare_max;  /**< spare trackers kept, each counts against the memcap */
+    uint32_t lock_depth; /**< Defrag() recursion depth of the owning thread */
+    struct DefragContext_ *next; /**< list of thread local contexts */
 } DefragContext;
 
 /**
@@ -63,6 +81,9 @@ typedef struct Frag_ {
     uint16_t ltrim;             /**< Number of leading bytes to trim when
                                  * re-assembling the packet. */
 
+    uint8_t pkt_pooled;         /**< Frag::pkt is from the fragment data
+                                 * pool. */
+
     uint8_t *pkt;               /**< The actual packet. */
 
 #ifdef DEBUG
@@ -112,6 +133,9 @@ typedef struct DefragTracker_ {
 
     struct IP_FRAGMENTS fragment_tree;
 
+    /** owning context if thread local, NULL if in the global hash */
+    DefragContext *dc;
+
     /** hash pointers, protected by hash row mutex/spin */
     struct DefragTracker_ *hnext;
     struct DefragTracker_ *hprev;
@@ -128,6 +152,10 @@ void DefragReload(void); /**< use only in unittests */
 uint8_t DefragGetOsPolicy(Packet *);
 void DefragTrackerFreeFrags(DefragTracker *);
 Packet *Defrag(ThreadVars *, DecodeThreadVars *, Packet *);
+bool DefragThreadLocalEnabled(void);
+DefragContext *DefragThreadContextNew(void);
+void DefragThreadContextFree(DefragContext *);
+uint32_t DefragThreadContextsTimeout(struct timeval *);
 void DefragRegisterTests(void);
 
 #endif /* __DEFRAG_H__ */
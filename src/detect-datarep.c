@@ -158,6 +158,8 @@ static int DetectDatarepParse(const char *str, char *cmd, int cmd_len, char *nam
                     *type = DATASET_TYPE_SHA256;
                 } else if (strcmp(val, "string") == 0) {
                     *type = DATASET_TYPE_STRING;
+                } else if (strcmp(val, "cidr") == 0) {
+                    *type = DATASET_TYPE_CIDR;
                 } else {
                     SCLogDebug("bad type %s", val);
                     return -1;
@@ -154,6 +154,8 @@ static int DetectDatasetParse(const char *str, char *cmd, int cmd_len, char *nam
                     *type = DATASET_TYPE_SHA256;
                 } else if (strcmp(val, "string") == 0) {
                     *type = DATASET_TYPE_STRING;
+                } else if (strcmp(val, "cidr") == 0) {
+                    *type = DATASET_TYPE_CIDR;
                 } else {
                     SCLogError(SC_ERR_INVALID_SIGNATURE, "bad type %s", val);
                     return -1;
@@ -390,6 +392,14 @@ int DetectDatasetSetup (DetectEngineCtx *de_ctx, Signature *s, const char *rawst
                 "failed to set up dataset '%s'.", name);
         return -1;
     }
+    /* a cidr set rebuilds its lookup tables on every change, which is too
+     * expensive to do per packet */
+    if (set->type == DATASET_TYPE_CIDR &&
+            (cmd == DETECT_DATASET_CMD_SET || cmd == DETECT_DATASET_CMD_UNSET)) {
+        SCLogError(SC_ERR_INVALID_SIGNATURE,
+                "dataset '%s': '%s' is not supported for cidr sets", name, cmd_str);
+        return -1;
+    }
     if (set->hash && SC_ATOMIC_GET(set->hash->memcap_reached)) {
         SCLogError(SC_ERR_THASH_INIT, "dataset too large for set memcap");
         return -1;
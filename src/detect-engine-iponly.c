@@ -1531,6 +1531,14 @@ void IPOnlyPrepare(DetectEngineCtx *de_ctx)
     SCRadixPrintTree((de_ctx->io_ctx).tree_ipv6dst);
     SCLogDebug("__________________");
     */
+    /* the trees are complete, compile them for fast per packet lookups */
+    if (SCRadixCompile((de_ctx->io_ctx).tree_ipv4src) < 0 ||
+            SCRadixCompile((de_ctx->io_ctx).tree_ipv6src) < 0 ||
+            SCRadixCompile((de_ctx->io_ctx).tree_ipv4dst) < 0 ||
+            SCRadixCompile((de_ctx->io_ctx).tree_ipv6dst) < 0) {
+        SCLogWarning(SC_ERR_IPONLY_RADIX, "failed to compile ip-only radix trees, "
+                "lookups will be slower");
+    }
 }
 
 /**
@@ -259,6 +259,8 @@ enum DetectKeywordId {
     DETECT_TEMPLATE2,
     DETECT_IPV4HDR,
     DETECT_IPV6HDR,
+    DETECT_IP_SRC,
+    DETECT_IP_DST,
     DETECT_ICMPV6HDR,
     DETECT_ICMPV6MTU,
     DETECT_TCPHDR,
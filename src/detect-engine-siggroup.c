@@ -575,6 +575,34 @@ void SigGroupHeadSetFilesizeFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
     return;
 }
 
+/**
+ *  \brief Set the packet sigs flag in the sgh if it has sigs that
+ *         are not app-layer only.
+ *
+ *  \param de_ctx detection engine ctx for the signatures
+ *  \param sgh sig group head to set the flag in
+ */
+void SigGroupHeadSetPacketSigsFlag(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    if (sgh == NULL)
+        return;
+
+    for (uint32_t sig = 0; sig < sgh->init->sig_cnt; sig++) {
+        const Signature *s = sgh->init->match_array[sig];
+        if (s == NULL)
+            continue;
+
+        /* SIG_FLAG_APPLAYER is set for any rule on an app-layer protocol,
+         * so also look for packet and payload matches */
+        if (!(s->flags & SIG_FLAG_APPLAYER) || (s->flags & SIG_FLAG_REQUIRE_PACKET) ||
+                s->init_data->smlists[DETECT_SM_LIST_MATCH] != NULL ||
+                s->init_data->smlists[DETECT_SM_LIST_PMATCH] != NULL) {
+            sgh->flags |= SIG_GROUP_HEAD_HAVEPKTSIGS;
+            break;
+        }
+    }
+}
+
 /**
  *  \brief Set the need hash flag in the sgh.
  *
@@ -1102,6 +1130,62 @@ static int SigGroupHeadTest06(void)
 
     PASS;
 }
+
+static const SigGroupHead *SigGroupHeadTestBuild(DetectEngineCtx *de_ctx, const char *sig)
+{
+    if (DetectEngineAppendSig(de_ctx, sig) == NULL)
+        return NULL;
+    SigGroupBuild(de_ctx);
+
+    Packet *p = UTHBuildPacketSrcDstPorts(NULL, 0, IPPROTO_TCP, 41424, 80);
+    if (p == NULL)
+        return NULL;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+    const SigGroupHead *sgh = SigMatchSignaturesGetSgh(de_ctx, p);
+    UTHFreePackets(&p, 1);
+    return sgh;
+}
+
+/**
+ * \test app-layer protocol rules with a payload match are packet sigs
+ */
+static int SigGroupHeadTest07(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    const SigGroupHead *sgh = SigGroupHeadTestBuild(de_ctx,
+            "alert http any any -> any any (content:\"x\"; sid:1;)");
+    FAIL_IF_NULL(sgh);
+    FAIL_IF_NOT(sgh->flags & SIG_GROUP_HEAD_HAVEPKTSIGS);
+    DetectEngineCtxFree(de_ctx);
+
+    de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    sgh = SigGroupHeadTestBuild(de_ctx,
+            "alert http any any -> any any (dsize:>10; sid:1;)");
+    FAIL_IF_NULL(sgh);
+    FAIL_IF_NOT(sgh->flags & SIG_GROUP_HEAD_HAVEPKTSIGS);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
+/**
+ * \test rules that only inspect app-layer buffers are no packet sigs
+ */
+static int SigGroupHeadTest08(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    const SigGroupHead *sgh = SigGroupHeadTestBuild(de_ctx,
+            "alert http any any -> any any (http.uri; content:\"x\"; sid:1;)");
+    FAIL_IF_NULL(sgh);
+    FAIL_IF(sgh->flags & SIG_GROUP_HEAD_HAVEPKTSIGS);
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
 #endif
 
 void SigGroupHeadRegisterTests(void)
@@ -1113,5 +1197,7 @@ void SigGroupHeadRegisterTests(void)
     UtRegisterTest("SigGroupHeadTest04", SigGroupHeadTest04);
     UtRegisterTest("SigGroupHeadTest05", SigGroupHeadTest05);
     UtRegisterTest("SigGroupHeadTest06", SigGroupHeadTest06);
+    UtRegisterTest("SigGroupHeadTest07", SigGroupHeadTest07);
+    UtRegisterTest("SigGroupHeadTest08", SigGroupHeadTest08);
 #endif
 }
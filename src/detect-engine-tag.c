@@ -88,6 +88,11 @@ int TagHostHasTag(Host *host)
     return HostGetStorageById(host, host_tag_id) ? 1 : 0;
 }
 
+int TagFlowHasTag(Flow *f)
+{
+    return FlowGetStorageById(f, flow_tag_id) ? 1 : 0;
+}
+
 static DetectTagDataEntry *DetectTagDataCopy(DetectTagDataEntry *dtd)
 {
     DetectTagDataEntry *tde = SCMalloc(sizeof(DetectTagDataEntry));
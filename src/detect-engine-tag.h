@@ -55,6 +55,7 @@ void TagRestartCtx(void);
 int TagTimeoutCheck(Host *, struct timeval *);
 
 int TagHostHasTag(Host *host);
+int TagFlowHasTag(Flow *f);
 
 void DetectEngineTagRegisterTests(void);
 
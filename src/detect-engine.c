@@ -75,6 +75,7 @@
 #include "util-signal.h"
 #include "util-spm.h"
 #include "util-device.h"
+#include "util-numa.h"
 #include "util-var-name.h"
 #include "util-profiling.h"
 #include "util-validate.h"
@@ -2456,6 +2457,7 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx)
     }
     SCProfilingPrefilterDestroyCtx(de_ctx);
 #endif
+    SCProfilingSampleDestroyCtx(de_ctx);
 
     /* Normally the hashes are freed elsewhere, but
      * to be sure look at them again here.
@@ -3121,6 +3123,7 @@ static TmEcode ThreadCtxDoInit (DetectEngineCtx *de_ctx, DetectEngineThreadCtx *
     SCProfilingPrefilterThreadSetup(de_ctx->profile_prefilter_ctx, det_ctx);
     SCProfilingSghThreadSetup(de_ctx->profile_sgh_ctx, det_ctx);
 #endif
+    SCProfilingSampleThreadSetup(de_ctx, det_ctx);
     SC_ATOMIC_INIT(det_ctx->so_far_used_by_detect);
 
     return TM_ECODE_OK;
@@ -3179,6 +3182,11 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
     det_ctx->counter_alerts = StatsRegisterCounter("detect.alert", tv);
     det_ctx->counter_alerts_overflow = StatsRegisterCounter("detect.alert_queue_overflow", tv);
     det_ctx->counter_alerts_suppressed = StatsRegisterCounter("detect.alerts_suppressed", tv);
+    det_ctx->counter_body_bytes_scanned = StatsRegisterCounter("detect.body_bytes_scanned", tv);
+    det_ctx->counter_body_bytes_copied = StatsRegisterCounter("detect.body_bytes_copied", tv);
+    if (StatsLatencyHistogramsEnabled()) {
+        det_ctx->counter_tx_time = StatsRegisterHistogramCounter("detect.tx_time_ns", tv);
+    }
 #ifdef PROFILING
     det_ctx->counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     det_ctx->counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -3199,16 +3207,7 @@ TmEcode DetectEngineThreadCtxInit(ThreadVars *tv, void *initdata, void **data)
     return TM_ECODE_OK;
 }
 
-/**
- * \internal
- * \brief initialize a det_ctx for reload cases
- * \param new_de_ctx the new detection engine
- * \param mt flag to indicate if MT should be set up for this det_ctx
- *           this should only be done for the 'root' det_ctx
- *
- * \retval det_ctx detection engine thread ctx or NULL in case of error
- */
-DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
+static DetectEngineThreadCtx *ThreadCtxInitForReload(
         ThreadVars *tv, DetectEngineCtx *new_de_ctx, int mt)
 {
     DetectEngineThreadCtx *det_ctx = SCMalloc(sizeof(DetectEngineThreadCtx));
@@ -3237,6 +3236,11 @@ DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
 
     /** alert counter setup */
     det_ctx->counter_alerts = StatsRegisterCounter("detect.alert", tv);
+    det_ctx->counter_body_bytes_scanned = StatsRegisterCounter("detect.body_bytes_scanned", tv);
+    det_ctx->counter_body_bytes_copied = StatsRegisterCounter("detect.body_bytes_copied", tv);
+    if (StatsLatencyHistogramsEnabled()) {
+        det_ctx->counter_tx_time = StatsRegisterHistogramCounter("detect.tx_time_ns", tv);
+    }
 #ifdef PROFILING
     uint16_t counter_mpm_list = StatsRegisterAvgCounter("detect.mpm_list", tv);
     uint16_t counter_nonmpm_list = StatsRegisterAvgCounter("detect.nonmpm_list", tv);
@@ -3259,6 +3263,25 @@ DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
     return det_ctx;
 }
 
+/**
+ * \internal
+ * \brief initialize a det_ctx for reload cases
+ * \param new_de_ctx the new detection engine
+ * \param mt flag to indicate if MT should be set up for this det_ctx
+ *           this should only be done for the 'root' det_ctx
+ *
+ * \retval det_ctx detection engine thread ctx or NULL in case of error
+ */
+DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
+        ThreadVars *tv, DetectEngineCtx *new_de_ctx, int mt)
+{
+    /* we run in the reload thread, allocate on the node of the worker */
+    const int node = UtilNumaSetThreadNode(tv->numa_node);
+    DetectEngineThreadCtx *det_ctx = ThreadCtxInitForReload(tv, new_de_ctx, mt);
+    UtilNumaSetThreadNode(node);
+    return det_ctx;
+}
+
 static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
 {
 #if  DEBUG
@@ -3282,6 +3305,7 @@ static void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
     SCProfilingPrefilterThreadCleanup(det_ctx);
     SCProfilingSghThreadCleanup(det_ctx);
 #endif
+    SCProfilingSampleThreadCleanup(det_ctx);
 
     DetectEngineIPOnlyThreadDeinit(&det_ctx->io_ctx);
 
@@ -284,6 +284,7 @@ static inline InspectionBuffer *HttpServerBodyXformsGetDataCallback(DetectEngine
     InspectionBufferSetup(det_ctx, list_id, buffer, base_buffer->inspect, base_buffer->inspect_len);
     buffer->inspect_offset = base_buffer->inspect_offset;
     InspectionBufferApplyTransforms(buffer, transforms);
+    StatsAddUI64(det_ctx->tv, det_ctx->counter_body_bytes_copied, base_buffer->inspect_len);
     SCLogDebug("xformed buffer %p size %u", buffer, buffer->inspect_len);
     SCReturnPtr(buffer, "InspectionBuffer");
 }
@@ -371,9 +372,12 @@ static InspectionBuffer *HttpServerBodyGetDataCallback(DetectEngineThreadCtx *de
     const uint8_t *data;
     uint32_t data_len;
 
+    /* point the inspection buffer directly into the body's streaming
+     * buffer, only transforms make a copy */
     StreamingBufferGetDataAtOffset(body->sb,
             &data, &data_len, offset);
     InspectionBufferSetup(det_ctx, base_id, buffer, data, data_len);
+    StatsAddUI64(det_ctx->tv, det_ctx->counter_body_bytes_scanned, data_len);
     buffer->inspect_offset = offset;
     body->body_inspected = body->content_len_so_far;
     SCLogDebug("body->body_inspected now: %" PRIu64, body->body_inspected);
@@ -507,6 +511,7 @@ static inline InspectionBuffer *FiledataWithXformsGetDataCallback(DetectEngineTh
 
     InspectionBufferSetupMulti(buffer, transforms, base_buffer->inspect, base_buffer->inspect_len);
     buffer->inspect_offset = base_buffer->inspect_offset;
+    StatsAddUI64(det_ctx->tv, det_ctx->counter_body_bytes_copied, base_buffer->inspect_len);
     SCLogDebug("xformed buffer %p size %u", buffer, buffer->inspect_len);
     SCReturnPtr(buffer, "InspectionBuffer");
 }
@@ -573,6 +578,7 @@ static InspectionBuffer *FiledataGetDataCallback(DetectEngineThreadCtx *det_ctx,
             &data, &data_len,
             cur_file->content_inspected);
     InspectionBufferSetupMulti(buffer, NULL, data, data_len);
+    StatsAddUI64(det_ctx->tv, det_ctx->counter_body_bytes_scanned, data_len);
     SCLogDebug("[list %d] [before] buffer offset %" PRIu64 "; buffer len %" PRIu32
                "; data_len %" PRIu32 "; file_size %" PRIu64,
             list_id, buffer->inspect_offset, buffer->inspect_len, data_len, file_size);
@@ -195,6 +195,7 @@ static inline InspectionBuffer *HttpRequestBodyXformsGetDataCallback(DetectEngin
     InspectionBufferSetup(det_ctx, list_id, buffer, base_buffer->inspect, base_buffer->inspect_len);
     buffer->inspect_offset = base_buffer->inspect_offset;
     InspectionBufferApplyTransforms(buffer, transforms);
+    StatsAddUI64(det_ctx->tv, det_ctx->counter_body_bytes_copied, base_buffer->inspect_len);
     SCLogDebug("xformed buffer %p size %u", buffer, buffer->inspect_len);
     SCReturnPtr(buffer, "InspectionBuffer");
 }
@@ -282,9 +283,12 @@ static InspectionBuffer *HttpRequestBodyGetDataCallback(DetectEngineThreadCtx *d
     const uint8_t *data;
     uint32_t data_len;
 
+    /* point the inspection buffer directly into the body's streaming
+     * buffer, only transforms make a copy */
     StreamingBufferGetDataAtOffset(body->sb,
             &data, &data_len, offset);
     InspectionBufferSetup(det_ctx, base_id, buffer, data, data_len);
+    StatsAddUI64(det_ctx->tv, det_ctx->counter_body_bytes_scanned, data_len);
     buffer->inspect_offset = offset;
     body->body_inspected = body->content_len_so_far;
     SCLogDebug("body->body_inspected now: %" PRIu64, body->body_inspected);
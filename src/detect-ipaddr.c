@@ -0,0 +1,127 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Implements the ip.src and ip.dst sticky buffers. The buffer is the raw
+ * address in network byte order: 4 bytes for IPv4, 16 bytes for IPv6. It
+ * is mostly meant for use with the dataset and datarep keywords.
+ */
+
+#include "suricata-common.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-mpm.h"
+#include "detect-engine-prefilter.h"
+#include "detect-engine-content-inspection.h"
+#include "detect-ipaddr.h"
+
+static int DetectIpSrcSetup(DetectEngineCtx *, Signature *, const char *);
+static int DetectIpDstSetup(DetectEngineCtx *, Signature *, const char *);
+
+static int g_ip_src_buffer_id = 0;
+static int g_ip_dst_buffer_id = 0;
+
+static InspectionBuffer *GetDataSrc(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Packet *p, const int list_id);
+static InspectionBuffer *GetDataDst(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Packet *p, const int list_id);
+
+/**
+ * \brief Registration function for the ip.src: and ip.dst: keywords
+ */
+void DetectIpAddrRegister(void)
+{
+    sigmatch_table[DETECT_IP_SRC].name = "ip.src";
+    sigmatch_table[DETECT_IP_SRC].desc = "sticky buffer to match on the source IP address";
+    sigmatch_table[DETECT_IP_SRC].url = "/rules/header-keywords.html#ip-src-ip-dst";
+    sigmatch_table[DETECT_IP_SRC].Setup = DetectIpSrcSetup;
+    sigmatch_table[DETECT_IP_SRC].flags |= SIGMATCH_NOOPT | SIGMATCH_INFO_STICKY_BUFFER;
+
+    sigmatch_table[DETECT_IP_DST].name = "ip.dst";
+    sigmatch_table[DETECT_IP_DST].desc = "sticky buffer to match on the destination IP address";
+    sigmatch_table[DETECT_IP_DST].url = "/rules/header-keywords.html#ip-src-ip-dst";
+    sigmatch_table[DETECT_IP_DST].Setup = DetectIpDstSetup;
+    sigmatch_table[DETECT_IP_DST].flags |= SIGMATCH_NOOPT | SIGMATCH_INFO_STICKY_BUFFER;
+
+    g_ip_src_buffer_id = DetectBufferTypeRegister("ip.src");
+    BUG_ON(g_ip_src_buffer_id < 0);
+    DetectBufferTypeSupportsPacket("ip.src");
+    DetectPktMpmRegister("ip.src", 2, PrefilterGenericMpmPktRegister, GetDataSrc);
+    DetectPktInspectEngineRegister("ip.src", GetDataSrc, DetectEngineInspectPktBufferGeneric);
+
+    g_ip_dst_buffer_id = DetectBufferTypeRegister("ip.dst");
+    BUG_ON(g_ip_dst_buffer_id < 0);
+    DetectBufferTypeSupportsPacket("ip.dst");
+    DetectPktMpmRegister("ip.dst", 2, PrefilterGenericMpmPktRegister, GetDataDst);
+    DetectPktInspectEngineRegister("ip.dst", GetDataDst, DetectEngineInspectPktBufferGeneric);
+}
+
+static int DetectIpSrcSetup(DetectEngineCtx *de_ctx, Signature *s, const char *_unused)
+{
+    s->flags |= SIG_FLAG_REQUIRE_PACKET;
+
+    if (DetectBufferSetActiveList(s, g_ip_src_buffer_id) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int DetectIpDstSetup(DetectEngineCtx *de_ctx, Signature *s, const char *_unused)
+{
+    s->flags |= SIG_FLAG_REQUIRE_PACKET;
+
+    if (DetectBufferSetActiveList(s, g_ip_dst_buffer_id) < 0)
+        return -1;
+
+    return 0;
+}
+
+static InspectionBuffer *GetDataAddress(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, const Address *a, const int list_id)
+{
+    InspectionBuffer *buffer = InspectionBufferGet(det_ctx, list_id);
+    if (buffer->inspect == NULL) {
+        uint32_t data_len;
+        if (a->family == AF_INET)
+            data_len = 4;
+        else if (a->family == AF_INET6)
+            data_len = 16;
+        else
+            return NULL;
+
+        InspectionBufferSetup(det_ctx, list_id, buffer, a->addr_data8, data_len);
+        InspectionBufferApplyTransforms(buffer, transforms);
+    }
+
+    return buffer;
+}
+
+static InspectionBuffer *GetDataSrc(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Packet *p, const int list_id)
+{
+    return GetDataAddress(det_ctx, transforms, &p->src, list_id);
+}
+
+static InspectionBuffer *GetDataDst(DetectEngineThreadCtx *det_ctx,
+        const DetectEngineTransforms *transforms, Packet *p, const int list_id)
+{
+    return GetDataAddress(det_ctx, transforms, &p->dst, list_id);
+}
@@ -59,6 +59,7 @@
 
 #include "util-validate.h"
 #include "util-detect.h"
+#include "util-time.h"
 
 typedef struct DetectRunScratchpad {
     const AppProto alproto;
@@ -745,9 +746,7 @@ static inline void DetectRulePacketRules(
     while (match_cnt--) {
         RULE_PROFILING_START(p);
         uint8_t alert_flags = 0;
-#ifdef PROFILING
         bool smatch = false; /* signature match */
-#endif
         s = next_s;
         sflags = next_sflags;
         if (match_cnt) {
@@ -791,9 +790,7 @@ static inline void DetectRulePacketRules(
             goto next;
         }
 
-#ifdef PROFILING
         smatch = true;
-#endif
         DetectRunPostMatch(tv, det_ctx, p, s);
 
         AlertQueueAppend(det_ctx, s, p, 0, alert_flags);
@@ -1323,6 +1320,8 @@ static void DetectRunTx(ThreadVars *tv,
         }
         tx_id_min = tx.tx_id + 1; // next look for cur + 1
 
+        const uint64_t tx_start_ns = det_ctx->counter_tx_time ? TimeGetMonotonicNs() : 0;
+
         bool do_sort = false; // do we need to sort the tx candidate list?
         uint32_t array_idx = 0;
         uint32_t total_rules = det_ctx->match_array_cnt;
@@ -1531,6 +1530,9 @@ static void DetectRunTx(ThreadVars *tv,
 
             StoreDetectFlags(&tx, flow_flags, ipproto, alproto, new_detect_flags);
         }
+        if (det_ctx->counter_tx_time) {
+            StatsHistogramAdd(tv, det_ctx->counter_tx_time, TimeGetMonotonicNs() - tx_start_ns);
+        }
 next:
         InspectionBufferClean(det_ctx);
 
@@ -1756,11 +1758,18 @@ TmEcode Detect(ThreadVars *tv, Packet *p, void *data)
         de_ctx = det_ctx->de_ctx;
     }
 
+    /* sampled profiling: time the rules and keywords of 1 in 'rate' packets */
+    const bool sampled =
+            det_ctx->profile_sample_data != NULL && SCProfilingSampleStart(det_ctx);
+
     if (p->flow) {
         DetectFlow(tv, de_ctx, det_ctx, p);
     } else {
         DetectNoFlow(tv, de_ctx, det_ctx, p);
     }
+
+    if (sampled)
+        SCProfilingSampleEnd(det_ctx, p);
     return TM_ECODE_OK;
 error:
     return TM_ECODE_FAILED;
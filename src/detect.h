@@ -921,6 +921,8 @@ typedef struct DetectEngineCtx_ {
     struct SCProfileSghDetectCtx_ *profile_sgh_ctx;
     uint32_t profile_match_logging_threshold;
 #endif
+    /** sampled profiling, see util-profiling-sampling.c */
+    struct SCProfileSampleDetectCtx_ *profile_sample_ctx;
     uint32_t prefilter_maxid;
 
     char config_prefix[64];
@@ -1081,6 +1083,12 @@ typedef struct DetectEngineThreadCtx_ {
     uint16_t counter_alerts_overflow;
     /** id for suppressed alerts counter */
     uint16_t counter_alerts_suppressed;
+    /** id for counter of body bytes inspected in place */
+    uint16_t counter_body_bytes_scanned;
+    /** id for counter of body bytes copied for transforms */
+    uint16_t counter_body_bytes_copied;
+    /** id for histogram of the inspection time per tx, 0 if disabled */
+    uint16_t counter_tx_time;
 #ifdef PROFILING
     uint16_t counter_mpm_list;
     uint16_t counter_nonmpm_list;
@@ -1209,6 +1217,8 @@ typedef struct DetectEngineThreadCtx_ {
     struct SCProfilePrefilterData_ *prefilter_perf_data;
     int prefilter_perf_size;
 #endif
+    /** sampled profiling, NULL if disabled */
+    struct SCProfileSampleThreadData_ *profile_sample_data;
 } DetectEngineThreadCtx;
 
 /** \brief element in sigmatch type table.
@@ -1278,6 +1288,8 @@ enum {
 };
 
 #define SIG_GROUP_HEAD_HAVERAWSTREAM    BIT_U32(0)
+/** sgh has sigs that can match on packets after the app-layer is done */
+#define SIG_GROUP_HEAD_HAVEPKTSIGS      BIT_U32(1)
 #ifdef HAVE_MAGIC
 #define SIG_GROUP_HEAD_HAVEFILEMAGIC    BIT_U32(20)
 #endif
@@ -0,0 +1,542 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per flow accounting of the CPU ticks spent by the worker threads.
+ *
+ * When enabled, the flow worker accounts the ticks it spends on a packet
+ * per stage (decode, flow, stream, app-layer, detect, output) to a
+ * FlowCost kept in the flow storage. The totals are added to the flow
+ * record in EVE and, when the flow ends, to a global report of the
+ * costliest flows, app-layer protocols and rule groups that is returned
+ * by the 'flow-cost-report' unix socket command.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "decode.h"
+#include "detect.h"
+#include "flow.h"
+#include "flow-cost.h"
+#include "flow-storage.h"
+#include "flow-util.h"
+#include "flow-private.h"
+#include "app-layer-protos.h"
+#include "util-print.h"
+#include "util-proto-name.h"
+#include "util-unittest.h"
+
+#define FLOW_COST_DEFAULT_TOP 20
+#define FLOW_COST_MAX_TOP     1000
+
+static const char * const flow_cost_stage_names[FLOW_COST_STAGE_MAX] = {
+    "decode",
+    "flow",
+    "stream",
+    "app_layer",
+    "detect",
+    "output",
+};
+
+typedef struct FlowCostTopFlow_ {
+    int64_t flow_id;
+    uint64_t total;
+    uint64_t ticks[FLOW_COST_STAGE_MAX];
+    FlowAddress src;
+    FlowAddress dst;
+    int family;
+    Port sp;
+    Port dp;
+    uint8_t proto;
+    AppProto alproto;
+} FlowCostTopFlow;
+
+typedef struct FlowCostAppProto_ {
+    uint64_t flows;
+    uint64_t ticks[FLOW_COST_STAGE_MAX];
+} FlowCostAppProto;
+
+typedef struct FlowCostSgh_ {
+    uint64_t flows;
+    uint64_t ticks;
+} FlowCostSgh;
+
+/** costs of the flows that ended */
+typedef struct FlowCostReport_ {
+    SCMutex m;
+    uint64_t flows;
+    uint64_t ticks[FLOW_COST_STAGE_MAX];
+    uint32_t top_size; /**< max number of entries in top */
+    uint32_t top_cnt;
+    FlowCostTopFlow *top;
+    FlowCostAppProto alprotos[ALPROTO_MAX];
+    /** rule groups of the detect engine with version 'de_version' */
+    uint32_t de_version;
+    uint32_t sghs_size;
+    FlowCostSgh *sghs;
+} FlowCostReport;
+
+bool g_flow_cost_enabled = false;
+static FlowStorageId g_flow_cost_storage_id = { .id = -1 };
+static FlowCostReport flow_cost_report = { .m = SCMUTEX_INITIALIZER };
+
+static void FlowCostFree(void *x)
+{
+    if (x != NULL) {
+        SCFree(x);
+        FLOW_DECR_MEMUSE(sizeof(FlowCost));
+    }
+}
+
+void FlowCostRegisterFlowStorage(void)
+{
+    ConfNode *conf = ConfGetNode("flow.cost-accounting");
+    if (conf == NULL || !ConfNodeChildValueIsTrue(conf, "enabled"))
+        return;
+
+    intmax_t top = FLOW_COST_DEFAULT_TOP;
+    if (ConfGetChildValueInt(conf, "top", &top) == 1 && (top < 1 || top > FLOW_COST_MAX_TOP)) {
+        FatalError(SC_ERR_INVALID_ARGUMENT,
+                "flow.cost-accounting.top must be between 1 and %d", FLOW_COST_MAX_TOP);
+    }
+
+    flow_cost_report.top = SCCalloc(top, sizeof(FlowCostTopFlow));
+    if (flow_cost_report.top == NULL) {
+        FatalError(SC_ERR_MEM_ALLOC, "failed to allocate flow cost report");
+    }
+    flow_cost_report.top_size = (uint32_t)top;
+
+    g_flow_cost_storage_id = FlowStorageRegister("cost", sizeof(void *), NULL, FlowCostFree);
+    if (g_flow_cost_storage_id.id == -1) {
+        FatalError(SC_ERR_FLOW_INIT, "failed to register flow cost storage");
+    }
+    g_flow_cost_enabled = true;
+    SCLogConfig("flow cost accounting enabled, reporting the top %u flows", (uint32_t)top);
+}
+
+/**
+ *  \brief get the cost of a flow, allocating it if needed
+ *
+ *  \retval fc cost or NULL if the flow memcap is reached
+ */
+FlowCost *FlowCostGet(Flow *f)
+{
+    FlowCost *fc = FlowGetStorageById(f, g_flow_cost_storage_id);
+    if (likely(fc != NULL))
+        return fc;
+
+    if (!FLOW_CHECK_MEMCAP(sizeof(FlowCost)))
+        return NULL;
+    fc = SCCalloc(1, sizeof(FlowCost));
+    if (unlikely(fc == NULL))
+        return NULL;
+    FLOW_INCR_MEMUSE(sizeof(FlowCost));
+    FlowSetStorageById(f, g_flow_cost_storage_id, fc);
+    return fc;
+}
+
+void FlowCostAddTicks(Flow *f, enum FlowCostStage stage, uint64_t ticks)
+{
+    FlowCost *fc = FlowCostGet(f);
+    if (fc != NULL)
+        fc->ticks[stage] += ticks;
+}
+
+/**
+ *  \brief account the detection of a packet
+ *
+ *  Besides the stage ticks, the ticks are accounted per direction to the
+ *  rule group the packet was inspected with. Rule groups of tenants are
+ *  not tracked.
+ */
+void FlowCostDetectEnd(FlowCost *fc, const Packet *p, void *detect_thread, uint64_t *ticks)
+{
+    const uint64_t before = fc->ticks[FLOW_COST_DETECT];
+    FlowCostStageEnd(fc, FLOW_COST_DETECT, ticks);
+
+    const int dir = (p->flowflags & FLOW_PKT_TOSERVER) ? 0 : 1;
+    fc->detect_ticks[dir] += fc->ticks[FLOW_COST_DETECT] - before;
+
+    const DetectEngineThreadCtx *det_ctx = detect_thread;
+    const SigGroupHead *sgh = dir == 0 ? p->flow->sgh_toserver : p->flow->sgh_toclient;
+    if (sgh != NULL && p->tenant_id == 0 && det_ctx != NULL && det_ctx->de_ctx != NULL) {
+        fc->sgh_id[dir] = sgh->id;
+        fc->de_version = det_ctx->de_ctx->version;
+        fc->sgh_set |= BIT_U8(dir);
+    }
+}
+
+static uint64_t FlowCostTotal(const uint64_t *ticks)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < FLOW_COST_STAGE_MAX; i++) {
+        total += ticks[i];
+    }
+    return total;
+}
+
+static void FlowCostReportAddSgh(FlowCostReport *r, uint32_t version, uint32_t id, uint64_t ticks)
+{
+    /* a newer ruleset was loaded, its rule groups have different ids */
+    if (version != r->de_version) {
+        if (version < r->de_version)
+            return;
+        if (r->sghs != NULL)
+            memset(r->sghs, 0, r->sghs_size * sizeof(FlowCostSgh));
+        r->de_version = version;
+    }
+    if (id >= r->sghs_size) {
+        const uint32_t size = (id + 64) & ~63U;
+        FlowCostSgh *sghs = SCRealloc(r->sghs, size * sizeof(FlowCostSgh));
+        if (sghs == NULL)
+            return;
+        memset(sghs + r->sghs_size, 0, (size - r->sghs_size) * sizeof(FlowCostSgh));
+        r->sghs = sghs;
+        r->sghs_size = size;
+    }
+    r->sghs[id].flows++;
+    r->sghs[id].ticks += ticks;
+}
+
+/** \internal
+ *  \brief add an ended flow to the report
+ *  \note report lock must be held */
+static void FlowCostReportAdd(FlowCostReport *r, const FlowCostTopFlow *entry, const FlowCost *fc)
+{
+    r->flows++;
+    for (int i = 0; i < FLOW_COST_STAGE_MAX; i++) {
+        r->ticks[i] += entry->ticks[i];
+    }
+    if (entry->alproto < ALPROTO_MAX) {
+        FlowCostAppProto *a = &r->alprotos[entry->alproto];
+        a->flows++;
+        for (int i = 0; i < FLOW_COST_STAGE_MAX; i++) {
+            a->ticks[i] += entry->ticks[i];
+        }
+    }
+
+    if (r->top_cnt < r->top_size) {
+        r->top[r->top_cnt++] = *entry;
+    } else if (r->top_size > 0) {
+        uint32_t min = 0;
+        for (uint32_t i = 1; i < r->top_cnt; i++) {
+            if (r->top[i].total < r->top[min].total)
+                min = i;
+        }
+        if (entry->total > r->top[min].total)
+            r->top[min] = *entry;
+    }
+
+    for (int dir = 0; dir < 2; dir++) {
+        if (fc->sgh_set & BIT_U8(dir))
+            FlowCostReportAddSgh(r, fc->de_version, fc->sgh_id[dir], fc->detect_ticks[dir]);
+    }
+}
+
+/**
+ *  \brief add the cost of a flow that is being cleared to the report
+ */
+void FlowCostFlowEnd(Flow *f)
+{
+    const FlowCost *fc = FlowGetStorageById(f, g_flow_cost_storage_id);
+    if (fc == NULL)
+        return;
+
+    FlowCostTopFlow entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.flow_id = FlowGetId(f);
+    memcpy(entry.ticks, fc->ticks, sizeof(entry.ticks));
+    entry.total = FlowCostTotal(fc->ticks);
+    entry.src = f->src;
+    entry.dst = f->dst;
+    entry.family = FLOW_IS_IPV4(f) ? AF_INET : (FLOW_IS_IPV6(f) ? AF_INET6 : 0);
+    entry.sp = f->sp;
+    entry.dp = f->dp;
+    entry.proto = f->proto;
+    entry.alproto = f->alproto;
+
+    SCMutexLock(&flow_cost_report.m);
+    FlowCostReportAdd(&flow_cost_report, &entry, fc);
+    SCMutexUnlock(&flow_cost_report.m);
+}
+
+void EveAddFlowCost(Flow *f, JsonBuilder *js)
+{
+    if (!g_flow_cost_enabled)
+        return;
+    const FlowCost *fc = FlowGetStorageById(f, g_flow_cost_storage_id);
+    if (fc == NULL)
+        return;
+
+    jb_open_object(js, "cpu_ticks");
+    for (int i = 0; i < FLOW_COST_STAGE_MAX; i++) {
+        jb_set_uint(js, flow_cost_stage_names[i], fc->ticks[i]);
+    }
+    jb_set_uint(js, "total", FlowCostTotal(fc->ticks));
+    jb_close(js);
+}
+
+static json_t *FlowCostTicksToJSON(const uint64_t *ticks)
+{
+    json_t *js = json_object();
+    if (js == NULL)
+        return NULL;
+    for (int i = 0; i < FLOW_COST_STAGE_MAX; i++) {
+        json_object_set_new(js, flow_cost_stage_names[i], json_integer(ticks[i]));
+    }
+    return js;
+}
+
+static int FlowCostTopFlowCompare(const void *a, const void *b)
+{
+    const FlowCostTopFlow *f0 = a;
+    const FlowCostTopFlow *f1 = b;
+    if (f0->total == f1->total)
+        return 0;
+    return f1->total > f0->total ? 1 : -1;
+}
+
+static json_t *FlowCostTopFlowToJSON(const FlowCostTopFlow *e)
+{
+    json_t *js = json_object();
+    if (js == NULL)
+        return NULL;
+
+    char srcip[46] = "", dstip[46] = "";
+    if (e->family == AF_INET) {
+        PrintInet(AF_INET, (const void *)&e->src.addr_data32[0], srcip, sizeof(srcip));
+        PrintInet(AF_INET, (const void *)&e->dst.addr_data32[0], dstip, sizeof(dstip));
+    } else if (e->family == AF_INET6) {
+        PrintInet(AF_INET6, (const void *)&e->src.address, srcip, sizeof(srcip));
+        PrintInet(AF_INET6, (const void *)&e->dst.address, dstip, sizeof(dstip));
+    }
+    json_object_set_new(js, "flow_id", json_integer(e->flow_id));
+    json_object_set_new(js, "src_ip", json_string(srcip));
+    json_object_set_new(js, "src_port", json_integer(e->sp));
+    json_object_set_new(js, "dest_ip", json_string(dstip));
+    json_object_set_new(js, "dest_port", json_integer(e->dp));
+    if (SCProtoNameValid(e->proto)) {
+        json_object_set_new(js, "proto", json_string(known_proto[e->proto]));
+    } else {
+        char proto[4];
+        snprintf(proto, sizeof(proto), "%03" PRIu32, e->proto);
+        json_object_set_new(js, "proto", json_string(proto));
+    }
+    json_object_set_new(js, "app_proto", json_string(AppProtoToString(e->alproto)));
+    json_object_set_new(js, "ticks_total", json_integer(e->total));
+    json_object_set_new(js, "ticks", FlowCostTicksToJSON(e->ticks));
+    return js;
+}
+
+/** \internal
+ *  \brief compare (key, index) pairs by decreasing key */
+static int FlowCostKeyCompare(const void *a, const void *b)
+{
+    const uint64_t *k0 = a;
+    const uint64_t *k1 = b;
+    if (k0[0] == k1[0])
+        return 0;
+    return k1[0] > k0[0] ? 1 : -1;
+}
+
+/**
+ *  \brief unix socket command returning the report of the costliest flows,
+ *         app-layer protocols and rule groups
+ */
+TmEcode FlowCostReportCommand(json_t *cmd, json_t *answer, void *data)
+{
+    if (!g_flow_cost_enabled) {
+        json_object_set_new(answer, "message",
+                json_string("flow cost accounting is disabled, see flow.cost-accounting"));
+        return TM_ECODE_FAILED;
+    }
+
+    FlowCostReport *r = &flow_cost_report;
+    json_t *js = json_object();
+    json_t *js_top = json_array();
+    json_t *js_alprotos = json_array();
+    json_t *js_sghs = json_array();
+    /* pairs of key and index */
+    uint64_t (*keys)[2] = SCCalloc(MAX(ALPROTO_MAX, r->top_size), sizeof(*keys));
+    if (js == NULL || js_top == NULL || js_alprotos == NULL || js_sghs == NULL || keys == NULL)
+        goto error;
+
+    SCMutexLock(&r->m);
+    json_object_set_new(js, "flows", json_integer(r->flows));
+    json_object_set_new(js, "ticks_total", json_integer(FlowCostTotal(r->ticks)));
+    json_object_set_new(js, "ticks", FlowCostTicksToJSON(r->ticks));
+
+    FlowCostTopFlow *top = SCMalloc(r->top_size * sizeof(FlowCostTopFlow));
+    const uint32_t top_cnt = top ? r->top_cnt : 0;
+    if (top != NULL)
+        memcpy(top, r->top, top_cnt * sizeof(FlowCostTopFlow));
+
+    uint32_t alproto_cnt = 0;
+    for (AppProto a = 0; a < ALPROTO_MAX; a++) {
+        if (r->alprotos[a].flows == 0)
+            continue;
+        keys[alproto_cnt][0] = FlowCostTotal(r->alprotos[a].ticks);
+        keys[alproto_cnt][1] = a;
+        alproto_cnt++;
+    }
+    qsort(keys, alproto_cnt, sizeof(*keys), FlowCostKeyCompare);
+    for (uint32_t i = 0; i < alproto_cnt; i++) {
+        const FlowCostAppProto *a = &r->alprotos[keys[i][1]];
+        json_t *jsa = json_object();
+        if (jsa == NULL)
+            break;
+        json_object_set_new(jsa, "app_proto", json_string(AppProtoToString((AppProto)keys[i][1])));
+        json_object_set_new(jsa, "flows", json_integer(a->flows));
+        json_object_set_new(jsa, "ticks_total", json_integer(keys[i][0]));
+        json_object_set_new(jsa, "ticks", FlowCostTicksToJSON(a->ticks));
+        json_array_append_new(js_alprotos, jsa);
+    }
+
+    /* top rule groups by detection ticks */
+    uint32_t sgh_cnt = 0;
+    memset(keys, 0, MAX(ALPROTO_MAX, r->top_size) * sizeof(*keys));
+    for (uint32_t id = 0; id < r->sghs_size; id++) {
+        if (r->sghs[id].flows == 0)
+            continue;
+        uint32_t slot = sgh_cnt;
+        if (sgh_cnt == r->top_size) {
+            /* replace the cheapest entry */
+            slot = 0;
+            for (uint32_t i = 1; i < sgh_cnt; i++) {
+                if (keys[i][0] < keys[slot][0])
+                    slot = i;
+            }
+            if (r->sghs[id].ticks <= keys[slot][0])
+                continue;
+        } else {
+            sgh_cnt++;
+        }
+        keys[slot][0] = r->sghs[id].ticks;
+        keys[slot][1] = id;
+    }
+    qsort(keys, sgh_cnt, sizeof(*keys), FlowCostKeyCompare);
+    for (uint32_t i = 0; i < sgh_cnt; i++) {
+        json_t *jss = json_object();
+        if (jss == NULL)
+            break;
+        json_object_set_new(jss, "id", json_integer(keys[i][1]));
+        json_object_set_new(jss, "flows", json_integer(r->sghs[keys[i][1]].flows));
+        json_object_set_new(jss, "ticks_detect", json_integer(keys[i][0]));
+        json_array_append_new(js_sghs, jss);
+    }
+    SCMutexUnlock(&r->m);
+
+    if (top != NULL) {
+        qsort(top, top_cnt, sizeof(FlowCostTopFlow), FlowCostTopFlowCompare);
+        for (uint32_t i = 0; i < top_cnt; i++) {
+            json_t *jsf = FlowCostTopFlowToJSON(&top[i]);
+            if (jsf == NULL)
+                break;
+            json_array_append_new(js_top, jsf);
+        }
+        SCFree(top);
+    }
+    SCFree(keys);
+
+    json_object_set_new(js, "top_flows", js_top);
+    json_object_set_new(js, "app_protos", js_alprotos);
+    json_object_set_new(js, "rule_groups", js_sghs);
+    json_object_set_new(answer, "message", js);
+    return TM_ECODE_OK;
+
+error:
+    json_decref(js);
+    json_decref(js_top);
+    json_decref(js_alprotos);
+    json_decref(js_sghs);
+    SCFree(keys);
+    json_object_set_new(answer, "message", json_string("memory allocation failed"));
+    return TM_ECODE_FAILED;
+}
+
+#ifdef UNITTESTS
+
+static int FlowCostTest01(void)
+{
+    FlowCostReport r;
+    memset(&r, 0, sizeof(r));
+    FlowCostTopFlow top[2];
+    r.top = top;
+    r.top_size = 2;
+
+    FlowCost fc;
+    memset(&fc, 0, sizeof(fc));
+    FlowCostTopFlow e;
+    memset(&e, 0, sizeof(e));
+    e.alproto = ALPROTO_HTTP1;
+
+    uint64_t totals[] = { 10, 30, 20, 5 };
+    for (int i = 0; i < 4; i++) {
+        e.flow_id = i;
+        e.ticks[FLOW_COST_DETECT] = totals[i];
+        e.total = totals[i];
+        FlowCostReportAdd(&r, &e, &fc);
+    }
+    FAIL_IF(r.flows != 4);
+    FAIL_IF(r.ticks[FLOW_COST_DETECT] != 65);
+    FAIL_IF(r.alprotos[ALPROTO_HTTP1].flows != 4);
+    FAIL_IF(r.alprotos[ALPROTO_HTTP1].ticks[FLOW_COST_DETECT] != 65);
+
+    /* the 2 most expensive flows are kept */
+    FAIL_IF(r.top_cnt != 2);
+    FAIL_IF(!((top[0].flow_id == 1 && top[1].flow_id == 2) ||
+              (top[0].flow_id == 2 && top[1].flow_id == 1)));
+    PASS;
+}
+
+static int FlowCostTest02(void)
+{
+    FlowCostReport r;
+    memset(&r, 0, sizeof(r));
+
+    FlowCostReportAddSgh(&r, 1, 3, 100);
+    FlowCostReportAddSgh(&r, 1, 3, 50);
+    FlowCostReportAddSgh(&r, 1, 70, 10);
+    FAIL_IF(r.sghs_size < 71);
+    FAIL_IF(r.sghs[3].flows != 2 || r.sghs[3].ticks != 150);
+    FAIL_IF(r.sghs[70].flows != 1);
+
+    /* flows of an older ruleset are ignored */
+    FlowCostReportAddSgh(&r, 0, 3, 100);
+    FAIL_IF(r.sghs[3].ticks != 150);
+
+    /* a newer ruleset resets the rule groups */
+    FlowCostReportAddSgh(&r, 2, 4, 7);
+    FAIL_IF(r.de_version != 2);
+    FAIL_IF(r.sghs[3].flows != 0);
+    FAIL_IF(r.sghs[4].ticks != 7);
+
+    SCFree(r.sghs);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void FlowCostRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowCostTest01", FlowCostTest01);
+    UtRegisterTest("FlowCostTest02", FlowCostTest02);
+#endif
+}
@@ -0,0 +1,75 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Per flow accounting of the CPU ticks spent by the worker threads.
+ */
+
+#ifndef __FLOW_COST_H__
+#define __FLOW_COST_H__
+
+#include "flow.h"
+#include "rust.h"
+#include "util-cpu.h"
+
+enum FlowCostStage {
+    FLOW_COST_DECODE = 0,
+    FLOW_COST_FLOW,     /**< flow lookup and update */
+    FLOW_COST_STREAM,   /**< tcp tracking and reassembly */
+    FLOW_COST_APPLAYER, /**< protocol detection and parsing */
+    FLOW_COST_DETECT,
+    FLOW_COST_OUTPUT,
+    FLOW_COST_STAGE_MAX,
+};
+
+typedef struct FlowCost_ {
+    uint64_t ticks[FLOW_COST_STAGE_MAX];
+    /** detection ticks per direction, 0 is to server */
+    uint64_t detect_ticks[2];
+    /** rule group used per direction and the version of its detect engine */
+    uint32_t sgh_id[2];
+    uint32_t de_version;
+    uint8_t sgh_set; /**< bit per direction that has a rule group */
+} FlowCost;
+
+extern bool g_flow_cost_enabled;
+
+void FlowCostRegisterFlowStorage(void);
+
+FlowCost *FlowCostGet(Flow *f);
+void FlowCostAddTicks(Flow *f, enum FlowCostStage stage, uint64_t ticks);
+void FlowCostDetectEnd(FlowCost *fc, const Packet *p, void *detect_thread, uint64_t *ticks);
+void FlowCostFlowEnd(Flow *f);
+
+void EveAddFlowCost(Flow *f, JsonBuilder *js);
+TmEcode FlowCostReportCommand(json_t *cmd, json_t *answer, void *data);
+
+void FlowCostRegisterTests(void);
+
+/**
+ *  \brief account the ticks since *ticks to a stage and restart the clock
+ */
+static inline void FlowCostStageEnd(FlowCost *fc, enum FlowCostStage stage, uint64_t *ticks)
+{
+    const uint64_t now = UtilCpuGetTicks();
+    fc->ticks[stage] += now - *ticks;
+    *ticks = now;
+}
+
+#endif /* __FLOW_COST_H__ */
@@ -58,8 +58,78 @@ FlowBucket *flow_hash;
 SC_ATOMIC_EXTERN(unsigned int, flow_prune_idx);
 SC_ATOMIC_EXTERN(unsigned int, flow_flags);
 
+/** number of shards the hash is split in, 0 if not sharded */
+static uint16_t flow_hash_shards = 0;
+/** shard of the capture thread, set by the capture method */
+static thread_local int flow_hash_thread_shard = -1;
+
 static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv, const struct timeval *ts);
 
+/**
+ *  \brief split the flow hash in shards
+ *
+ *  Used by capture methods that guarantee both directions of a flow are
+ *  received by the same thread, like symmetric RSS in workers mode. Each
+ *  thread then only looks up and adds flows in its own part of the hash,
+ *  so the buckets are never contended. The flow manager is not affected:
+ *  it still walks the whole hash.
+ *
+ *  Must be called before the packet threads are started.
+ */
+void FlowHashSetShards(uint16_t shards)
+{
+    if (shards > flow_config.hash_size)
+        shards = (uint16_t)flow_config.hash_size;
+    flow_hash_shards = shards;
+    if (shards > 1) {
+        SCLogConfig("flow hash split in %u shards of %u buckets", shards,
+                flow_config.hash_size / shards);
+    }
+}
+
+/**
+ *  \brief set the flow hash shard of the calling thread
+ *
+ *  Called by the capture method from its thread init. The flow worker
+ *  of the same thread picks it up in FlowHashShardLookupInit().
+ */
+void FlowHashSetThreadShard(uint16_t shard)
+{
+    flow_hash_thread_shard = shard;
+}
+
+/**
+ *  \brief set up the lookup of a thread to use its shard, if any
+ */
+void FlowHashShardLookupInit(FlowLookupStruct *fls)
+{
+    fls->shard_base = 0;
+    fls->shard_size = 0;
+
+    if (flow_hash_shards <= 1 || flow_hash_thread_shard < 0)
+        return;
+    if (flow_hash_thread_shard >= flow_hash_shards) {
+        SCLogWarning(SC_ERR_INVALID_VALUE,
+                "flow hash shard %d out of range, using the whole hash",
+                flow_hash_thread_shard);
+        return;
+    }
+
+    fls->shard_size = flow_config.hash_size / flow_hash_shards;
+    fls->shard_base = (uint32_t)flow_hash_thread_shard * fls->shard_size;
+    SCLogDebug("flow hash shard %d: buckets %u-%u", flow_hash_thread_shard,
+            fls->shard_base, fls->shard_base + fls->shard_size - 1);
+}
+
+/** \internal
+ *  \brief get the bucket of a packet hash for the lookup thread */
+static inline FlowBucket *FlowHashGetBucket(const FlowLookupStruct *fls, const uint32_t hash)
+{
+    if (fls->shard_size != 0)
+        return &flow_hash[fls->shard_base + (hash % fls->shard_size)];
+    return &flow_hash[hash % flow_config.hash_size];
+}
+
 /** \brief compare two raw ipv6 addrs
  *
  *  \note we don't care about the real ipv6 ip's, this is just
@@ -580,6 +650,19 @@ static Flow *FlowGetNew(ThreadVars *tv, FlowLookupStruct *fls, Packet *p)
         return NULL;
     }
 
+    /* with a sharded hash the SYN created the flow in our shard. If a
+     * SYN/ACK starts a flow, the SYN was received on another queue. */
+    if (fls->shard_size != 0 && PKT_IS_TCP(p) &&
+            (p->tcph->th_flags & (TH_SYN | TH_ACK)) == (TH_SYN | TH_ACK)) {
+#ifdef UNITTESTS
+        if (tv != NULL && fls->dtv != NULL) {
+#endif
+            StatsIncr(tv, fls->dtv->counter_flow_shard_cross_queue);
+#ifdef UNITTESTS
+        }
+#endif
+    }
+
     /* get a flow from the spare queue */
     Flow *f = FlowQueuePrivateGetFromTop(&fls->spare_queue);
     if (f == NULL) {
@@ -754,7 +837,7 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, FlowLookupStruct *fls, Packet *p, Flow
 
     /* get our hash bucket and lock it */
     const uint32_t hash = p->flow_hash;
-    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
+    FlowBucket *fb = FlowHashGetBucket(fls, hash);
     FBLOCK_LOCK(fb);
 
     SCLogDebug("fb %p fb->head %p", fb, fb->head);
@@ -83,6 +83,10 @@ Flow *FlowGetFromFlowKey(FlowKey *key, struct timespec *ttime, const uint32_t ha
 Flow *FlowGetExistingFlowFromHash(FlowKey * key, uint32_t hash);
 uint32_t FlowKeyGetHash(FlowKey *flow_key);
 
+void FlowHashSetShards(uint16_t shards);
+void FlowHashSetThreadShard(uint16_t shard);
+void FlowHashShardLookupInit(FlowLookupStruct *fls);
+
 /** \note f->fb must be locked */
 static inline void RemoveFromHash(Flow *f, Flow *prev_f)
 {
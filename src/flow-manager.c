@@ -631,6 +631,9 @@ typedef struct FlowCounters_ {
 
     uint16_t memcap_pressure;
     uint16_t memcap_pressure_max;
+
+    /* histogram of the time taken by a timeout pass, 0 if disabled */
+    uint16_t flow_mgr_pass_time;
 } FlowCounters;
 
 typedef struct FlowManagerThreadData_ {
@@ -670,6 +673,10 @@ static void FlowCountersInit(ThreadVars *t, FlowCounters *fc)
 
     fc->memcap_pressure = StatsRegisterCounter("memcap_pressure", t);
     fc->memcap_pressure_max = StatsRegisterMaxCounter("memcap_pressure_max", t);
+
+    if (StatsLatencyHistogramsEnabled()) {
+        fc->flow_mgr_pass_time = StatsRegisterHistogramCounter("flow.mgr.pass_time_us", t);
+    }
 }
 
 static void FlowCountersUpdate(
@@ -855,16 +862,13 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
         }
         if (ts_ms >= next_run_ms) {
             if (ftd->instance == 0) {
-                const uint32_t sq_len = FlowSpareGetPoolSize();
-                const uint32_t spare_perc = sq_len * 100 / flow_config.prealloc;
                 /* see if we still have enough spare flows */
-                if (spare_perc < 90 || spare_perc > 110) {
-                    FlowSparePoolUpdate(sq_len);
-                }
+                FlowSparePoolUpdate();
             }
 
             /* try to time out flows */
             FlowTimeoutCounters counters = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+            const uint64_t pass_start_ns = ftd->cnt.flow_mgr_pass_time ? TimeGetMonotonicNs() : 0;
 
             if (emerg) {
                 /* in emergency mode, do a full pass of the hash table */
@@ -886,6 +890,10 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
             StatsSetUI64(th_v, ftd->cnt.flow_mgr_spare, (uint64_t)spare_pool_len);
 
             FlowCountersUpdate(th_v, ftd, &counters);
+            if (ftd->cnt.flow_mgr_pass_time) {
+                StatsHistogramAdd(th_v, ftd->cnt.flow_mgr_pass_time,
+                        (TimeGetMonotonicNs() - pass_start_ns) / 1000);
+            }
 
             if (emerg == true) {
                 SCLogDebug("flow_sparse_q.len = %" PRIu32 " prealloc: %" PRIu32
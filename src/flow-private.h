@@ -28,6 +28,7 @@
 #include "flow-queue.h"
 
 #include "util-atomic.h"
+#include "util-memcap-credit.h"
 
 /* global flow flags */
 
@@ -97,8 +98,8 @@ extern FlowQueue flow_recycle_q;
 extern FlowBucket *flow_hash;
 extern FlowConfig flow_config;
 
-/** flow memuse counter (atomic), for enforcing memcap limit */
-SC_ATOMIC_EXTERN(uint64_t, flow_memuse);
+/** flow memuse counter (per thread credit), for enforcing memcap limit */
+extern MemcapCredit flow_memuse;
 
 typedef FlowProtoTimeout *FlowProtoTimeoutPtr;
 SC_ATOMIC_EXTERN(FlowProtoTimeoutPtr, flow_timeouts);
@@ -33,16 +33,28 @@
 #include "util-error.h"
 #include "util-debug.h"
 #include "util-print.h"
+#include "util-numa.h"
 #include "util-validate.h"
+#include "util-unittest.h"
 
 typedef struct FlowSparePool {
     FlowQueuePrivate queue;
     struct FlowSparePool *next;
 } FlowSparePool;
 
+/** spare flows allocated on a NUMA node. There is only one when the
+ *  system has a single node or NUMA awareness is disabled. */
+typedef struct FlowSpareNodePool_ {
+    FlowSparePool *top;
+    uint32_t flow_cnt;
+    uint32_t target; /**< number of spare flows to keep for this node */
+    bool alloc_failed; /**< last update couldn't allocate all flows */
+} FlowSpareNodePool;
+
 static uint32_t flow_spare_pool_flow_cnt = 0;
 static uint32_t flow_spare_pool_block_size = 100;
-static FlowSparePool *flow_spare_pool = NULL;
+static FlowSpareNodePool flow_spare_pool[UTIL_NUMA_MAX_NODES];
+static int flow_spare_pool_nodes = 1;
 static SCMutex flow_spare_pool_m = SCMUTEX_INITIALIZER;
 
 uint32_t FlowSpareGetPoolSize(void)
@@ -100,21 +112,25 @@ static void Validate(FlowSparePool *top, const uint32_t target)
 
 void FlowSparePoolReturnFlow(Flow *f)
 {
+    FlowSpareNodePool *np =
+            &flow_spare_pool[f->numa_node < flow_spare_pool_nodes ? f->numa_node : 0];
+
     SCMutexLock(&flow_spare_pool_m);
-    if (flow_spare_pool == NULL) {
-        flow_spare_pool = FlowSpareGetPool();
+    if (np->top == NULL) {
+        np->top = FlowSpareGetPool();
     }
-    DEBUG_VALIDATE_BUG_ON(flow_spare_pool == NULL);
+    DEBUG_VALIDATE_BUG_ON(np->top == NULL);
 
     /* if the top is full, get a new block */
-    if (flow_spare_pool->queue.len >= flow_spare_pool_block_size) {
+    if (np->top->queue.len >= flow_spare_pool_block_size) {
         FlowSparePool *p = FlowSpareGetPool();
         DEBUG_VALIDATE_BUG_ON(p == NULL);
-        p->next = flow_spare_pool;
-        flow_spare_pool = p;
+        p->next = np->top;
+        np->top = p;
     }
     /* add to the (possibly new) top */
-    FlowQueuePrivateAppendFlow(&flow_spare_pool->queue, f);
+    FlowQueuePrivateAppendFlow(&np->top->queue, f);
+    np->flow_cnt++;
     flow_spare_pool_flow_cnt++;
 
     SCMutexUnlock(&flow_spare_pool_m);
@@ -125,43 +141,50 @@ void FlowSparePoolReturnFlows(FlowQueuePrivate *fqp)
 
 }
 
-FlowQueuePrivate FlowSpareGetFromPool(void)
+/** \internal
+ *  \brief take a block of flows from a node pool
+ *  \note flow_spare_pool_m must be held */
+static FlowSparePool *FlowSpareNodePoolTake(FlowSpareNodePool *np)
 {
-    SCMutexLock(&flow_spare_pool_m);
-    if (flow_spare_pool == NULL || flow_spare_pool_flow_cnt == 0) {
-        SCMutexUnlock(&flow_spare_pool_m);
-        FlowQueuePrivate empty = { NULL, NULL, 0 };
-        return empty;
-    }
+    if (np->top == NULL || np->flow_cnt == 0)
+        return NULL;
 
+    FlowSparePool *p;
     /* top if full or its the only block we have */
-    if (flow_spare_pool->queue.len >= flow_spare_pool_block_size || flow_spare_pool->next == NULL) {
-        FlowSparePool *p = flow_spare_pool;
-        flow_spare_pool = p->next;
-        DEBUG_VALIDATE_BUG_ON(flow_spare_pool_flow_cnt < p->queue.len);
-        flow_spare_pool_flow_cnt -= p->queue.len;
-#ifdef FSP_VALIDATE
-        Validate(flow_spare_pool, flow_spare_pool_flow_cnt);
-#endif
-        SCMutexUnlock(&flow_spare_pool_m);
-
-        FlowQueuePrivate ret = p->queue;
-        SCFree(p);
-        return ret;
+    if (np->top->queue.len >= flow_spare_pool_block_size || np->top->next == NULL) {
+        p = np->top;
+        np->top = p->next;
     /* next should always be full if it exists */
-    } else if (flow_spare_pool->next != NULL) {
-        FlowSparePool *p = flow_spare_pool->next;
-        flow_spare_pool->next = p->next;
-        DEBUG_VALIDATE_BUG_ON(flow_spare_pool_flow_cnt < p->queue.len);
-        flow_spare_pool_flow_cnt -= p->queue.len;
+    } else {
+        p = np->top->next;
+        np->top->next = p->next;
+    }
+    DEBUG_VALIDATE_BUG_ON(np->flow_cnt < p->queue.len);
+    np->flow_cnt -= p->queue.len;
+    flow_spare_pool_flow_cnt -= p->queue.len;
 #ifdef FSP_VALIDATE
-        Validate(flow_spare_pool, flow_spare_pool_flow_cnt);
+    Validate(np->top, np->flow_cnt);
 #endif
-        SCMutexUnlock(&flow_spare_pool_m);
+    return p;
+}
 
-        FlowQueuePrivate ret = p->queue;
-        SCFree(p);
-        return ret;
+/** \internal
+ *  \brief take a block of flows, preferably from the pool of node */
+static FlowQueuePrivate FlowSpareGetFromNodePool(const int node)
+{
+    SCMutexLock(&flow_spare_pool_m);
+    /* prefer flows of our own node, but remote flows are still cheaper
+     * than allocating new ones */
+    for (int i = 0; i < flow_spare_pool_nodes; i++) {
+        FlowSparePool *p = FlowSpareNodePoolTake(
+                &flow_spare_pool[(node + i) % flow_spare_pool_nodes]);
+        if (p != NULL) {
+            SCMutexUnlock(&flow_spare_pool_m);
+
+            FlowQueuePrivate ret = p->queue;
+            SCFree(p);
+            return ret;
+        }
     }
 
     SCMutexUnlock(&flow_spare_pool_m);
@@ -169,45 +192,73 @@ FlowQueuePrivate FlowSpareGetFromPool(void)
     return empty;
 }
 
-void FlowSparePoolUpdate(uint32_t size)
+FlowQueuePrivate FlowSpareGetFromPool(void)
 {
-    const int64_t todo = (int64_t)flow_config.prealloc - (int64_t)size;
+    return FlowSpareGetFromNodePool(UtilNumaGetThreadNode());
+}
+
+static void FlowSparePoolUpdateNode(const int node)
+{
+    FlowSpareNodePool *np = &flow_spare_pool[node];
+
+    SCMutexLock(&flow_spare_pool_m);
+    const uint32_t size = np->flow_cnt;
+    const uint32_t target = np->target;
+    SCMutexUnlock(&flow_spare_pool_m);
+
+    /* see if we still have enough spare flows */
+    if (target > 0) {
+        const uint64_t spare_perc = (uint64_t)size * 100 / target;
+        if (spare_perc >= 90 && spare_perc <= 110)
+            return;
+    }
+
+    const int64_t todo = (int64_t)target - (int64_t)size;
+
     if (todo < 0) {
-        uint32_t to_remove = (uint32_t)(todo * -1) / 10;
+        /* shrink gradually, but a node that shouldn't have spare flows at
+         * all is emptied completely */
+        uint32_t to_remove = target == 0 ? size : (uint32_t)(todo * -1) / 10;
         while (to_remove) {
-            if (to_remove < flow_spare_pool_block_size)
+            if (target > 0 && to_remove < flow_spare_pool_block_size)
                 return;
 
             FlowSparePool *p = NULL;
             SCMutexLock(&flow_spare_pool_m);
-            p = flow_spare_pool;
+            p = np->top;
             if (p != NULL) {
-                flow_spare_pool = p->next;
+                np->top = p->next;
+                np->flow_cnt -= p->queue.len;
                 flow_spare_pool_flow_cnt -= p->queue.len;
-                to_remove -= p->queue.len;
+                to_remove -= MIN(to_remove, p->queue.len);
             }
             SCMutexUnlock(&flow_spare_pool_m);
 
-            if (p != NULL) {
-                Flow *f;
-                while ((f = FlowQueuePrivateGetFromTop(&p->queue))) {
-                    FlowFree(f);
-                }
-                SCFree(p);
+            if (p == NULL)
+                return;
+
+            Flow *f;
+            while ((f = FlowQueuePrivateGetFromTop(&p->queue))) {
+                FlowFree(f);
             }
+            SCFree(p);
         }
     } else if (todo > 0) {
         FlowSparePool *head = NULL, *tail = NULL;
 
         uint32_t blocks = ((uint32_t)todo / flow_spare_pool_block_size) + 1;
 
+        /* allocate the flows on the node of the pool */
+        const int prev_node = UtilNumaSetThreadNode(node);
         uint32_t flow_cnt = 0;
+        bool ok = true;
         for (uint32_t cnt = 0; cnt < blocks; cnt++) {
             FlowSparePool *p = FlowSpareGetPool();
             if (p == NULL) {
+                ok = false;
                 break;
             }
-            const bool ok = FlowSparePoolUpdateBlock(p);
+            ok = FlowSparePoolUpdateBlock(p);
             if (p->queue.len == 0) {
                 SCFree(p);
                 break;
@@ -222,30 +273,110 @@ void FlowSparePoolUpdate(uint32_t size)
             if (!ok)
                 break;
         }
+        UtilNumaSetThreadNode(prev_node);
+
+        /* warn once until the allocations succeed again */
+        if (!ok && !np->alloc_failed) {
+            SCLogWarning(SC_ERR_FLOW_INIT,
+                    "flow spare pool: node %d: failed to allocate spare flows: "
+                    "%u of %" PRIi64 " allocated. Flow memcap reached?",
+                    node, flow_cnt, todo);
+        }
+        np->alloc_failed = !ok;
+
         if (head) {
             SCMutexLock(&flow_spare_pool_m);
-            if (flow_spare_pool == NULL) {
-                flow_spare_pool = head;
+            if (np->top == NULL) {
+                np->top = head;
             } else if (tail != NULL) {
                 /* since these are 'full' buckets we don't put them
                  * at the top but right after as the top is likely not
                  * full. */
-                tail->next = flow_spare_pool->next;
-                flow_spare_pool->next = head;
+                tail->next = np->top->next;
+                np->top->next = head;
             }
 
+            np->flow_cnt += flow_cnt;
             flow_spare_pool_flow_cnt += flow_cnt;
 #ifdef FSP_VALIDATE
-            Validate(flow_spare_pool, flow_spare_pool_flow_cnt);
+            Validate(np->top, np->flow_cnt);
 #endif
             SCMutexUnlock(&flow_spare_pool_m);
         }
     }
 }
 
+void FlowSparePoolUpdate(void)
+{
+    for (int node = 0; node < flow_spare_pool_nodes; node++) {
+        FlowSparePoolUpdateNode(node);
+    }
+}
+
+/**
+ *  \brief spread the spare flows over the NUMA nodes of the worker threads
+ *
+ *  Called once the threads are set up. Each node gets a share of the
+ *  prealloc setting matching its share of the workers and the flows are
+ *  allocated on the node. Without workers the initializing thread's node
+ *  gets all of them.
+ */
+void FlowSparePoolNumaSetup(void)
+{
+    if (flow_spare_pool_nodes < 2)
+        return;
+
+    uint32_t workers[UTIL_NUMA_MAX_NODES];
+    const uint32_t total = UtilNumaGetWorkerThreads(workers);
+    if (total == 0) {
+        FlowSparePoolUpdate();
+        return;
+    }
+
+    SCMutexLock(&flow_spare_pool_m);
+    uint32_t assigned = 0;
+    for (int node = 0; node < flow_spare_pool_nodes; node++) {
+        flow_spare_pool[node].target =
+                (uint32_t)((uint64_t)flow_config.prealloc * workers[node] / total);
+        assigned += flow_spare_pool[node].target;
+    }
+    /* rounding leftover goes to the node with the first worker */
+    for (int node = 0; node < flow_spare_pool_nodes; node++) {
+        if (workers[node] > 0) {
+            flow_spare_pool[node].target += flow_config.prealloc - assigned;
+            break;
+        }
+    }
+    SCMutexUnlock(&flow_spare_pool_m);
+
+    FlowSparePoolUpdate();
+
+    SCMutexLock(&flow_spare_pool_m);
+    for (int node = 0; node < flow_spare_pool_nodes; node++) {
+        SCLogConfig("flow spare pool: node %d: %u worker threads, %u spare flows, target %u",
+                node, workers[node], flow_spare_pool[node].flow_cnt,
+                flow_spare_pool[node].target);
+    }
+    SCMutexUnlock(&flow_spare_pool_m);
+}
+
 void FlowSparePoolInit(void)
 {
     SCMutexLock(&flow_spare_pool_m);
+    flow_spare_pool_nodes = UtilNumaGetNodeCount();
+    /* until the workers are known all flows belong to the node of the
+     * initializing thread */
+    const int node = UtilNumaGetThreadNode();
+    FlowSpareNodePool *np = &flow_spare_pool[node];
+    np->target = flow_config.prealloc;
+
+    /* with multiple nodes the prealloc is split over the nodes of the
+     * workers and allocated by FlowSparePoolNumaSetup() */
+    if (flow_spare_pool_nodes > 1) {
+        SCMutexUnlock(&flow_spare_pool_m);
+        return;
+    }
+
     for (uint32_t cnt = 0; cnt < flow_config.prealloc; ) {
         FlowSparePool *p = FlowSpareGetPool();
         if (p == NULL) {
@@ -255,8 +386,9 @@ void FlowSparePoolInit(void)
         cnt += p->queue.len;
 
         /* prepend to list */
-        p->next = flow_spare_pool;
-        flow_spare_pool = p;
+        p->next = np->top;
+        np->top = p;
+        np->flow_cnt = cnt;
         flow_spare_pool_flow_cnt = cnt;
     }
     SCMutexUnlock(&flow_spare_pool_m);
@@ -265,18 +397,157 @@ void FlowSparePoolInit(void)
 void FlowSparePoolDestroy(void)
 {
     SCMutexLock(&flow_spare_pool_m);
-    for (FlowSparePool *p = flow_spare_pool; p != NULL; ) {
-        uint32_t cnt = 0;
-        Flow *f;
-        while ((f = FlowQueuePrivateGetFromTop(&p->queue))) {
-            FlowFree(f);
-            cnt++;
+    for (int node = 0; node < flow_spare_pool_nodes; node++) {
+        FlowSpareNodePool *np = &flow_spare_pool[node];
+        for (FlowSparePool *p = np->top; p != NULL; ) {
+            uint32_t cnt = 0;
+            Flow *f;
+            while ((f = FlowQueuePrivateGetFromTop(&p->queue))) {
+                FlowFree(f);
+                cnt++;
+            }
+            flow_spare_pool_flow_cnt -= cnt;
+            FlowSparePool *next = p->next;
+            SCFree(p);
+            p = next;
         }
-        flow_spare_pool_flow_cnt -= cnt;
-        FlowSparePool *next = p->next;
-        SCFree(p);
-        p = next;
+        np->top = NULL;
+        np->flow_cnt = 0;
+        np->target = 0;
+        np->alloc_failed = false;
     }
-    flow_spare_pool = NULL;
     SCMutexUnlock(&flow_spare_pool_m);
 }
+
+#ifdef UNITTESTS
+/** \internal
+ *  \brief set up an empty pool spread over two nodes */
+static int FlowSparePoolTestSetup(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+    FlowSparePoolDestroy();
+    const int nodes = flow_spare_pool_nodes;
+    flow_spare_pool_nodes = 2;
+    return nodes;
+}
+
+static void FlowSparePoolTestCleanup(const int nodes)
+{
+    FlowSparePoolDestroy();
+    flow_spare_pool_nodes = nodes;
+    FlowShutdown();
+}
+
+static void FlowSparePoolTestFree(FlowQueuePrivate *fqp)
+{
+    Flow *f;
+    while ((f = FlowQueuePrivateGetFromTop(fqp))) {
+        FlowFree(f);
+    }
+}
+
+/** \test take flows from the own node, fall back to the other node */
+static int FlowSparePoolTest01(void)
+{
+    const int nodes = FlowSparePoolTestSetup();
+
+    flow_spare_pool[0].target = 150;
+    FlowSparePoolUpdate();
+    FAIL_IF_NOT(flow_spare_pool[0].flow_cnt == 200);
+    FAIL_IF_NOT(flow_spare_pool[1].flow_cnt == 0);
+
+    /* node 1 has none, so it gets them from node 0 */
+    FlowQueuePrivate fqp = FlowSpareGetFromNodePool(1);
+    FAIL_IF_NOT(fqp.len == flow_spare_pool_block_size);
+    FAIL_IF_NOT(flow_spare_pool[0].flow_cnt == 100);
+    FlowSparePoolTestFree(&fqp);
+
+    flow_spare_pool[1].target = 50;
+    FlowSparePoolUpdateNode(1);
+    FAIL_IF_NOT(flow_spare_pool[1].flow_cnt == 100);
+
+    /* now it's served by its own node */
+    fqp = FlowSpareGetFromNodePool(1);
+    FAIL_IF_NOT(fqp.len == flow_spare_pool_block_size);
+    FAIL_IF_NOT(flow_spare_pool[0].flow_cnt == 100);
+    FAIL_IF_NOT(flow_spare_pool[1].flow_cnt == 0);
+    FlowSparePoolTestFree(&fqp);
+    FAIL_IF_NOT(FlowSpareGetPoolSize() == 100);
+
+    FlowSparePoolTestCleanup(nodes);
+    PASS;
+}
+
+/** \test flows are returned to the pool of their node */
+static int FlowSparePoolTest02(void)
+{
+    const int nodes = FlowSparePoolTestSetup();
+
+    flow_spare_pool[0].target = 50;
+    FlowSparePoolUpdate();
+    FlowQueuePrivate fqp = FlowSpareGetFromNodePool(0);
+    FAIL_IF_NOT(fqp.len == flow_spare_pool_block_size);
+    FAIL_IF_NOT(FlowSpareGetPoolSize() == 0);
+
+    Flow *f = FlowQueuePrivateGetFromTop(&fqp);
+    FAIL_IF_NULL(f);
+    f->numa_node = 1;
+    FlowSparePoolReturnFlow(f);
+    FAIL_IF_NOT(flow_spare_pool[0].flow_cnt == 0);
+    FAIL_IF_NOT(flow_spare_pool[1].flow_cnt == 1);
+
+    /* unknown node */
+    f = FlowQueuePrivateGetFromTop(&fqp);
+    FAIL_IF_NULL(f);
+    f->numa_node = 5;
+    FlowSparePoolReturnFlow(f);
+    FAIL_IF_NOT(flow_spare_pool[0].flow_cnt == 1);
+    FAIL_IF_NOT(flow_spare_pool[1].flow_cnt == 1);
+    FAIL_IF_NOT(FlowSpareGetPoolSize() == 2);
+
+    FlowSparePoolTestFree(&fqp);
+    FlowSparePoolTestCleanup(nodes);
+    PASS;
+}
+
+/** \test pools are trimmed to their target */
+static int FlowSparePoolTest03(void)
+{
+    const int nodes = FlowSparePoolTestSetup();
+
+    flow_spare_pool[0].target = 2450;
+    flow_spare_pool[1].target = 150;
+    FlowSparePoolUpdate();
+    FAIL_IF_NOT(flow_spare_pool[0].flow_cnt == 2500);
+    FAIL_IF_NOT(flow_spare_pool[1].flow_cnt == 200);
+
+    /* excess is freed gradually, in blocks */
+    flow_spare_pool[0].target = 100;
+    FlowSparePoolUpdate();
+    FAIL_IF_NOT(flow_spare_pool[0].flow_cnt == 2300);
+
+    /* a node without target is emptied, including partial blocks */
+    Flow *f = FlowAlloc();
+    FAIL_IF_NULL(f);
+    f->numa_node = 1;
+    FlowSparePoolReturnFlow(f);
+    FAIL_IF_NOT(flow_spare_pool[1].flow_cnt == 201);
+    flow_spare_pool[1].target = 0;
+    FlowSparePoolUpdateNode(1);
+    FAIL_IF_NOT(flow_spare_pool[1].flow_cnt == 0);
+    FAIL_IF_NOT_NULL(flow_spare_pool[1].top);
+    FAIL_IF_NOT(FlowSpareGetPoolSize() == flow_spare_pool[0].flow_cnt);
+
+    FlowSparePoolTestCleanup(nodes);
+    PASS;
+}
+#endif
+
+void FlowSparePoolRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowSparePoolTest01", FlowSparePoolTest01);
+    UtRegisterTest("FlowSparePoolTest02", FlowSparePoolTest02);
+    UtRegisterTest("FlowSparePoolTest03", FlowSparePoolTest03);
+#endif
+}
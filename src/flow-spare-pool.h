@@ -29,7 +29,8 @@
 
 void FlowSparePoolInit(void);
 void FlowSparePoolDestroy(void);
-void FlowSparePoolUpdate(uint32_t size);
+void FlowSparePoolUpdate(void);
+void FlowSparePoolNumaSetup(void);
 
 uint32_t FlowSpareGetPoolSize(void);
 
@@ -38,4 +39,6 @@ FlowQueuePrivate FlowSpareGetFromPool(void);
 void FlowSparePoolReturnFlow(Flow *f);
 void FlowSparePoolReturnFlows(FlowQueuePrivate *fqp);
 
+void FlowSparePoolRegisterTests(void);
+
 #endif /* __FLOW_SPARE_POOL_H__ */
@@ -34,6 +34,7 @@
 
 #include "util-var.h"
 #include "util-debug.h"
+#include "util-numa.h"
 #include "flow-storage.h"
 
 #include "detect.h"
@@ -57,17 +58,18 @@ Flow *FlowAlloc(void)
         return NULL;
     }
 
-    (void) SC_ATOMIC_ADD(flow_memuse, size);
+    FLOW_INCR_MEMUSE(size);
 
     f = SCMalloc(size);
     if (unlikely(f == NULL)) {
-        (void)SC_ATOMIC_SUB(flow_memuse, size);
+        FLOW_DECR_MEMUSE(size);
         return NULL;
     }
     memset(f, 0, size);
 
     /* coverity[missing_lock] */
     FLOW_INITIALIZE(f);
+    f->numa_node = (uint8_t)UtilNumaGetThreadNode();
     return f;
 }
 
@@ -83,7 +85,7 @@ void FlowFree(Flow *f)
     SCFree(f);
 
     size_t size = sizeof(Flow) + FlowStorageSize();
-    (void) SC_ATOMIC_SUB(flow_memuse, size);
+    FLOW_DECR_MEMUSE(size);
 }
 
 /**
@@ -142,8 +142,17 @@
  *  \retval 1 it fits
  *  \retval 0 no fit
  */
-#define FLOW_CHECK_MEMCAP(size) \
-    ((((uint64_t)SC_ATOMIC_GET(flow_memuse) + (uint64_t)(size)) <= SC_ATOMIC_GET(flow_config.memcap)))
+#define FLOW_CHECK_MEMCAP(size)                                                                    \
+    (SC_ATOMIC_GET(flow_config.memcap) != 0 &&                                                     \
+            MemcapCreditCheck(&flow_memuse, SC_ATOMIC_GET(flow_config.memcap), (uint64_t)(size)))
+
+/** \brief account an allocation against the flow memcap */
+#define FLOW_INCR_MEMUSE(size)                                                                     \
+    MemcapCreditIncr(&flow_memuse, SC_ATOMIC_GET(flow_config.memcap), (uint64_t)(size))
+
+/** \brief account a free against the flow memcap */
+#define FLOW_DECR_MEMUSE(size)                                                                     \
+    MemcapCreditDecr(&flow_memuse, SC_ATOMIC_GET(flow_config.memcap), (uint64_t)(size))
 
 Flow *FlowAlloc(void);
 Flow *FlowAllocDirect(void);
@@ -43,11 +43,14 @@
 #include "app-layer-parser.h"
 
 #include "util-validate.h"
+#include "util-time.h"
 
+#include "flow-hash.h"
 #include "flow-util.h"
 #include "flow-manager.h"
 #include "flow-timeout.h"
 #include "flow-spare-pool.h"
+#include "flow-cost.h"
 
 typedef DetectEngineThreadCtx *DetectEngineThreadCtxPtr;
 
@@ -82,6 +85,7 @@ typedef struct FlowWorkerThreadData_ {
         uint16_t flows_removed;
         uint16_t flows_aside_needs_work;
         uint16_t flows_aside_pkt_inject;
+        uint16_t pipeline_latency;
     } cnt;
     FlowEndCounters fec;
 
@@ -259,12 +263,18 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, const void *initdata, void *
     fw->cnt.flows_aside_pkt_inject = StatsRegisterCounter("flow.wrk.flows_evicted_pkt_inject", tv);
     fw->cnt.flows_removed = StatsRegisterCounter("flow.wrk.flows_evicted", tv);
     fw->cnt.flows_injected = StatsRegisterCounter("flow.wrk.flows_injected", tv);
+    /* capture timestamps are only comparable to the clock when live */
+    if (StatsLatencyHistogramsEnabled() && TimeModeIsLive()) {
+        fw->cnt.pipeline_latency =
+                StatsRegisterHistogramCounter("flow.wrk.pipeline_latency_us", tv);
+    }
 
     fw->fls.dtv = fw->dtv = DecodeThreadVarsAlloc(tv);
     if (fw->dtv == NULL) {
         FlowWorkerThreadDeinit(tv, fw);
         return TM_ECODE_FAILED;
     }
+    FlowHashShardLookupInit(&fw->fls);
 
     /* setup TCP */
     if (StreamTcpThreadInit(tv, NULL, &fw->stream_thread_ptr) != TM_ECODE_OK) {
@@ -441,6 +451,7 @@ static void FlowWorkerFlowTimeout(ThreadVars *tv, Packet *p, FlowWorkerThreadDat
     FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_TCPPRUNE);
     StreamTcpPruneSession(p->flow, p->flowflags & FLOW_PKT_TOSERVER ?
             STREAM_TOSERVER : STREAM_TOCLIENT);
+    StreamTcpReassembleUpdatePoolStats(tv, fw->stream_thread->ra_ctx);
     FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_TCPPRUNE);
 
     /* run tx cleanup last */
@@ -503,6 +514,10 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data)
         TimeSetByThread(tv->id, &p->ts);
     }
 
+    /* flow cost accounting: ticks at the end of the last accounted stage */
+    uint64_t cost_ticks = g_flow_cost_enabled ? UtilCpuGetTicks() : 0;
+    FlowCost *cost = NULL;
+
     /* handle Flow */
     if (p->flags & PKT_WANTS_FLOW) {
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_FLOW);
@@ -525,6 +540,14 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data)
         DEBUG_VALIDATE_BUG_ON(p->pkt_src != PKT_SRC_FFR);
     }
 
+    if (cost_ticks != 0 && p->flow != NULL) {
+        cost = FlowCostGet(p->flow);
+        if (cost != NULL) {
+            cost->ticks[FLOW_COST_DECODE] += p->decode_ticks;
+            FlowCostStageEnd(cost, FLOW_COST_FLOW, &cost_ticks);
+        }
+    }
+
     SCLogDebug("packet %"PRIu64" has flow? %s", p->pcap_cnt, p->flow ? "yes" : "no");
 
     /* handle TCP and app layer */
@@ -541,13 +564,21 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data)
             DisableDetectFlowFileFlags(p->flow);
         }
 
+        const uint64_t app_ticks = cost ? cost->ticks[FLOW_COST_APPLAYER] : 0;
         FlowWorkerStreamTCPUpdate(tv, fw, p, detect_thread, false);
+        if (cost != NULL) {
+            FlowCostStageEnd(cost, FLOW_COST_STREAM, &cost_ticks);
+            /* app-layer parsing was accounted by AppLayerHandleTCPData() */
+            cost->ticks[FLOW_COST_STREAM] -= cost->ticks[FLOW_COST_APPLAYER] - app_ticks;
+        }
 
         /* handle the app layer part of the UDP packet payload */
     } else if (p->flow && p->proto == IPPROTO_UDP) {
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_APPLAYERUDP);
         AppLayerHandleUdp(tv, fw->stream_thread->ra_ctx->app_tctx, p, p->flow);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_APPLAYERUDP);
+        if (cost != NULL)
+            FlowCostStageEnd(cost, FLOW_COST_APPLAYER, &cost_ticks);
     }
 
     PacketUpdateEngineEventCounters(tv, fw->dtv, p);
@@ -559,10 +590,14 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data)
         FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_DETECT);
         Detect(tv, p, detect_thread);
         FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_DETECT);
+        if (cost != NULL)
+            FlowCostDetectEnd(cost, p, detect_thread, &cost_ticks);
     }
 
     // Outputs.
     OutputLoggerLog(tv, p, fw->output_thread);
+    if (cost != NULL)
+        FlowCostStageEnd(cost, FLOW_COST_OUTPUT, &cost_ticks);
 
     /* Prune any stored files. */
     FlowPruneFiles(p);
@@ -581,6 +616,7 @@ static TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data)
             FLOWWORKER_PROFILING_START(p, PROFILE_FLOWWORKER_TCPPRUNE);
             StreamTcpPruneSession(p->flow, p->flowflags & FLOW_PKT_TOSERVER ?
                     STREAM_TOSERVER : STREAM_TOCLIENT);
+            StreamTcpReassembleUpdatePoolStats(tv, fw->stream_thread->ra_ctx);
             FLOWWORKER_PROFILING_END(p, PROFILE_FLOWWORKER_TCPPRUNE);
         } else if (p->proto == IPPROTO_UDP) {
             FramesPrune(p->flow, p);
@@ -602,6 +638,15 @@ housekeeping:
     /* process local work queue */
     FlowWorkerProcessLocalFlows(tv, fw, p, detect_thread);
 
+    /* time from capture to the end of the packet processing */
+    if (fw->cnt.pipeline_latency && !(PKT_IS_PSEUDOPKT(p))) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        if (timercmp(&now, &p->ts, >)) {
+            StatsHistogramAdd(tv, fw->cnt.pipeline_latency, TimeDifferenceMicros(p->ts, now));
+        }
+    }
+
     return TM_ECODE_OK;
 }
 
@@ -45,6 +45,7 @@
 #include "flow-storage.h"
 #include "flow-bypass.h"
 #include "flow-spare-pool.h"
+#include "flow-cost.h"
 
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
@@ -58,6 +59,7 @@
 #include "util-debug.h"
 #include "util-privs.h"
 #include "util-validate.h"
+#include "util-pages.h"
 
 #include "detect.h"
 #include "detect-engine-state.h"
@@ -98,7 +100,7 @@ FlowProtoFreeFunc flow_freefuncs[FLOW_PROTO_MAX];
 FlowConfig flow_config;
 
 /** flow memuse counter (atomic), for enforcing memcap limit */
-SC_ATOMIC_DECLARE(uint64_t, flow_memuse);
+MemcapCredit flow_memuse;
 
 void FlowRegisterTests(void);
 void FlowInitFlowProto(void);
@@ -114,7 +116,7 @@ extern int run_mode;
  */
 int FlowSetMemcap(uint64_t size)
 {
-    if ((uint64_t)SC_ATOMIC_GET(flow_memuse) < size) {
+    if (FlowGetMemuse() < size) {
         SC_ATOMIC_SET(flow_config.memcap, size);
         return 1;
     }
@@ -135,8 +137,7 @@ uint64_t FlowGetMemcap(void)
 
 uint64_t FlowGetMemuse(void)
 {
-    uint64_t memusecopy = SC_ATOMIC_GET(flow_memuse);
-    return memusecopy;
+    return MemcapCreditMemuse(&flow_memuse);
 }
 
 void FlowCleanupAppLayer(Flow *f)
@@ -526,7 +527,7 @@ void FlowInitConfig(bool quiet)
 
     memset(&flow_config,  0, sizeof(flow_config));
     SC_ATOMIC_INIT(flow_flags);
-    SC_ATOMIC_INIT(flow_memuse);
+    MemcapCreditInit(&flow_memuse, "flow", MEMCAP_CREDIT_CHUNK_DEFAULT);
     SC_ATOMIC_INIT(flow_prune_idx);
     SC_ATOMIC_INIT(flow_config.memcap);
     FlowQueueInit(&flow_recycle_q);
@@ -614,7 +615,7 @@ void FlowInitConfig(bool quiet)
                 (uintmax_t)sizeof(FlowBucket));
         exit(EXIT_FAILURE);
     }
-    flow_hash = SCMallocAligned(flow_config.hash_size * sizeof(FlowBucket), CLS);
+    flow_hash = PageLargeAlloc(flow_config.hash_size * sizeof(FlowBucket), PAGE_LARGE_FLOW);
     if (unlikely(flow_hash == NULL)) {
         FatalError(SC_ERR_FATAL,
                    "Fatal error encountered in FlowInitConfig. Exiting...");
@@ -626,18 +627,18 @@ void FlowInitConfig(bool quiet)
         FBLOCK_INIT(&flow_hash[i]);
         SC_ATOMIC_INIT(flow_hash[i].next_ts);
     }
-    (void) SC_ATOMIC_ADD(flow_memuse, (flow_config.hash_size * sizeof(FlowBucket)));
+    FLOW_INCR_MEMUSE(flow_config.hash_size * sizeof(FlowBucket));
 
     if (!quiet) {
         SCLogConfig("allocated %"PRIu64" bytes of memory for the flow hash... "
                   "%" PRIu32 " buckets of size %" PRIuMAX "",
-                  SC_ATOMIC_GET(flow_memuse), flow_config.hash_size,
+                  FlowGetMemuse(), flow_config.hash_size,
                   (uintmax_t)sizeof(FlowBucket));
     }
     FlowSparePoolInit();
     if (!quiet) {
         SCLogConfig("flow memory usage: %"PRIu64" bytes, maximum: %"PRIu64,
-                SC_ATOMIC_GET(flow_memuse), SC_ATOMIC_GET(flow_config.memcap));
+                FlowGetMemuse(), SC_ATOMIC_GET(flow_config.memcap));
     }
 
     FlowInitFlowProto();
@@ -699,10 +700,10 @@ void FlowShutdown(void)
 
             FBLOCK_DESTROY(&flow_hash[u]);
         }
-        SCFreeAligned(flow_hash);
+        PageLargeFree(flow_hash);
         flow_hash = NULL;
     }
-    (void) SC_ATOMIC_SUB(flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
+    FLOW_DECR_MEMUSE(flow_config.hash_size * sizeof(FlowBucket));
     FlowQueueDestroy(&flow_recycle_q);
     FlowSparePoolDestroy();
     return;
@@ -1096,6 +1097,9 @@ int FlowClearMemory(Flow* f, uint8_t proto_map)
         flow_freefuncs[proto_map].Freefunc(f->protoctx);
     }
 
+    if (g_flow_cost_enabled)
+        FlowCostFlowEnd(f);
+
     FlowFreeStorage(f);
 
     FLOW_RECYCLE(f);
@@ -1439,6 +1443,49 @@ static int FlowTest09 (void)
     return result;
 }
 
+/**
+ *  \test   Test that flows are added to the shard of the thread
+ */
+static int FlowTest10(void)
+{
+    FlowInitConfig(FLOW_QUIET);
+
+    FlowHashSetShards(4);
+    FlowHashSetThreadShard(2);
+    FlowLookupStruct fls;
+    memset(&fls, 0, sizeof(fls));
+    FlowHashShardLookupInit(&fls);
+    FAIL_IF(fls.shard_size != flow_config.hash_size / 4);
+    FAIL_IF(fls.shard_base != 2 * fls.shard_size);
+
+    uint8_t payload[] = "Payload";
+    for (uint32_t i = 0; i < 16; i++) {
+        Packet *p = UTHBuildPacket(payload, sizeof(payload), IPPROTO_TCP);
+        FAIL_IF_NULL(p);
+        p->src.addr_data32[0] = i;
+        p->dst.addr_data32[0] = i + 1;
+        FlowSetupPacket(p);
+        FlowHandlePacket(NULL, &fls, p);
+        FAIL_IF_NULL(p->flow);
+        FAIL_IF(p->flow->fb < &flow_hash[fls.shard_base]);
+        FAIL_IF(p->flow->fb >= &flow_hash[fls.shard_base + fls.shard_size]);
+        p->flow->use_cnt = 0;
+        FLOWLOCK_UNLOCK(p->flow);
+        UTHFreePacket(p);
+    }
+
+    Flow *f;
+    while ((f = FlowQueuePrivateGetFromTop(&fls.spare_queue))) {
+        FlowFree(f);
+    }
+    while ((f = FlowQueuePrivateGetFromTop(&fls.work_queue))) {
+        FlowFree(f);
+    }
+    FlowHashSetShards(0);
+    FlowShutdown();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 /**
@@ -1456,6 +1503,7 @@ void FlowRegisterTests (void)
                    FlowTest08);
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap",
                    FlowTest09);
+    UtRegisterTest("FlowTest10 -- Test flow hash shards", FlowTest10);
 
     RegisterFlowStorageTests();
 #endif /* UNITTESTS */
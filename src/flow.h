@@ -482,6 +482,9 @@ typedef struct Flow_
     uint8_t min_ttl_toclient;
     uint8_t max_ttl_toclient;
 
+    /** NUMA node the flow was allocated on, selects its spare pool */
+    uint8_t numa_node;
+
     /** application level storage ptrs.
      *
      */
@@ -553,6 +556,10 @@ typedef struct FlowLookupStruct_ // TODO name
     DecodeThreadVars *dtv;
     FlowQueuePrivate work_queue;
     uint32_t emerg_spare_sync_stamp;
+    /** part of the flow hash used by this thread. shard_size 0 means
+     *  the whole hash is used. */
+    uint32_t shard_base;
+    uint32_t shard_size;
 } FlowLookupStruct;
 
 /** \brief prepare packet for a life with flow
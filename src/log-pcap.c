@@ -29,6 +29,7 @@
 #include "util-fmemopen.h"
 #include "util-datalink.h"
 #include "stream-tcp-util.h"
+#include "stream-tcp.h"
 
 #ifdef HAVE_LIBLZ4
 #include <lz4frame.h>
@@ -1680,6 +1681,7 @@ static OutputInitResult PcapLogInitCtx(ConfNode *conf)
                            "log-pcap use_stream_depth specified is invalid must be");
         }
     }
+    StreamTcpAutoBypassRegisterPcapLog(pl->use_stream_depth == USE_STREAM_DEPTH_ENABLED);
 
     const char *honor_pass_rules = NULL;
     if (conf != NULL) { /* To faciliate unit tests. */
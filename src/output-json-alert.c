@@ -433,6 +433,35 @@ static void AlertJsonTunnel(const Packet *p, JsonBuilder *js)
     jb_close(js);
 }
 
+/** \brief log the outer headers of a tunnel that was decoded in place */
+static void AlertJsonTunnelInPlace(const Packet *p, JsonBuilder *js)
+{
+    const PacketTunnelOuter *outer = &p->tunnel_outer;
+    char srcip[46] = "", dstip[46] = "";
+
+    PrintInet(outer->src.family, (const void *)outer->src.addr_data32, srcip, sizeof(srcip));
+    PrintInet(outer->dst.family, (const void *)outer->dst.addr_data32, dstip, sizeof(dstip));
+
+    jb_open_object(js, "tunnel");
+    jb_set_string(js, "src_ip", srcip);
+    jb_set_uint(js, "src_port", outer->sp);
+    jb_set_string(js, "dest_ip", dstip);
+    jb_set_uint(js, "dest_port", outer->dp);
+    if (SCProtoNameValid(outer->proto)) {
+        jb_set_string(js, "proto", known_proto[outer->proto]);
+    } else {
+        char proto[4];
+        snprintf(proto, sizeof(proto), "%" PRIu32, outer->proto);
+        jb_set_string(js, "proto", proto);
+    }
+    jb_set_uint(js, "depth", p->recursion_level);
+    if (p->pcap_cnt != 0) {
+        jb_set_uint(js, "pcap_cnt", p->pcap_cnt);
+    }
+    jb_set_string(js, "pkt_src", PktSrcToString(p->pkt_src));
+    jb_close(js);
+}
+
 static void AlertAddPayload(AlertJsonOutputCtx *json_output_ctx, JsonBuilder *js, const Packet *p)
 {
     if (json_output_ctx->flags & LOG_JSON_PAYLOAD_BASE64) {
@@ -701,6 +730,8 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
 
         if (IS_TUNNEL_PKT(p)) {
             AlertJsonTunnel(p, jb);
+        } else if (p->flags & PKT_TUNNEL_INPLACE) {
+            AlertJsonTunnelInPlace(p, jb);
         }
 
         if (p->flow != NULL) {
@@ -59,6 +59,10 @@ OutputJsonThreadCtx *CreateEveThreadCtx(ThreadVars *t, OutputJsonCtx *ctx)
     }
 
     thread->ctx = ctx;
+    thread->tv = t;
+    if (StatsLatencyHistogramsEnabled()) {
+        thread->counter_write_latency = StatsRegisterHistogramCounter("eve.write_latency_us", t);
+    }
 
     return thread;
 
@@ -43,6 +43,7 @@
 #include "util-buffer.h"
 
 #include "util-logopenfile.h"
+#include "util-profiling-sampling.h"
 
 #include "output-json.h"
 #include "output-json-stats.h"
@@ -60,6 +61,7 @@ typedef enum OutputEngineInfo_ {
     OUTPUT_ENGINE_LAST_RELOAD = 0,
     OUTPUT_ENGINE_RULESET,
     OUTPUT_ENGINE_ALL,
+    OUTPUT_ENGINE_PROFILING, /**< sampled profiling results, not part of ALL */
 } OutputEngineInfo;
 
 typedef struct OutputStatsCtx_ {
@@ -101,6 +103,13 @@ static json_t *EngineStats2Json(const DetectEngineCtx *de_ctx,
                             json_integer(sig_stat->bad_sigs_total));
     }
 
+    if (output == OUTPUT_ENGINE_PROFILING) {
+        json_t *js_profiling = SCProfilingSampleToJSON(de_ctx);
+        if (js_profiling != NULL)
+            json_object_update(jdata, js_profiling);
+        json_decref(js_profiling);
+    }
+
     return jdata;
 }
 
@@ -165,6 +174,11 @@ TmEcode OutputEngineStatsRuleset(json_t **jdata) {
     return OutputEngineStats2Json(jdata, OUTPUT_ENGINE_RULESET);
 }
 
+TmEcode OutputEngineStatsProfiling(json_t **jdata)
+{
+    return OutputEngineStats2Json(jdata, OUTPUT_ENGINE_PROFILING);
+}
+
 static json_t *OutputStats2Json(json_t *js, const char *key)
 {
     void *iter;
@@ -289,6 +303,32 @@ json_t *StatsToJSON(const StatsTable *st, uint8_t flags)
     return js_stats;
 }
 
+/** \brief log the sampled profiling results as a 'profiling' event */
+static void JsonStatsLogProfiling(JsonStatsLogThread *aft, const char *timebuf)
+{
+    json_t *js_engines = NULL;
+    if (OutputEngineStatsProfiling(&js_engines) != TM_ECODE_OK)
+        return;
+
+    json_t *js = json_object();
+    json_t *js_profiling = json_object();
+    if (unlikely(js == NULL || js_profiling == NULL)) {
+        json_decref(js);
+        json_decref(js_profiling);
+        json_decref(js_engines);
+        return;
+    }
+    json_object_set_new(js, "timestamp", json_string(timebuf));
+    json_object_set_new(js, "event_type", json_string("profiling"));
+    json_object_set_new(js_profiling, "engines", js_engines);
+    json_object_set_new(js, "profiling", js_profiling);
+
+    OutputJSONBuffer(js, aft->file_ctx, &aft->buffer);
+    MemBufferReset(aft->buffer);
+
+    json_decref(js);
+}
+
 static int JsonStatsLogger(ThreadVars *tv, void *thread_data, const StatsTable *st)
 {
     SCEnter();
@@ -321,6 +361,9 @@ static int JsonStatsLogger(ThreadVars *tv, void *thread_data, const StatsTable *
     json_object_clear(js);
     json_decref(js);
 
+    if (profiling_sample_enabled)
+        JsonStatsLogProfiling(aft, timebuf);
+
     SCReturnInt(0);
 }
 
@@ -33,6 +33,7 @@
 json_t *StatsToJSON(const StatsTable *st, uint8_t flags);
 TmEcode OutputEngineStatsReloadTime(json_t **jdata);
 TmEcode OutputEngineStatsRuleset(json_t **jdata);
+TmEcode OutputEngineStatsProfiling(json_t **jdata);
 void JsonStatsLogRegister(void);
 
 #endif /* __OUTPUT_JSON_COUNTERS_H__ */
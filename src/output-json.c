@@ -60,6 +60,7 @@
 #include "util-device.h"
 #include "util-validate.h"
 #include "util-plugin.h"
+#include "util-time.h"
 
 #include "flow-var.h"
 #include "flow-bit.h"
@@ -977,7 +978,16 @@ int OutputJsonBuilderBuffer(JsonBuilder *js, OutputJsonThreadCtx *ctx)
     }
 
     MemBufferWriteRaw((*buffer), jb_ptr(js), jslen);
-    LogFileWrite(file_ctx, *buffer);
+
+    /* the thread's counters are set up after the loggers are */
+    if (ctx->counter_write_latency && ctx->tv->perf_private_ctx.initialized) {
+        const uint64_t start_ns = TimeGetMonotonicNs();
+        LogFileWrite(file_ctx, *buffer);
+        StatsHistogramAdd(ctx->tv, ctx->counter_write_latency,
+                (TimeGetMonotonicNs() - start_ns) / 1000);
+    } else {
+        LogFileWrite(file_ctx, *buffer);
+    }
 
     return 0;
 }
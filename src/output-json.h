@@ -90,6 +90,9 @@ typedef struct OutputJsonThreadCtx_ {
     OutputJsonCtx *ctx;
     LogFileCtx *file_ctx;
     MemBuffer *buffer;
+    ThreadVars *tv;
+    /** histogram of the record write times, 0 if disabled */
+    uint16_t counter_write_latency;
 } OutputJsonThreadCtx;
 
 json_t *SCJsonString(const char *val);
@@ -230,3 +230,95 @@ void PacketQueueFree(PacketQueue *pq)
     SCMutexDestroy(&pq->mutex_q);
     SCFree(pq);
 }
+
+/**
+ *  \brief allocate a single producer, single consumer packet ring
+ *
+ *  \param size minimal number of slots, rounded up to a power of 2
+ *
+ *  \retval r ring or NULL on error
+ */
+PacketRing *PacketRingAlloc(uint32_t size)
+{
+    if (size == 0 || size > (1U << 31))
+        return NULL;
+
+    uint32_t slots = 1;
+    while (slots < size)
+        slots <<= 1;
+
+    PacketRing *r = SCMallocAligned(sizeof(*r), CLS);
+    if (r == NULL)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+    r->slots = SCCalloc(slots, sizeof(Packet *));
+    if (r->slots == NULL) {
+        SCFreeAligned(r);
+        return NULL;
+    }
+    r->size = slots;
+    r->mask = slots - 1;
+    SC_ATOMIC_INIT(r->tail);
+    SC_ATOMIC_INIT(r->head);
+    return r;
+}
+
+void PacketRingFree(PacketRing *r)
+{
+    if (r == NULL)
+        return;
+    SCFree(r->slots);
+    SCFreeAligned(r);
+}
+
+/**
+ *  \brief add a packet to the ring, producer thread only
+ *
+ *  The tail is published with a full barrier, so that a producer can
+ *  safely check whether the consumer went to sleep after this returns.
+ *
+ *  \retval false ring is full, packet not added
+ */
+bool PacketRingEnqueue(PacketRing *r, Packet *p)
+{
+    const uint32_t tail = SC_ATOMIC_LOAD_EXPLICIT(r->tail, SC_ATOMIC_MEMORY_ORDER_RELAXED);
+    if (tail - r->head_cache == r->size) {
+        r->head_cache = SC_ATOMIC_LOAD_EXPLICIT(r->head, SC_ATOMIC_MEMORY_ORDER_ACQUIRE);
+        if (tail - r->head_cache == r->size)
+            return false;
+    }
+    r->slots[tail & r->mask] = p;
+    SC_ATOMIC_STORE_EXPLICIT(r->tail, tail + 1, SC_ATOMIC_MEMORY_ORDER_SEQ_CST);
+    return true;
+}
+
+/**
+ *  \brief take up to 'max' packets from the ring, consumer thread only
+ *
+ *  \retval cnt number of packets stored in 'batch'
+ */
+uint32_t PacketRingDequeueBatch(PacketRing *r, Packet **batch, uint32_t max)
+{
+    const uint32_t head = SC_ATOMIC_LOAD_EXPLICIT(r->head, SC_ATOMIC_MEMORY_ORDER_RELAXED);
+    uint32_t avail = r->tail_cache - head;
+    if (avail < max) {
+        r->tail_cache = SC_ATOMIC_LOAD_EXPLICIT(r->tail, SC_ATOMIC_MEMORY_ORDER_SEQ_CST);
+        avail = r->tail_cache - head;
+        if (avail == 0)
+            return 0;
+    }
+    const uint32_t cnt = MIN(avail, max);
+    for (uint32_t i = 0; i < cnt; i++) {
+        batch[i] = r->slots[(head + i) & r->mask];
+    }
+    SC_ATOMIC_STORE_EXPLICIT(r->head, head + cnt, SC_ATOMIC_MEMORY_ORDER_RELEASE);
+    return cnt;
+}
+
+/** \brief number of packets in the ring, safe to call from any thread */
+uint32_t PacketRingLen(PacketRing *r)
+{
+    const uint32_t head = SC_ATOMIC_LOAD_EXPLICIT(r->head, SC_ATOMIC_MEMORY_ORDER_ACQUIRE);
+    const uint32_t tail = SC_ATOMIC_LOAD_EXPLICIT(r->tail, SC_ATOMIC_MEMORY_ORDER_ACQUIRE);
+    return tail - head;
+}
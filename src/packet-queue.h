@@ -55,6 +55,29 @@ typedef struct PacketQueue_ {
     SCCondT cond_q;
 } PacketQueue;
 
+/** \brief lockless fifo ring between one producer and one consumer thread
+ *
+ *  Producer and consumer each own one index and keep a private copy of
+ *  the other side's index, so the shared cache line of the other side
+ *  is only read when the local view is exhausted. The consumer takes
+ *  packets out in batches and publishes its index once per batch.
+ */
+typedef struct PacketRing_ {
+    /* producer side */
+    SC_ATOMIC_DECLARE(uint32_t, tail);
+    uint32_t head_cache;
+    uint8_t pad0[CLS - 2 * sizeof(uint32_t)];
+
+    /* consumer side */
+    SC_ATOMIC_DECLARE(uint32_t, head);
+    uint32_t tail_cache;
+    uint8_t pad1[CLS - 2 * sizeof(uint32_t)];
+
+    uint32_t size;  /**< number of slots, power of 2 */
+    uint32_t mask;
+    struct Packet_ **slots;
+} PacketRing;
+
 #include "decode.h"
 
 void PacketEnqueueNoLock(PacketQueueNoLock *qnl, struct Packet_ *p);
@@ -66,5 +89,11 @@ struct Packet_ *PacketDequeue (PacketQueue *);
 PacketQueue *PacketQueueAlloc(void);
 void PacketQueueFree(PacketQueue *);
 
+PacketRing *PacketRingAlloc(uint32_t size);
+void PacketRingFree(PacketRing *);
+bool PacketRingEnqueue(PacketRing *, struct Packet_ *);
+uint32_t PacketRingDequeueBatch(PacketRing *, struct Packet_ **, uint32_t);
+uint32_t PacketRingLen(PacketRing *);
+
 #endif /* __PACKET_QUEUE_H__ */
 
@@ -122,6 +122,20 @@ static void SRepCIDRAddNetblock(SRepCIDRTree *cidr_ctx, char *ip, int cat, uint8
     }
 }
 
+/** \brief compile the trees for fast lookups once all files are loaded */
+static void SRepCIDRCompile(SRepCIDRTree *cidr_ctx)
+{
+    for (int i = 0; i < SREP_MAX_CATS; i++) {
+        if ((cidr_ctx->srepIPV4_tree[i] != NULL &&
+                    SCRadixCompile(cidr_ctx->srepIPV4_tree[i]) < 0) ||
+                (cidr_ctx->srepIPV6_tree[i] != NULL &&
+                        SCRadixCompile(cidr_ctx->srepIPV6_tree[i]) < 0)) {
+            SCLogWarning(SC_ERR_NO_REPUTATION,
+                    "failed to compile reputation lookup tables for category %d", i);
+        }
+    }
+}
+
 static uint8_t SRepCIDRGetIPv4IPRep(SRepCIDRTree *cidr_ctx, uint8_t *ipv4_addr, uint8_t cat)
 {
     void *user_data = NULL;
@@ -650,6 +664,7 @@ int SRepInit(DetectEngineCtx *de_ctx)
             }
         }
     }
+    SRepCIDRCompile(cidr_ctx);
 
     /* Set effective rep version.
      * On live reload we will handle this after de_ctx has been swapped */
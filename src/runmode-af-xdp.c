@@ -0,0 +1,467 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup afxdppacket
+ *
+ * @{
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket runmode
+ *
+ * One thread per queue of the interface. As the threads are started in
+ * order, worker N reads queue N and is pinned to the Nth CPU of the
+ * worker-cpu-set when cpu affinity is enabled.
+ */
+
+#include "suricata-common.h"
+#include "tm-threads.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "runmode-af-xdp.h"
+
+#include "flow-bypass.h"
+
+#include "util-debug.h"
+#include "util-cpu.h"
+#include "util-device.h"
+#include "util-runmodes.h"
+#include "util-ioctl.h"
+#include "util-ebpf.h"
+#include "util-byte.h"
+
+#include "source-af-xdp.h"
+
+#ifdef HAVE_AF_XDP
+#include <net/if.h>
+#include <linux/if_link.h>
+#ifdef HAVE_XDP_XSK_H
+#include <xdp/xsk.h>
+#else
+#include <bpf/xsk.h>
+#endif
+#endif /* HAVE_AF_XDP */
+
+const char *RunModeAFXDPGetDefaultMode(void)
+{
+    return "workers";
+}
+
+void RunModeIdsAFXDPRegister(void)
+{
+    RunModeRegisterNewRunMode(RUNMODE_AFXDP_DEV, "single",
+            "Single threaded af-xdp mode",
+            RunModeIdsAFXDPSingle);
+    RunModeRegisterNewRunMode(RUNMODE_AFXDP_DEV, "workers",
+            "Workers af-xdp mode, each thread does all"
+            " tasks from acquisition to logging",
+            RunModeIdsAFXDPWorkers);
+    RunModeRegisterNewRunMode(RUNMODE_AFXDP_DEV, "autofp",
+            "Multi-threaded af-xdp mode.  Packets from "
+            "each flow are assigned to a single detect "
+            "thread.",
+            RunModeIdsAFXDPAutoFp);
+    return;
+}
+
+#ifdef HAVE_AF_XDP
+
+#define AFXDP_BATCH_SIZE_DEFAULT 64
+
+static void AFXDPDerefConfig(void *conf)
+{
+    AFXDPIfaceConfig *pfp = (AFXDPIfaceConfig *)conf;
+    /* config is used only once but cost of this low. */
+    if (SC_ATOMIC_SUB(pfp->ref, 1) == 1) {
+        SCFree(pfp);
+    }
+}
+
+static inline bool IsPowerOfTwo(uint32_t v)
+{
+    return v != 0 && (v & (v - 1)) == 0;
+}
+
+#ifdef HAVE_PACKET_XDP
+/**
+ * \brief load the XDP filter and set up bypass
+ *
+ * The filter has to be built with AF_XDP_REDIRECT so that the packets
+ * that are not bypassed are redirected to our sockets.
+ */
+static void AFXDPSetupXDPFilter(AFXDPIfaceConfig *aconf, ConfNode *if_root, ConfNode *if_default)
+{
+    int conf_val = 0;
+    int boolval = 1;
+
+    aconf->ebpf_t_config.mode = AFP_MODE_XDP_BYPASS;
+    aconf->ebpf_t_config.flags |= EBPF_XDP_CODE;
+    aconf->ebpf_t_config.cpus_count = UtilCpuGetNumProcessorsConfigured();
+
+    if (ConfGetChildValueBoolWithDefault(if_root, if_default, "use-percpu-hash", &boolval) == 1) {
+        if (boolval == 0) {
+            SCLogConfig("Not using percpu hash on iface %s", aconf->iface);
+            aconf->ebpf_t_config.cpus_count = 1;
+        }
+    }
+
+    int ret = EBPFLoadFile(aconf->iface, aconf->xdp_filter_file, "xdp", &aconf->xdp_filter_fd,
+            &aconf->ebpf_t_config);
+    if (ret != 0) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "Error when loading XDP filter file, "
+                "using default XDP program");
+        return;
+    }
+    ret = EBPFSetupXDP(aconf->iface, aconf->xdp_filter_fd, aconf->xdp_mode);
+    if (ret != 0) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "Error when setting up XDP, "
+                "using default XDP program");
+        return;
+    }
+    aconf->flags |= AFXDP_XDP_FILTER;
+
+    ConfGetChildValueBoolWithDefault(if_root, if_default, "bypass", &conf_val);
+    if (conf_val) {
+        SCLogConfig("Using bypass kernel functionality for AF_XDP (iface %s)", aconf->iface);
+        aconf->flags |= AFXDP_BYPASS;
+        BypassedFlowManagerRegisterUpdateFunc(EBPFUpdateFlow, NULL);
+    }
+}
+#endif /* HAVE_PACKET_XDP */
+
+/**
+ * \brief extract information from config file
+ *
+ * The returned structure will be freed by the thread init function.
+ * This is thus necessary to copy the structure before giving it
+ * to thread or to reparse the file for each thread (and thus have
+ * new structure.
+ *
+ * \return a AFXDPIfaceConfig corresponding to the interface name
+ */
+static void *ParseAFXDPConfig(const char *iface)
+{
+    ConfNode *if_root = NULL;
+    ConfNode *if_default = NULL;
+    const char *threadsstr = NULL;
+    const char *tmpctype = NULL;
+    const char *xdp_filter_file = NULL;
+    intmax_t value;
+    int boolval = 0;
+
+    if (iface == NULL) {
+        return NULL;
+    }
+
+    AFXDPIfaceConfig *aconf = SCCalloc(1, sizeof(*aconf));
+    if (unlikely(aconf == NULL)) {
+        return NULL;
+    }
+
+    strlcpy(aconf->iface, iface, sizeof(aconf->iface));
+    aconf->threads = 0;
+    SC_ATOMIC_INIT(aconf->ref);
+    (void)SC_ATOMIC_ADD(aconf->ref, 1);
+    SC_ATOMIC_INIT(aconf->queue_id);
+    aconf->promisc = 1;
+    aconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+    aconf->zero_copy = AFXDP_ZC_AUTO;
+    aconf->frame_size = XSK_UMEM__DEFAULT_FRAME_SIZE;
+    aconf->ring_size = XSK_RING_CONS__DEFAULT_NUM_DESCS;
+    aconf->batch_size = AFXDP_BATCH_SIZE_DEFAULT;
+    aconf->xdp_filter_fd = -1;
+    /* let the kernel use driver mode if supported */
+    aconf->xdp_mode = 0;
+    aconf->DerefFunc = AFXDPDerefConfig;
+
+    /* command line value has precedence */
+    const char *bpf_filter = NULL;
+    if (ConfGet("bpf-filter", &bpf_filter) == 1) {
+        if (strlen(bpf_filter) > 0) {
+            aconf->bpf_filter = bpf_filter;
+            SCLogConfig("Going to use command-line provided bpf filter '%s'", aconf->bpf_filter);
+        }
+    }
+
+    /* Find initial node */
+    ConfNode *af_xdp_node = ConfGetNode("af-xdp");
+    if (af_xdp_node == NULL) {
+        SCLogInfo("unable to find af-xdp config using default values");
+        goto finalize;
+    }
+
+    if_root = ConfFindDeviceConfig(af_xdp_node, iface);
+    if_default = ConfFindDeviceConfig(af_xdp_node, "default");
+
+    if (if_root == NULL && if_default == NULL) {
+        SCLogInfo("unable to find af-xdp config for "
+                  "interface \"%s\" or \"default\", using default values",
+                iface);
+        goto finalize;
+    }
+
+    /* If there is no setting for current interface use default one as main iface */
+    if (if_root == NULL) {
+        if_root = if_default;
+        if_default = NULL;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "threads", &threadsstr) == 1) {
+        if (strcmp(threadsstr, "auto") != 0 &&
+                StringParseInt32(&aconf->threads, 10, 0, threadsstr) < 0) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "Invalid config value for "
+                    "threads: %s, resetting to default", threadsstr);
+            aconf->threads = 0;
+        }
+    }
+
+    if (aconf->bpf_filter == NULL) {
+        if (ConfGetChildValueWithDefault(if_root, if_default, "bpf-filter", &bpf_filter) == 1) {
+            if (strlen(bpf_filter) > 0) {
+                aconf->bpf_filter = bpf_filter;
+                SCLogConfig("Going to use bpf filter %s", aconf->bpf_filter);
+            }
+        }
+    }
+
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "disable-promisc", &boolval);
+    if (boolval) {
+        SCLogConfig("Disabling promiscuous mode on iface %s", aconf->iface);
+        aconf->promisc = 0;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "checksum-checks", &tmpctype) == 1) {
+        if (strcmp(tmpctype, "auto") == 0) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+        } else if (ConfValIsTrue(tmpctype)) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_ENABLE;
+        } else if (ConfValIsFalse(tmpctype)) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+        } else {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid value for checksum-checks for %s",
+                    aconf->iface);
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "zero-copy", &tmpctype) == 1) {
+        if (strcmp(tmpctype, "auto") == 0) {
+            aconf->zero_copy = AFXDP_ZC_AUTO;
+        } else if (ConfValIsTrue(tmpctype)) {
+            aconf->zero_copy = AFXDP_ZC_ENABLE;
+        } else if (ConfValIsFalse(tmpctype)) {
+            aconf->zero_copy = AFXDP_ZC_DISABLE;
+        } else {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid value for zero-copy for %s",
+                    aconf->iface);
+        }
+    }
+
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "frame-size", &value) == 1) {
+        if (value < 2048 || value > getpagesize() || !IsPowerOfTwo((uint32_t)value)) {
+            SCLogError(SC_ERR_INVALID_VALUE, "frame-size must be a power of 2 between 2048 "
+                    "and the page size, using %" PRIu32, aconf->frame_size);
+        } else {
+            aconf->frame_size = (uint32_t)value;
+        }
+    }
+
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "ring-size", &value) == 1) {
+        if (value <= 0 || value > (1 << 24) || !IsPowerOfTwo((uint32_t)value)) {
+            SCLogError(SC_ERR_INVALID_VALUE, "ring-size must be a power of 2, using %" PRIu32,
+                    aconf->ring_size);
+        } else {
+            aconf->ring_size = (uint32_t)value;
+        }
+    }
+
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "batch-size", &value) == 1) {
+        if (value <= 0 || value > (intmax_t)aconf->ring_size) {
+            SCLogError(SC_ERR_INVALID_VALUE, "batch-size must be between 1 and ring-size, "
+                    "using %" PRIu32, aconf->batch_size);
+        } else {
+            aconf->batch_size = (uint32_t)value;
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "xdp-mode", &tmpctype) == 1) {
+        if (strcmp(tmpctype, "soft") == 0) {
+            aconf->xdp_mode = XDP_FLAGS_SKB_MODE;
+        } else if (strcmp(tmpctype, "driver") == 0) {
+            aconf->xdp_mode = XDP_FLAGS_DRV_MODE;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "Invalid xdp-mode value: '%s'", tmpctype);
+        }
+    }
+    if (aconf->xdp_mode == XDP_FLAGS_SKB_MODE && aconf->zero_copy == AFXDP_ZC_ENABLE) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "zero-copy is not possible with xdp-mode soft "
+                "on iface %s", aconf->iface);
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "xdp-filter-file", &xdp_filter_file) ==
+            1) {
+#ifdef HAVE_PACKET_XDP
+        aconf->xdp_filter_file = xdp_filter_file;
+        AFXDPSetupXDPFilter(aconf, if_root, if_default);
+#else
+        SCLogWarning(SC_ERR_UNIMPLEMENTED, "XDP filter set but XDP support is not built-in");
+#endif
+    }
+
+finalize:
+    if (aconf->threads == 0) {
+        int rss_queues = GetIfaceRSSQueuesNum(iface);
+        if (rss_queues > 0) {
+            aconf->threads = rss_queues;
+            SCLogPerf("%d RSS queues, so using %d threads", rss_queues, aconf->threads);
+        }
+    }
+    if (aconf->threads <= 0) {
+        aconf->threads = 1;
+    }
+    SCLogPerf("Using %d AF_XDP threads for interface %s", aconf->threads, iface);
+
+    SC_ATOMIC_RESET(aconf->ref);
+    (void)SC_ATOMIC_ADD(aconf->ref, aconf->threads);
+
+    if (aconf->promisc) {
+        int if_flags = GetIfaceFlags(iface);
+        if (if_flags != -1 && (if_flags & IFF_PROMISC) == 0) {
+            if (SetIfaceFlags(iface, if_flags | IFF_PROMISC) == -1) {
+                SCLogWarning(SC_ERR_AF_XDP_CREATE, "Unable to set promiscuous mode on %s", iface);
+            }
+        }
+    }
+
+    /* GRO and LRO merge packets before XDP sees them */
+    if (LiveGetOffload() == 0) {
+        if (GetIfaceOffloading(iface, 0, 1) == 1) {
+            SCLogWarning(SC_ERR_AF_XDP_CREATE,
+                    "Using AF_XDP with offloading activated leads to capture problems");
+        }
+    } else {
+        DisableIfaceOffloading(LiveGetDevice(iface), 0, 1);
+    }
+
+    return aconf;
+}
+
+static int AFXDPConfigGetThreadsCount(void *conf)
+{
+    AFXDPIfaceConfig *aconf = (AFXDPIfaceConfig *)conf;
+    return aconf->threads;
+}
+
+typedef enum { AFXDP_AUTOFP, AFXDP_WORKERS, AFXDP_SINGLE } AFXDPRunMode_t;
+
+static int AFXDPRunModeInit(AFXDPRunMode_t runmode)
+{
+    SCEnter();
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    const char *live_dev = NULL;
+    (void)ConfGet("af-xdp.live-interface", &live_dev);
+
+    int ret = 0;
+    switch (runmode) {
+        case AFXDP_AUTOFP:
+            ret = RunModeSetLiveCaptureAutoFp(ParseAFXDPConfig, AFXDPConfigGetThreadsCount,
+                    "ReceiveAFXDP", "DecodeAFXDP", thread_name_autofp, live_dev);
+            break;
+        case AFXDP_WORKERS:
+            ret = RunModeSetLiveCaptureWorkers(ParseAFXDPConfig, AFXDPConfigGetThreadsCount,
+                    "ReceiveAFXDP", "DecodeAFXDP", thread_name_workers, live_dev);
+            break;
+        case AFXDP_SINGLE:
+            ret = RunModeSetLiveCaptureSingle(ParseAFXDPConfig, AFXDPConfigGetThreadsCount,
+                    "ReceiveAFXDP", "DecodeAFXDP", thread_name_single, live_dev);
+            break;
+    }
+    if (ret != 0) {
+        FatalError(SC_ERR_FATAL, "Unable to start runmode %s",
+                runmode == AFXDP_AUTOFP ? "autofp"
+                                        : runmode == AFXDP_WORKERS ? "workers" : "single");
+    }
+
+    SCLogDebug("%s initialized",
+            runmode == AFXDP_AUTOFP ? "autofp" : runmode == AFXDP_WORKERS ? "workers" : "single");
+
+    SCReturnInt(0);
+}
+
+int RunModeIdsAFXDPAutoFp(void)
+{
+    return AFXDPRunModeInit(AFXDP_AUTOFP);
+}
+
+/**
+ * \brief Single thread version of the AF_XDP processing.
+ */
+int RunModeIdsAFXDPSingle(void)
+{
+    return AFXDPRunModeInit(AFXDP_SINGLE);
+}
+
+/**
+ * \brief Workers version of the AF_XDP processing.
+ *
+ * Start N threads with each thread doing all the work.
+ *
+ */
+int RunModeIdsAFXDPWorkers(void)
+{
+    return AFXDPRunModeInit(AFXDP_WORKERS);
+}
+#else
+int RunModeIdsAFXDPAutoFp(void)
+{
+    SCEnter();
+    FatalError(SC_ERR_FATAL, "AF_XDP not configured");
+    SCReturnInt(0);
+}
+
+/**
+ * \brief Single thread version of the AF_XDP processing.
+ */
+int RunModeIdsAFXDPSingle(void)
+{
+    SCEnter();
+    FatalError(SC_ERR_FATAL, "AF_XDP not configured");
+    SCReturnInt(0);
+}
+
+/**
+ * \brief Workers version of the AF_XDP processing.
+ *
+ * Start N threads with each thread doing all the work.
+ *
+ */
+int RunModeIdsAFXDPWorkers(void)
+{
+    SCEnter();
+    FatalError(SC_ERR_FATAL, "AF_XDP not configured");
+    SCReturnInt(0);
+}
+#endif /* HAVE_AF_XDP */
+
+/**
+ * @}
+ */
@@ -41,6 +41,7 @@
 #include "util-dpdk-i40e.h"
 #include "util-dpdk-ice.h"
 #include "util-dpdk-ixgbe.h"
+#include "flow-hash.h"
 
 #ifdef HAVE_DPDK
 
@@ -88,6 +89,7 @@ static int ConfigSetChecksumOffload(DPDKIfaceConfig *iconf, int entry_bool);
 static int ConfigSetCopyIface(DPDKIfaceConfig *iconf, const char *entry_str);
 static int ConfigSetCopyMode(DPDKIfaceConfig *iconf, const char *entry_str);
 static int ConfigSetCopyIfaceSettings(DPDKIfaceConfig *iconf, const char *iface, const char *mode);
+static int ConfigSetFlowShards(DPDKIfaceConfig *iconf, int entry_bool);
 static void ConfigInit(DPDKIfaceConfig **iconf);
 static int ConfigLoad(DPDKIfaceConfig *iconf, const char *iface);
 static DPDKIfaceConfig *ConfigParse(const char *iface);
@@ -114,6 +116,7 @@ static void DPDKDerefConfig(void *conf);
 #define DPDK_CONFIG_DEFAULT_CHECKSUM_VALIDATION_OFFLOAD 1
 #define DPDK_CONFIG_DEFAULT_COPY_MODE                   "none"
 #define DPDK_CONFIG_DEFAULT_COPY_INTERFACE              "none"
+#define DPDK_CONFIG_DEFAULT_FLOW_SHARDS                 0
 
 DPDKIfaceConfigAttributes dpdk_yaml = {
     .threads = "threads",
@@ -128,6 +131,7 @@ DPDKIfaceConfigAttributes dpdk_yaml = {
     .tx_descriptors = "tx-descriptors",
     .copy_mode = "copy-mode",
     .copy_iface = "copy-iface",
+    .flow_shards = "flow-shards",
 };
 
 static int GreatestDivisorUpTo(uint32_t num, uint32_t max_num)
@@ -612,6 +616,24 @@ static int ConfigSetCopyIfaceSettings(DPDKIfaceConfig *iconf, const char *iface,
     SCReturnInt(0);
 }
 
+static int ConfigSetFlowShards(DPDKIfaceConfig *iconf, int entry_bool)
+{
+    SCEnter();
+    if (!entry_bool)
+        SCReturnInt(0);
+
+    // a flow can only be tracked by a single queue if both directions use the same port
+    if (iconf->copy_mode != DPDK_COPY_MODE_NONE) {
+        SCLogWarning(SC_ERR_INVALID_VALUE,
+                "%s: flow-shards is not supported with copy-mode, using the shared flow table",
+                iconf->iface);
+        SCReturnInt(0);
+    }
+
+    iconf->flags |= DPDK_FLOW_SHARDS;
+    SCReturnInt(0);
+}
+
 static int ConfigLoad(DPDKIfaceConfig *iconf, const char *iface)
 {
     SCEnter();
@@ -722,6 +744,13 @@ static int ConfigLoad(DPDKIfaceConfig *iconf, const char *iface)
     if (retval < 0)
         SCReturnInt(retval);
 
+    retval = ConfGetChildValueBoolWithDefault(
+                     if_root, if_default, dpdk_yaml.flow_shards, &entry_bool) != 1
+                     ? ConfigSetFlowShards(iconf, DPDK_CONFIG_DEFAULT_FLOW_SHARDS)
+                     : ConfigSetFlowShards(iconf, entry_bool);
+    if (retval < 0)
+        SCReturnInt(retval);
+
     SCReturnInt(0);
 }
 
@@ -1162,10 +1191,6 @@ static int DeviceConfigure(DPDKIfaceConfig *iconf)
         return retval;
 
     DeviceInitPortConf(iconf, &dev_info, &port_conf);
-    if (port_conf.rxmode.offloads & DEV_RX_OFFLOAD_CHECKSUM) {
-        // Suricata does not need recalc checksums now
-        iconf->checksum_mode = CHECKSUM_VALIDATION_DISABLE;
-    }
 
     retval = rte_eth_dev_configure(
             iconf->port_id, iconf->nb_rx_queues, iconf->nb_tx_queues, &port_conf);
@@ -1312,6 +1337,36 @@ static int DPDKConfigGetThreadsCount(void *conf)
     return dpdk_conf->threads;
 }
 
+/**
+ * \brief Split the flow hash between the threads of the interfaces using flow-shards
+ *
+ * The interfaces are configured one by one as their threads are started, so the
+ * number of shards is counted from the configuration before.
+ */
+static void DPDKSetupFlowShards(void)
+{
+    uint32_t shards = 0;
+    int nlive = LiveGetDeviceCount();
+
+    for (int ldev = 0; ldev < nlive; ldev++) {
+        const char *live_dev = LiveGetDeviceName(ldev);
+        if (live_dev == NULL)
+            continue;
+        DPDKIfaceConfig *iconf = ConfigParse(live_dev);
+        if (iconf == NULL)
+            continue;
+        if (iconf->flags & DPDK_FLOW_SHARDS)
+            shards += (uint32_t)iconf->threads;
+        iconf->DerefFunc(iconf);
+    }
+
+    if (shards > UINT16_MAX) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "too many threads for flow-shards, disabling it");
+        shards = 0;
+    }
+    FlowHashSetShards((uint16_t)shards);
+}
+
 #endif /* HAVE_DPDK */
 
 const char *RunModeDpdkGetDefaultMode(void)
@@ -1343,6 +1398,7 @@ int RunModeIdsDpdkWorkers(void)
     TimeModeSetLive();
 
     InitEal();
+    DPDKSetupFlowShards();
     ret = RunModeSetLiveCaptureWorkers(ParseDpdkConfigAndConfigureDevice, DPDKConfigGetThreadsCount,
             "ReceiveDPDK", "DecodeDPDK", thread_name_workers, NULL);
     if (ret != 0) {
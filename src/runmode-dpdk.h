@@ -36,6 +36,7 @@ typedef struct DPDKIfaceConfigAttributes_ {
     const char *tx_descriptors;
     const char *copy_mode;
     const char *copy_iface;
+    const char *flow_shards;
 } DPDKIfaceConfigAttributes;
 
 int RunModeIdsDpdkWorkers(void);
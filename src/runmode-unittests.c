@@ -44,6 +44,8 @@
 #include "flow-manager.h"
 #include "flow-var.h"
 #include "flow-bit.h"
+#include "flow-cost.h"
+#include "flow-spare-pool.h"
 #include "pkt-var.h"
 
 #include "host.h"
@@ -76,10 +78,15 @@
 #include "util-profiling.h"
 #include "util-magic.h"
 #include "util-memcmp.h"
+#include "util-memcap-credit.h"
 #include "util-misc.h"
 #include "util-signal.h"
 
 #include "reputation.h"
+#include "datasets.h"
+#include "datasets-compact.h"
+#include "datasets-cidr.h"
+#include "util-lpm.h"
 #include "util-atomic.h"
 #include "util-spm.h"
 #include "util-hash.h"
@@ -90,6 +97,8 @@
 #include "util-byte.h"
 #include "util-proto-name.h"
 #include "util-macset.h"
+#include "util-numa.h"
+#include "util-pages.h"
 #include "util-memrchr.h"
 
 #include "util-mpm-ac.h"
@@ -123,7 +132,12 @@ static void RegisterUnittests(void)
     StreamTcpRegisterTests();
     SigRegisterTests();
     SCReputationRegisterTests();
+    DatasetRegisterTests();
+    DatasetCompactRegisterTests();
+    DatasetCidrRegisterTests();
+    SCLpmRegisterTests();
     TmModuleRegisterTests();
+    TmThreadsRegisterTests();
     SigTableRegisterTests();
     HashTableRegisterTests();
     HashListTableRegisterTests();
@@ -160,6 +174,7 @@ static void RegisterUnittests(void)
     ConfYamlRegisterTests();
     TmqhFlowRegisterTests();
     FlowRegisterTests();
+    FlowSparePoolRegisterTests();
     HostRegisterUnittests();
     IPPairRegisterUnittests();
     SCSigRegisterSignatureOrderingTests();
@@ -181,8 +196,10 @@ static void RegisterUnittests(void)
 #ifdef PROFILING
     SCProfilingRegisterTests();
 #endif
+    SCProfilingSampleRegisterTests();
     DeStateRegisterTests();
     MemcmpRegisterTests();
+    MemcapCreditRegisterTests();
     DetectEngineRegisterTests();
     SCLogRegisterTests();
     MagicRegisterTests();
@@ -196,6 +213,9 @@ static void RegisterUnittests(void)
     MimeDecRegisterTests();
     StreamingBufferRegisterTests();
     MacSetRegisterTests();
+    FlowCostRegisterTests();
+    UtilNumaRegisterTests();
+    PageLargeRegisterTests();
 #ifdef OS_WIN32
     Win32SyscallRegisterTests();
 #endif
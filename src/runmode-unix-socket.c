@@ -760,6 +760,67 @@ TmEcode UnixSocketDatasetRemove(json_t *cmd, json_t* answer, void *data)
     }
 }
 
+/**
+ * \brief Background task doing the deferred commits of datasets
+ *
+ * Updates of cidr sets in quick succession are batched, the rebuild of
+ * the lookup tables is done here rather than by the packet threads.
+ */
+TmEcode UnixSocketDatasetCommitTask(void *data)
+{
+    DatasetsCommitPending();
+    return TM_ECODE_OK;
+}
+
+static void UnixSocketDatasetStatsAdd(const Dataset *set, void *ctx)
+{
+    json_t *jsets = ctx;
+    json_t *jobj = json_object();
+    if (jobj == NULL)
+        return;
+
+    json_object_set_new(jobj, "name", json_string(set->name));
+    json_object_set_new(jobj, "type", json_string(DatasetGetTypeString(set->type)));
+    json_object_set_new(jobj, "compact", json_boolean(set->compact != NULL));
+    if (set->prefilter != NULL) {
+        DatasetPrefilterStatsResult res;
+        DatasetGetPrefilterStats(set, &res);
+
+        json_t *jpf = json_object();
+        if (jpf != NULL) {
+            json_object_set_new(jpf, "size",
+                    json_integer((json_int_t)set->prefilter->size *
+                                 (json_int_t)sizeof(DatasetPrefilterCounter)));
+            json_object_set_new(jpf, "skipped", json_integer((json_int_t)res.skipped));
+            json_object_set_new(
+                    jpf, "false_positives", json_integer((json_int_t)res.false_positives));
+            json_object_set_new(jobj, "prefilter", jpf);
+        }
+    }
+    json_array_append_new(jsets, jobj);
+}
+
+/**
+ * \brief Command to list the datasets with their prefilter statistics
+ *
+ * \param cmd the content of command Arguments as a json_t object
+ * \param answer the json_t object that has to be used to answer
+ * \param data not used
+ */
+TmEcode UnixSocketDatasetStats(json_t *cmd, json_t *answer, void *data)
+{
+    json_t *jsets = json_array();
+    if (jsets == NULL) {
+        json_object_set_new(answer, "message", json_string("internal error at json array creation"));
+        return TM_ECODE_FAILED;
+    }
+
+    DatasetsWalk(UnixSocketDatasetStatsAdd, jsets);
+
+    json_object_set_new(answer, "message", jsets);
+    return TM_ECODE_OK;
+}
+
 /**
  * \brief Command to add a tenant handler
  *
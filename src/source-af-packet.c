@@ -171,6 +171,9 @@ TmEcode NoAFPSupportExit(ThreadVars *tv, const void *initdata, void **data)
 
 #define POLL_TIMEOUT 100
 
+/** max number of packets of a tpacket_v3 block handed over at once */
+#define AFP_BATCH_SIZE 32
+
 /* kernel flags defined for RX ring tp_status */
 #ifndef TP_STATUS_KERNEL
 #define TP_STATUS_KERNEL 0
@@ -272,6 +275,12 @@ typedef struct AFPThreadVars_
     ThreadVars *tv;
     TmSlot *slot;
     LiveDevice *livedev;
+
+#ifdef HAVE_TPACKET_V3
+    /* packets of the current block, not yet handed to the pipeline */
+    Packet *batch[AFP_BATCH_SIZE];
+    uint32_t batch_cnt;
+#endif
     /* data link type for the thread */
     uint32_t datalink;
 
@@ -281,6 +290,13 @@ typedef struct AFPThreadVars_
     /* File descriptor of the IPv6 flow bypass table maps */
     int v6_map_fd;
 #endif
+#ifdef HAVE_PACKET_XDP
+    /* load published to the adaptive XDP load balancer */
+    bool xdp_lb_load;
+    EBPFCPULoadMaps lb_maps;
+    uint64_t lb_last_cputime; /* thread CPU time, in usec */
+    uint64_t lb_last_drops;
+#endif
 
     unsigned int frame_offset;
 
@@ -632,6 +648,63 @@ static inline void AFPDumpCounters(AFPThreadVars *ptv)
 #endif
 }
 
+#ifdef HAVE_PACKET_XDP
+/** \internal
+ *  \brief get the CPU time used by the calling thread, in usec */
+static uint64_t AFPThreadCPUTime(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/**
+ * \brief Setup the publication of the thread load to the XDP load balancer
+ *
+ * Only done when the XDP program has a cpus_load map. Must be called from the
+ * capture thread as the load is the CPU time used by the calling thread.
+ */
+static void AFPXDPLoadInit(AFPThreadVars *ptv)
+{
+    if (EBPFGetCPULoadMaps(ptv->iface, &ptv->lb_maps) < 0)
+        return;
+
+    ptv->lb_last_cputime = AFPThreadCPUTime();
+    ptv->xdp_lb_load = true;
+    SCLogConfig("%s: publishing load to the XDP load balancer", ptv->tv->name);
+}
+
+/**
+ * \brief Publish the thread load to the adaptive XDP load balancer
+ *
+ * The load is the CPU time in usec the worker used since the last call.
+ * Time spent waiting for packets doesn't count, so it is the cost of
+ * decoding, detection and output of the packets of the thread, whatever
+ * the throughput. A thread that had kernel drops publishes the maximum
+ * load so it is not selected for new IP pairs.
+ */
+static void AFPXDPLoadUpdate(AFPThreadVars *ptv)
+{
+    const uint64_t cputime = AFPThreadCPUTime();
+    const uint64_t used = cputime - ptv->lb_last_cputime;
+    uint32_t load = used < UINT32_MAX ? (uint32_t)used : UINT32_MAX;
+    ptv->lb_last_cputime = cputime;
+#ifdef PACKET_STATISTICS
+    uint64_t drops = StatsGetLocalCounterValue(ptv->tv, ptv->capture_kernel_drops);
+    if (drops != ptv->lb_last_drops) {
+        load = UINT32_MAX;
+        ptv->lb_last_drops = drops;
+    }
+#endif
+
+    int cpu = sched_getcpu();
+    if (cpu < 0 || EBPFSetCPULoad(&ptv->lb_maps, (uint32_t)cpu, load) < 0) {
+        SCLogDebug("%s: CPU %d is not in the xdp-cpu-redirect set", ptv->tv->name, cpu);
+    }
+}
+#endif
+
 /**
  * \brief AF packet write function.
  *
@@ -782,6 +855,7 @@ static void AFPReadFromRingSetupPacket(
         p->vlan_id[0] = h.h2->tp_vlan_tci & 0x0fff;
         p->vlan_idx = 1;
         p->afp_v.vlan_tci = h.h2->tp_vlan_tci;
+        p->capture_flags |= PKT_CAPTURE_VLAN_STRIPPED;
     }
 
     (void)PacketSetData(p, (unsigned char *)h.raw + h.h2->tp_mac, h.h2->tp_snaplen);
@@ -816,6 +890,10 @@ static void AFPReadFromRingSetupPacket(
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
     }
+    /* kernel or NIC validated the L4 checksum */
+    if (!(p->flags & PKT_IGNORE_CHECKSUM) && (tp_status & TP_STATUS_CSUM_VALID)) {
+        p->capture_flags |= PKT_CAPTURE_L4_CSUM_OK;
+    }
 }
 
 static inline int AFPReadFromRingWaitForPacket(AFPThreadVars *ptv)
@@ -949,6 +1027,7 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
         p->vlan_id[0] = ppd->hv1.tp_vlan_tci & 0x0fff;
         p->vlan_idx = 1;
         p->afp_v.vlan_tci = ppd->hv1.tp_vlan_tci;
+        p->capture_flags |= PKT_CAPTURE_VLAN_STRIPPED;
     }
 
     (void)PacketSetData(p, (unsigned char *)ppd + ppd->tp_mac, ppd->tp_snaplen);
@@ -980,14 +1059,34 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
             p->flags |= PKT_IGNORE_CHECKSUM;
         }
     }
+    /* kernel or NIC validated the L4 checksum */
+    if (!(p->flags & PKT_IGNORE_CHECKSUM) && (ppd->tp_status & TP_STATUS_CSUM_VALID)) {
+        p->capture_flags |= PKT_CAPTURE_L4_CSUM_OK;
+    }
 
-    if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+    ptv->batch[ptv->batch_cnt++] = p;
+    SCReturnInt(AFP_READ_OK);
+}
+
+/** \internal
+ *  \brief hand the batched packets of the block to the pipeline
+ */
+static inline int AFPFlushBatchV3(AFPThreadVars *ptv)
+{
+    const uint32_t cnt = ptv->batch_cnt;
+    ptv->batch_cnt = 0;
+    if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch, cnt) != TM_ECODE_OK) {
         SCReturnInt(AFP_SURI_FAILURE);
     }
-
     SCReturnInt(AFP_READ_OK);
 }
 
+/** \internal
+ *  \brief process the packets of a block
+ *
+ *  The packet data points into the block, so all packets are processed
+ *  before returning, the block is handed back to the kernel afterwards.
+ */
 static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pbd)
 {
     const int num_pkts = pbd->hdr.bh1.num_pkts;
@@ -995,6 +1094,9 @@ static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pb
 
     for (int i = 0; i < num_pkts; ++i) {
         int ret = AFPParsePacketV3(ptv, pbd, (struct tpacket3_hdr *)ppd);
+        if (ret == AFP_READ_OK && ptv->batch_cnt == AFP_BATCH_SIZE) {
+            ret = AFPFlushBatchV3(ptv);
+        }
         switch (ret) {
             case AFP_READ_OK:
                 break;
@@ -1003,13 +1105,18 @@ static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pb
                  * treat thenext packet */
                 break;
             case AFP_READ_FAILURE:
+                (void)AFPFlushBatchV3(ptv);
                 SCReturnInt(AFP_READ_FAILURE);
             default:
+                (void)AFPFlushBatchV3(ptv);
                 SCReturnInt(ret);
         }
         ppd = ppd + ((struct tpacket3_hdr *)ppd)->tp_next_offset;
     }
 
+    /* on failure the packets are released already, the block can go */
+    (void)AFPFlushBatchV3(ptv);
+
     SCReturnInt(AFP_READ_OK);
 }
 #endif /* HAVE_TPACKET_V3 */
@@ -1335,6 +1442,10 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
 #endif
     }
 
+#ifdef HAVE_PACKET_XDP
+    AFPXDPLoadInit(ptv);
+#endif
+
     fds.fd = ptv->socket;
     fds.events = POLLIN;
 
@@ -1398,6 +1509,10 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
                     current_time = time(NULL);
                     if (current_time != last_dump) {
                         AFPDumpCounters(ptv);
+#ifdef HAVE_PACKET_XDP
+                        if (ptv->xdp_lb_load)
+                            AFPXDPLoadUpdate(ptv);
+#endif
                         last_dump = current_time;
                     }
                     break;
@@ -1421,6 +1536,10 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
             current_time = time(NULL);
             if (current_time != last_dump) {
                 AFPDumpCounters(ptv);
+#ifdef HAVE_PACKET_XDP
+                if (ptv->xdp_lb_load)
+                    AFPXDPLoadUpdate(ptv);
+#endif
                 last_dump = current_time;
             }
             /* poll timed out, lets see handle our timeout path */
@@ -2084,91 +2203,6 @@ TmEcode AFPSetBPFFilter(AFPThreadVars *ptv)
 }
 
 #ifdef HAVE_PACKET_EBPF
-/**
- * Insert a half flow in the kernel bypass table
- *
- * \param mapfd file descriptor of the protocol bypass table
- * \param key data to use as key in the table
- * \return 0 in case of error, 1 if success
- */
-static int AFPInsertHalfFlow(int mapd, void *key, unsigned int nr_cpus)
-{
-    BPF_DECLARE_PERCPU(struct pair, value, nr_cpus);
-    unsigned int i;
-
-    if (mapd == -1) {
-        return 0;
-    }
-
-    /* We use a per CPU structure so we have to set an array of values as the kernel
-     * is not duplicating the data on each CPU by itself. */
-    for (i = 0; i < nr_cpus; i++) {
-        BPF_PERCPU(value, i).packets = 0;
-        BPF_PERCPU(value, i).bytes = 0;
-    }
-    if (bpf_map_update_elem(mapd, key, value, BPF_NOEXIST) != 0) {
-        switch (errno) {
-            /* no more place in the hash */
-            case E2BIG:
-                return 0;
-            /* no more place in the hash for some hardware bypass */
-            case EAGAIN:
-                return 0;
-            /* if we already have the key then bypass is a success */
-            case EEXIST:
-                return 1;
-            /* Not supposed to be there so issue a error */
-            default:
-                SCLogError(SC_ERR_BPF, "Can't update eBPF map: %s (%d)",
-                        strerror(errno),
-                        errno);
-                return 0;
-        }
-    }
-    return 1;
-}
-
-static int AFPSetFlowStorage(Packet *p, int map_fd, void *key0, void* key1,
-                             int family)
-{
-    FlowBypassInfo *fc = FlowGetStorageById(p->flow, GetFlowBypassInfoID());
-    if (fc) {
-        if (fc->bypass_data != NULL) {
-            // bypass already activated
-            SCFree(key0);
-            SCFree(key1);
-            return 1;
-        }
-        EBPFBypassData *eb = SCCalloc(1, sizeof(EBPFBypassData));
-        if (eb == NULL) {
-            EBPFDeleteKey(map_fd, key0);
-            EBPFDeleteKey(map_fd, key1);
-            LiveDevAddBypassFail(p->livedev, 1, family);
-            SCFree(key0);
-            SCFree(key1);
-            return 0;
-        }
-        eb->key[0] = key0;
-        eb->key[1] = key1;
-        eb->mapfd = map_fd;
-        eb->cpus_count = p->afp_v.nr_cpus;
-        fc->BypassUpdate = EBPFBypassUpdate;
-        fc->BypassFree = EBPFBypassFree;
-        fc->bypass_data = eb;
-    } else {
-        EBPFDeleteKey(map_fd, key0);
-        EBPFDeleteKey(map_fd, key1);
-        LiveDevAddBypassFail(p->livedev, 1, family);
-        SCFree(key0);
-        SCFree(key1);
-        return 0;
-    }
-
-    LiveDevAddBypassStats(p->livedev, 1, family);
-    LiveDevAddBypassSuccess(p->livedev, 1, family);
-    return 1;
-}
-
 /**
  * Bypass function for AF_PACKET capture in eBPF mode
  *
@@ -2225,7 +2259,7 @@ static int AFPBypassCallback(Packet *p)
         } else {
             keys[0]->ip_proto = 0;
         }
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, keys[0],
+        if (EBPFInsertHalfFlow(p->afp_v.v4_map_fd, keys[0],
                               p->afp_v.nr_cpus) == 0) {
             LiveDevAddBypassFail(p->livedev, 1, AF_INET);
             SCFree(keys[0]);
@@ -2246,7 +2280,7 @@ static int AFPBypassCallback(Packet *p)
         keys[1]->vlan1 = p->vlan_id[1];
 
         keys[1]->ip_proto = keys[0]->ip_proto;
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, keys[1],
+        if (EBPFInsertHalfFlow(p->afp_v.v4_map_fd, keys[1],
                               p->afp_v.nr_cpus) == 0) {
             EBPFDeleteKey(p->afp_v.v4_map_fd, keys[0]);
             LiveDevAddBypassFail(p->livedev, 1, AF_INET);
@@ -2255,7 +2289,8 @@ static int AFPBypassCallback(Packet *p)
             return 0;
         }
         EBPFUpdateFlow(p->flow, p, NULL);
-        return AFPSetFlowStorage(p, p->afp_v.v4_map_fd, keys[0], keys[1], AF_INET);
+        return EBPFSetFlowStorage(
+                p, p->afp_v.v4_map_fd, keys[0], keys[1], AF_INET, p->afp_v.nr_cpus);
     }
     /* For IPv6 case we don't handle extended header in eBPF */
     if (PKT_IS_IPV6(p) &&
@@ -2285,7 +2320,7 @@ static int AFPBypassCallback(Packet *p)
         } else {
             keys[0]->ip_proto = 0;
         }
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, keys[0],
+        if (EBPFInsertHalfFlow(p->afp_v.v6_map_fd, keys[0],
                               p->afp_v.nr_cpus) == 0) {
             LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
             SCFree(keys[0]);
@@ -2308,7 +2343,7 @@ static int AFPBypassCallback(Packet *p)
         keys[1]->vlan1 = p->vlan_id[1];
 
         keys[1]->ip_proto = keys[0]->ip_proto;
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, keys[1],
+        if (EBPFInsertHalfFlow(p->afp_v.v6_map_fd, keys[1],
                               p->afp_v.nr_cpus) == 0) {
             EBPFDeleteKey(p->afp_v.v6_map_fd, keys[0]);
             LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
@@ -2318,7 +2353,8 @@ static int AFPBypassCallback(Packet *p)
         }
         if (p->flow)
             EBPFUpdateFlow(p->flow, p, NULL);
-        return AFPSetFlowStorage(p, p->afp_v.v6_map_fd, keys[0], keys[1], AF_INET6);
+        return EBPFSetFlowStorage(
+                p, p->afp_v.v6_map_fd, keys[0], keys[1], AF_INET6, p->afp_v.nr_cpus);
     }
     return 0;
 }
@@ -2326,148 +2362,13 @@ static int AFPBypassCallback(Packet *p)
 /**
  * Bypass function for AF_PACKET capture in XDP mode
  *
- * This function creates two half flows in the map shared with the kernel
- * to trigger bypass. This function is similar to AFPBypassCallback() but
- * the bytes order is changed for some data due to the way we get the data
- * in the XDP case.
- *
  * \param p the packet belonging to the flow to bypass
  * \return 0 if unable to bypass, 1 if success
  */
 static int AFPXDPBypassCallback(Packet *p)
 {
     SCLogDebug("Calling af_packet callback function");
-    /* Only bypass TCP and UDP */
-    if (!(PKT_IS_TCP(p) || PKT_IS_UDP(p))) {
-        return 0;
-    }
-
-    /* If we don't have a flow attached to packet the eBPF map entries
-     * will be destroyed at first flow bypass manager pass as we won't
-     * find any associated entry */
-    if (p->flow == NULL) {
-        return 0;
-    }
-    /* Bypassing tunneled packets is currently not supported
-     * because we can't discard the inner packet only due to
-     * primitive parsing in eBPF */
-    if (IS_TUNNEL_PKT(p)) {
-        return 0;
-    }
-    if (PKT_IS_IPV4(p)) {
-        struct flowv4_keys *keys[2];
-        keys[0]= SCCalloc(1, sizeof(struct flowv4_keys));
-        if (keys[0] == NULL) {
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
-            return 0;
-        }
-        if (p->afp_v.v4_map_fd == -1) {
-            SCFree(keys[0]);
-            return 0;
-        }
-        keys[0]->src = p->src.addr_data32[0];
-        keys[0]->dst = p->dst.addr_data32[0];
-        /* In the XDP filter we get port from parsing of packet and not from skb
-         * (as in eBPF filter) so we need to pass from host to network order */
-        keys[0]->port16[0] = htons(p->sp);
-        keys[0]->port16[1] = htons(p->dp);
-        keys[0]->vlan0 = p->vlan_id[0];
-        keys[0]->vlan1 = p->vlan_id[1];
-        if (IPV4_GET_IPPROTO(p) == IPPROTO_TCP) {
-            keys[0]->ip_proto = 1;
-        } else {
-            keys[0]->ip_proto = 0;
-        }
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, keys[0],
-                              p->afp_v.nr_cpus) == 0) {
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
-            SCFree(keys[0]);
-            return 0;
-        }
-        keys[1]= SCCalloc(1, sizeof(struct flowv4_keys));
-        if (keys[1] == NULL) {
-            EBPFDeleteKey(p->afp_v.v4_map_fd, keys[0]);
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
-            SCFree(keys[0]);
-            return 0;
-        }
-        keys[1]->src = p->dst.addr_data32[0];
-        keys[1]->dst = p->src.addr_data32[0];
-        keys[1]->port16[0] = htons(p->dp);
-        keys[1]->port16[1] = htons(p->sp);
-        keys[1]->vlan0 = p->vlan_id[0];
-        keys[1]->vlan1 = p->vlan_id[1];
-        keys[1]->ip_proto = keys[0]->ip_proto;
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, keys[1],
-                              p->afp_v.nr_cpus) == 0) {
-            EBPFDeleteKey(p->afp_v.v4_map_fd, keys[0]);
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
-            SCFree(keys[0]);
-            SCFree(keys[1]);
-            return 0;
-        }
-        return AFPSetFlowStorage(p, p->afp_v.v4_map_fd, keys[0], keys[1], AF_INET);
-    }
-    /* For IPv6 case we don't handle extended header in eBPF */
-    if (PKT_IS_IPV6(p) &&
-        ((IPV6_GET_NH(p) == IPPROTO_TCP) || (IPV6_GET_NH(p) == IPPROTO_UDP))) {
-        SCLogDebug("add an IPv6");
-        if (p->afp_v.v6_map_fd == -1) {
-            return 0;
-        }
-        int i;
-        struct flowv6_keys *keys[2];
-        keys[0] = SCCalloc(1, sizeof(struct flowv6_keys));
-        if (keys[0] == NULL) {
-            return 0;
-        }
-
-        for (i = 0; i < 4; i++) {
-            keys[0]->src[i] = GET_IPV6_SRC_ADDR(p)[i];
-            keys[0]->dst[i] = GET_IPV6_DST_ADDR(p)[i];
-        }
-        keys[0]->port16[0] = htons(GET_TCP_SRC_PORT(p));
-        keys[0]->port16[1] = htons(GET_TCP_DST_PORT(p));
-        keys[0]->vlan0 = p->vlan_id[0];
-        keys[0]->vlan1 = p->vlan_id[1];
-        if (IPV6_GET_NH(p) == IPPROTO_TCP) {
-            keys[0]->ip_proto = 1;
-        } else {
-            keys[0]->ip_proto = 0;
-        }
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, keys[0],
-                              p->afp_v.nr_cpus) == 0) {
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
-            SCFree(keys[0]);
-            return 0;
-        }
-        keys[1]= SCCalloc(1, sizeof(struct flowv6_keys));
-        if (keys[1] == NULL) {
-            EBPFDeleteKey(p->afp_v.v6_map_fd, keys[0]);
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
-            SCFree(keys[0]);
-            return 0;
-        }
-        for (i = 0; i < 4; i++) {
-            keys[1]->src[i] = GET_IPV6_DST_ADDR(p)[i];
-            keys[1]->dst[i] = GET_IPV6_SRC_ADDR(p)[i];
-        }
-        keys[1]->port16[0] = htons(GET_TCP_DST_PORT(p));
-        keys[1]->port16[1] = htons(GET_TCP_SRC_PORT(p));
-        keys[1]->vlan0 = p->vlan_id[0];
-        keys[1]->vlan1 = p->vlan_id[1];
-        keys[1]->ip_proto = keys[0]->ip_proto;
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, keys[1],
-                              p->afp_v.nr_cpus) == 0) {
-            EBPFDeleteKey(p->afp_v.v6_map_fd, keys[0]);
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
-            SCFree(keys[0]);
-            SCFree(keys[1]);
-            return 0;
-        }
-        return AFPSetFlowStorage(p, p->afp_v.v6_map_fd, keys[0], keys[1], AF_INET6);
-    }
-    return 0;
+    return EBPFXDPBypassPacket(p, p->afp_v.v4_map_fd, p->afp_v.v6_map_fd, p->afp_v.nr_cpus);
 }
 
 bool g_flowv4_ok = true;
@@ -2706,7 +2607,7 @@ TmEcode DecodeAFP(ThreadVars *tv, Packet *p, void *data)
 {
     SCEnter();
 
-    const bool afp_vlan_hdr = p->vlan_idx != 0;
+    const bool afp_vlan_hdr = (p->capture_flags & PKT_CAPTURE_VLAN_STRIPPED) != 0;
     DecodeThreadVars *dtv = (DecodeThreadVars *)data;
 
     DEBUG_VALIDATE_BUG_ON(PKT_IS_PSEUDOPKT(p));
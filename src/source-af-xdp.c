@@ -0,0 +1,783 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ *  \defgroup afxdppacket AF_XDP running mode
+ *
+ *  @{
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket acquisition support
+ *
+ * Each thread opens an AF_XDP socket bound to one queue of the interface.
+ * The packets are received in a UMEM area registered by the thread. In
+ * the workers and single runmodes the packet data is not copied: the
+ * packet points into its UMEM frame and the frame is handed back to the
+ * kernel when the packet is released. In autofp the data is copied and
+ * the frame is recycled right away.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "decode.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-modules.h"
+#include "tm-threads.h"
+#include "tm-threads-common.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "tmqh-packetpool.h"
+#include "util-checksum.h"
+#include "util-datalink.h"
+#include "util-debug.h"
+#include "util-device.h"
+#include "util-ebpf.h"
+#include "util-error.h"
+#include "util-privs.h"
+#include "util-validate.h"
+
+#include "source-af-xdp.h"
+
+#ifdef HAVE_AF_XDP
+
+#include <poll.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#ifdef HAVE_XDP_XSK_H
+#include <xdp/xsk.h>
+#else
+#include <bpf/xsk.h>
+#endif
+
+/* libxdp renamed the libbpf flag */
+#ifndef XSK_LIBBPF_FLAGS__INHIBIT_PROG_LOAD
+#define XSK_LIBBPF_FLAGS__INHIBIT_PROG_LOAD XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD
+#endif
+
+#ifdef HAVE_PCAP_H
+#include <pcap.h>
+#endif
+
+#ifdef HAVE_PCAP_PCAP_H
+#include <pcap/pcap.h>
+#endif
+
+#include "util-bpf.h"
+
+#endif /* HAVE_AF_XDP */
+
+#ifndef HAVE_AF_XDP
+
+/**
+ * \brief this function prints an error message and exits.
+ */
+static TmEcode NoAFXDPSupportExit(ThreadVars *tv, const void *initdata, void **data)
+{
+    FatalError(SC_ERR_NO_AF_XDP,
+            "Error creating thread %s: AF_XDP is not enabled. "
+            "Make sure libxdp or libbpf development files are installed "
+            "when building.",
+            tv->name);
+}
+
+void TmModuleReceiveAFXDPRegister(void)
+{
+    tmm_modules[TMM_RECEIVEAFXDP].name = "ReceiveAFXDP";
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadInit = NoAFXDPSupportExit;
+    tmm_modules[TMM_RECEIVEAFXDP].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeAFXDP.
+ */
+void TmModuleDecodeAFXDPRegister(void)
+{
+    tmm_modules[TMM_DECODEAFXDP].name = "DecodeAFXDP";
+    tmm_modules[TMM_DECODEAFXDP].ThreadInit = NoAFXDPSupportExit;
+    tmm_modules[TMM_DECODEAFXDP].flags = TM_FLAG_DECODE_TM;
+}
+
+#else /* We have AF_XDP support */
+
+#define POLL_TIMEOUT 100
+
+/**
+ * \brief Structure to hold thread specific variables.
+ */
+typedef struct AFXDPThreadVars_ {
+    char iface[AFXDP_IFACE_NAME_LENGTH];
+    uint32_t queue_id;
+    int flags;
+    /* packet data points into the UMEM instead of being copied */
+    bool zero_copy;
+    ChecksumValidationMode checksum_mode;
+    struct bpf_program bpf_prog;
+
+    /* suricata internals */
+    TmSlot *slot;
+    ThreadVars *tv;
+    LiveDevice *livedev;
+
+    /* UMEM and its rings */
+    struct xsk_umem *umem;
+    void *umem_area;
+    uint64_t umem_size;
+    uint32_t frame_size;
+    uint32_t frame_count;
+    struct xsk_ring_prod fq;
+    struct xsk_ring_cons cq;
+
+    /* socket and its rx ring */
+    struct xsk_socket *xsk;
+    struct xsk_ring_cons rx;
+    int fd;
+    uint32_t batch_size;
+
+    /* frames owned by Suricata again, waiting to be put on the fill ring */
+    uint64_t *free_frames;
+    uint32_t free_cnt;
+
+    /* packets of the current read, handed to the pipeline at once */
+    Packet **batch;
+
+#ifdef HAVE_PACKET_EBPF
+    int v4_map_fd;
+    int v6_map_fd;
+    unsigned int nr_cpus;
+#endif
+
+    /* counters */
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t drops;
+    uint64_t pkts_dumped;
+    uint16_t capture_kernel_packets;
+    uint16_t capture_kernel_drops;
+} AFXDPThreadVars;
+
+static inline void AFXDPFrameFree(AFXDPThreadVars *ptv, uint64_t frame)
+{
+    DEBUG_VALIDATE_BUG_ON(ptv->free_cnt >= ptv->frame_count);
+    ptv->free_frames[ptv->free_cnt++] = frame;
+}
+
+/**
+ * \brief Hand the released frames back to the kernel
+ *
+ * The fill ring is as large as the UMEM, so there is always room for
+ * all the frames we own.
+ */
+static inline void AFXDPRefillFillRing(AFXDPThreadVars *ptv)
+{
+    if (ptv->free_cnt == 0)
+        return;
+
+    uint32_t idx = 0;
+    const uint32_t n = xsk_ring_prod__reserve(&ptv->fq, ptv->free_cnt, &idx);
+    for (uint32_t i = 0; i < n; i++) {
+        *xsk_ring_prod__fill_addr(&ptv->fq, idx++) = ptv->free_frames[--ptv->free_cnt];
+    }
+    xsk_ring_prod__submit(&ptv->fq, n);
+}
+
+static void AFXDPDumpCounters(AFXDPThreadVars *ptv)
+{
+    struct xdp_statistics stats;
+    socklen_t len = sizeof(stats);
+
+    if (getsockopt(ptv->fd, SOL_XDP, XDP_STATISTICS, &stats, &len) == 0) {
+        uint64_t drops = stats.rx_dropped;
+#ifdef HAVE_STRUCT_XDP_STATISTICS_RX_RING_FULL
+        drops += stats.rx_ring_full;
+#endif
+        /* kernel values are totals since the socket creation */
+        StatsSetUI64(ptv->tv, ptv->capture_kernel_drops, drops);
+        (void)SC_ATOMIC_ADD(ptv->livedev->drop, drops - ptv->drops);
+        ptv->drops = drops;
+    }
+    StatsSetUI64(ptv->tv, ptv->capture_kernel_packets, ptv->pkts);
+    (void)SC_ATOMIC_ADD(ptv->livedev->pkts, ptv->pkts - ptv->pkts_dumped);
+    ptv->pkts_dumped = ptv->pkts;
+}
+
+static void AFXDPCloseSocket(AFXDPThreadVars *ptv)
+{
+    if (ptv->xsk != NULL) {
+        xsk_socket__delete(ptv->xsk);
+        ptv->xsk = NULL;
+    }
+    if (ptv->umem != NULL) {
+        (void)xsk_umem__delete(ptv->umem);
+        ptv->umem = NULL;
+    }
+    if (ptv->umem_area != NULL) {
+        SCFreeAligned(ptv->umem_area);
+        ptv->umem_area = NULL;
+    }
+    if (ptv->free_frames != NULL) {
+        SCFree(ptv->free_frames);
+        ptv->free_frames = NULL;
+    }
+    if (ptv->batch != NULL) {
+        SCFree(ptv->batch);
+        ptv->batch = NULL;
+    }
+}
+
+/**
+ * \brief Create the UMEM and the socket bound to the thread queue
+ *
+ * \retval 0 on success, -1 on error
+ */
+static int AFXDPCreateSocket(AFXDPThreadVars *ptv, const AFXDPIfaceConfig *aconf)
+{
+    ptv->umem_size = (uint64_t)ptv->frame_count * ptv->frame_size;
+    ptv->umem_area = SCMallocAligned(ptv->umem_size, getpagesize());
+    if (ptv->umem_area == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate %" PRIu64 " bytes of UMEM for iface %s",
+                ptv->umem_size, ptv->iface);
+        return -1;
+    }
+
+    struct xsk_umem_config ucfg = {
+        .fill_size = ptv->frame_count,
+        .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .frame_size = ptv->frame_size,
+        .frame_headroom = XSK_UMEM__DEFAULT_FRAME_HEADROOM,
+        .flags = XSK_UMEM__DEFAULT_FLAGS,
+    };
+    int r = xsk_umem__create(
+            &ptv->umem, ptv->umem_area, ptv->umem_size, &ptv->fq, &ptv->cq, &ucfg);
+    if (r != 0) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "Unable to create UMEM for iface %s: %s", ptv->iface,
+                strerror(-r));
+        return -1;
+    }
+
+    struct xsk_socket_config scfg;
+    memset(&scfg, 0, sizeof(scfg));
+    scfg.rx_size = aconf->ring_size;
+    scfg.xdp_flags = aconf->xdp_mode;
+    scfg.bind_flags = XDP_USE_NEED_WAKEUP;
+    if (aconf->zero_copy == AFXDP_ZC_ENABLE) {
+        scfg.bind_flags |= XDP_ZEROCOPY;
+    } else if (aconf->zero_copy == AFXDP_ZC_DISABLE) {
+        scfg.bind_flags |= XDP_COPY;
+    }
+    /* our XDP filter is attached already, the socket only has to be
+     * added to its map */
+    if (aconf->flags & AFXDP_XDP_FILTER) {
+        scfg.libbpf_flags = XSK_LIBBPF_FLAGS__INHIBIT_PROG_LOAD;
+    }
+
+    /* IDS only, so no tx ring */
+    r = xsk_socket__create(&ptv->xsk, ptv->iface, ptv->queue_id, ptv->umem, &ptv->rx, NULL, &scfg);
+    if (r != 0) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "Unable to create AF_XDP socket on queue %" PRIu32
+                " of iface %s: %s%s", ptv->queue_id, ptv->iface, strerror(-r),
+                aconf->zero_copy == AFXDP_ZC_ENABLE ? " (is zero-copy supported by the driver?)"
+                                                    : "");
+        return -1;
+    }
+
+#ifdef HAVE_PACKET_XDP
+    if (aconf->flags & AFXDP_XDP_FILTER) {
+        int map_fd = EBPFGetMapFDByName(ptv->iface, "xsks_map");
+        if (map_fd < 0) {
+            SCLogError(SC_ERR_AF_XDP_CREATE, "Can't find 'xsks_map' in the XDP filter of iface %s, "
+                    "is the filter built for AF_XDP?", ptv->iface);
+            return -1;
+        }
+        r = xsk_socket__update_xskmap(ptv->xsk, map_fd);
+        if (r != 0) {
+            SCLogError(SC_ERR_AF_XDP_CREATE, "Unable to add queue %" PRIu32 " of iface %s "
+                    "to 'xsks_map': %s", ptv->queue_id, ptv->iface, strerror(-r));
+            return -1;
+        }
+    }
+#endif
+
+    ptv->fd = xsk_socket__fd(ptv->xsk);
+
+    ptv->free_frames = SCMalloc(ptv->frame_count * sizeof(uint64_t));
+    if (ptv->free_frames == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate frame stack for iface %s", ptv->iface);
+        return -1;
+    }
+    for (uint32_t i = 0; i < ptv->frame_count; i++) {
+        AFXDPFrameFree(ptv, (uint64_t)i * ptv->frame_size);
+    }
+    AFXDPRefillFillRing(ptv);
+
+    ptv->batch = SCCalloc(ptv->batch_size, sizeof(Packet *));
+    if (ptv->batch == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate packet batch for iface %s", ptv->iface);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief Init function for ReceiveAFXDP.
+ *
+ * \param tv pointer to ThreadVars
+ * \param initdata pointer to the interface passed from the user
+ * \param data pointer gets populated with AFXDPThreadVars
+ */
+static TmEcode ReceiveAFXDPThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+
+    AFXDPIfaceConfig *aconf = (AFXDPIfaceConfig *)initdata;
+    if (initdata == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "initdata == NULL");
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    AFXDPThreadVars *ptv = SCCalloc(1, sizeof(*ptv));
+    if (unlikely(ptv == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Memory allocation failed");
+        goto error;
+    }
+
+    ptv->tv = tv;
+    strlcpy(ptv->iface, aconf->iface, sizeof(ptv->iface));
+    ptv->livedev = LiveGetDevice(ptv->iface);
+    if (ptv->livedev == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Unable to find Live device");
+        goto error_ptv;
+    }
+
+    /* threads are started one by one, so thread N gets queue N */
+    ptv->queue_id = SC_ATOMIC_ADD(aconf->queue_id, 1);
+    ptv->flags = aconf->flags;
+    ptv->checksum_mode = aconf->checksum_mode;
+    ptv->batch_size = aconf->batch_size;
+    ptv->frame_size = aconf->frame_size;
+    ptv->frame_count = aconf->ring_size * 2;
+
+    /* the packets can only point into the UMEM if they are released
+     * by this thread */
+    const char *active_runmode = RunmodeGetActive();
+    if (active_runmode != NULL &&
+            (strcmp("workers", active_runmode) == 0 || strcmp("single", active_runmode) == 0)) {
+        ptv->zero_copy = true;
+    }
+
+    if (AFXDPCreateSocket(ptv, aconf) != 0) {
+        goto error_socket;
+    }
+
+    if (aconf->bpf_filter) {
+        SCLogConfig("Using BPF '%s' on iface '%s'", aconf->bpf_filter, ptv->iface);
+        char errbuf[PCAP_ERRBUF_SIZE];
+        if (SCBPFCompile(default_packet_size, /* snaplen_arg */
+                    LINKTYPE_ETHERNET,         /* linktype_arg */
+                    &ptv->bpf_prog,            /* program */
+                    aconf->bpf_filter,         /* const char *buf */
+                    1,                         /* optimize */
+                    PCAP_NETMASK_UNKNOWN,      /* mask */
+                    errbuf, sizeof(errbuf)) == -1) {
+            SCLogError(SC_ERR_AF_XDP_CREATE, "Failed to compile BPF \"%s\": %s",
+                    aconf->bpf_filter, errbuf);
+            goto error_socket;
+        }
+    }
+
+#ifdef HAVE_PACKET_EBPF
+    ptv->v4_map_fd = -1;
+    ptv->v6_map_fd = -1;
+    if (ptv->flags & AFXDP_BYPASS) {
+        ptv->v4_map_fd = EBPFGetMapFDByName(ptv->iface, "flow_table_v4");
+        if (ptv->v4_map_fd == -1) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Can't find eBPF map fd for '%s'", "flow_table_v4");
+        }
+        ptv->v6_map_fd = EBPFGetMapFDByName(ptv->iface, "flow_table_v6");
+        if (ptv->v6_map_fd == -1) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Can't find eBPF map fd for '%s'", "flow_table_v6");
+        }
+        ptv->nr_cpus = aconf->ebpf_t_config.cpus_count;
+    }
+#endif
+
+    ptv->capture_kernel_packets = StatsRegisterCounter("capture.kernel_packets", ptv->tv);
+    ptv->capture_kernel_drops = StatsRegisterCounter("capture.kernel_drops", ptv->tv);
+
+    DatalinkSetGlobalType(LINKTYPE_ETHERNET);
+
+    SCLogConfig("%s: using queue %" PRIu32 " of iface %s, %s packet data", tv->name,
+            ptv->queue_id, ptv->iface, ptv->zero_copy ? "zero-copy" : "copied");
+
+    *data = (void *)ptv;
+    aconf->DerefFunc(aconf);
+    SCReturnInt(TM_ECODE_OK);
+
+error_socket:
+    AFXDPCloseSocket(ptv);
+error_ptv:
+    SCFree(ptv);
+error:
+    aconf->DerefFunc(aconf);
+    SCReturnInt(TM_ECODE_FAILED);
+}
+
+#ifdef HAVE_PACKET_EBPF
+/**
+ * Bypass function for AF_XDP capture
+ *
+ * \param p the packet belonging to the flow to bypass
+ * \return 0 if unable to bypass, 1 if success
+ */
+static int AFXDPBypassCallback(Packet *p)
+{
+    SCLogDebug("Calling af_xdp callback function");
+    return EBPFXDPBypassPacket(
+            p, p->afxdp_v.v4_map_fd, p->afxdp_v.v6_map_fd, p->afxdp_v.nr_cpus);
+}
+#endif
+
+/**
+ * \brief Return the UMEM frame of a zero-copy packet
+ *
+ * The frame goes back to the fill ring on the next read of the thread.
+ */
+static void AFXDPReleasePacket(Packet *p)
+{
+    DEBUG_VALIDATE_BUG_ON(PKT_IS_PSEUDOPKT(p));
+
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)p->afxdp_v.ptv;
+    AFXDPFrameFree(ptv, p->afxdp_v.addr);
+    PacketFreeOrRelease(p);
+}
+
+/**
+ * \brief Set up a packet for a received frame
+ *
+ * \retval p the packet or NULL if the frame was filtered or dropped
+ */
+static Packet *AFXDPProcessPacket(
+        AFXDPThreadVars *ptv, uint64_t addr, uint32_t len, const struct timeval *ts)
+{
+    uint8_t *pkt_data = xsk_umem__get_data(ptv->umem_area, addr);
+    /* the descriptor address includes the headroom, frames are
+     * frame_size aligned */
+    const uint64_t frame = addr & ~((uint64_t)ptv->frame_size - 1);
+
+    ptv->pkts++;
+    ptv->bytes += len;
+
+    if (ptv->bpf_prog.bf_len) {
+        struct pcap_pkthdr pkthdr = { { 0, 0 }, len, len };
+        if (pcap_offline_filter(&ptv->bpf_prog, &pkthdr, pkt_data) == 0) {
+            AFXDPFrameFree(ptv, frame);
+            return NULL;
+        }
+    }
+
+    Packet *p = PacketPoolGetPacket();
+    if (unlikely(p == NULL)) {
+        AFXDPFrameFree(ptv, frame);
+        return NULL;
+    }
+
+    PKT_SET_SRC(p, PKT_SRC_WIRE);
+    p->livedev = ptv->livedev;
+    p->datalink = LINKTYPE_ETHERNET;
+    p->ts = *ts;
+
+    if (ptv->zero_copy) {
+        if (PacketSetData(p, pkt_data, len) == -1) {
+            AFXDPFrameFree(ptv, frame);
+            TmqhOutputPacketpool(ptv->tv, p);
+            return NULL;
+        }
+        p->afxdp_v.ptv = ptv;
+        p->afxdp_v.addr = frame;
+        p->ReleasePacket = AFXDPReleasePacket;
+    } else {
+        int r = PacketCopyData(p, pkt_data, len);
+        /* data is copied, the frame can be reused right away */
+        AFXDPFrameFree(ptv, frame);
+        if (r == -1) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            return NULL;
+        }
+    }
+
+    if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+        if (ChecksumAutoModeCheck(ptv->pkts, SC_ATOMIC_GET(ptv->livedev->pkts),
+                    SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
+            ptv->checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        }
+    }
+
+#ifdef HAVE_PACKET_EBPF
+    if (ptv->flags & AFXDP_BYPASS) {
+        p->BypassPacketsFlow = AFXDPBypassCallback;
+        p->afxdp_v.v4_map_fd = ptv->v4_map_fd;
+        p->afxdp_v.v6_map_fd = ptv->v6_map_fd;
+        p->afxdp_v.nr_cpus = ptv->nr_cpus;
+    }
+#endif
+
+    SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)", GET_PKT_LEN(p), p, GET_PKT_DATA(p));
+
+    return p;
+}
+
+/**
+ * \brief Process up to batch_size packets of the rx ring
+ *
+ * \retval number of packets read, or -1 if processing the packets failed
+ */
+static int AFXDPReadPackets(AFXDPThreadVars *ptv)
+{
+    uint32_t idx = 0;
+    const uint32_t rcvd = xsk_ring_cons__peek(&ptv->rx, ptv->batch_size, &idx);
+    if (rcvd == 0)
+        return 0;
+
+    /* AF_XDP has no timestamps, use one per batch */
+    struct timeval ts;
+    gettimeofday(&ts, NULL);
+
+    uint32_t cnt = 0;
+    for (uint32_t i = 0; i < rcvd; i++) {
+        const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&ptv->rx, idx++);
+        Packet *p = AFXDPProcessPacket(ptv, desc->addr, desc->len, &ts);
+        if (p != NULL)
+            ptv->batch[cnt++] = p;
+    }
+    /* the frames are tracked by the packets, the descriptors can go */
+    xsk_ring_cons__release(&ptv->rx, rcvd);
+
+    if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch, cnt) != TM_ECODE_OK) {
+        return -1;
+    }
+    return (int)rcvd;
+}
+
+/**
+ *  \brief Main AF_XDP reading loop function
+ */
+static TmEcode ReceiveAFXDPLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    TmSlot *s = (TmSlot *)slot;
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+    struct pollfd fds;
+    time_t last_dump = 0;
+
+    ptv->slot = s->slot_next;
+    fds.fd = ptv->fd;
+    fds.events = POLLIN;
+
+    SCLogDebug("thread %s polling on %d", tv->name, fds.fd);
+    for (;;) {
+        if (unlikely(suricata_ctl_flags != 0)) {
+            break;
+        }
+
+        /* make sure we have at least one packet in the packet pool,
+         * to prevent us from alloc'ing packets at line rate */
+        PacketPoolWait();
+
+        AFXDPRefillFillRing(ptv);
+
+        /* only poll when the rx ring is empty. Polling also wakes up
+         * the driver if it ran out of fill ring entries. */
+        const int rcvd = AFXDPReadPackets(ptv);
+        if (unlikely(rcvd < 0)) {
+            SCReturnInt(TM_ECODE_FAILED);
+        } else if (rcvd > 0) {
+            /* Trigger one dump of stats every second */
+            time_t current_time = time(NULL);
+            if (current_time != last_dump) {
+                AFXDPDumpCounters(ptv);
+                last_dump = current_time;
+            }
+            StatsSyncCountersIfSignalled(tv);
+            continue;
+        }
+
+        int r = poll(&fds, 1, POLL_TIMEOUT);
+        if (r < 0) {
+            if (errno != EINTR)
+                SCLogError(SC_ERR_AF_XDP_READ, "Error polling AF_XDP socket of iface '%s': (%d) %s",
+                        ptv->iface, errno, strerror(errno));
+            continue;
+
+        } else if (r == 0) {
+            /* no events, timeout */
+            AFXDPDumpCounters(ptv);
+            last_dump = time(NULL);
+            StatsSyncCountersIfSignalled(tv);
+
+            /* poll timed out, lets handle the timeout */
+            TmThreadsCaptureHandleTimeout(tv, NULL);
+            continue;
+        }
+
+        if (unlikely(fds.revents & (POLLHUP | POLLERR | POLLNVAL))) {
+            if (fds.revents & POLLNVAL) {
+                SCLogError(SC_ERR_AF_XDP_READ, "Invalid polling request");
+            } else {
+                SCLogError(SC_ERR_AF_XDP_READ, "Error on AF_XDP socket of iface '%s'",
+                        ptv->iface);
+            }
+            continue;
+        }
+    }
+
+    AFXDPDumpCounters(ptv);
+    StatsSyncCountersIfSignalled(tv);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief This function prints stats to the screen at exit.
+ * \param tv pointer to ThreadVars
+ * \param data pointer that gets cast into AFXDPThreadVars for ptv
+ */
+static void ReceiveAFXDPThreadExitStats(ThreadVars *tv, void *data)
+{
+    SCEnter();
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+
+    AFXDPDumpCounters(ptv);
+    SCLogPerf("(%s) Kernel: Packets %" PRIu64 ", dropped %" PRIu64 ", bytes %" PRIu64 "",
+            tv->name, StatsGetLocalCounterValue(tv, ptv->capture_kernel_packets),
+            StatsGetLocalCounterValue(tv, ptv->capture_kernel_drops), ptv->bytes);
+}
+
+/**
+ * \brief DeInit function closes the AF_XDP socket
+ * \param tv pointer to ThreadVars
+ * \param data pointer that gets cast into AFXDPThreadVars for ptv
+ */
+static TmEcode ReceiveAFXDPThreadDeinit(ThreadVars *tv, void *data)
+{
+    SCEnter();
+
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+
+    AFXDPCloseSocket(ptv);
+    if (ptv->bpf_prog.bf_insns) {
+        SCBPFFree(&ptv->bpf_prog);
+    }
+
+    SCFree(ptv);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Prepare AF_XDP decode thread.
+ * \param tv Thread local variables.
+ * \param initdata Thread config.
+ * \param data Pointer to DecodeThreadVars placed here.
+ */
+static TmEcode DecodeAFXDPThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+
+    DecodeThreadVars *dtv = DecodeThreadVarsAlloc(tv);
+    if (dtv == NULL)
+        SCReturnInt(TM_ECODE_FAILED);
+
+    DecodeRegisterPerfCounters(dtv, tv);
+
+    *data = (void *)dtv;
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief This function passes off to link type decoders.
+ *
+ * \param tv pointer to ThreadVars
+ * \param p pointer to the current packet
+ * \param data pointer that gets cast into DecodeThreadVars for dtv
+ */
+static TmEcode DecodeAFXDP(ThreadVars *tv, Packet *p, void *data)
+{
+    SCEnter();
+
+    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+
+    BUG_ON(PKT_IS_PSEUDOPKT(p));
+
+    /* update counters */
+    DecodeUpdatePacketCounters(tv, dtv, p);
+
+    DecodeEthernet(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p));
+
+    PacketDecodeFinalize(tv, dtv, p);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+static TmEcode DecodeAFXDPThreadDeinit(ThreadVars *tv, void *data)
+{
+    SCEnter();
+
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Registration Function for ReceiveAFXDP.
+ */
+void TmModuleReceiveAFXDPRegister(void)
+{
+    tmm_modules[TMM_RECEIVEAFXDP].name = "ReceiveAFXDP";
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadInit = ReceiveAFXDPThreadInit;
+    tmm_modules[TMM_RECEIVEAFXDP].PktAcqLoop = ReceiveAFXDPLoop;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadExitPrintStats = ReceiveAFXDPThreadExitStats;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadDeinit = ReceiveAFXDPThreadDeinit;
+    tmm_modules[TMM_RECEIVEAFXDP].cap_flags = SC_CAP_NET_RAW;
+    tmm_modules[TMM_RECEIVEAFXDP].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeAFXDP.
+ */
+void TmModuleDecodeAFXDPRegister(void)
+{
+    tmm_modules[TMM_DECODEAFXDP].name = "DecodeAFXDP";
+    tmm_modules[TMM_DECODEAFXDP].ThreadInit = DecodeAFXDPThreadInit;
+    tmm_modules[TMM_DECODEAFXDP].Func = DecodeAFXDP;
+    tmm_modules[TMM_DECODEAFXDP].ThreadDeinit = DecodeAFXDPThreadDeinit;
+    tmm_modules[TMM_DECODEAFXDP].cap_flags = 0;
+    tmm_modules[TMM_DECODEAFXDP].flags = TM_FLAG_DECODE_TM;
+}
+
+#endif /* HAVE_AF_XDP */
+
+/**
+ * @}
+ */
@@ -0,0 +1,82 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket acquisition support
+ */
+
+#ifndef __SOURCE_AF_XDP_H__
+#define __SOURCE_AF_XDP_H__
+
+#define AFXDP_IFACE_NAME_LENGTH 48
+
+/* value for flags */
+#define AFXDP_BYPASS     (1 << 0)
+/* the XDP filter of the iface is loaded by Suricata */
+#define AFXDP_XDP_FILTER (1 << 1)
+
+/* zero-copy modes of the socket binding */
+enum {
+    AFXDP_ZC_AUTO,
+    AFXDP_ZC_ENABLE,
+    AFXDP_ZC_DISABLE,
+};
+
+typedef struct AFXDPIfaceConfig_ {
+    char iface[AFXDP_IFACE_NAME_LENGTH];
+    /* number of threads, one per queue of the interface */
+    int threads;
+    int promisc;
+    int flags;
+    int zero_copy;
+    /* size of the UMEM frames */
+    uint32_t frame_size;
+    /* size of the rx ring, the fill ring is twice as large */
+    uint32_t ring_size;
+    /* max number of packets read per call */
+    uint32_t batch_size;
+    ChecksumValidationMode checksum_mode;
+    const char *bpf_filter;
+    const char *xdp_filter_file;
+    int xdp_filter_fd;
+    uint32_t xdp_mode;
+#ifdef HAVE_PACKET_EBPF
+    struct ebpf_timeout_config ebpf_t_config;
+#endif
+    /* queue of the next thread to start */
+    SC_ATOMIC_DECLARE(unsigned int, queue_id);
+    SC_ATOMIC_DECLARE(unsigned int, ref);
+    void (*DerefFunc)(void *);
+} AFXDPIfaceConfig;
+
+typedef struct AFXDPPacketVars_ {
+    /* AFXDPThreadVars */
+    void *ptv;
+    /* UMEM frame holding the packet data, returned to the fill
+     * ring on release */
+    uint64_t addr;
+    int v4_map_fd;
+    int v6_map_fd;
+    unsigned int nr_cpus;
+} AFXDPPacketVars;
+
+void TmModuleReceiveAFXDPRegister(void);
+void TmModuleDecodeAFXDPRegister(void);
+
+#endif /* __SOURCE_AF_XDP_H__ */
@@ -85,10 +85,28 @@ TmEcode NoDPDKSupportExit(ThreadVars *tv, const void *initdata, void **data)
 
 #include "util-dpdk.h"
 #include "util-dpdk-i40e.h"
+#include "flow-hash.h"
 #include <numa.h>
 
 #define BURST_SIZE 32
 
+#if RTE_VERSION >= RTE_VERSION_NUM(21, 11, 0, 0)
+#define DPDK_MBUF_RX_VLAN_STRIPPED  RTE_MBUF_F_RX_VLAN_STRIPPED
+#define DPDK_MBUF_RX_IP_CKSUM_MASK  RTE_MBUF_F_RX_IP_CKSUM_MASK
+#define DPDK_MBUF_RX_IP_CKSUM_GOOD  RTE_MBUF_F_RX_IP_CKSUM_GOOD
+#define DPDK_MBUF_RX_L4_CKSUM_MASK  RTE_MBUF_F_RX_L4_CKSUM_MASK
+#define DPDK_MBUF_RX_L4_CKSUM_GOOD  RTE_MBUF_F_RX_L4_CKSUM_GOOD
+#else
+#define DPDK_MBUF_RX_VLAN_STRIPPED  PKT_RX_VLAN_STRIPPED
+#define DPDK_MBUF_RX_IP_CKSUM_MASK  PKT_RX_IP_CKSUM_MASK
+#define DPDK_MBUF_RX_IP_CKSUM_GOOD  PKT_RX_IP_CKSUM_GOOD
+#define DPDK_MBUF_RX_L4_CKSUM_MASK  PKT_RX_L4_CKSUM_MASK
+#define DPDK_MBUF_RX_L4_CKSUM_GOOD  PKT_RX_L4_CKSUM_GOOD
+#endif
+
+/** next flow hash shard to hand out, over all interfaces using flow-shards */
+static SC_ATOMIC_DECLARE(uint16_t, flow_shard_id);
+
 /**
  * \brief Structure to hold thread specific variables.
  */
@@ -120,6 +138,7 @@ typedef struct DPDKThreadVars_ {
     uint16_t queue_id;
     struct rte_mempool *pkt_mempool;
     struct rte_mbuf *received_mbufs[BURST_SIZE];
+    Packet *received_pkts[BURST_SIZE];
     struct timeval machine_start_time;
 } DPDKThreadVars;
 
@@ -131,16 +150,35 @@ static TmEcode ReceiveDPDKLoop(ThreadVars *tv, void *data, void *slot);
 static TmEcode DecodeDPDKThreadInit(ThreadVars *, const void *, void **);
 static TmEcode DecodeDPDKThreadDeinit(ThreadVars *tv, void *data);
 static TmEcode DecodeDPDK(ThreadVars *, Packet *, void *);
+static TmEcode DecodeDPDKBatch(ThreadVars *, Packet **, uint32_t, void *);
 
 static uint64_t CyclesToMicroseconds(uint64_t cycles);
 static uint64_t CyclesToSeconds(uint64_t cycles);
-static void DPDKFreeMbufArray(struct rte_mbuf **mbuf_array, uint16_t mbuf_cnt, uint16_t offset);
 static uint64_t DPDKGetSeconds(void);
 
-static void DPDKFreeMbufArray(struct rte_mbuf **mbuf_array, uint16_t mbuf_cnt, uint16_t offset)
+/**
+ * \brief Pass the checksum validation results of the NIC to the decoders
+ *
+ * Only good checksums are passed on: bad or unknown ones are validated
+ * in software so that the invalid checksum handling stays the same.
+ */
+static inline void DPDKSetCaptureFlags(Packet *p, const struct rte_mbuf *mbuf)
+{
+    if ((mbuf->ol_flags & DPDK_MBUF_RX_IP_CKSUM_MASK) == DPDK_MBUF_RX_IP_CKSUM_GOOD)
+        p->capture_flags |= PKT_CAPTURE_IPV4_CSUM_OK;
+    if ((mbuf->ol_flags & DPDK_MBUF_RX_L4_CKSUM_MASK) == DPDK_MBUF_RX_L4_CKSUM_GOOD)
+        p->capture_flags |= PKT_CAPTURE_L4_CSUM_OK;
+}
+
+/**
+ * \brief Get the vlan id from the mbuf if the NIC stripped the vlan header
+ */
+static inline void DPDKSetVlan(Packet *p, const struct rte_mbuf *mbuf)
 {
-    for (int i = offset; i < mbuf_cnt; i++) {
-        rte_pktmbuf_free(mbuf_array[i]);
+    if (mbuf->ol_flags & DPDK_MBUF_RX_VLAN_STRIPPED) {
+        p->vlan_id[0] = mbuf->vlan_tci & 0x0fff;
+        p->vlan_idx = 1;
+        p->capture_flags |= PKT_CAPTURE_VLAN_STRIPPED;
     }
 }
 
@@ -255,6 +293,7 @@ void TmModuleDecodeDPDKRegister(void)
     tmm_modules[TMM_DECODEDPDK].name = "DecodeDPDK";
     tmm_modules[TMM_DECODEDPDK].ThreadInit = DecodeDPDKThreadInit;
     tmm_modules[TMM_DECODEDPDK].Func = DecodeDPDK;
+    tmm_modules[TMM_DECODEDPDK].FuncBatch = DecodeDPDKBatch;
     tmm_modules[TMM_DECODEDPDK].ThreadExitPrintStats = NULL;
     tmm_modules[TMM_DECODEDPDK].ThreadDeinit = DecodeDPDKThreadDeinit;
     tmm_modules[TMM_DECODEDPDK].cap_flags = 0;
@@ -361,16 +400,21 @@ static TmEcode ReceiveDPDKLoop(ThreadVars *tv, void *data, void *slot)
         }
 
         ptv->pkts += (uint64_t)nb_rx;
+        uint32_t cnt = 0;
         for (uint16_t i = 0; i < nb_rx; i++) {
             p = PacketGetFromQueueOrAlloc();
             if (unlikely(p == NULL)) {
+                rte_pktmbuf_free(ptv->received_mbufs[i]);
                 continue;
             }
             PKT_SET_SRC(p, PKT_SRC_WIRE);
             p->datalink = LINKTYPE_ETHERNET;
             if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
                 p->flags |= PKT_IGNORE_CHECKSUM;
+            } else {
+                DPDKSetCaptureFlags(p, ptv->received_mbufs[i]);
             }
+            DPDKSetVlan(p, ptv->received_mbufs[i]);
 
             DPDKSetTimevalReal(&ptv->machine_start_time, &p->ts);
             p->dpdk_v.mbuf = ptv->received_mbufs[i];
@@ -381,11 +425,14 @@ static TmEcode ReceiveDPDKLoop(ThreadVars *tv, void *data, void *slot)
 
             PacketSetData(p, rte_pktmbuf_mtod(p->dpdk_v.mbuf, uint8_t *),
                     rte_pktmbuf_pkt_len(p->dpdk_v.mbuf));
-            if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-                TmqhOutputPacketpool(ptv->tv, p);
-                DPDKFreeMbufArray(ptv->received_mbufs, nb_rx - i - 1, i + 1);
-                SCReturnInt(EXIT_FAILURE);
-            }
+            ptv->received_pkts[cnt++] = p;
+        }
+
+        /* hand the burst over at once, the mbufs are released with
+         * the packets, also on failure */
+        if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->received_pkts, cnt) !=
+                TM_ECODE_OK) {
+            SCReturnInt(EXIT_FAILURE);
         }
 
         /* Trigger one dump of stats every second */
@@ -447,6 +494,11 @@ static TmEcode ReceiveDPDKThreadInit(ThreadVars *tv, const void *initdata, void
     ptv->out_port_id = dpdk_config->out_port_id;
     uint16_t queue_id = SC_ATOMIC_ADD(dpdk_config->queue_id, 1);
     ptv->queue_id = queue_id;
+    // symmetric RSS delivers both directions of a flow to this queue, so the
+    // flow worker of this thread can use a flow hash shard of its own
+    if (dpdk_config->flags & DPDK_FLOW_SHARDS) {
+        FlowHashSetThreadShard(SC_ATOMIC_ADD(flow_shard_id, 1));
+    }
     // pass the pointer to the mempool and then forget about it. Mempool is freed in thread deinit.
     ptv->pkt_mempool = dpdk_config->pkt_mempool;
     dpdk_config->pkt_mempool = NULL;
@@ -597,7 +649,7 @@ static TmEcode DecodeDPDK(ThreadVars *tv, Packet *p, void *data)
     DecodeUpdatePacketCounters(tv, dtv, p);
 
     /* If suri has set vlan during reading, we increase vlan counter */
-    if (p->vlan_idx) {
+    if (p->capture_flags & PKT_CAPTURE_VLAN_STRIPPED) {
         StatsIncr(tv, dtv->counter_vlan);
     }
 
@@ -609,6 +661,26 @@ static TmEcode DecodeDPDK(ThreadVars *tv, Packet *p, void *data)
     SCReturnInt(TM_ECODE_OK);
 }
 
+/**
+ * \brief Decode a burst of packets
+ *
+ * The headers of the next packet are prefetched while the current one is
+ * decoded, as the mbuf data is usually not in the cache yet.
+ */
+static TmEcode DecodeDPDKBatch(ThreadVars *tv, Packet **ps, uint32_t cnt, void *data)
+{
+    SCEnter();
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        if (i + 1 < cnt) {
+            rte_prefetch0(GET_PKT_DATA(ps[i + 1]));
+        }
+        (void)DecodeDPDK(tv, ps[i], data);
+    }
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
 static TmEcode DecodeDPDKThreadInit(ThreadVars *tv, const void *initdata, void **data)
 {
     SCEnter();
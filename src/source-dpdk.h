@@ -37,6 +37,8 @@ typedef enum { DPDK_COPY_MODE_NONE, DPDK_COPY_MODE_TAP, DPDK_COPY_MODE_IPS } Dpd
 #define DPDK_MULTICAST (1 << 1) /**< Enable multicast packets */
 // Offloads
 #define DPDK_RX_CHECKSUM_OFFLOAD (1 << 4) /**< Enable chsum offload */
+// Flow engine
+#define DPDK_FLOW_SHARDS (1 << 5) /**< Each queue uses its own flow hash shard */
 
 typedef struct DPDKIfaceConfig_ {
 #ifdef HAVE_DPDK
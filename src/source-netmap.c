@@ -91,6 +91,8 @@ void TmModuleDecodeNetmapRegister (void)
 #else /* We have NETMAP support */
 
 #define POLL_TIMEOUT 100
+/** max number of packets handed over to the pipeline at once */
+#define NETMAP_BATCH_SIZE 32
 
 #if defined(__linux__)
 #define POLL_EVENTS (POLLHUP|POLLRDHUP|POLLERR|POLLNVAL)
@@ -147,6 +149,10 @@ typedef struct NetmapThreadVars_
     int copy_mode;
     ChecksumValidationMode checksum_mode;
 
+    /* packets read from the rings, not yet handed to the pipeline */
+    Packet *batch[NETMAP_BATCH_SIZE];
+    uint32_t batch_cnt;
+
     /* counters */
     uint64_t pkts;
     uint64_t bytes;
@@ -651,6 +657,12 @@ static void NetmapReleasePacket(Packet *p)
     PacketFreeOrRelease(p);
 }
 
+static void NetmapFlushBatch(NetmapThreadVars *ntv)
+{
+    (void)TmThreadsSlotProcessPktBatch(ntv->tv, ntv->slot, ntv->batch, ntv->batch_cnt);
+    ntv->batch_cnt = 0;
+}
+
 static void NetmapProcessPacket(NetmapThreadVars *ntv, const struct nm_pkthdr *ph)
 {
     if (ntv->bpf_prog.bf_len) {
@@ -690,7 +702,12 @@ static void NetmapProcessPacket(NetmapThreadVars *ntv, const struct nm_pkthdr *p
     SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
             GET_PKT_LEN(p), p, GET_PKT_DATA(p));
 
-    (void)TmThreadsSlotProcessPkt(ntv->tv, ntv->slot, p);
+    /* in zero copy mode the ring slots stay ours until the next sync,
+     * so the batch is flushed before NetmapReadPackets returns */
+    ntv->batch[ntv->batch_cnt++] = p;
+    if (ntv->batch_cnt == NETMAP_BATCH_SIZE) {
+        NetmapFlushBatch(ntv);
+    }
 }
 
 /**
@@ -767,6 +784,7 @@ static TmEcode NetmapReadPackets(struct nmport_d *d, int cnt, NetmapThreadVars *
         hdr.flags = 0;
         NetmapProcessPacket(ntv, &hdr);
     }
+    NetmapFlushBatch(ntv);
     return got;
 }
 
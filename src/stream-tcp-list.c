@@ -33,15 +33,30 @@
 #include "util-validate.h"
 #include "app-layer-frames.h"
 
-static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg);
-
 static int check_overlap_different_data = 0;
+static bool segment_less = false;
 
 void StreamTcpReassembleConfigEnableOverlapCheck(void)
 {
     check_overlap_different_data = 1;
 }
 
+void StreamTcpReassembleConfigEnableSegmentLess(void)
+{
+    segment_less = true;
+}
+
+/** \brief check if stream data is inserted without TcpSegment tracking
+ *
+ *  Overlap checks and session dumping need the segments, so they turn
+ *  the segment-less mode off. Both can be enabled after the stream
+ *  config is parsed, by rules or outputs, so this is checked per packet.
+ */
+bool StreamTcpReassembleIsSegmentLess(void)
+{
+    return segment_less && !check_overlap_different_data && !IsTcpSessionDumpingEnabled();
+}
+
 /*
  *  Inserts and overlap handling
  */
@@ -157,24 +172,70 @@ static inline bool CheckOverlap(struct TCPSEG *tree, TcpSegment *seg)
 }
 
 /** \internal
- *  \brief insert the segment into the proper place in the tree
+ *  \brief move the in order segment list into the tree
+ *
+ *  Called when a segment arrives that is out of order or that overlaps
+ *  with the list tail.
+ */
+static void StreamTcpSegmentListToTree(TcpStream *stream)
+{
+    TcpSegment *seg = stream->seg_list_head;
+    stream->seg_list_head = stream->seg_list_tail = NULL;
+
+    while (seg != NULL) {
+        TcpSegment *next = seg->list.next;
+        TcpSegment *res = TCPSEG_RB_INSERT(&stream->seg_tree, seg);
+        DEBUG_VALIDATE_BUG_ON(res != NULL);
+        (void)res;
+        seg = next;
+    }
+}
+
+/** \internal
+ *  \brief insert the segment into the proper place in the list or tree
  *         don't worry about the data or overlaps
  *
+ *  Segments that start at or beyond the right edge of the list tail are
+ *  appended to the list. Anything else moves the stream to the tree.
+ *
  *  \retval 2 not inserted, data overlap
  *  \retval 1 inserted with overlap detected
  *  \retval 0 inserted, no overlap
  */
-static int DoInsertSegment (TcpStream *stream, TcpSegment *seg, TcpSegment **dup_seg, Packet *p)
+static int DoInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx, TcpStream *stream,
+        TcpSegment *seg, TcpSegment **dup_seg, Packet *p)
 {
     BUG_ON(SEQ_LEQ(SEG_SEQ_RIGHT_EDGE(seg), stream->base_seq));
 
-    /* fast track */
-    if (RB_EMPTY(&stream->seg_tree)) {
-        SCLogDebug("empty tree, inserting seg %p seq %" PRIu32 ", "
-                   "len %" PRIu32 "", seg, seg->seq, TCP_SEG_LEN(seg));
-        TCPSEG_RB_INSERT(&stream->seg_tree, seg);
-        stream->segs_right_edge = SEG_SEQ_RIGHT_EDGE(seg);
-        return 0;
+    /* fast track: append in order data to the list */
+    if (!STREAM_SEGS_IN_TREE(stream)) {
+        TcpSegment *tail = stream->seg_list_tail;
+        if (tail == NULL) {
+            SCLogDebug("empty list, inserting seg %p seq %" PRIu32 ", "
+                       "len %" PRIu32 "",
+                    seg, seg->seq, TCP_SEG_LEN(seg));
+            seg->list.prev = seg->list.next = NULL;
+            stream->seg_list_head = stream->seg_list_tail = seg;
+            stream->segs_right_edge = SEG_SEQ_RIGHT_EDGE(seg);
+            StatsIncr(tv, ra_ctx->counter_tcp_reass_list_append);
+            return 0;
+        }
+        if (SEQ_GEQ(seg->seq, SEG_SEQ_RIGHT_EDGE(tail))) {
+            SCLogDebug("appending seg %p seq %" PRIu32 ", len %" PRIu32 " to the list", seg,
+                    seg->seq, TCP_SEG_LEN(seg));
+            seg->list.prev = tail;
+            seg->list.next = NULL;
+            tail->list.next = seg;
+            stream->seg_list_tail = seg;
+            if (SEQ_GT(SEG_SEQ_RIGHT_EDGE(seg), stream->segs_right_edge))
+                stream->segs_right_edge = SEG_SEQ_RIGHT_EDGE(seg);
+            StatsIncr(tv, ra_ctx->counter_tcp_reass_list_append);
+            return 0;
+        }
+
+        SCLogDebug("seg %u is out of order or overlaps, moving list to the tree", seg->seq);
+        StreamTcpSegmentListToTree(stream);
+        StatsIncr(tv, ra_ctx->counter_tcp_reass_tree_promote);
     }
 
     /* insert and then check if there was any overlap with other segments */
@@ -635,7 +696,7 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
     TcpSegment *dup_seg = NULL;
 
     /* insert segment into list. Note: doesn't handle the data */
-    int r = DoInsertSegment (stream, seg, &dup_seg, p);
+    int r = DoInsertSegment(tv, ra_ctx, stream, seg, &dup_seg, p);
 
     if (IsTcpSessionDumpingEnabled()) {
         StreamTcpSegmentAddPacketData(seg, p, tv, ra_ctx);
@@ -685,15 +746,15 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
             StreamTcpSegmentReturntoPool(seg);
 #ifdef DEBUG
             if (SCLogDebugEnabled()) {
-                TcpSegment *s = NULL, *safe = NULL;
-                RB_FOREACH_SAFE(s, TCPSEG, &stream->seg_tree, safe)
+                TcpSegment *s = NULL;
+                STREAM_SEG_FOREACH(s, stream)
                 {
                     SCLogDebug("tree: seg %p, SEQ %"PRIu32", LEN %"PRIu16", SUM %"PRIu32"%s%s%s",
                             s, s->seq, TCP_SEG_LEN(s),
                             (uint32_t)(s->seq + TCP_SEG_LEN(s)),
                             s->seq == seg->seq ? " DUPLICATE" : "",
-                            TCPSEG_RB_PREV(s) == NULL ? " HEAD" : "",
-                            TCPSEG_RB_NEXT(s) == NULL ? " TAIL" : "");
+                            StreamTcpSegmentPrev(stream, s) == NULL ? " HEAD" : "",
+                            StreamTcpSegmentNext(stream, s) == NULL ? " TAIL" : "");
                 }
             }
 #endif
@@ -703,6 +764,104 @@ int StreamTcpReassembleInsertSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_
     SCReturnInt(0);
 }
 
+/** \internal
+ *  \brief insert data into the holes of the streaming buffer
+ *
+ *  Data that is already in the buffer is kept, so for overlaps the
+ *  first data wins.
+ *
+ *  \param overlap set to true if part of the data was already present
+ *  \retval 0 ok
+ *  \retval -1 memcap reached
+ */
+static int InsertDataInHoles(
+        TcpStream *stream, uint64_t offset, const uint8_t *data, uint32_t data_len, bool *overlap)
+{
+    StreamingBuffer *sb = &stream->sb;
+    StreamingBufferSegment sbseg;
+    const uint64_t end = offset + data_len;
+    uint64_t cur = offset;
+
+    while (cur < end) {
+        /* start and end of the next region with data at or beyond cur */
+        uint64_t data_start = end;
+        uint64_t data_end = end;
+
+        if (RB_EMPTY(&sb->sbb_tree)) {
+            /* no blocks: data is one region at the start of the buffer */
+            if (sb->buf_offset && cur < sb->stream_offset + sb->buf_offset) {
+                data_start = sb->stream_offset;
+                data_end = sb->stream_offset + sb->buf_offset;
+            }
+        } else {
+            StreamingBufferBlock key = { .offset = cur, .len = 0 };
+            StreamingBufferBlock *sbb = SBB_RB_FIND_INCLUSIVE(&sb->sbb_tree, &key);
+            if (sbb != NULL && sbb->offset < end) {
+                data_start = sbb->offset;
+                data_end = sbb->offset + sbb->len;
+            }
+        }
+
+        if (cur < data_start) {
+            const uint32_t len = (uint32_t)(MIN(data_start, end) - cur);
+            const int r = StreamingBufferInsertAt(sb, &sbseg, data + (cur - offset), len, cur);
+            if (r != 0) {
+                DEBUG_VALIDATE_BUG_ON(r != -1);
+                return -1;
+            }
+        }
+        if (data_start < end) {
+            *overlap = true;
+        }
+        cur = MAX(cur, data_end);
+    }
+    return 0;
+}
+
+/**
+ *  \brief insert packet data into the stream without creating a segment
+ *
+ *  Used in segment-less mode: only the streaming buffer and its blocks
+ *  track the data and the gaps in it.
+ *
+ *  \retval 0 ok
+ *  \retval -ENOMEM data not inserted due to memcap
+ */
+int StreamTcpReassembleInsertData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
+        TcpStream *stream, Packet *p, uint32_t seq, const uint8_t *data, uint16_t data_len)
+{
+    SCEnter();
+
+    const uint32_t re = seq + data_len;
+    if (SEQ_LEQ(re, stream->base_seq)) {
+        SCReturnInt(0);
+    }
+
+    uint32_t data_offset = 0;
+    uint64_t stream_offset = STREAM_BASE_OFFSET(stream);
+    if (likely(SEQ_GEQ(seq, stream->base_seq))) {
+        stream_offset += (seq - stream->base_seq);
+    } else {
+        /* data is partly before base_seq */
+        data_offset = stream->base_seq - seq;
+    }
+
+    const bool seen_data = STREAM_HAS_SEEN_DATA(stream);
+    bool overlap = false;
+    if (InsertDataInHoles(stream, stream_offset, data + data_offset, data_len - data_offset,
+                &overlap) != 0) {
+        StatsIncr(tv, ra_ctx->counter_tcp_segment_memcap);
+        StatsIncr(tv, ra_ctx->counter_tcp_reass_data_normal_fail);
+        SCReturnInt(-ENOMEM);
+    }
+    if (overlap) {
+        StatsIncr(tv, ra_ctx->counter_tcp_reass_overlap);
+    }
+
+    if (!seen_data || SEQ_GT(re, stream->segs_right_edge))
+        stream->segs_right_edge = re;
+    SCReturnInt(0);
+}
 
 /*
  * Pruning & removal
@@ -860,7 +1019,8 @@ static inline uint64_t GetLeftEdge(Flow *f, TcpSession *ssn, TcpStream *stream)
          * lets adjust it to make sure in-use segments still have
          * data */
         TcpSegment *seg = NULL;
-        RB_FOREACH(seg, TCPSEG, &stream->seg_tree) {
+        STREAM_SEG_FOREACH(seg, stream)
+        {
             if (TCP_SEG_OFFSET(seg) > left_edge) {
                 SCLogDebug("seg beyond left_edge, we're done");
                 break;
@@ -877,9 +1037,22 @@ static inline uint64_t GetLeftEdge(Flow *f, TcpSession *ssn, TcpStream *stream)
     return left_edge;
 }
 
-static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg)
+void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg)
 {
-    RB_REMOVE(TCPSEG, &stream->seg_tree, seg);
+    if (STREAM_SEGS_IN_TREE(stream)) {
+        RB_REMOVE(TCPSEG, &stream->seg_tree, seg);
+        return;
+    }
+
+    if (seg->list.prev != NULL)
+        seg->list.prev->list.next = seg->list.next;
+    else
+        stream->seg_list_head = seg->list.next;
+    if (seg->list.next != NULL)
+        seg->list.next->list.prev = seg->list.prev;
+    else
+        stream->seg_list_tail = seg->list.prev;
+    seg->list.prev = seg->list.next = NULL;
 }
 
 /** \brief Remove idle TcpSegments from TcpSession
@@ -965,7 +1138,7 @@ void StreamTcpPruneSession(Flow *f, uint8_t flags)
 
     /* loop through the segments and remove all not in use */
     TcpSegment *seg = NULL, *safe = NULL;
-    RB_FOREACH_SAFE(seg, TCPSEG, &stream->seg_tree, safe)
+    STREAM_SEG_FOREACH_SAFE(seg, stream, safe)
     {
         SCLogDebug("seg %p, SEQ %"PRIu32", LEN %"PRIu16", SUM %"PRIu32,
                 seg, seg->seq, TCP_SEG_LEN(seg),
@@ -26,6 +26,8 @@
 
 #include "stream-tcp-private.h"
 
+void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg);
+
 #ifdef UNITTESTS
 void StreamTcpListRegisterTests(void);
 #endif
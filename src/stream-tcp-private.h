@@ -76,7 +76,14 @@ typedef struct TcpSegment {
     PoolThreadReserved res;
     uint16_t payload_len;       /**< actual size of the payload */
     uint32_t seq;
-    RB_ENTRY(TcpSegment) __attribute__((__packed__)) rb;
+    union {
+        RB_ENTRY(TcpSegment) __attribute__((__packed__)) rb;
+        /** links while the stream keeps its segments in TcpStream::seg_list_head */
+        struct {
+            struct TcpSegment *prev;
+            struct TcpSegment *next;
+        } __attribute__((__packed__)) list;
+    };
     StreamingBufferSegment sbseg;
     TcpSegmentPcapHdrStorage *pcap_hdr_storage;
 } __attribute__((__packed__)) TcpSegment;
@@ -136,6 +143,8 @@ typedef struct TcpStream_ {
 
     StreamingBuffer sb;
     struct TCPSEG seg_tree;         /**< red black tree of TCP segments. Data is stored in TcpStream::sb */
+    TcpSegment *seg_list_head;      /**< in order segments, used while seg_tree is empty */
+    TcpSegment *seg_list_tail;
     uint32_t segs_right_edge;
 
     uint32_t sack_size;             /**< combined size of the SACK ranges currently in our tree. Updated
@@ -148,6 +157,51 @@ typedef struct TcpStream_ {
 #define STREAM_RAW_PROGRESS(stream) (STREAM_BASE_OFFSET((stream)) + (stream)->raw_progress_rel)
 #define STREAM_LOG_PROGRESS(stream) (STREAM_BASE_OFFSET((stream)) + (stream)->log_progress_rel)
 
+/* Segments that arrive in order and don't overlap are appended to a sorted
+ * list. The first out of order or overlapping segment moves the list into
+ * the seg_tree, where the stream stays until the tree is empty again. Use
+ * the helpers below to walk the segments of a stream. */
+#define STREAM_SEGS_IN_TREE(stream) (!RB_EMPTY(&(stream)->seg_tree))
+#define STREAM_SEGS_EMPTY(stream)                                                                  \
+    (RB_EMPTY(&(stream)->seg_tree) && (stream)->seg_list_head == NULL)
+
+static inline TcpSegment *StreamTcpSegmentFirst(TcpStream *stream)
+{
+    if (STREAM_SEGS_IN_TREE(stream))
+        return RB_MIN(TCPSEG, &stream->seg_tree);
+    return stream->seg_list_head;
+}
+
+static inline TcpSegment *StreamTcpSegmentLast(TcpStream *stream)
+{
+    if (STREAM_SEGS_IN_TREE(stream))
+        return RB_MAX(TCPSEG, &stream->seg_tree);
+    return stream->seg_list_tail;
+}
+
+static inline TcpSegment *StreamTcpSegmentNext(TcpStream *stream, TcpSegment *seg)
+{
+    if (STREAM_SEGS_IN_TREE(stream))
+        return TCPSEG_RB_NEXT(seg);
+    return seg->list.next;
+}
+
+static inline TcpSegment *StreamTcpSegmentPrev(TcpStream *stream, TcpSegment *seg)
+{
+    if (STREAM_SEGS_IN_TREE(stream))
+        return TCPSEG_RB_PREV(seg);
+    return seg->list.prev;
+}
+
+#define STREAM_SEG_FOREACH(seg, stream)                                                            \
+    for ((seg) = StreamTcpSegmentFirst((stream)); (seg) != NULL;                                   \
+            (seg) = StreamTcpSegmentNext((stream), (seg)))
+
+/* safe against removal of 'seg' from the stream */
+#define STREAM_SEG_FOREACH_SAFE(seg, stream, safe)                                                 \
+    for ((seg) = StreamTcpSegmentFirst((stream));                                                  \
+            (seg) != NULL && ((safe) = StreamTcpSegmentNext((stream), (seg)), 1); (seg) = (safe))
+
 /* from /usr/include/netinet/tcp.h */
 enum TcpState {
     TCP_NONE = 0,
@@ -283,6 +337,7 @@ typedef struct TcpSession_ {
     uint16_t flags;
     uint32_t reassembly_depth;      /**< reassembly depth for the stream */
     bool lossy_be_liberal;
+    uint8_t consumers_done;         /**< bitmask of StreamTcpConsumer done with the session */
     TcpStream server;
     TcpStream client;
     TcpStateQueue *queue;                   /**< list of SYN/ACK candidates */
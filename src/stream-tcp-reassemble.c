@@ -40,6 +40,7 @@
 #include "tm-threads.h"
 
 #include "util-pool.h"
+#include "util-memcap-credit.h"
 #include "util-unittest.h"
 #include "util-print.h"
 #include "util-host-os-info.h"
@@ -82,7 +83,8 @@ static PoolThread *segment_thread_pool = NULL;
 static SCMutex segment_thread_pool_mutex = SCMUTEX_INITIALIZER;
 
 /* Memory use counter */
-SC_ATOMIC_DECLARE(uint64_t, ra_memuse);
+/** reassembly memuse, accounted per thread */
+static MemcapCredit ra_memuse;
 
 static int g_tcp_session_dump_enabled = 0;
 
@@ -102,7 +104,7 @@ void StreamTcpCreateTestPacket(uint8_t *, uint8_t, uint8_t, uint8_t);
 
 void StreamTcpReassembleInitMemuse(void)
 {
-    SC_ATOMIC_INIT(ra_memuse);
+    MemcapCreditInit(&ra_memuse, "stream-reassembly", MEMCAP_CREDIT_CHUNK_DEFAULT);
 }
 
 /**
@@ -113,8 +115,8 @@ void StreamTcpReassembleInitMemuse(void)
  */
 void StreamTcpReassembleIncrMemuse(uint64_t size)
 {
-    (void) SC_ATOMIC_ADD(ra_memuse, size);
-    SCLogDebug("REASSEMBLY %"PRIu64", incr %"PRIu64, StreamTcpReassembleMemuseGlobalCounter(), size);
+    MemcapCreditIncr(&ra_memuse, SC_ATOMIC_GET(stream_config.reassembly_memcap), size);
+    SCLogDebug("REASSEMBLY incr %"PRIu64, size);
     return;
 }
 
@@ -126,29 +128,14 @@ void StreamTcpReassembleIncrMemuse(uint64_t size)
  */
 void StreamTcpReassembleDecrMemuse(uint64_t size)
 {
-#ifdef UNITTESTS
-    uint64_t presize = SC_ATOMIC_GET(ra_memuse);
-    if (RunmodeIsUnittests()) {
-        BUG_ON(presize > UINT_MAX);
-    }
-#endif
-
-    (void) SC_ATOMIC_SUB(ra_memuse, size);
-
-#ifdef UNITTESTS
-    if (RunmodeIsUnittests()) {
-        uint64_t postsize = SC_ATOMIC_GET(ra_memuse);
-        BUG_ON(postsize > presize);
-    }
-#endif
-    SCLogDebug("REASSEMBLY %"PRIu64", decr %"PRIu64, StreamTcpReassembleMemuseGlobalCounter(), size);
+    MemcapCreditDecr(&ra_memuse, SC_ATOMIC_GET(stream_config.reassembly_memcap), size);
+    SCLogDebug("REASSEMBLY decr %"PRIu64, size);
     return;
 }
 
 uint64_t StreamTcpReassembleMemuseGlobalCounter(void)
 {
-    uint64_t smemuse = SC_ATOMIC_GET(ra_memuse);
-    return smemuse;
+    return MemcapCreditMemuse(&ra_memuse);
 }
 
 /**
@@ -169,10 +156,7 @@ int StreamTcpReassembleCheckMemcap(uint64_t size)
     }
 #endif
     uint64_t memcapcopy = SC_ATOMIC_GET(stream_config.reassembly_memcap);
-    if (memcapcopy == 0 ||
-        (uint64_t)((uint64_t)size + SC_ATOMIC_GET(ra_memuse)) <= memcapcopy)
-        return 1;
-    return 0;
+    return MemcapCreditCheck(&ra_memuse, memcapcopy, size);
 }
 
 /**
@@ -182,7 +166,7 @@ int StreamTcpReassembleCheckMemcap(uint64_t size)
  */
 int StreamTcpReassembleSetMemcap(uint64_t size)
 {
-    if (size == 0 || (uint64_t)SC_ATOMIC_GET(ra_memuse) < size) {
+    if (size == 0 || StreamTcpReassembleMemuseGlobalCounter() < size) {
         SC_ATOMIC_SET(stream_config.reassembly_memcap, size);
         return 1;
     }
@@ -366,30 +350,52 @@ static void TcpSegmentPoolCleanup(void *ptr)
  *
  *  \param seg Segment which will be returned back to the pool.
  */
-void StreamTcpSegmentReturntoPool(TcpSegment *seg)
+static inline void StreamTcpSegmentReset(TcpSegment *seg)
 {
-    if (seg == NULL)
-        return;
-
     if (seg->pcap_hdr_storage && seg->pcap_hdr_storage->pktlen) {
         seg->pcap_hdr_storage->pktlen = 0;
     }
+}
+
+void StreamTcpSegmentReturntoPool(TcpSegment *seg)
+{
+    if (seg == NULL)
+        return;
 
+    StreamTcpSegmentReset(seg);
     PoolThreadReturn(segment_thread_pool, seg);
 }
 
+/** segments returned to the pool per batch by StreamTcpReturnStreamSegments */
+#define SEGMENT_RETURN_BATCH 32
+
 /**
  *  \brief return all segments in this stream into the pool(s)
  *
+ *  Segments are returned in batches, so that when the flow is cleaned up
+ *  by another thread than the one owning the segment pool, the pool's
+ *  return stack is locked once per batch instead of once per segment.
+ *
  *  \param stream the stream to cleanup
  */
 void StreamTcpReturnStreamSegments (TcpStream *stream)
 {
+    void *batch[SEGMENT_RETURN_BATCH];
+    uint32_t cnt = 0;
+
     TcpSegment *seg = NULL, *safe = NULL;
-    RB_FOREACH_SAFE(seg, TCPSEG, &stream->seg_tree, safe)
+    STREAM_SEG_FOREACH_SAFE(seg, stream, safe)
     {
-        RB_REMOVE(TCPSEG, &stream->seg_tree, seg);
-        StreamTcpSegmentReturntoPool(seg);
+        StreamTcpRemoveSegmentFromStream(stream, seg);
+        StreamTcpSegmentReset(seg);
+        batch[cnt++] = seg;
+        if (cnt == SEGMENT_RETURN_BATCH) {
+            PoolThreadReturnBatch(segment_thread_pool, batch, cnt);
+            cnt = 0;
+        }
+    }
+    if (cnt > 0) {
+        PoolThreadReturnBatch(segment_thread_pool, batch, cnt);
     }
 }
 
@@ -453,6 +459,28 @@ int StreamTcpAppLayerIsDisabled(Flow *f)
     return (ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED);
 }
 
+/** \internal
+ *  \brief get the first host-os-policy entry that assigns hosts
+ *
+ *  Segment-less mode doesn't know the segment boundaries the OS policies
+ *  depend on, so it can't apply them.
+ *
+ *  \retval name policy name or NULL if no hosts are assigned a policy
+ */
+static const char *StreamTcpReassembleHostOSPolicyInUse(void)
+{
+    ConfNode *root = ConfGetNode("host-os-policy");
+    if (root == NULL)
+        return NULL;
+
+    ConfNode *policy;
+    TAILQ_FOREACH (policy, &root->head, next) {
+        if (!TAILQ_EMPTY(&policy->head))
+            return policy->name;
+    }
+    return NULL;
+}
+
 static int StreamTcpReassemblyConfig(bool quiet)
 {
     uint32_t segment_prealloc = 2048;
@@ -479,6 +507,29 @@ static int StreamTcpReassemblyConfig(bool quiet)
         StreamTcpReassembleConfigEnableOverlapCheck();
     }
 
+    int segment_less = 0;
+    (void)ConfGetBool("stream.reassembly.segment-less", &segment_less);
+    if (segment_less) {
+        const char *os_policy = StreamTcpReassembleHostOSPolicyInUse();
+        if (overlap_diff_data || StreamTcpInlineMode() == TRUE) {
+            SCLogWarning(SC_WARN_COMPATIBILITY, "stream.reassembly.segment-less is not "
+                                                "supported with inline mode or "
+                                                "check-overlap-different-data, disabling");
+        } else if (os_policy != NULL) {
+            SCLogWarning(SC_WARN_COMPATIBILITY,
+                    "stream.reassembly.segment-less can't apply host-os-policy "
+                    "\"%s\", as overlaps always keep the first data. Disabling "
+                    "segment-less, remove the host-os-policy hosts to use it.",
+                    os_policy);
+        } else {
+            StreamTcpReassembleConfigEnableSegmentLess();
+        }
+    }
+    if (!quiet)
+        SCLogConfig("stream.reassembly \"segment-less\": %s",
+                StreamTcpReassembleIsSegmentLess() ? "enabled, overlaps keep the first data"
+                                                   : "disabled");
+
     stream_config.sbcnf.buf_size = 2048;
     stream_config.sbcnf.Calloc = ReassembleCalloc;
     stream_config.sbcnf.Realloc = StreamTcpReassembleRealloc;
@@ -530,6 +581,8 @@ TcpReassemblyThreadCtx *StreamTcpReassembleInitThreadCtx(ThreadVars *tv)
         return NULL;
 
     memset(ra_ctx, 0x00, sizeof(TcpReassemblyThreadCtx));
+    ra_ctx->segment_thread_pool_id = -1;
+    ra_ctx->ssn_pool_id = -1;
 
     ra_ctx->app_tctx = AppLayerGetCtxThread(tv);
 
@@ -567,6 +620,14 @@ void StreamTcpReassembleFreeThreadCtx(TcpReassemblyThreadCtx *ra_ctx)
 {
     SCEnter();
     if (ra_ctx) {
+        /* segments of this thread still in use by other threads' sessions
+         * are returned directly into the pool from now on */
+        SCMutexLock(&segment_thread_pool_mutex);
+        if (segment_thread_pool != NULL && ra_ctx->segment_thread_pool_id >= 0) {
+            PoolThreadRelease(segment_thread_pool, (uint16_t)ra_ctx->segment_thread_pool_id);
+        }
+        SCMutexUnlock(&segment_thread_pool_mutex);
+
         AppLayerDestroyCtxThread(ra_ctx->app_tctx);
         SCFree(ra_ctx);
     }
@@ -692,6 +753,19 @@ uint32_t StreamDataAvailableForProtoDetect(TcpStream *stream)
     }
 }
 
+/** \internal
+ *  \brief check if the stream holds data, as segments or in segment-less
+ *         mode as buffered data
+ */
+static inline bool StreamHasUnprocessedData(TcpStream *stream)
+{
+    if (!STREAM_SEGS_EMPTY(stream))
+        return true;
+    if (StreamTcpReassembleIsSegmentLess())
+        return stream->sb.buf_offset != 0 || !RB_EMPTY(&stream->sb.sbb_tree);
+    return false;
+}
+
 /**
  *  \brief Insert a packets TCP data into the stream reassembly engine.
  *
@@ -744,6 +818,29 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
     if (size > p->payload_len)
         size = p->payload_len;
 
+    if (StreamTcpReassembleIsSegmentLess()) {
+        uint32_t seq = TCP_GET_SEQ(p);
+        /* HACK: for TFO SYN packets the seq for data starts at + 1 */
+        if (TCP_HAS_TFO(p) && p->payload_len && p->tcph->th_flags == TH_SYN)
+            seq += 1;
+
+        if (!StreamHasUnprocessedData(stream) &&
+                stream->flags & STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_SKIPPED) {
+            AppLayerDecoderEventsSetEventRaw(
+                    &p->app_layer_events, APPLAYER_PROTO_DETECTION_SKIPPED);
+        }
+
+        DEBUG_VALIDATE_BUG_ON(size > UINT16_MAX);
+        int r = StreamTcpReassembleInsertData(
+                tv, ra_ctx, stream, p, seq, p->payload, (uint16_t)size);
+        if (r < 0) {
+            ssn->lossy_be_liberal = true;
+            SCLogDebug("StreamTcpReassembleInsertData failed");
+            SCReturnInt(-1);
+        }
+        SCReturnInt(0);
+    }
+
     TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx);
     if (seg == NULL) {
         SCLogDebug("segment_pool is empty");
@@ -761,7 +858,7 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
         seg->seq += 1;
 
     /* proto detection skipped, but now we do get data. Set event. */
-    if (RB_EMPTY(&stream->seg_tree) &&
+    if (STREAM_SEGS_EMPTY(stream) &&
         stream->flags & STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_SKIPPED) {
 
         AppLayerDecoderEventsSetEventRaw(&p->app_layer_events,
@@ -942,7 +1039,8 @@ static uint64_t GetStreamSize(TcpStream *stream)
         SCLogDebug("stream_offset %" PRIu64, stream->sb.stream_offset);
 
         TcpSegment *seg;
-        RB_FOREACH(seg, TCPSEG, &stream->seg_tree) {
+        STREAM_SEG_FOREACH(seg, stream)
+        {
             const uint64_t seg_abs =
                     STREAM_BASE_OFFSET(stream) + (uint64_t)(seg->seq - stream->base_seq);
             if (last_re != 0 && last_re < seg_abs) {
@@ -1313,7 +1411,7 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     }
 
 #ifdef DEBUG
-    SCLogDebug("stream->seg_tree RB_MIN %p", RB_MIN(TCPSEG, &stream->seg_tree));
+    SCLogDebug("stream first segment %p", StreamTcpSegmentFirst(stream));
     GetSessionSize(ssn, p);
 #endif
     /* if no segments are in the list or all are already processed,
@@ -1420,7 +1518,7 @@ bool StreamReassembleRawHasDataReady(TcpSession *ssn, Packet *p)
         stream = &ssn->server;
     }
 
-    if (RB_EMPTY(&stream->seg_tree)) {
+    if (!StreamHasUnprocessedData(stream)) {
         return false;
     }
 
@@ -2044,11 +2142,44 @@ TcpSegment *StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx)
         StatsIncr(tv, ra_ctx->counter_tcp_segment_memcap);
     } else {
         memset(&seg->sbseg, 0, sizeof(seg->sbseg));
+        StreamTcpReassembleUpdatePoolStats(tv, ra_ctx);
     }
 
     return seg;
 }
 
+/**
+ *  \brief bytes of segment metadata held by this thread's segment pool
+ *
+ *  Covers the TcpSegment objects and, with session dumping, their packet
+ *  header storage. The stream data itself is in the streaming buffers.
+ */
+uint64_t StreamTcpReassembleSegmentMetadata(TcpReassemblyThreadCtx *ra_ctx)
+{
+    uint64_t size = sizeof(TcpSegment);
+    if (IsTcpSessionDumpingEnabled()) {
+        size += sizeof(TcpSegmentPcapHdrStorage) + TCPSEG_PKT_HDR_DEFAULT_SIZE;
+    }
+    return size * PoolThreadInUse(segment_thread_pool, (uint16_t)ra_ctx->segment_thread_pool_id);
+}
+
+/**
+ *  \brief update the segment pool gauges of this thread
+ *
+ *  Called when segments are taken from the pool and after they are pruned,
+ *  so tcp.segment_metadata_per_ssn follows the segments actually held.
+ */
+void StreamTcpReassembleUpdatePoolStats(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx)
+{
+    const uint32_t segs =
+            PoolThreadInUse(segment_thread_pool, (uint16_t)ra_ctx->segment_thread_pool_id);
+    StatsSetUI64(tv, ra_ctx->counter_tcp_segment_pool_inuse, segs);
+
+    const uint32_t ssns = StreamTcpSsnPoolInUse(ra_ctx->ssn_pool_id);
+    StatsSetUI64(tv, ra_ctx->counter_tcp_segment_metadata_per_ssn,
+            ssns > 0 ? StreamTcpReassembleSegmentMetadata(ra_ctx) / ssns : 0);
+}
+
 /**
  *  \brief Trigger RAW stream reassembly
  *
@@ -2435,8 +2566,8 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOSERVER));
     FAIL_IF(FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
-    FAIL_IF(!RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(!RB_EMPTY(&ssn->server.seg_tree));
+    FAIL_IF(!STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(!STREAM_SEGS_EMPTY(&ssn->server));
     FAIL_IF(ssn->data_first_seen_dir != 0);
 
     /* handshake */
@@ -2456,8 +2587,8 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOSERVER));
     FAIL_IF(FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
-    FAIL_IF(!RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(!RB_EMPTY(&ssn->server.seg_tree));
+    FAIL_IF(!STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(!STREAM_SEGS_EMPTY(&ssn->server));
     FAIL_IF(ssn->data_first_seen_dir != 0);
 
     /* handshake */
@@ -2478,8 +2609,8 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOSERVER));
     FAIL_IF(FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
-    FAIL_IF(!RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(!RB_EMPTY(&ssn->server.seg_tree));
+    FAIL_IF(!STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(!STREAM_SEGS_EMPTY(&ssn->server));
     FAIL_IF(ssn->data_first_seen_dir != 0);
 
     /* partial request */
@@ -2501,9 +2632,9 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOSERVER));
     FAIL_IF(FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(!RB_EMPTY(&ssn->server.seg_tree));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(!STREAM_SEGS_EMPTY(&ssn->server));
     FAIL_IF(ssn->data_first_seen_dir != STREAM_TOSERVER);
 
     /* response ack against partial request */
@@ -2524,9 +2655,9 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(!FLOW_IS_PP_DONE(&f, STREAM_TOSERVER));
     FAIL_IF(FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(!RB_EMPTY(&ssn->server.seg_tree));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(!STREAM_SEGS_EMPTY(&ssn->server));
     FAIL_IF(ssn->data_first_seen_dir != STREAM_TOSERVER);
 
     /* complete partial request */
@@ -2559,10 +2690,11 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(!FLOW_IS_PP_DONE(&f, STREAM_TOSERVER));
     FAIL_IF(FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(!TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))));
-    FAIL_IF(!RB_EMPTY(&ssn->server.seg_tree));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(StreamTcpSegmentNext(
+            &ssn->client, StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client))));
+    FAIL_IF(!STREAM_SEGS_EMPTY(&ssn->server));
     FAIL_IF(ssn->data_first_seen_dir != STREAM_TOSERVER);
 
     /* response - request ack */
@@ -2627,10 +2759,11 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER);
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(RB_EMPTY(&ssn->server.seg_tree));
-    FAIL_IF(!TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->server));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(StreamTcpSegmentNext(
+            &ssn->client, StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client))));
 
     /* response ack from request */
     p->tcph->th_ack = htonl(328);
@@ -2651,11 +2784,12 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(!FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER);
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(RB_EMPTY(&ssn->server.seg_tree));
-    FAIL_IF(!TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))));
-    FAIL_IF(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->server));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(StreamTcpSegmentNext(
+            &ssn->client, StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client))));
+    FAIL_IF(StreamTcpSegmentNext(&ssn->server, StreamTcpSegmentFirst(&ssn->server)));
 
     /* response - acking */
     p->tcph->th_ack = htonl(88);
@@ -2676,11 +2810,12 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(!FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER);
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(RB_EMPTY(&ssn->server.seg_tree));
-    FAIL_IF(!TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))));
-    FAIL_IF(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->server));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(StreamTcpSegmentNext(
+            &ssn->client, StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client))));
+    FAIL_IF(StreamTcpSegmentNext(&ssn->server, StreamTcpSegmentFirst(&ssn->server)));
 
     /* response ack from request */
     p->tcph->th_ack = htonl(328);
@@ -2701,10 +2836,10 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(!FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER);
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(!TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(RB_EMPTY(&ssn->server.seg_tree));
-    FAIL_IF(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->server));
+    FAIL_IF(StreamTcpSegmentNext(&ssn->server, StreamTcpSegmentFirst(&ssn->server)));
 
     /* response - acking the request again*/
     p->tcph->th_ack = htonl(88);
@@ -2725,10 +2860,10 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(!FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER);
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(!TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(RB_EMPTY(&ssn->server.seg_tree));
-    FAIL_IF(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->server));
+    FAIL_IF(StreamTcpSegmentNext(&ssn->server, StreamTcpSegmentFirst(&ssn->server)));
 
     /*** New Request ***/
 
@@ -2751,11 +2886,12 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(!FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER);
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(!TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(!TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))));
-    FAIL_IF(RB_EMPTY(&ssn->server.seg_tree));
-    FAIL_IF(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(!StreamTcpSegmentNext(
+            &ssn->client, StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client))));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->server));
+    FAIL_IF(StreamTcpSegmentNext(&ssn->server, StreamTcpSegmentFirst(&ssn->server)));
 
     /* response ack against partial request */
     p->tcph->th_ack = htonl(90);
@@ -2777,11 +2913,12 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(!FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER);
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(!TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(!TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))));
-    FAIL_IF(RB_EMPTY(&ssn->server.seg_tree));
-    FAIL_IF(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(!StreamTcpSegmentNext(
+            &ssn->client, StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client))));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->server));
+    FAIL_IF(StreamTcpSegmentNext(&ssn->server, StreamTcpSegmentFirst(&ssn->server)));
 
     /* complete request */
     p->tcph->th_ack = htonl(328);
@@ -2802,12 +2939,15 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(!FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER);
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(!TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(!TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))));
-    FAIL_IF(!TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)))));
-    FAIL_IF(RB_EMPTY(&ssn->server.seg_tree));
-    FAIL_IF(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(!StreamTcpSegmentNext(
+            &ssn->client, StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client))));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client,
+            StreamTcpSegmentNext(&ssn->client,
+                    StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)))));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->server));
+    FAIL_IF(StreamTcpSegmentNext(&ssn->server, StreamTcpSegmentFirst(&ssn->server)));
 
     /* response ack against second partial request */
     p->tcph->th_ack = htonl(175);
@@ -2829,12 +2969,15 @@ static int StreamTcpReassembleTest39 (void)
     FAIL_IF(!FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(FLOW_IS_PP_DONE(&f, STREAM_TOCLIENT));
     FAIL_IF(ssn->data_first_seen_dir != APP_LAYER_DATA_ALREADY_SENT_TO_APP_LAYER);
-    FAIL_IF(RB_EMPTY(&ssn->client.seg_tree));
-    FAIL_IF(!TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)));
-    FAIL_IF(!TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree))));
-    FAIL_IF(!TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->client.seg_tree)))));
-    FAIL_IF(RB_EMPTY(&ssn->server.seg_tree));
-    FAIL_IF(TCPSEG_RB_NEXT(RB_MIN(TCPSEG, &ssn->server.seg_tree)));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->client));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)));
+    FAIL_IF(!StreamTcpSegmentNext(
+            &ssn->client, StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client))));
+    FAIL_IF(!StreamTcpSegmentNext(&ssn->client,
+            StreamTcpSegmentNext(&ssn->client,
+                    StreamTcpSegmentNext(&ssn->client, StreamTcpSegmentFirst(&ssn->client)))));
+    FAIL_IF(STREAM_SEGS_EMPTY(&ssn->server));
+    FAIL_IF(StreamTcpSegmentNext(&ssn->server, StreamTcpSegmentFirst(&ssn->server)));
 
     /* response acking a request */
     p->tcph->th_ack = htonl(175);
@@ -2961,7 +3104,7 @@ static int StreamTcpReassembleTest40 (void)
     FAIL_IF(StreamTcpReassembleHandleSegment(&tv, ra_ctx, &ssn, s, p, &pq) == -1);
 
     /* check is have the segment in the list and flagged or not */
-    TcpSegment *seg = RB_MIN(TCPSEG, &ssn.client.seg_tree);
+    TcpSegment *seg = StreamTcpSegmentFirst(&ssn.client);
     FAIL_IF_NULL(seg);
     FAIL_IF(SEGMENT_BEFORE_OFFSET(&ssn.client, seg, STREAM_APP_PROGRESS(&ssn.client)));
 
@@ -3018,15 +3161,15 @@ static int StreamTcpReassembleTest40 (void)
 static int StreamTcpReassembleTest44(void)
 {
     StreamTcpInitConfig(true);
-    uint32_t memuse = SC_ATOMIC_GET(ra_memuse);
+    uint32_t memuse = StreamTcpReassembleMemuseGlobalCounter();
     StreamTcpReassembleIncrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(ra_memuse) != (memuse+500));
+    FAIL_IF(StreamTcpReassembleMemuseGlobalCounter() != (memuse+500));
     StreamTcpReassembleDecrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(ra_memuse) != memuse);
+    FAIL_IF(StreamTcpReassembleMemuseGlobalCounter() != memuse);
     FAIL_IF(StreamTcpReassembleCheckMemcap(500) != 1);
     FAIL_IF(StreamTcpReassembleCheckMemcap((1 + memuse + SC_ATOMIC_GET(stream_config.reassembly_memcap))) != 0);
     StreamTcpFreeConfig(true);
-    FAIL_IF(SC_ATOMIC_GET(ra_memuse) != 0);
+    FAIL_IF(StreamTcpReassembleMemuseGlobalCounter() != 0);
     PASS;
 }
 
@@ -3455,7 +3598,7 @@ static int StreamTcpReassembleInlineTest08(void)
     p->tcph->th_seq = htonl(17);
     StreamTcpPruneSession(&f, STREAM_TOSERVER);
 
-    TcpSegment *seg = RB_MIN(TCPSEG, &ssn.client.seg_tree);
+    TcpSegment *seg = StreamTcpSegmentFirst(&ssn.client);
     FAIL_IF_NULL(seg);
     FAIL_IF_NOT(seg->seq == 2);
 
@@ -3523,7 +3666,7 @@ static int StreamTcpReassembleInlineTest09(void)
 
     p->tcph->th_seq = htonl(12);
 
-    TcpSegment *seg = RB_MIN(TCPSEG, &ssn.client.seg_tree);
+    TcpSegment *seg = StreamTcpSegmentFirst(&ssn.client);
     FAIL_IF_NULL(seg);
     FAIL_IF_NOT(seg->seq == 2);
 
@@ -61,9 +61,15 @@ typedef struct TcpReassemblyThreadCtx_ {
     void *app_tctx;
 
     int segment_thread_pool_id;
+    /** session pool id of the owning stream thread, -1 if not set */
+    int ssn_pool_id;
 
     /** TCP segments which are not being reassembled due to memcap was reached */
     uint16_t counter_tcp_segment_memcap;
+    /** segments of this thread's pool in use */
+    uint16_t counter_tcp_segment_pool_inuse;
+    /** bytes of segment metadata per session in use */
+    uint16_t counter_tcp_segment_metadata_per_ssn;
     /** number of streams that stop reassembly because their depth is reached */
     uint16_t counter_tcp_stream_depth;
     /** count number of streams with a unrecoverable stream gap (missing pkts) */
@@ -73,6 +79,10 @@ typedef struct TcpReassemblyThreadCtx_ {
     uint16_t counter_tcp_reass_overlap;
     /** count overlaps with different data */
     uint16_t counter_tcp_reass_overlap_diff_data;
+    /** segments appended to the in order segment list */
+    uint16_t counter_tcp_reass_list_append;
+    /** streams moving their segment list into the segment tree */
+    uint16_t counter_tcp_reass_tree_promote;
 
     uint16_t counter_tcp_reass_data_normal_fail;
     uint16_t counter_tcp_reass_data_overlap_fail;
@@ -103,7 +113,11 @@ void StreamTcpSetOSPolicy(TcpStream *, Packet *);
 int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
         TcpSession *ssn, TcpStream *stream, Packet *p);
 int StreamTcpReassembleInsertSegment(ThreadVars *, TcpReassemblyThreadCtx *, TcpStream *, TcpSegment *, Packet *, uint32_t pkt_seq, uint8_t *pkt_data, uint16_t pkt_datalen);
+int StreamTcpReassembleInsertData(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
+        TcpStream *stream, Packet *p, uint32_t seq, const uint8_t *data, uint16_t data_len);
 TcpSegment *StreamTcpGetSegment(ThreadVars *, TcpReassemblyThreadCtx *);
+uint64_t StreamTcpReassembleSegmentMetadata(TcpReassemblyThreadCtx *ra_ctx);
+void StreamTcpReassembleUpdatePoolStats(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx);
 
 void StreamTcpReturnStreamSegments(TcpStream *);
 void StreamTcpSegmentReturntoPool(TcpSegment *);
@@ -191,16 +191,17 @@ static int StreamTcpUtilStreamTest01(void)
     FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &stream,  2, 'A', 5) == -1);
     FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &stream,  7, 'B', 5) == -1);
     FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &stream, 12, 'C', 5) == -1);
+    FAIL_IF(STREAM_SEGS_IN_TREE(&stream));
 
-    TcpSegment *seg = RB_MIN(TCPSEG, &stream.seg_tree);
+    TcpSegment *seg = StreamTcpSegmentFirst(&stream);
     FAIL_IF_NULL(seg);
     FAIL_IF(seg->seq != 2);
 
-    seg = TCPSEG_RB_NEXT(seg);
+    seg = StreamTcpSegmentNext(&stream, seg);
     FAIL_IF_NULL(seg);
     FAIL_IF(seg->seq != 7);
 
-    seg = TCPSEG_RB_NEXT(seg);
+    seg = StreamTcpSegmentNext(&stream, seg);
     FAIL_IF_NULL(seg);
     FAIL_IF(seg->seq != 12);
 
@@ -222,16 +223,17 @@ static int StreamTcpUtilStreamTest02(void)
     FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &stream,  7, 'B', 5) == -1);
     FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &stream, 12, 'C', 5) == -1);
     FAIL_IF(StreamTcpUTAddSegmentWithByte(&tv, ra_ctx, &stream,  2, 'A', 5) == -1);
+    FAIL_IF_NOT(STREAM_SEGS_IN_TREE(&stream));
 
-    TcpSegment *seg = RB_MIN(TCPSEG, &stream.seg_tree);
+    TcpSegment *seg = StreamTcpSegmentFirst(&stream);
     FAIL_IF_NULL(seg);
     FAIL_IF(seg->seq != 2);
 
-    seg = TCPSEG_RB_NEXT(seg);
+    seg = StreamTcpSegmentNext(&stream, seg);
     FAIL_IF_NULL(seg);
     FAIL_IF(seg->seq != 7);
 
-    seg = TCPSEG_RB_NEXT(seg);
+    seg = StreamTcpSegmentNext(&stream, seg);
     FAIL_IF_NULL(seg);
     FAIL_IF(seg->seq != 12);
 
@@ -32,6 +32,7 @@
 #include "decode.h"
 #include "debug.h"
 #include "detect.h"
+#include "detect-engine-tag.h"
 
 #include "flow.h"
 #include "flow-util.h"
@@ -45,6 +46,7 @@
 
 #include "util-pool.h"
 #include "util-pool-thread.h"
+#include "util-memcap-credit.h"
 #include "util-checksum.h"
 #include "util-unittest.h"
 #include "util-print.h"
@@ -106,51 +108,34 @@ extern int g_detect_disabled;
 
 static PoolThread *ssn_pool = NULL;
 static SCMutex ssn_pool_mutex = SCMUTEX_INITIALIZER; /**< init only, protect initializing and growing pool */
-#ifdef DEBUG
-static uint64_t ssn_pool_cnt = 0; /** counts ssns, protected by ssn_pool_mutex */
-#endif
 
 TcpStreamCnf stream_config;
 uint64_t StreamTcpReassembleMemuseGlobalCounter(void);
-SC_ATOMIC_DECLARE(uint64_t, st_memuse);
+/** stream memuse, accounted per thread */
+static MemcapCredit st_memuse;
 
 void StreamTcpInitMemuse(void)
 {
-    SC_ATOMIC_INIT(st_memuse);
+    MemcapCreditInit(&st_memuse, "stream", MEMCAP_CREDIT_CHUNK_DEFAULT);
 }
 
 void StreamTcpIncrMemuse(uint64_t size)
 {
-    (void) SC_ATOMIC_ADD(st_memuse, size);
-    SCLogDebug("STREAM %"PRIu64", incr %"PRIu64, StreamTcpMemuseCounter(), size);
+    MemcapCreditIncr(&st_memuse, SC_ATOMIC_GET(stream_config.memcap), size);
+    SCLogDebug("STREAM incr %"PRIu64, size);
     return;
 }
 
 void StreamTcpDecrMemuse(uint64_t size)
 {
-#ifdef DEBUG_VALIDATION
-    uint64_t presize = SC_ATOMIC_GET(st_memuse);
-    if (RunmodeIsUnittests()) {
-        BUG_ON(presize > UINT_MAX);
-    }
-#endif
-
-    (void) SC_ATOMIC_SUB(st_memuse, size);
-
-#ifdef DEBUG_VALIDATION
-    if (RunmodeIsUnittests()) {
-        uint64_t postsize = SC_ATOMIC_GET(st_memuse);
-        BUG_ON(postsize > presize);
-    }
-#endif
-    SCLogDebug("STREAM %"PRIu64", decr %"PRIu64, StreamTcpMemuseCounter(), size);
+    MemcapCreditDecr(&st_memuse, SC_ATOMIC_GET(stream_config.memcap), size);
+    SCLogDebug("STREAM decr %"PRIu64, size);
     return;
 }
 
 uint64_t StreamTcpMemuseCounter(void)
 {
-    uint64_t memusecopy = SC_ATOMIC_GET(st_memuse);
-    return memusecopy;
+    return MemcapCreditMemuse(&st_memuse);
 }
 
 /**
@@ -162,9 +147,7 @@ uint64_t StreamTcpMemuseCounter(void)
 int StreamTcpCheckMemcap(uint64_t size)
 {
     uint64_t memcapcopy = SC_ATOMIC_GET(stream_config.memcap);
-    if (memcapcopy == 0 || size + SC_ATOMIC_GET(st_memuse) <= memcapcopy)
-        return 1;
-    return 0;
+    return MemcapCreditCheck(&st_memuse, memcapcopy, size);
 }
 
 /**
@@ -174,7 +157,7 @@ int StreamTcpCheckMemcap(uint64_t size)
  */
 int StreamTcpSetMemcap(uint64_t size)
 {
-    if (size == 0 || (uint64_t)SC_ATOMIC_GET(st_memuse) < size) {
+    if (size == 0 || StreamTcpMemuseCounter() < size) {
         SC_ATOMIC_SET(stream_config.memcap, size);
         return 1;
     }
@@ -255,11 +238,6 @@ void StreamTcpSessionClear(void *ssnptr)
     ssn->res = a;
 
     PoolThreadReturn(ssn_pool, ssn);
-#ifdef DEBUG
-    SCMutexLock(&ssn_pool_mutex);
-    ssn_pool_cnt--;
-    SCMutexUnlock(&ssn_pool_mutex);
-#endif
 
     SCReturn;
 }
@@ -489,6 +467,18 @@ void StreamTcpInitConfig(bool quiet)
                     ? "enabled" : "disabled");
     }
 
+    int auto_bypass = 0;
+    if ((ConfGetBool("stream.auto-bypass", &auto_bypass)) == 1) {
+        if (auto_bypass == 1) {
+            stream_config.flags |= STREAMTCP_INIT_FLAG_AUTO_BYPASS;
+        }
+    }
+
+    if (!quiet) {
+        SCLogConfig("stream \"auto-bypass\": %s",
+                (stream_config.flags & STREAMTCP_INIT_FLAG_AUTO_BYPASS) ? "enabled" : "disabled");
+    }
+
     int drop_invalid = 0;
     if ((ConfGetBool("stream.drop-invalid", &drop_invalid)) == 1) {
         if (drop_invalid == 1) {
@@ -676,8 +666,6 @@ void StreamTcpFreeConfig(bool quiet)
     }
     SCMutexUnlock(&ssn_pool_mutex);
     SCMutexDestroy(&ssn_pool_mutex);
-
-    SCLogDebug("ssn_pool_cnt %"PRIu64"", ssn_pool_cnt);
 }
 
 /** \internal
@@ -697,11 +685,6 @@ static TcpSession *StreamTcpNewSession (Packet *p, int id)
         DEBUG_VALIDATE_BUG_ON(id < 0 || id > UINT16_MAX);
         p->flow->protoctx = PoolThreadGetById(ssn_pool, (uint16_t)id);
 #ifdef DEBUG
-        SCMutexLock(&ssn_pool_mutex);
-        if (p->flow->protoctx != NULL)
-            ssn_pool_cnt++;
-        SCMutexUnlock(&ssn_pool_mutex);
-
         if (unlikely((g_eps_stream_ssn_memcap != UINT64_MAX &&
                       g_eps_stream_ssn_memcap == t_pcapcnt))) {
             SCLogNotice("simulating memcap reached condition for packet %" PRIu64, t_pcapcnt);
@@ -896,6 +879,137 @@ static int StreamTcpPacketIsRetransmission(TcpStream *stream, Packet *p)
     SCReturnInt(0);
 }
 
+#define STREAM_CONSUMERS_ALL (BIT_U8(STREAM_CONSUMER_MAX) - 1)
+#define STREAM_DONE_FLAGS                                                                          \
+    (STREAMTCP_STREAM_FLAG_NOREASSEMBLY | STREAMTCP_STREAM_FLAG_DEPTH_REACHED)
+
+/** pcap-log needs for stream.auto-bypass: 0 not used, 1 until stream
+ *  depth, 2 all packets */
+static int auto_bypass_pcap_log = 0;
+
+/** \brief register a pcap-log instance with stream.auto-bypass
+ *
+ *  \param use_stream_depth true if pcap-log stops logging packets of a
+ *         session once its stream depth is reached
+ */
+void StreamTcpAutoBypassRegisterPcapLog(bool use_stream_depth)
+{
+    const int need = use_stream_depth ? 1 : 2;
+    if (need > auto_bypass_pcap_log)
+        auto_bypass_pcap_log = need;
+}
+
+/** \internal
+ *  \brief check if no rule can match on the later packets of a flow
+ *
+ *  App-layer rules are done with the app-layer. Other rules of the
+ *  flow's rule groups might still match on packets. IP-only rules are
+ *  not in the rule groups, they are done once both directions were
+ *  inspected. A flow with a drop or pass action still needs detect to
+ *  enforce it. In IPS mode the verdict is only settled once all stream
+ *  data was inspected.
+ */
+static bool StreamTcpRulesDone(Flow *f, const uint8_t done)
+{
+    if (g_detect_disabled)
+        return true;
+    if (f->flags & (FLOW_ACTION_DROP | FLOW_ACTION_PASS))
+        return false;
+    if ((f->flags & (FLOW_TOSERVER_IPONLY_SET | FLOW_TOCLIENT_IPONLY_SET)) !=
+            (FLOW_TOSERVER_IPONLY_SET | FLOW_TOCLIENT_IPONLY_SET))
+        return false;
+    if (!(done & BIT_U8(STREAM_CONSUMER_APP_LAYER)))
+        return false;
+    if (EngineModeIsIPS() && !(done & BIT_U8(STREAM_CONSUMER_STREAM)))
+        return false;
+    if ((f->flags & (FLOW_SGH_TOSERVER | FLOW_SGH_TOCLIENT)) !=
+            (FLOW_SGH_TOSERVER | FLOW_SGH_TOCLIENT))
+        return false;
+    if (f->sgh_toserver != NULL && (f->sgh_toserver->flags & SIG_GROUP_HEAD_HAVEPKTSIGS))
+        return false;
+    if (f->sgh_toclient != NULL && (f->sgh_toclient->flags & SIG_GROUP_HEAD_HAVEPKTSIGS))
+        return false;
+    /* tagged packets are still logged */
+    if (TagFlowHasTag(f))
+        return false;
+    return true;
+}
+
+/** \internal
+ *  \brief update which consumers are done with the session
+ *
+ *  \retval consumer the consumer that was done last, if all are done now
+ *  \retval -1 not all consumers are done or they already were
+ */
+static int StreamTcpConsumersUpdate(TcpSession *ssn, const Packet *p)
+{
+    const uint8_t prev = ssn->consumers_done;
+    if (prev == STREAM_CONSUMERS_ALL)
+        return -1;
+
+    uint8_t done = prev;
+    const bool stream_done = (ssn->client.flags & STREAM_DONE_FLAGS) &&
+                             (ssn->server.flags & STREAM_DONE_FLAGS);
+    if (stream_done) {
+        done |= BIT_U8(STREAM_CONSUMER_STREAM);
+    }
+    /* the app-layer and file tracking get no data once the stream is done */
+    if (stream_done || (ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED)) {
+        done |= BIT_U8(STREAM_CONSUMER_APP_LAYER);
+    }
+    if ((done & BIT_U8(STREAM_CONSUMER_APP_LAYER)) ||
+            (p->flow->file_flags & FLOWFILE_NONE) == FLOWFILE_NONE) {
+        done |= BIT_U8(STREAM_CONSUMER_FILES);
+    }
+    if (auto_bypass_pcap_log == 0 || (auto_bypass_pcap_log == 1 && stream_done)) {
+        done |= BIT_U8(STREAM_CONSUMER_PCAP_LOG);
+    }
+    /* a drop or pass action set after the rules were done still needs
+     * detect to enforce it */
+    if (p->flow->flags & (FLOW_ACTION_DROP | FLOW_ACTION_PASS)) {
+        done &= ~BIT_U8(STREAM_CONSUMER_RULES);
+    } else if (!(done & BIT_U8(STREAM_CONSUMER_RULES)) && StreamTcpRulesDone(p->flow, done)) {
+        done |= BIT_U8(STREAM_CONSUMER_RULES);
+    }
+
+    ssn->consumers_done = done;
+    if (done != STREAM_CONSUMERS_ALL)
+        return -1;
+
+    const uint8_t last = done & ~prev;
+    for (int c = STREAM_CONSUMER_MAX - 1; c >= 0; c--) {
+        if (last & BIT_U8(c))
+            return c;
+    }
+    return -1;
+}
+
+/**
+ *  \brief sessions of a thread's session pool in use
+ *
+ *  \param ssn_pool_id the thread's id in the session pool
+ */
+uint32_t StreamTcpSsnPoolInUse(int ssn_pool_id)
+{
+    if (ssn_pool_id < 0)
+        return 0;
+    return PoolThreadInUse(ssn_pool, (uint16_t)ssn_pool_id);
+}
+
+/** \internal
+ *  \brief update the session pool gauges of this thread
+ *
+ *  Also refreshes the segment gauges, as the number of sessions is the
+ *  divisor of tcp.segment_metadata_per_ssn.
+ */
+static void StreamTcpUpdatePoolStats(ThreadVars *tv, StreamTcpThread *stt)
+{
+    StatsSetUI64(tv, stt->counter_tcp_ssn_pool_inuse, StreamTcpSsnPoolInUse(stt->ssn_pool_id));
+    if (stt->ra_ctx != NULL) {
+        StreamTcpReassembleUpdatePoolStats(tv, stt->ra_ctx);
+    }
+}
+
 /**
  *  \internal
  *  \brief  Function to handle the TCP_CLOSED or NONE state. The function handles
@@ -935,6 +1049,7 @@ static int StreamTcpPacketStateNone(ThreadVars *tv, Packet *p,
                 return -1;
             }
             StatsIncr(tv, stt->counter_tcp_sessions);
+            StreamTcpUpdatePoolStats(tv, stt);
             StatsIncr(tv, stt->counter_tcp_active_sessions);
             StatsIncr(tv, stt->counter_tcp_midstream_pickups);
         }
@@ -1029,6 +1144,7 @@ static int StreamTcpPacketStateNone(ThreadVars *tv, Packet *p,
             }
 
             StatsIncr(tv, stt->counter_tcp_sessions);
+            StreamTcpUpdatePoolStats(tv, stt);
             StatsIncr(tv, stt->counter_tcp_active_sessions);
         }
 
@@ -1096,6 +1212,7 @@ static int StreamTcpPacketStateNone(ThreadVars *tv, Packet *p,
                 return -1;
             }
             StatsIncr(tv, stt->counter_tcp_sessions);
+            StreamTcpUpdatePoolStats(tv, stt);
             StatsIncr(tv, stt->counter_tcp_active_sessions);
             StatsIncr(tv, stt->counter_tcp_midstream_pickups);
         }
@@ -5108,6 +5225,15 @@ int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
         {
             SCLogDebug("bypass as stream is dead and we have no rules");
             PacketBypassCallback(p);
+
+        /* bypass once nothing needs the packets of the session anymore */
+        } else if (stream_config.flags & STREAMTCP_INIT_FLAG_AUTO_BYPASS) {
+            const int consumer = StreamTcpConsumersUpdate(ssn, p);
+            if (consumer >= 0) {
+                SCLogDebug("ssn %p: all consumers done, last %d: bypass", ssn, consumer);
+                StatsIncr(tv, stt->counter_tcp_auto_bypass[consumer]);
+                PacketBypassCallback(p);
+            }
         }
     }
 
@@ -5377,6 +5503,17 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->counter_tcp_active_sessions = StatsRegisterCounter("tcp.active_sessions", tv);
     stt->counter_tcp_sessions = StatsRegisterCounter("tcp.sessions", tv);
     stt->counter_tcp_ssn_memcap = StatsRegisterCounter("tcp.ssn_memcap_drop", tv);
+    stt->counter_tcp_ssn_pool_inuse = StatsRegisterCounter("tcp.ssn_pool_inuse", tv);
+    stt->counter_tcp_auto_bypass[STREAM_CONSUMER_STREAM] =
+            StatsRegisterCounter("tcp.auto_bypass_stream", tv);
+    stt->counter_tcp_auto_bypass[STREAM_CONSUMER_APP_LAYER] =
+            StatsRegisterCounter("tcp.auto_bypass_app_layer", tv);
+    stt->counter_tcp_auto_bypass[STREAM_CONSUMER_FILES] =
+            StatsRegisterCounter("tcp.auto_bypass_files", tv);
+    stt->counter_tcp_auto_bypass[STREAM_CONSUMER_PCAP_LOG] =
+            StatsRegisterCounter("tcp.auto_bypass_pcap_log", tv);
+    stt->counter_tcp_auto_bypass[STREAM_CONSUMER_RULES] =
+            StatsRegisterCounter("tcp.auto_bypass_rules", tv);
     stt->counter_tcp_pseudo = StatsRegisterCounter("tcp.pseudo", tv);
     stt->counter_tcp_pseudo_failed = StatsRegisterCounter("tcp.pseudo_failed", tv);
     stt->counter_tcp_invalid_checksum = StatsRegisterCounter("tcp.invalid_checksum", tv);
@@ -5393,10 +5530,18 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
         SCReturnInt(TM_ECODE_FAILED);
 
     stt->ra_ctx->counter_tcp_segment_memcap = StatsRegisterCounter("tcp.segment_memcap_drop", tv);
+    stt->ra_ctx->counter_tcp_segment_pool_inuse =
+            StatsRegisterCounter("tcp.segment_pool_inuse", tv);
+    stt->ra_ctx->counter_tcp_segment_metadata_per_ssn =
+            StatsRegisterCounter("tcp.segment_metadata_per_ssn", tv);
     stt->ra_ctx->counter_tcp_stream_depth = StatsRegisterCounter("tcp.stream_depth_reached", tv);
     stt->ra_ctx->counter_tcp_reass_gap = StatsRegisterCounter("tcp.reassembly_gap", tv);
     stt->ra_ctx->counter_tcp_reass_overlap = StatsRegisterCounter("tcp.overlap", tv);
     stt->ra_ctx->counter_tcp_reass_overlap_diff_data = StatsRegisterCounter("tcp.overlap_diff_data", tv);
+    stt->ra_ctx->counter_tcp_reass_list_append =
+            StatsRegisterCounter("tcp.segment_list_append", tv);
+    stt->ra_ctx->counter_tcp_reass_tree_promote =
+            StatsRegisterCounter("tcp.segment_tree_promote", tv);
 
     stt->ra_ctx->counter_tcp_reass_data_normal_fail = StatsRegisterCounter("tcp.insert_data_normal_fail", tv);
     stt->ra_ctx->counter_tcp_reass_data_overlap_fail = StatsRegisterCounter("tcp.insert_data_overlap_fail", tv);
@@ -5425,6 +5570,7 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
         SCLogError(SC_ERR_MEM_ALLOC, "failed to setup/expand stream session pool. Expand stream.memcap?");
         SCReturnInt(TM_ECODE_FAILED);
     }
+    stt->ra_ctx->ssn_pool_id = stt->ssn_pool_id;
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -5437,7 +5583,13 @@ TmEcode StreamTcpThreadDeinit(ThreadVars *tv, void *data)
         return TM_ECODE_OK;
     }
 
-    /* XXX */
+    /* sessions of this thread still in use are returned directly into
+     * the pool from now on */
+    SCMutexLock(&ssn_pool_mutex);
+    if (ssn_pool != NULL && stt->ssn_pool_id >= 0) {
+        PoolThreadRelease(ssn_pool, (uint16_t)stt->ssn_pool_id);
+    }
+    SCMutexUnlock(&ssn_pool_mutex);
 
     /* free reassembly ctx */
     StreamTcpReassembleFreeThreadCtx(stt->ra_ctx);
@@ -6397,7 +6549,8 @@ int StreamTcpSegmentForEach(const Packet *p, uint8_t flag, StreamSegmentCallback
 
     /* for IDS, return ack'd segments. For IPS all. */
     TcpSegment *seg;
-    RB_FOREACH(seg, TCPSEG, &stream->seg_tree) {
+    STREAM_SEG_FOREACH(seg, stream)
+    {
         if (!(stream_config.flags & STREAMTCP_INIT_FLAG_INLINE)) {
             if (PKT_IS_PSEUDOPKT(p)) {
                 /* use un-ACK'd data as well */
@@ -6453,8 +6606,8 @@ int StreamTcpSegmentForSession(
     TcpStream *server_stream = &(ssn->server);
     TcpStream *client_stream = &(ssn->client);
 
-    TcpSegment *server_node = RB_ROOT(&(server_stream->seg_tree));
-    TcpSegment *client_node = RB_ROOT(&(client_stream->seg_tree));
+    TcpSegment *server_node = StreamTcpSegmentFirst(server_stream);
+    TcpSegment *client_node = StreamTcpSegmentFirst(client_stream);
     if (server_node == NULL && client_node == NULL) {
         return cnt;
     }
@@ -6475,7 +6628,7 @@ int StreamTcpSegmentForSession(
                 SCLogDebug("Callback function has failed");
                 return -1;
             }
-            client_node = TCPSEG_RB_NEXT(client_node);
+            client_node = StreamTcpSegmentNext(client_stream, client_node);
         } else if (client_node == NULL) {
             /*
              * This means the client side RB Tree has been completely searched,
@@ -6489,7 +6642,7 @@ int StreamTcpSegmentForSession(
                 SCLogDebug("Callback function has failed");
                 return -1;
             }
-            server_node = TCPSEG_RB_NEXT(server_node);
+            server_node = StreamTcpSegmentNext(server_stream, server_node);
         } else {
             if (TimevalEarlier(
                         &client_node->pcap_hdr_storage->ts, &server_node->pcap_hdr_storage->ts)) {
@@ -6500,7 +6653,7 @@ int StreamTcpSegmentForSession(
                     SCLogDebug("Callback function has failed");
                     return -1;
                 }
-                client_node = TCPSEG_RB_NEXT(client_node);
+                client_node = StreamTcpSegmentNext(client_stream, client_node);
             } else {
                 StreamingBufferSegmentGetData(
                         &server_stream->sb, &server_node->sbseg, &seg_data, &seg_datalen);
@@ -6509,7 +6662,7 @@ int StreamTcpSegmentForSession(
                     SCLogDebug("Callback function has failed");
                     return -1;
                 }
-                server_node = TCPSEG_RB_NEXT(server_node);
+                server_node = StreamTcpSegmentNext(server_stream, server_node);
             }
         }
 
@@ -37,6 +37,18 @@
 #define STREAMTCP_INIT_FLAG_DROP_INVALID           BIT_U8(1)
 #define STREAMTCP_INIT_FLAG_BYPASS                 BIT_U8(2)
 #define STREAMTCP_INIT_FLAG_INLINE                 BIT_U8(3)
+#define STREAMTCP_INIT_FLAG_AUTO_BYPASS            BIT_U8(4)
+
+/** consumers of the packets of a session. Once all of them are done with
+ *  a session it is bypassed if stream.auto-bypass is enabled. */
+enum StreamTcpConsumer {
+    STREAM_CONSUMER_STREAM = 0, /**< reassembly in both directions */
+    STREAM_CONSUMER_APP_LAYER,
+    STREAM_CONSUMER_FILES,
+    STREAM_CONSUMER_PCAP_LOG,
+    STREAM_CONSUMER_RULES,
+    STREAM_CONSUMER_MAX,
+};
 
 /*global flow data*/
 typedef struct TcpStreamCnf_ {
@@ -82,6 +94,10 @@ typedef struct StreamTcpThread_ {
     uint16_t counter_tcp_sessions;
     /** sessions not picked up because memcap was reached */
     uint16_t counter_tcp_ssn_memcap;
+    /** sessions of this thread's pool in use */
+    uint16_t counter_tcp_ssn_pool_inuse;
+    /** sessions bypassed by stream.auto-bypass, by consumer done last */
+    uint16_t counter_tcp_auto_bypass[STREAM_CONSUMER_MAX];
     /** pseudo packets processed */
     uint16_t counter_tcp_pseudo;
     /** pseudo packets failed to setup */
@@ -121,6 +137,7 @@ int StreamTcpSetMemcap(uint64_t);
 uint64_t StreamTcpGetMemcap(void);
 int StreamTcpCheckMemcap(uint64_t);
 uint64_t StreamTcpMemuseCounter(void);
+uint32_t StreamTcpSsnPoolInUse(int ssn_pool_id);
 uint64_t StreamTcpReassembleMemuseGlobalCounter(void);
 
 Packet *StreamTcpPseudoSetup(Packet *, uint8_t *, uint32_t);
@@ -131,6 +148,8 @@ int StreamTcpSegmentForEach(const Packet *p, uint8_t flag,
 int StreamTcpSegmentForSession(
         const Packet *p, uint8_t flag, StreamSegmentCallback CallbackFunc, void *data);
 void StreamTcpReassembleConfigEnableOverlapCheck(void);
+void StreamTcpReassembleConfigEnableSegmentLess(void);
+bool StreamTcpReassembleIsSegmentLess(void);
 void TcpSessionSetReassemblyDepth(TcpSession *ssn, uint32_t size);
 
 typedef int (*StreamReassembleRawFunc)(
@@ -199,6 +218,7 @@ void StreamTcpSessionCleanup(TcpSession *ssn);
 void StreamTcpStreamCleanup(TcpStream *stream);
 /* check if bypass is enabled */
 int StreamTcpBypassEnabled(void);
+void StreamTcpAutoBypassRegisterPcapLog(bool use_stream_depth);
 int StreamTcpInlineDropInvalid(void);
 int StreamTcpInlineMode(void);
 
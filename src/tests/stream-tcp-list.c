@@ -708,6 +708,69 @@ static int StreamTcpReassembleTest32(void)
     OVERLAP_END;
 }
 
+/** \test in order segments are kept in the list, out of order data moves
+ *        them into the tree until the stream is empty again */
+static int StreamTcpReassembleTest33(void)
+{
+    OVERLAP_START(0, OS_POLICY_BSD);
+    OVERLAP_STEP(1, "AAAAA", 5, "AAAAA", 5);
+    OVERLAP_STEP(6, "BBBBB", 5, "AAAAABBBBB", 10);
+    OVERLAP_STEP(21, "DDDDD", 5, "AAAAABBBBB\0\0\0\0\0\0\0\0\0\0DDDDD", 25);
+    FAIL_IF(STREAM_SEGS_IN_TREE(stream));
+    FAIL_IF_NULL(stream->seg_list_head);
+    FAIL_IF(stream->seg_list_tail->seq != 21);
+    FAIL_IF(stream->segs_right_edge != 26);
+
+    /* fill the gap: moves the segments into the tree */
+    OVERLAP_STEP(11, "CCCCC", 5, "AAAAABBBBBCCCCC\0\0\0\0\0DDDDD", 25);
+    FAIL_IF_NOT(STREAM_SEGS_IN_TREE(stream));
+    FAIL_IF_NOT_NULL(stream->seg_list_head);
+
+    uint32_t expect[] = { 1, 6, 11, 21 };
+    uint32_t cnt = 0;
+    TcpSegment *seg = NULL, *safe = NULL;
+    STREAM_SEG_FOREACH(seg, stream)
+    {
+        FAIL_IF(cnt >= ARRAY_SIZE(expect));
+        FAIL_IF(seg->seq != expect[cnt]);
+        cnt++;
+    }
+    FAIL_IF(cnt != ARRAY_SIZE(expect));
+
+    STREAM_SEG_FOREACH_SAFE(seg, stream, safe)
+    {
+        StreamTcpRemoveSegmentFromStream(stream, seg);
+        StreamTcpSegmentReturntoPool(seg);
+    }
+    FAIL_IF_NOT(STREAM_SEGS_EMPTY(stream));
+
+    /* empty again, so new data goes into the list */
+    OVERLAP_STEP(26, "EEEEE", 5, "AAAAABBBBBCCCCC\0\0\0\0\0DDDDDEEEEE", 30);
+    FAIL_IF(STREAM_SEGS_IN_TREE(stream));
+    FAIL_IF(stream->seg_list_head != stream->seg_list_tail);
+    OVERLAP_END;
+}
+
+/** \test segment-less mode: data goes into the holes of the streaming
+ *        buffer, already present data wins, no segments are created */
+static int StreamTcpReassembleTest34(void)
+{
+    OVERLAP_START(0, OS_POLICY_BSD);
+    segment_less = true;
+    FAIL_IF_NOT(StreamTcpReassembleIsSegmentLess());
+
+    OVERLAP_STEP(1, "AAAAA", 5, "AAAAA", 5);
+    OVERLAP_STEP(11, "CCCCC", 5, "AAAAA\0\0\0\0\0CCCCC", 15);
+    OVERLAP_STEP(6, "BBBBB", 5, "AAAAABBBBBCCCCC", 15);
+    OVERLAP_STEP(3, "xxxxxx", 6, "AAAAABBBBBCCCCC", 15);
+    OVERLAP_STEP(14, "123456", 6, "AAAAABBBBBCCCCC3456", 19);
+    FAIL_IF_NOT(STREAM_SEGS_EMPTY(stream));
+    FAIL_IF(stream->segs_right_edge != 20);
+
+    segment_less = false;
+    OVERLAP_END;
+}
+
 void StreamTcpListRegisterTests(void)
 {
     UtRegisterTest("StreamTcpReassembleTest01 -- BSD policy",
@@ -729,5 +792,7 @@ void StreamTcpListRegisterTests(void)
             StreamTcpReassembleTest31);
     UtRegisterTest("StreamTcpReassembleTest32",
             StreamTcpReassembleTest32);
+    UtRegisterTest("StreamTcpReassembleTest33", StreamTcpReassembleTest33);
+    UtRegisterTest("StreamTcpReassembleTest34", StreamTcpReassembleTest34);
 
 }
@@ -646,9 +646,9 @@ static int StreamTcpTest09(void)
 
     TcpSession *ssn = p->flow->protoctx;
     FAIL_IF_NULL(ssn);
-    TcpSegment *seg = RB_MIN(TCPSEG, &ssn->client.seg_tree);
+    TcpSegment *seg = StreamTcpSegmentFirst(&ssn->client);
     FAIL_IF_NULL(seg);
-    FAIL_IF(TCPSEG_RB_NEXT(seg) != NULL);
+    FAIL_IF(StreamTcpSegmentNext(&ssn->client, seg) != NULL);
 
     StreamTcpSessionClear(p->flow->protoctx);
     SCFree(p);
@@ -2279,7 +2279,7 @@ static int StreamTcpTest23(void)
 
     FAIL_IF(StreamTcpReassembleHandleSegment(&tv, stt.ra_ctx, &ssn, &ssn.client, p, &pq) == -1);
 
-    TcpSegment *seg = RB_MAX(TCPSEG, &ssn.client.seg_tree);
+    TcpSegment *seg = StreamTcpSegmentLast(&ssn.client);
     FAIL_IF_NULL(seg);
     FAIL_IF(TCP_SEG_LEN(seg) != 2);
 
@@ -2287,7 +2287,7 @@ static int StreamTcpTest23(void)
     SCFree(p);
     FLOW_DESTROY(&f);
     StreamTcpUTDeinit(stt.ra_ctx);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) > 0);
+    FAIL_IF(StreamTcpMemuseCounter() > 0);
     PASS;
 }
 
@@ -2344,7 +2344,7 @@ static int StreamTcpTest24(void)
 
     FAIL_IF(StreamTcpReassembleHandleSegment(&tv, stt.ra_ctx, &ssn, &ssn.client, p, &pq) == -1);
 
-    TcpSegment *seg = RB_MAX(TCPSEG, &ssn.client.seg_tree);
+    TcpSegment *seg = StreamTcpSegmentLast(&ssn.client);
     FAIL_IF_NULL(seg);
     FAIL_IF(TCP_SEG_LEN(seg) != 4);
 
@@ -2352,7 +2352,7 @@ static int StreamTcpTest24(void)
     SCFree(p);
     FLOW_DESTROY(&f);
     StreamTcpUTDeinit(stt.ra_ctx);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) > 0);
+    FAIL_IF(StreamTcpMemuseCounter() > 0);
     PASS;
 }
 
@@ -2637,13 +2637,13 @@ static int StreamTcpTest28(void)
     StreamTcpThread stt;
     StreamTcpUTInit(&stt.ra_ctx);
 
-    uint32_t memuse = SC_ATOMIC_GET(st_memuse);
+    uint32_t memuse = StreamTcpMemuseCounter();
 
     StreamTcpIncrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) != (memuse + 500));
+    FAIL_IF(StreamTcpMemuseCounter() != (memuse + 500));
 
     StreamTcpDecrMemuse(500);
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) != memuse);
+    FAIL_IF(StreamTcpMemuseCounter() != memuse);
 
     FAIL_IF(StreamTcpCheckMemcap(500) != 1);
 
@@ -2651,7 +2651,7 @@ static int StreamTcpTest28(void)
 
     StreamTcpUTDeinit(stt.ra_ctx);
 
-    FAIL_IF(SC_ATOMIC_GET(st_memuse) != 0);
+    FAIL_IF(StreamTcpMemuseCounter() != 0);
     PASS;
 }
 
@@ -4272,6 +4272,50 @@ end:
     return ret;
 }
 
+/** \test auto-bypass consumer tracking */
+static int StreamTcpTest46(void)
+{
+    Flow f;
+    TcpSession ssn;
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+    p->flow = &f;
+    const int pcap_log = auto_bypass_pcap_log;
+    const int detect_disabled = g_detect_disabled;
+    auto_bypass_pcap_log = 1;
+    g_detect_disabled = 0;
+
+    /* one direction done: nothing is done */
+    ssn.client.flags |= STREAMTCP_STREAM_FLAG_DEPTH_REACHED;
+    FAIL_IF_NOT(StreamTcpConsumersUpdate(&ssn, p) == -1);
+    FAIL_IF_NOT(ssn.consumers_done == 0);
+
+    /* both done: all but the rules are done, as there are no sghs yet */
+    ssn.server.flags |= STREAMTCP_STREAM_FLAG_NOREASSEMBLY;
+    FAIL_IF_NOT(StreamTcpConsumersUpdate(&ssn, p) == -1);
+    FAIL_IF_NOT(ssn.consumers_done == (STREAM_CONSUMERS_ALL & ~BIT_U8(STREAM_CONSUMER_RULES)));
+
+    /* without rules the rules were done last */
+    g_detect_disabled = 1;
+    FAIL_IF_NOT(StreamTcpConsumersUpdate(&ssn, p) == STREAM_CONSUMER_RULES);
+    FAIL_IF_NOT(ssn.consumers_done == STREAM_CONSUMERS_ALL);
+    /* reported only once */
+    FAIL_IF_NOT(StreamTcpConsumersUpdate(&ssn, p) == -1);
+
+    /* pcap-log logging all packets is never done */
+    auto_bypass_pcap_log = 2;
+    ssn.consumers_done = 0;
+    FAIL_IF_NOT(StreamTcpConsumersUpdate(&ssn, p) == -1);
+    FAIL_IF(ssn.consumers_done & BIT_U8(STREAM_CONSUMER_PCAP_LOG));
+
+    auto_bypass_pcap_log = pcap_log;
+    g_detect_disabled = detect_disabled;
+    SCFree(p);
+    PASS;
+}
+
 void StreamTcpRegisterTests(void)
 {
     UtRegisterTest("StreamTcpTest01 -- TCP session allocation", StreamTcpTest01);
@@ -4329,6 +4373,7 @@ void StreamTcpRegisterTests(void)
     UtRegisterTest("StreamTcpTest43 -- SYN/ACK queue", StreamTcpTest43);
     UtRegisterTest("StreamTcpTest44 -- SYN/ACK queue", StreamTcpTest44);
     UtRegisterTest("StreamTcpTest45 -- SYN/ACK queue", StreamTcpTest45);
+    UtRegisterTest("StreamTcpTest46 -- auto-bypass consumers", StreamTcpTest46);
 
     /* set up the reassembly tests as well */
     StreamTcpReassembleRegisterTests();
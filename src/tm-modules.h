@@ -51,6 +51,11 @@ typedef struct TmModule_ {
     /** the packet processing function */
     TmEcode (*Func)(ThreadVars *, Packet *, void *);
 
+    /** optional: process a batch of packets at once. Used for the
+     *  packets a capture module hands over together, Func is used
+     *  for all others. */
+    TmEcode (*FuncBatch)(ThreadVars *, Packet **, uint32_t, void *);
+
     TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
 
     /** terminates the capture loop in PktAcqLoop */
@@ -36,6 +36,7 @@ enum {
 typedef struct Tmqh_ {
     const char *name;
     Packet *(*InHandler)(ThreadVars *);
+    void (*InThreadInitHandler)(ThreadVars *);
     void (*InShutdownHandler)(ThreadVars *);
     void (*OutHandler)(ThreadVars *, Packet *);
     void *(*OutHandlerCtxSetup)(const char *);
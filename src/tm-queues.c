@@ -26,6 +26,7 @@
 #include "suricata.h"
 #include "threads.h"
 #include "tm-queues.h"
+#include "tmqh-flow.h"
 #include "util-debug.h"
 
 static TAILQ_HEAD(TmqList_, Tmq_) tmq_list = TAILQ_HEAD_INITIALIZER(tmq_list);
@@ -89,6 +90,9 @@ void TmqResetQueues(void)
         if (tmq->pq) {
             PacketQueueFree(tmq->pq);
         }
+        if (tmq->rings) {
+            TmqhFlowRingsFree(tmq->rings);
+        }
         SCFree(tmq);
     }
     tmq_id = 0;
@@ -113,6 +117,11 @@ void TmValidateQueueState(void)
             SCLogError(SC_ERR_THREAD_QUEUE, "queue \"%s\" doesn't have a writer (id %d, max %u)",
                     tmq->name, tmq->id, tmq_id);
             err = true;
+        } else if (tmq->rings != NULL && tmq->reader_cnt > 1) {
+            SCLogError(SC_ERR_THREAD_QUEUE,
+                    "queue \"%s\" uses rings but has %u readers, only one is supported",
+                    tmq->name, tmq->reader_cnt);
+            err = true;
         }
         SCMutexUnlock(&tmq->pq->mutex_q);
 
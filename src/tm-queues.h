@@ -33,6 +33,7 @@ typedef struct Tmq_ {
     uint16_t reader_cnt;
     uint16_t writer_cnt;
     PacketQueue *pq;
+    struct TmqhFlowRings_ *rings; /**< autofp producer rings, if enabled */
     TAILQ_ENTRY(Tmq_) next;
 } Tmq;
 
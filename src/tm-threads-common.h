@@ -53,6 +53,8 @@ typedef enum {
     TMM_DECODEERFDAG,
     TMM_RECEIVEAFP,
     TMM_DECODEAFP,
+    TMM_RECEIVEAFXDP,
+    TMM_DECODEAFXDP,
     TMM_RECEIVEDPDK,
     TMM_DECODEDPDK,
     TMM_RECEIVENETMAP,
@@ -34,10 +34,12 @@
 #include "tm-queuehandlers.h"
 #include "tm-threads.h"
 #include "tmqh-packetpool.h"
+#include "tmqh-flow.h"
 #include "threads.h"
 #include "util-debug.h"
 #include "util-privs.h"
 #include "util-cpu.h"
+#include "util-numa.h"
 #include "util-optimize.h"
 #include "util-profiling.h"
 #include "util-signal.h"
@@ -145,6 +147,120 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p, TmSlot *slot)
     return TM_ECODE_OK;
 }
 
+/** \internal
+ *  \brief get the index of the batch packet an extra packet was created for
+ *
+ *  Tunnel and defrag packets point to the packet they came from through
+ *  their root. Extras are queued in batch order, so the search starts at
+ *  the packet of the previous extra.
+ */
+static uint32_t TmThreadsBatchExtraOwner(
+        Packet **ps, const uint32_t cnt, const uint32_t from, const Packet *extra_p)
+{
+    for (uint32_t i = from; i < cnt; i++) {
+        if (ps[i] == extra_p->root)
+            return i;
+    }
+    return cnt - 1;
+}
+
+/** \internal
+ *  \brief run the batch and the packets slot 's' created through the
+ *         remaining slots
+ *
+ *  Keeps the order of TmThreadsSlotVarRun: the extras of a packet run
+ *  through the remaining slots after the packets before it and before
+ *  the packet itself. The batch is split up around the packets that have
+ *  extras for this.
+ */
+static TmEcode TmThreadsSlotVarRunBatchExtras(
+        ThreadVars *tv, Packet **ps, uint32_t cnt, TmSlot *s)
+{
+    /* take the extras of the whole batch, as running an extra through
+     * the next slots can queue new ones */
+    PacketQueueNoLock extras = tv->decode_pq;
+    memset(&tv->decode_pq, 0, sizeof(tv->decode_pq));
+
+    /* first packet not yet run through the remaining slots */
+    uint32_t start = 0;
+    Packet *extra_p;
+    while ((extra_p = PacketDequeueNoLock(&extras)) != NULL) {
+        const uint32_t owner = TmThreadsBatchExtraOwner(ps, cnt, start, extra_p);
+        if (s->slot_next != NULL) {
+            if (owner > start) {
+                TmEcode r = TmThreadsSlotVarRunBatch(tv, ps + start, owner - start, s->slot_next);
+                if (unlikely(r == TM_ECODE_FAILED)) {
+                    TmqhOutputPacketpool(tv, extra_p);
+                    TmThreadsCleanDecodePQ(&extras);
+                    return TM_ECODE_FAILED;
+                }
+            }
+            TmEcode r = TmThreadsSlotVarRun(tv, extra_p, s->slot_next);
+            if (unlikely(r == TM_ECODE_FAILED)) {
+                TmThreadsSlotProcessPktFail(tv, s, extra_p);
+                TmThreadsCleanDecodePQ(&extras);
+                return TM_ECODE_FAILED;
+            }
+        }
+        start = owner;
+        tv->tmqh_out(tv, extra_p);
+    }
+
+    if (s->slot_next != NULL)
+        return TmThreadsSlotVarRunBatch(tv, ps + start, cnt - start, s->slot_next);
+    return TM_ECODE_OK;
+}
+
+/**
+ *  \brief Run a batch of packets through the slots, starting at 'slot'.
+ *
+ *  Each slot handles the whole batch before the next one runs, through
+ *  its batch function if it has one and otherwise packet by packet. If
+ *  a slot creates packets (tunnel, defrag), each of these runs through
+ *  the remaining slots right before the packet it was created for, as in
+ *  TmThreadsSlotVarRun.
+ *
+ *  The batch functions are bypassed when per packet profiling is
+ *  enabled, so the ticks are still accounted per packet and module.
+ *
+ *  On failure the packets of the batch are left to the caller.
+ */
+TmEcode TmThreadsSlotVarRunBatch(ThreadVars *tv, Packet **ps, uint32_t cnt, TmSlot *slot)
+{
+    for (TmSlot *s = slot; s != NULL; s = s->slot_next) {
+        void *slot_data = SC_ATOMIC_GET(s->slot_data);
+        TmEcode r = TM_ECODE_OK;
+
+#ifdef PROFILING
+        if (s->SlotFuncBatch != NULL && !profiling_packets_enabled) {
+#else
+        if (s->SlotFuncBatch != NULL) {
+#endif
+            r = s->SlotFuncBatch(tv, ps, cnt, slot_data);
+        } else {
+            for (uint32_t i = 0; i < cnt; i++) {
+                PACKET_PROFILING_TMM_START(ps[i], s->tm_id);
+                r = s->SlotFunc(tv, ps[i], slot_data);
+                PACKET_PROFILING_TMM_END(ps[i], s->tm_id);
+                if (unlikely(r == TM_ECODE_FAILED))
+                    break;
+            }
+        }
+
+        /* handle error */
+        if (unlikely(r == TM_ECODE_FAILED)) {
+            TmThreadsSlotProcessPktFail(tv, s, NULL);
+            return TM_ECODE_FAILED;
+        }
+
+        /* handle new packets, this runs the rest of the slots */
+        if (tv->decode_pq.top != NULL)
+            return TmThreadsSlotVarRunBatchExtras(tv, ps, cnt, s);
+    }
+
+    return TM_ECODE_OK;
+}
+
 /** \internal
  *
  *  \brief Process flow timeout packets
@@ -425,6 +541,13 @@ static void *TmThreadsSlotVar(void *td)
         }
     }
 
+    if (tv->inq_id != TMQH_NOT_SET) {
+        Tmqh *qh = TmqhGetQueueHandlerByID(tv->inq_id);
+        if (qh != NULL && qh->InThreadInitHandler != NULL) {
+            qh->InThreadInitHandler(tv);
+        }
+    }
+
     StatsSetupPrivate(tv);
 
     TmThreadsSetFlag(tv, THV_INIT_DONE);
@@ -636,6 +759,7 @@ void TmSlotSetFuncAppend(ThreadVars *tv, TmModule *tm, const void *data)
     slot->slot_initdata = data;
     if (tm->Func) {
         slot->SlotFunc = tm->Func;
+        slot->SlotFuncBatch = tm->FuncBatch;
     } else if (tm->PktAcqLoop) {
         slot->PktAcqLoop = tm->PktAcqLoop;
         if (tm->PktAcqBreakLoop) {
@@ -836,6 +960,8 @@ TmEcode TmThreadSetupOptions(ThreadVars *tv)
                   "%"PRIu16", thread id %lu", tv->name, tv->cpu_affinity,
                   SCGetThreadIdLong());
         SetCPUAffinity(tv->cpu_affinity);
+        tv->numa_node = UtilNumaGetNodeOfCpu(tv->cpu_affinity);
+        UtilNumaSetThreadNode(tv->numa_node);
     }
 
 #if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__ && !defined sun
@@ -846,6 +972,8 @@ TmEcode TmThreadSetupOptions(ThreadVars *tv)
         if (taf->mode_flag == EXCLUSIVE_AFFINITY) {
             uint16_t cpu = AffinityGetNextCPU(taf);
             SetCPUAffinity(cpu);
+            tv->numa_node = UtilNumaGetNodeOfCpu(cpu);
+            UtilNumaSetThreadNode(tv->numa_node);
             /* If CPU is in a set overwrite the default thread prio */
             if (CPU_ISSET(cpu, &taf->lowprio_cpu)) {
                 tv->thread_priority = PRIO_LOW;
@@ -903,6 +1031,7 @@ ThreadVars *TmThreadCreate(const char *name, const char *inq_name, const char *i
     if (unlikely(tv == NULL))
         goto error;
     memset(tv, 0, sizeof(ThreadVars));
+    tv->numa_node = -1;
 
     SC_ATOMIC_INIT(tv->flags);
     SCMutexInit(&tv->perf_public_ctx.m, NULL);
@@ -1178,6 +1307,9 @@ static bool ThreadStillHasPackets(ThreadVars *tv)
         if (len != 0) {
             return true;
         }
+        if (tv->inq->rings != NULL && TmqhFlowRingsPending(tv->inq->rings) != 0) {
+            return true;
+        }
     }
 
     if (tv->stream_pq != NULL) {
@@ -2248,3 +2380,171 @@ void TmThreadsInjectFlowById(Flow *f, const int id)
         ThreadBreakLoop(tv);
     }
 }
+
+#ifdef UNITTESTS
+#include "util-unittest.h"
+
+#define TM_THREADS_TEST_PKTS 8
+
+/** packets in the order the last slot saw them, with their root, as
+ *  the extras are freed once they are done */
+static Packet *tm_threads_test_seen[TM_THREADS_TEST_PKTS];
+static Packet *tm_threads_test_seen_root[TM_THREADS_TEST_PKTS];
+static uint32_t tm_threads_test_seen_cnt = 0;
+
+/** extras created by the first slot, indexed by the batch packet */
+static uint32_t tm_threads_test_extras[TM_THREADS_TEST_PKTS];
+
+static TmEcode TmThreadsTestDecode(ThreadVars *tv, Packet *p, void *data)
+{
+    Packet **ps = data;
+    for (uint32_t i = 0; i < TM_THREADS_TEST_PKTS; i++) {
+        if (ps[i] != p)
+            continue;
+        for (uint32_t e = 0; e < tm_threads_test_extras[i]; e++) {
+            Packet *extra_p = PacketGetFromAlloc();
+            if (extra_p == NULL)
+                return TM_ECODE_FAILED;
+            extra_p->root = p;
+            PacketEnqueueNoLock(&tv->decode_pq, extra_p);
+        }
+    }
+    return TM_ECODE_OK;
+}
+
+static TmEcode TmThreadsTestDecodeBatch(ThreadVars *tv, Packet **ps, uint32_t cnt, void *data)
+{
+    for (uint32_t i = 0; i < cnt; i++) {
+        if (TmThreadsTestDecode(tv, ps[i], data) != TM_ECODE_OK)
+            return TM_ECODE_FAILED;
+    }
+    return TM_ECODE_OK;
+}
+
+static TmEcode TmThreadsTestLog(ThreadVars *tv, Packet *p, void *data)
+{
+    if (tm_threads_test_seen_cnt == TM_THREADS_TEST_PKTS)
+        return TM_ECODE_FAILED;
+    tm_threads_test_seen_root[tm_threads_test_seen_cnt] = p->root;
+    tm_threads_test_seen[tm_threads_test_seen_cnt++] = p;
+    return TM_ECODE_OK;
+}
+
+static void TmThreadsTestOut(ThreadVars *tv, Packet *p)
+{
+    if (p->root != NULL)
+        PacketFree(p);
+}
+
+/** \internal
+ *  \brief run a batch of 4 packets where the 2nd and 4th create extras
+ *
+ *  \param batch use the batch function of the first slot
+ */
+static int TmThreadsTestBatchExtras(bool batch)
+{
+    ThreadVars tv;
+    TmSlot decode, log;
+    Packet *ps[TM_THREADS_TEST_PKTS];
+
+    memset(&tv, 0, sizeof(tv));
+    memset(&decode, 0, sizeof(decode));
+    memset(&log, 0, sizeof(log));
+    memset(ps, 0, sizeof(ps));
+    memset(tm_threads_test_extras, 0, sizeof(tm_threads_test_extras));
+    tm_threads_test_seen_cnt = 0;
+    tv.tmqh_out = TmThreadsTestOut;
+
+    decode.SlotFunc = TmThreadsTestDecode;
+    if (batch)
+        decode.SlotFuncBatch = TmThreadsTestDecodeBatch;
+    SC_ATOMIC_INIT(decode.slot_data);
+    SC_ATOMIC_SET(decode.slot_data, (void *)ps);
+    decode.slot_next = &log;
+    log.SlotFunc = TmThreadsTestLog;
+    SC_ATOMIC_INIT(log.slot_data);
+
+    for (int i = 0; i < 4; i++) {
+        ps[i] = PacketGetFromAlloc();
+        FAIL_IF_NULL(ps[i]);
+    }
+    tm_threads_test_extras[1] = 1;
+    tm_threads_test_extras[3] = 2;
+
+    FAIL_IF(TmThreadsSlotVarRunBatch(&tv, ps, 4, &decode) != TM_ECODE_OK);
+    FAIL_IF_NOT_NULL(tv.decode_pq.top);
+
+    /* extras run right before the packet they were created for */
+    FAIL_IF_NOT(tm_threads_test_seen_cnt == 7);
+    FAIL_IF_NOT(tm_threads_test_seen[0] == ps[0]);
+    FAIL_IF_NOT(tm_threads_test_seen_root[1] == ps[1]);
+    FAIL_IF_NOT(tm_threads_test_seen[2] == ps[1]);
+    FAIL_IF_NOT(tm_threads_test_seen[3] == ps[2]);
+    FAIL_IF_NOT(tm_threads_test_seen_root[4] == ps[3]);
+    FAIL_IF_NOT(tm_threads_test_seen_root[5] == ps[3]);
+    FAIL_IF_NOT(tm_threads_test_seen[6] == ps[3]);
+
+    for (int i = 0; i < 4; i++) {
+        PacketFree(ps[i]);
+    }
+    PASS;
+}
+
+/** \test extras of a slot running packet by packet */
+static int TmThreadsTestBatch01(void)
+{
+    return TmThreadsTestBatchExtras(false);
+}
+
+/** \test extras of a slot with a batch function */
+static int TmThreadsTestBatch02(void)
+{
+    return TmThreadsTestBatchExtras(true);
+}
+
+/** \test a batch without extras runs slot by slot, in batch order */
+static int TmThreadsTestBatch03(void)
+{
+    ThreadVars tv;
+    TmSlot decode, log;
+    Packet *ps[TM_THREADS_TEST_PKTS];
+
+    memset(&tv, 0, sizeof(tv));
+    memset(&decode, 0, sizeof(decode));
+    memset(&log, 0, sizeof(log));
+    memset(ps, 0, sizeof(ps));
+    memset(tm_threads_test_extras, 0, sizeof(tm_threads_test_extras));
+    tm_threads_test_seen_cnt = 0;
+    tv.tmqh_out = TmThreadsTestOut;
+
+    decode.SlotFunc = TmThreadsTestDecode;
+    decode.SlotFuncBatch = TmThreadsTestDecodeBatch;
+    SC_ATOMIC_INIT(decode.slot_data);
+    SC_ATOMIC_SET(decode.slot_data, (void *)ps);
+    decode.slot_next = &log;
+    log.SlotFunc = TmThreadsTestLog;
+    SC_ATOMIC_INIT(log.slot_data);
+
+    for (int i = 0; i < 3; i++) {
+        ps[i] = PacketGetFromAlloc();
+        FAIL_IF_NULL(ps[i]);
+    }
+
+    FAIL_IF(TmThreadsSlotVarRunBatch(&tv, ps, 3, &decode) != TM_ECODE_OK);
+    FAIL_IF_NOT(tm_threads_test_seen_cnt == 3);
+    for (int i = 0; i < 3; i++) {
+        FAIL_IF_NOT(tm_threads_test_seen[i] == ps[i]);
+        PacketFree(ps[i]);
+    }
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void TmThreadsRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("TmThreadsTestBatch01", TmThreadsTestBatch01);
+    UtRegisterTest("TmThreadsTestBatch02", TmThreadsTestBatch02);
+    UtRegisterTest("TmThreadsTestBatch03", TmThreadsTestBatch03);
+#endif /* UNITTESTS */
+}
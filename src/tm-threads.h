@@ -48,6 +48,7 @@ static inline void SleepUsec(uint64_t usec)
 #define TM_THREAD_NAME_MAX 16
 
 typedef TmEcode (*TmSlotFunc)(ThreadVars *, Packet *, void *);
+typedef TmEcode (*TmSlotBatchFunc)(ThreadVars *, Packet **, uint32_t, void *);
 
 typedef struct TmSlot_ {
     /* function pointers */
@@ -56,6 +57,9 @@ typedef struct TmSlot_ {
         TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
         TmEcode (*Management)(ThreadVars *, void *);
     };
+    /** optional batch version of SlotFunc */
+    TmSlotBatchFunc SlotFuncBatch;
+
     /** linked list of slots, used when a pipeline has multiple slots
      *  in a single thread. */
     struct TmSlot_ *slot_next;
@@ -116,6 +120,8 @@ void TmThreadsUnsetFlag(ThreadVars *, uint32_t);
 void TmThreadWaitForFlag(ThreadVars *, uint32_t);
 
 TmEcode TmThreadsSlotVarRun (ThreadVars *tv, Packet *p, TmSlot *slot);
+TmEcode TmThreadsSlotVarRunBatch(ThreadVars *tv, Packet **ps, uint32_t cnt, TmSlot *slot);
+void TmThreadsRegisterTests(void);
 
 void TmThreadDisablePacketThreads(void);
 void TmThreadDisableReceiveThreads(void);
@@ -198,6 +204,42 @@ static inline TmEcode TmThreadsSlotProcessPkt(ThreadVars *tv, TmSlot *s, Packet
     return TM_ECODE_OK;
 }
 
+/**
+ *  \brief Process a batch of packets handed over by a capture module.
+ *
+ *  Like TmThreadsSlotProcessPkt, but each slot processes the whole
+ *  batch before the next slot runs. On failure all packets of the
+ *  batch are returned to the pool.
+ *
+ *  \param ps array of cnt packets, owned by the pipeline after the call
+ */
+static inline TmEcode TmThreadsSlotProcessPktBatch(
+        ThreadVars *tv, TmSlot *s, Packet **ps, uint32_t cnt)
+{
+    if (cnt == 0)
+        return TM_ECODE_OK;
+
+    if (s != NULL) {
+        TmEcode r = TmThreadsSlotVarRunBatch(tv, ps, cnt, s);
+        if (unlikely(r == TM_ECODE_FAILED)) {
+            for (uint32_t i = 0; i < cnt; i++) {
+                TmqhOutputPacketpool(tv, ps[i]);
+            }
+            TmThreadsSlotProcessPktFail(tv, s, NULL);
+            return TM_ECODE_FAILED;
+        }
+    }
+
+    for (uint32_t i = 0; i < cnt; i++) {
+        tv->tmqh_out(tv, ps[i]);
+    }
+
+    if (s != NULL)
+        TmThreadsHandleInjectedPackets(tv);
+
+    return TM_ECODE_OK;
+}
+
 /** \brief inject packet if THV_CAPTURE_INJECT_PKT is set
  *  Allow caller to supply their own packet
  *
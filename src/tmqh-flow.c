@@ -35,11 +35,24 @@
 #include "tmqh-flow.h"
 
 #include "tm-queuehandlers.h"
+#include "tm-threads.h"
 
 #include "conf.h"
 #include "util-unittest.h"
 
+/* spin budget of the ring consumer before it goes to sleep */
+#define TMQH_FLOW_SPIN_MIN 64
+#define TMQH_FLOW_SPIN_MAX 8192
+
+extern intmax_t max_pending_packets;
+
+/** use per producer rings instead of the locked queue */
+static bool tmqh_flow_rings = false;
+static SCMutex tmqh_flow_rings_lock = SCMUTEX_INITIALIZER;
+
 Packet *TmqhInputFlow(ThreadVars *t);
+Packet *TmqhInputFlowRing(ThreadVars *t);
+void TmqhInputFlowRingThreadInit(ThreadVars *t);
 void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
 void TmqhOutputFlowIPPair(ThreadVars *t, Packet *p);
 void *TmqhOutputFlowSetupCtx(const char *queue_str);
@@ -76,6 +89,22 @@ void TmqhFlowRegister(void)
         tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
     }
 
+    const char *mode = NULL;
+    if (ConfGet("autofp-queue-mode", &mode) == 1) {
+        if (strcasecmp(mode, "ring") == 0) {
+            tmqh_flow_rings = true;
+        } else if (strcasecmp(mode, "mutex") != 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
+                       "for autofp-queue-mode in conf.  Killing engine.",
+                       mode);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (tmqh_flow_rings) {
+        tmqh_table[TMQH_FLOW].InHandler = TmqhInputFlowRing;
+        tmqh_table[TMQH_FLOW].InThreadInitHandler = TmqhInputFlowRingThreadInit;
+    }
+
     return;
 }
 
@@ -89,6 +118,197 @@ void TmqhFlowPrintAutofpHandler(void)
     PRINT_IF_FUNC(TmqhOutputFlowIPPair, "IPPair");
 
 #undef PRINT_IF_FUNC
+
+    if (tmqh_flow_rings)
+        SCLogConfig("AutoFP mode using per thread rings for its queues");
+}
+
+static inline void TmqhFlowPause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+static TmqhFlowRings *TmqhFlowRingsGet(Tmq *tmq)
+{
+    SCMutexLock(&tmqh_flow_rings_lock);
+    if (tmq->rings == NULL) {
+        TmqhFlowRings *rs = SCMallocAligned(sizeof(*rs), CLS);
+        if (rs != NULL) {
+            memset(rs, 0, sizeof(*rs));
+            SC_ATOMIC_INIT(rs->cnt);
+            SC_ATOMIC_INIT(rs->sleeping);
+            SC_ATOMIC_INIT(rs->batch_left);
+            rs->spin = TMQH_FLOW_SPIN_MIN;
+            tmq->rings = rs;
+        }
+    }
+    SCMutexUnlock(&tmqh_flow_rings_lock);
+    return tmq->rings;
+}
+
+/** \brief add a producer ring to a queue
+ *
+ *  \retval r ring or NULL if the queue has no room for more producers
+ */
+static PacketRing *TmqhFlowRingsRegister(TmqhFlowRings *rs)
+{
+    PacketRing *r = NULL;
+
+    SCMutexLock(&tmqh_flow_rings_lock);
+    const uint16_t cnt = SC_ATOMIC_GET(rs->cnt);
+    if (cnt < TMQH_FLOW_RINGS_MAX) {
+        /* room for all packets of the producer and some pseudo packets */
+        r = PacketRingAlloc((uint32_t)max_pending_packets + TMQH_FLOW_BATCH);
+        if (r != NULL) {
+            rs->rings[cnt] = r;
+            /* the consumer may already be running, publish after the store */
+            SC_ATOMIC_SET(rs->cnt, cnt + 1);
+        }
+    }
+    SCMutexUnlock(&tmqh_flow_rings_lock);
+    return r;
+}
+
+/** \brief number of packets waiting in the rings of a queue */
+uint32_t TmqhFlowRingsPending(TmqhFlowRings *rs)
+{
+    uint32_t len = SC_ATOMIC_GET(rs->batch_left);
+    const uint16_t cnt = SC_ATOMIC_GET(rs->cnt);
+    for (uint16_t i = 0; i < cnt; i++) {
+        len += PacketRingLen(rs->rings[i]);
+    }
+    return len;
+}
+
+void TmqhFlowRingsFree(TmqhFlowRings *rs)
+{
+    const uint16_t cnt = SC_ATOMIC_GET(rs->cnt);
+    for (uint16_t i = 0; i < cnt; i++) {
+        PacketRingFree(rs->rings[i]);
+    }
+    SCFreeAligned(rs);
+}
+
+/** \internal
+ *  \brief get the next packet from the batch, refilling it from the rings
+ *
+ *  Each refill starts at the next ring so that a busy producer can't
+ *  starve the others.
+ */
+static Packet *TmqhFlowRingsNext(TmqhFlowRings *rs)
+{
+    if (rs->batch_idx == rs->batch_cnt) {
+        const uint16_t cnt = SC_ATOMIC_GET(rs->cnt);
+        if (cnt == 0)
+            return NULL;
+        if (rs->next >= cnt)
+            rs->next = 0;
+
+        uint32_t n = 0;
+        for (uint16_t i = 0, idx = rs->next; i < cnt && n < TMQH_FLOW_BATCH; i++) {
+            n += PacketRingDequeueBatch(rs->rings[idx], rs->batch + n, TMQH_FLOW_BATCH - n);
+            if (++idx == cnt)
+                idx = 0;
+        }
+        rs->next++;
+        rs->batch_idx = 0;
+        rs->batch_cnt = n;
+        if (n == 0) {
+            return NULL;
+        }
+    }
+
+    Packet *p = rs->batch[rs->batch_idx++];
+    SC_ATOMIC_STORE_EXPLICIT(rs->batch_left, rs->batch_cnt - rs->batch_idx,
+            SC_ATOMIC_MEMORY_ORDER_RELAXED);
+    return p;
+}
+
+/** \internal
+ *  \brief get a packet from the rings or the locked queue w/o blocking */
+static Packet *TmqhFlowRingsPoll(TmqhFlowRings *rs, PacketQueue *q)
+{
+    Packet *p = TmqhFlowRingsNext(rs);
+    if (p != NULL)
+        return p;
+
+    /* packets injected into the locked queue by the rest of the engine.
+     * Reading the len unlocked is only a hint, it's rechecked under
+     * the lock before going to sleep. */
+    if (q->len > 0) {
+        SCMutexLock(&q->mutex_q);
+        p = PacketDequeue(q);
+        SCMutexUnlock(&q->mutex_q);
+    }
+    return p;
+}
+
+void TmqhInputFlowRingThreadInit(ThreadVars *tv)
+{
+    TmqhFlowRings *rs = TmqhFlowRingsGet(tv->inq);
+    if (rs == NULL) {
+        FatalError(SC_ERR_MEM_ALLOC, "failed to alloc autofp rings");
+    }
+    rs->counter_depth = StatsRegisterCounter("autofp.queue_depth", tv);
+    rs->counter_wakeups = StatsRegisterCounter("autofp.wakeups", tv);
+    rs->counter_spin_hits = StatsRegisterCounter("autofp.spin_hits", tv);
+}
+
+/**
+ *  \brief get a packet from the producer rings of our queue
+ *
+ *  When the rings are empty the consumer first spins for a while. The
+ *  spin budget grows when spinning pays off and shrinks when it doesn't.
+ *  After that it sleeps on the queue cond. Producers only signal the
+ *  cond if they see the consumer sleeping.
+ */
+Packet *TmqhInputFlowRing(ThreadVars *tv)
+{
+    PacketQueue *q = tv->inq->pq;
+    TmqhFlowRings *rs = tv->inq->rings;
+
+    /* sample the depth once per stats interval */
+    if (tv->perf_public_ctx.perf_flag == 1)
+        StatsSetUI64(tv, rs->counter_depth, TmqhFlowRingsPending(rs));
+    StatsSyncCountersIfSignalled(tv);
+
+    Packet *p = TmqhFlowRingsPoll(rs, q);
+    if (p != NULL)
+        return p;
+
+    for (uint32_t i = 1; i <= rs->spin; i++) {
+        TmqhFlowPause();
+        if ((i & 0x0f) == 0 && (p = TmqhFlowRingsPoll(rs, q)) != NULL) {
+            StatsIncr(tv, rs->counter_spin_hits);
+            rs->spin = MIN(rs->spin * 2, TMQH_FLOW_SPIN_MAX);
+            return p;
+        }
+    }
+    rs->spin = MAX(rs->spin / 2, TMQH_FLOW_SPIN_MIN);
+
+    SCMutexLock(&q->mutex_q);
+    /* producers check the flag after publishing their packet, so
+     * either they see it set or we see their packet here */
+    SC_ATOMIC_SET(rs->sleeping, true);
+    p = TmqhFlowRingsNext(rs);
+    if (p == NULL && q->len == 0) {
+        SCCondWait(&q->cond_q, &q->mutex_q);
+        StatsIncr(tv, rs->counter_wakeups);
+    }
+    SC_ATOMIC_SET(rs->sleeping, false);
+    if (p == NULL && q->len > 0) {
+        p = PacketDequeue(q);
+    }
+    SCMutexUnlock(&q->mutex_q);
+
+    /* NULL if woken up by a signal */
+    if (p == NULL)
+        p = TmqhFlowRingsNext(rs);
+    return p;
 }
 
 /* same as 'simple' */
@@ -147,6 +367,18 @@ static int StoreQueueId(TmqhFlowCtx *ctx, char *name)
     }
     ctx->queues[ctx->size - 1].q = tmq->pq;
 
+    if (tmqh_flow_rings) {
+        TmqhFlowRings *rs = TmqhFlowRingsGet(tmq);
+        if (rs == NULL)
+            return -1;
+        ctx->queues[ctx->size - 1].rings = rs;
+        ctx->queues[ctx->size - 1].ring = TmqhFlowRingsRegister(rs);
+        if (ctx->queues[ctx->size - 1].ring == NULL) {
+            SCLogWarning(SC_ERR_THREAD_QUEUE,
+                    "queue \"%s\": no ring for producer, using locked queue", name);
+        }
+    }
+
     return 0;
 }
 
@@ -218,6 +450,32 @@ void TmqhOutputFlowFreeCtx(void *ctx)
     return;
 }
 
+static inline void TmqhFlowEnqueue(TmqhFlowMode *m, Packet *p)
+{
+    PacketQueue *q = m->q;
+
+    if (m->ring != NULL) {
+        /* a full ring means the consumer is busy, so it will get to it */
+        for (uint32_t i = 0; !PacketRingEnqueue(m->ring, p); i++) {
+            if (i < TMQH_FLOW_SPIN_MIN)
+                TmqhFlowPause();
+            else
+                SleepUsec(1);
+        }
+        if (SC_ATOMIC_GET(m->rings->sleeping)) {
+            SCMutexLock(&q->mutex_q);
+            SCCondSignal(&q->cond_q);
+            SCMutexUnlock(&q->mutex_q);
+        }
+        return;
+    }
+
+    SCMutexLock(&q->mutex_q);
+    PacketEnqueue(q, p);
+    SCCondSignal(&q->cond_q);
+    SCMutexUnlock(&q->mutex_q);
+}
+
 void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
 {
     uint32_t qid;
@@ -233,13 +491,7 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
             ctx->last = 0;
     }
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
-
-    return;
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
 }
 
 /**
@@ -263,13 +515,7 @@ void TmqhOutputFlowIPPair(ThreadVars *tv, Packet *p)
     }
 
     uint32_t qid = addr_hash % ctx->size;
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
-
-    return;
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
 }
 
 #ifdef UNITTESTS
@@ -370,6 +616,89 @@ static int TmqhOutputFlowSetupCtxTest03(void)
     PASS;
 }
 
+static int TmqhFlowRingTest01(void)
+{
+    Packet pkts[12];
+    Packet *batch[12];
+
+    PacketRing *r = PacketRingAlloc(5);
+    FAIL_IF_NULL(r);
+    FAIL_IF_NOT(r->size == 8);
+
+    for (int i = 0; i < 8; i++) {
+        FAIL_IF_NOT(PacketRingEnqueue(r, &pkts[i]));
+    }
+    FAIL_IF(PacketRingEnqueue(r, &pkts[8]));
+    FAIL_IF_NOT(PacketRingLen(r) == 8);
+
+    FAIL_IF_NOT(PacketRingDequeueBatch(r, batch, 3) == 3);
+    FAIL_IF_NOT(batch[0] == &pkts[0]);
+    FAIL_IF_NOT(batch[2] == &pkts[2]);
+    FAIL_IF_NOT(PacketRingLen(r) == 5);
+
+    /* wraps around the end of the slots */
+    for (int i = 8; i < 11; i++) {
+        FAIL_IF_NOT(PacketRingEnqueue(r, &pkts[i]));
+    }
+    FAIL_IF(PacketRingEnqueue(r, &pkts[11]));
+
+    FAIL_IF_NOT(PacketRingDequeueBatch(r, batch, 12) == 8);
+    for (int i = 0; i < 8; i++) {
+        FAIL_IF_NOT(batch[i] == &pkts[i + 3]);
+    }
+    FAIL_IF_NOT(PacketRingDequeueBatch(r, batch, 12) == 0);
+    FAIL_IF_NOT(PacketRingLen(r) == 0);
+
+    PacketRingFree(r);
+    PASS;
+}
+
+static int TmqhOutputFlowRingsTest01(void)
+{
+    Packet pkts[4];
+
+    TmqResetQueues();
+    tmqh_flow_rings = true;
+
+    /* two producers into the same two queues */
+    TmqhFlowCtx *fctx1 = TmqhOutputFlowSetupCtx("queue1,queue2");
+    FAIL_IF_NULL(fctx1);
+    TmqhFlowCtx *fctx2 = TmqhOutputFlowSetupCtx("queue1,queue2");
+    FAIL_IF_NULL(fctx2);
+
+    Tmq *tmq1 = TmqGetQueueByName("queue1");
+    FAIL_IF_NULL(tmq1);
+    FAIL_IF_NULL(tmq1->rings);
+    FAIL_IF_NOT(SC_ATOMIC_GET(tmq1->rings->cnt) == 2);
+    FAIL_IF_NOT(fctx1->queues[0].ring == tmq1->rings->rings[0]);
+    FAIL_IF_NOT(fctx2->queues[0].ring == tmq1->rings->rings[1]);
+
+    TmqhFlowEnqueue(&fctx2->queues[0], &pkts[0]);
+    TmqhFlowEnqueue(&fctx1->queues[0], &pkts[1]);
+    TmqhFlowEnqueue(&fctx2->queues[0], &pkts[2]);
+    TmqhFlowEnqueue(&fctx1->queues[1], &pkts[3]);
+    FAIL_IF_NOT(tmq1->pq->len == 0);
+    FAIL_IF_NOT(TmqhFlowRingsPending(tmq1->rings) == 3);
+
+    /* one batch takes from all rings, each ring stays in order */
+    FAIL_IF_NOT(TmqhFlowRingsNext(tmq1->rings) == &pkts[1]);
+    FAIL_IF_NOT(TmqhFlowRingsPending(tmq1->rings) == 2);
+    FAIL_IF_NOT(TmqhFlowRingsNext(tmq1->rings) == &pkts[0]);
+    FAIL_IF_NOT(TmqhFlowRingsNext(tmq1->rings) == &pkts[2]);
+    FAIL_IF_NOT(TmqhFlowRingsNext(tmq1->rings) == NULL);
+    FAIL_IF_NOT(TmqhFlowRingsPending(tmq1->rings) == 0);
+
+    Tmq *tmq2 = TmqGetQueueByName("queue2");
+    FAIL_IF_NULL(tmq2);
+    FAIL_IF_NOT(TmqhFlowRingsNext(tmq2->rings) == &pkts[3]);
+
+    tmqh_flow_rings = false;
+    TmqhOutputFlowFreeCtx(fctx1);
+    TmqhOutputFlowFreeCtx(fctx2);
+    TmqResetQueues();
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void TmqhFlowRegisterTests(void)
@@ -381,6 +710,8 @@ void TmqhFlowRegisterTests(void)
                    TmqhOutputFlowSetupCtxTest02);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest03",
                    TmqhOutputFlowSetupCtxTest03);
+    UtRegisterTest("TmqhFlowRingTest01", TmqhFlowRingTest01);
+    UtRegisterTest("TmqhOutputFlowRingsTest01", TmqhOutputFlowRingsTest01);
 #endif
 
     return;
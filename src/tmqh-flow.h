@@ -24,8 +24,42 @@
 #ifndef __TMQH_FLOW_H__
 #define __TMQH_FLOW_H__
 
+/** max number of producer rings per queue, more producers use the locked queue */
+#define TMQH_FLOW_RINGS_MAX 256
+/** max number of packets the consumer takes from the rings at once */
+#define TMQH_FLOW_BATCH 32
+
+/** \brief per queue state of the ring based autofp queues
+ *
+ *  Each producer thread gets its own single producer, single consumer
+ *  ring into each of the queues it outputs to. The queue's PacketQueue
+ *  and its mutex and cond are still used for packets injected by other
+ *  parts of the engine, and to put the consumer to sleep.
+ */
+typedef struct TmqhFlowRings_ {
+    PacketRing *rings[TMQH_FLOW_RINGS_MAX];
+    SC_ATOMIC_DECLARE(uint16_t, cnt);
+    /** set by the consumer while it waits on the queue cond */
+    SC_ATOMIC_DECLARE(bool, sleeping);
+    /** packets taken from the rings but not yet handed out */
+    SC_ATOMIC_DECLARE(uint32_t, batch_left);
+
+    /* consumer thread only */
+    uint16_t next;      /**< ring to start the next batch at */
+    uint32_t spin;      /**< current spin budget before sleeping */
+    uint32_t batch_idx;
+    uint32_t batch_cnt;
+    Packet *batch[TMQH_FLOW_BATCH];
+
+    uint16_t counter_depth;
+    uint16_t counter_wakeups;
+    uint16_t counter_spin_hits;
+} TmqhFlowRings;
+
 typedef struct TmqhFlowMode_ {
     PacketQueue *q;
+    PacketRing *ring;       /**< our ring into q's consumer or NULL */
+    TmqhFlowRings *rings;
 } TmqhFlowMode;
 
 /** \brief Ctx for the flow queue handler
@@ -43,4 +77,7 @@ void TmqhFlowRegisterTests(void);
 
 void TmqhFlowPrintAutofpHandler(void);
 
+uint32_t TmqhFlowRingsPending(TmqhFlowRings *rs);
+void TmqhFlowRingsFree(TmqhFlowRings *rs);
+
 #endif /* __TMQH_FLOW_H__ */
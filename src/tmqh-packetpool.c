@@ -49,6 +49,7 @@
 #include "util-error.h"
 #include "util-profiling.h"
 #include "util-device.h"
+#include "util-pages.h"
 
 /* Number of freed packet to save for one pool before freeing them. */
 #define MAX_PENDING_RETURN_PACKETS 32
@@ -315,16 +316,30 @@ void PacketPoolInit(void)
     SCCondInit(&my_pool->return_stack.cond, NULL);
     SC_ATOMIC_INIT(my_pool->return_stack.sync_now);
 
-    /* pre allocate packets */
+    if (max_pending_packets <= 0)
+        return;
+
+    /* pre allocate packets in a single block, so that they can be backed
+     * by hugepages */
+    const size_t stride = (SIZE_OF_PACKET + CLS - 1) & ~((size_t)CLS - 1);
     SCLogDebug("preallocating packets... packet size %" PRIuMAX "",
                (uintmax_t)SIZE_OF_PACKET);
-    int i = 0;
-    for (i = 0; i < max_pending_packets; i++) {
-        Packet *p = PacketGetFromAlloc();
-        if (unlikely(p == NULL)) {
-            FatalError(SC_ERR_FATAL,
-                       "Fatal error encountered while allocating a packet. Exiting...");
-        }
+    PktPoolSlab *slab = PageLargeAlloc(CLS + (size_t)max_pending_packets * stride,
+            PAGE_LARGE_PACKET);
+    if (unlikely(slab == NULL)) {
+        FatalError(SC_ERR_FATAL,
+                   "Fatal error encountered while allocating a packet. Exiting...");
+    }
+    SC_ATOMIC_INIT(slab->refcnt);
+    SC_ATOMIC_SET(slab->refcnt, (uint32_t)max_pending_packets);
+
+    uint8_t *mem = (uint8_t *)slab + CLS;
+    for (intmax_t i = 0; i < max_pending_packets; i++) {
+        Packet *p = (Packet *)(mem + i * stride);
+        memset(p, 0, SIZE_OF_PACKET);
+        PACKET_INITIALIZE(p);
+        p->slab = slab;
+        PACKET_PROFILING_START(p);
         PacketPoolStorePacket(p);
     }
 
@@ -332,6 +347,19 @@ void PacketPoolInit(void)
     //        max_pending_packets, (uintmax_t)(max_pending_packets*SIZE_OF_PACKET));
 }
 
+/**
+ *  \brief drop the reference of a freed packet to its pool slab
+ *
+ *  The slab is freed with its last packet, which may be on another thread
+ *  than the one that created the pool.
+ */
+void PacketPoolSlabRelease(PktPoolSlab *slab)
+{
+    if (SC_ATOMIC_SUB(slab->refcnt, 1) == 1) {
+        PageLargeFree(slab);
+    }
+}
+
 void PacketPoolDestroy(void)
 {
     Packet *p = NULL;
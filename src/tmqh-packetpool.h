@@ -67,6 +67,12 @@ typedef struct PktPool_ {
     PktPoolLockedStack return_stack;
 } PktPool;
 
+/** Memory block holding the preallocated packets of a pool. The packets
+ *  follow the header, it is freed when the last packet is freed. */
+typedef struct PktPoolSlab_ {
+    SC_ATOMIC_DECLARE(uint32_t, refcnt);
+} PktPoolSlab;
+
 Packet *TmqhInputPacketpool(ThreadVars *);
 void TmqhOutputPacketpool(ThreadVars *, Packet *);
 void TmqhReleasePacketsToPacketPool(PacketQueue *);
@@ -79,5 +85,6 @@ void PacketPoolInit(void);
 void PacketPoolInitEmpty(void);
 void PacketPoolDestroy(void);
 void PacketPoolPostRunmodes(void);
+void PacketPoolSlabRelease(PktPoolSlab *slab);
 
 #endif /* __TMQH_PACKETPOOL_H__ */
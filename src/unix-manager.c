@@ -30,6 +30,8 @@
 #include "conf.h"
 
 #include "output-json-stats.h"
+#include "util-profiling-sampling.h"
+#include "flow-cost.h"
 
 #include "util-privs.h"
 #include "util-debug.h"
@@ -790,6 +792,21 @@ static TmEcode UnixManagerRulesetStatsCommand(json_t *cmd,
     SCReturnInt(retval);
 }
 
+static TmEcode UnixManagerRulesetProfileCommand(json_t *cmd, json_t *server_msg, void *data)
+{
+    SCEnter();
+    if (!profiling_sample_enabled) {
+        json_object_set_new(server_msg, "message",
+                json_string("sampled profiling is disabled, see profiling.sampling"));
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    json_t *jdata = NULL;
+    TmEcode retval = OutputEngineStatsProfiling(&jdata);
+    json_object_set_new(server_msg, "message", jdata);
+    SCReturnInt(retval);
+}
+
 static TmEcode UnixManagerShowFailedRules(json_t *cmd,
                                           json_t *server_msg, void *data)
 {
@@ -1068,6 +1085,8 @@ int UnixManagerInit(void)
     UnixManagerRegisterCommand("ruleset-reload-time", UnixManagerReloadTimeCommand, NULL, 0);
     UnixManagerRegisterCommand("ruleset-stats", UnixManagerRulesetStatsCommand, NULL, 0);
     UnixManagerRegisterCommand("ruleset-failed-rules", UnixManagerShowFailedRules, NULL, 0);
+    UnixManagerRegisterCommand("ruleset-profile", UnixManagerRulesetProfileCommand, NULL, 0);
+    UnixManagerRegisterCommand("flow-cost-report", FlowCostReportCommand, NULL, 0);
     UnixManagerRegisterCommand("register-tenant-handler", UnixSocketRegisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("unregister-tenant-handler", UnixSocketUnregisterTenantHandler, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("register-tenant", UnixSocketRegisterTenant, &command, UNIX_CMD_TAKE_ARGS);
@@ -1083,6 +1102,8 @@ int UnixManagerInit(void)
 
     UnixManagerRegisterCommand("dataset-add", UnixSocketDatasetAdd, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("dataset-remove", UnixSocketDatasetRemove, &command, UNIX_CMD_TAKE_ARGS);
+    UnixManagerRegisterCommand("dataset-stats", UnixSocketDatasetStats, NULL, 0);
+    UnixManagerRegisterBackgroundTask(UnixSocketDatasetCommitTask, NULL);
 
     return 0;
 }
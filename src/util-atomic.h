@@ -161,6 +161,9 @@
 #define SC_ATOMIC_SET(name, val)    \
     atomic_store(&(name ## _sc_atomic__), (val))
 
+#define SC_ATOMIC_STORE_EXPLICIT(name, val, order) \
+    atomic_store_explicit(&(name ## _sc_atomic__), (val), (order))
+
 #else
 
 #define SC_ATOMIC_MEMORY_ORDER_RELAXED
@@ -389,6 +392,9 @@
         ;                                                       \
         })
 
+#define SC_ATOMIC_STORE_EXPLICIT(name, val, order) \
+    SC_ATOMIC_SET(name, val)
+
 #endif /* no c11 atomics */
 
 void SCAtomicRegisterTests(void);
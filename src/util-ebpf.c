@@ -237,42 +237,20 @@ static int EBPFLoadPinnedMaps(LiveDevice *livedev, struct ebpf_timeout_config *c
         bpf_map_data->last = 0;
     }
 
-    /* Load other known maps: cpu_map, cpus_available, tx_peer, tx_peer_int */
-    int fd = EBPFLoadPinnedMapsFile(livedev, "cpu_map");
-    if (fd >= 0) {
-        bpf_map_data->array[bpf_map_data->last].fd = fd;
-        bpf_map_data->array[bpf_map_data->last].name = SCStrdup("cpu_map");
-        if (bpf_map_data->array[bpf_map_data->last].name == NULL) {
-            goto alloc_error;
-        }
-        bpf_map_data->last++;
-    }
-    fd = EBPFLoadPinnedMapsFile(livedev, "cpus_available");
-    if (fd >= 0) {
-        bpf_map_data->array[bpf_map_data->last].fd = fd;
-        bpf_map_data->array[bpf_map_data->last].name = SCStrdup("cpus_available");
-        if (bpf_map_data->array[bpf_map_data->last].name == NULL) {
-            goto alloc_error;
-        }
-        bpf_map_data->last++;
-    }
-    fd = EBPFLoadPinnedMapsFile(livedev, "tx_peer");
-    if (fd >= 0) {
-        bpf_map_data->array[bpf_map_data->last].fd = fd;
-        bpf_map_data->array[bpf_map_data->last].name = SCStrdup("tx_peer");
-        if (bpf_map_data->array[bpf_map_data->last].name == NULL) {
-            goto alloc_error;
-        }
-        bpf_map_data->last++;
-    }
-    fd = EBPFLoadPinnedMapsFile(livedev, "tx_peer_int");
-    if (fd >= 0) {
-        bpf_map_data->array[bpf_map_data->last].fd = fd;
-        bpf_map_data->array[bpf_map_data->last].name = SCStrdup("tx_peer_int");
-        if (bpf_map_data->array[bpf_map_data->last].name == NULL) {
-            goto alloc_error;
+    /* Load other known maps: cpu_map, cpus_available, cpus_count,
+     * cpus_load, tx_peer, tx_peer_int */
+    const char *other_maps[] = { "cpu_map", "cpus_available", "cpus_count", "cpus_load",
+        "tx_peer", "tx_peer_int" };
+    for (size_t i = 0; i < ARRAY_SIZE(other_maps); i++) {
+        int fd = EBPFLoadPinnedMapsFile(livedev, other_maps[i]);
+        if (fd >= 0) {
+            bpf_map_data->array[bpf_map_data->last].fd = fd;
+            bpf_map_data->array[bpf_map_data->last].name = SCStrdup(other_maps[i]);
+            if (bpf_map_data->array[bpf_map_data->last].name == NULL) {
+                goto alloc_error;
+            }
+            bpf_map_data->last++;
         }
-        bpf_map_data->last++;
     }
 
     /* Attach the bpf_maps_info to the LiveDevice via the device storage */
@@ -920,6 +898,244 @@ int EBPFCheckBypassedFlowCreate(ThreadVars *th_v, struct timespec *curtime, void
     return 0;
 }
 
+/**
+ * Insert a half flow in the kernel bypass table
+ *
+ * \param mapfd file descriptor of the protocol bypass table
+ * \param key data to use as key in the table
+ * \param nr_cpus number of CPUs of the per CPU value
+ * \return 0 in case of error, 1 if success
+ */
+int EBPFInsertHalfFlow(int mapd, void *key, unsigned int nr_cpus)
+{
+    BPF_DECLARE_PERCPU(struct pair, value, nr_cpus);
+    unsigned int i;
+
+    if (mapd == -1) {
+        return 0;
+    }
+
+    /* We use a per CPU structure so we have to set an array of values as the kernel
+     * is not duplicating the data on each CPU by itself. */
+    for (i = 0; i < nr_cpus; i++) {
+        BPF_PERCPU(value, i).packets = 0;
+        BPF_PERCPU(value, i).bytes = 0;
+    }
+    if (bpf_map_update_elem(mapd, key, value, BPF_NOEXIST) != 0) {
+        switch (errno) {
+            /* no more place in the hash */
+            case E2BIG:
+                return 0;
+            /* no more place in the hash for some hardware bypass */
+            case EAGAIN:
+                return 0;
+            /* if we already have the key then bypass is a success */
+            case EEXIST:
+                return 1;
+            /* Not supposed to be there so issue a error */
+            default:
+                SCLogError(SC_ERR_BPF, "Can't update eBPF map: %s (%d)",
+                        strerror(errno),
+                        errno);
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Attach the bypass data of the two half flows to the flow
+ *
+ * Ownership of the keys is taken, they are freed on failure.
+ *
+ * \return 0 in case of error, 1 if success
+ */
+int EBPFSetFlowStorage(Packet *p, int map_fd, void *key0, void *key1, int family,
+        unsigned int nr_cpus)
+{
+    FlowBypassInfo *fc = FlowGetStorageById(p->flow, GetFlowBypassInfoID());
+    if (fc) {
+        if (fc->bypass_data != NULL) {
+            // bypass already activated
+            SCFree(key0);
+            SCFree(key1);
+            return 1;
+        }
+        EBPFBypassData *eb = SCCalloc(1, sizeof(EBPFBypassData));
+        if (eb == NULL) {
+            EBPFDeleteKey(map_fd, key0);
+            EBPFDeleteKey(map_fd, key1);
+            LiveDevAddBypassFail(p->livedev, 1, family);
+            SCFree(key0);
+            SCFree(key1);
+            return 0;
+        }
+        eb->key[0] = key0;
+        eb->key[1] = key1;
+        eb->mapfd = map_fd;
+        eb->cpus_count = nr_cpus;
+        fc->BypassUpdate = EBPFBypassUpdate;
+        fc->BypassFree = EBPFBypassFree;
+        fc->bypass_data = eb;
+    } else {
+        EBPFDeleteKey(map_fd, key0);
+        EBPFDeleteKey(map_fd, key1);
+        LiveDevAddBypassFail(p->livedev, 1, family);
+        SCFree(key0);
+        SCFree(key1);
+        return 0;
+    }
+
+    LiveDevAddBypassStats(p->livedev, 1, family);
+    LiveDevAddBypassSuccess(p->livedev, 1, family);
+    return 1;
+}
+
+/**
+ * Bypass a flow in the tables of the XDP filter
+ *
+ * This function creates two half flows in the map shared with the kernel
+ * to trigger bypass. This is similar to the AF_PACKET eBPF bypass but
+ * the bytes order is changed for some data due to the way we get the data
+ * in the XDP case. It is used by all capture methods running the XDP filter.
+ *
+ * \param p the packet belonging to the flow to bypass
+ * \param v4_map_fd file descriptor of the IPv4 flow table
+ * \param v6_map_fd file descriptor of the IPv6 flow table
+ * \param nr_cpus number of CPUs of the per CPU values
+ * \return 0 if unable to bypass, 1 if success
+ */
+int EBPFXDPBypassPacket(Packet *p, int v4_map_fd, int v6_map_fd, unsigned int nr_cpus)
+{
+    /* Only bypass TCP and UDP */
+    if (!(PKT_IS_TCP(p) || PKT_IS_UDP(p))) {
+        return 0;
+    }
+
+    /* If we don't have a flow attached to packet the eBPF map entries
+     * will be destroyed at first flow bypass manager pass as we won't
+     * find any associated entry */
+    if (p->flow == NULL) {
+        return 0;
+    }
+    /* Bypassing tunneled packets is currently not supported
+     * because we can't discard the inner packet only due to
+     * primitive parsing in eBPF */
+    if (IS_TUNNEL_PKT(p)) {
+        return 0;
+    }
+    if (PKT_IS_IPV4(p)) {
+        struct flowv4_keys *keys[2];
+        keys[0]= SCCalloc(1, sizeof(struct flowv4_keys));
+        if (keys[0] == NULL) {
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
+            return 0;
+        }
+        if (v4_map_fd == -1) {
+            SCFree(keys[0]);
+            return 0;
+        }
+        keys[0]->src = p->src.addr_data32[0];
+        keys[0]->dst = p->dst.addr_data32[0];
+        /* In the XDP filter we get port from parsing of packet and not from skb
+         * (as in eBPF filter) so we need to pass from host to network order */
+        keys[0]->port16[0] = htons(p->sp);
+        keys[0]->port16[1] = htons(p->dp);
+        keys[0]->vlan0 = p->vlan_id[0];
+        keys[0]->vlan1 = p->vlan_id[1];
+        if (IPV4_GET_IPPROTO(p) == IPPROTO_TCP) {
+            keys[0]->ip_proto = 1;
+        } else {
+            keys[0]->ip_proto = 0;
+        }
+        if (EBPFInsertHalfFlow(v4_map_fd, keys[0], nr_cpus) == 0) {
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
+            SCFree(keys[0]);
+            return 0;
+        }
+        keys[1]= SCCalloc(1, sizeof(struct flowv4_keys));
+        if (keys[1] == NULL) {
+            EBPFDeleteKey(v4_map_fd, keys[0]);
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
+            SCFree(keys[0]);
+            return 0;
+        }
+        keys[1]->src = p->dst.addr_data32[0];
+        keys[1]->dst = p->src.addr_data32[0];
+        keys[1]->port16[0] = htons(p->dp);
+        keys[1]->port16[1] = htons(p->sp);
+        keys[1]->vlan0 = p->vlan_id[0];
+        keys[1]->vlan1 = p->vlan_id[1];
+        keys[1]->ip_proto = keys[0]->ip_proto;
+        if (EBPFInsertHalfFlow(v4_map_fd, keys[1], nr_cpus) == 0) {
+            EBPFDeleteKey(v4_map_fd, keys[0]);
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
+            SCFree(keys[0]);
+            SCFree(keys[1]);
+            return 0;
+        }
+        return EBPFSetFlowStorage(p, v4_map_fd, keys[0], keys[1], AF_INET, nr_cpus);
+    }
+    /* For IPv6 case we don't handle extended header in eBPF */
+    if (PKT_IS_IPV6(p) &&
+        ((IPV6_GET_NH(p) == IPPROTO_TCP) || (IPV6_GET_NH(p) == IPPROTO_UDP))) {
+        SCLogDebug("add an IPv6");
+        if (v6_map_fd == -1) {
+            return 0;
+        }
+        int i;
+        struct flowv6_keys *keys[2];
+        keys[0] = SCCalloc(1, sizeof(struct flowv6_keys));
+        if (keys[0] == NULL) {
+            return 0;
+        }
+
+        for (i = 0; i < 4; i++) {
+            keys[0]->src[i] = GET_IPV6_SRC_ADDR(p)[i];
+            keys[0]->dst[i] = GET_IPV6_DST_ADDR(p)[i];
+        }
+        keys[0]->port16[0] = htons(GET_TCP_SRC_PORT(p));
+        keys[0]->port16[1] = htons(GET_TCP_DST_PORT(p));
+        keys[0]->vlan0 = p->vlan_id[0];
+        keys[0]->vlan1 = p->vlan_id[1];
+        if (IPV6_GET_NH(p) == IPPROTO_TCP) {
+            keys[0]->ip_proto = 1;
+        } else {
+            keys[0]->ip_proto = 0;
+        }
+        if (EBPFInsertHalfFlow(v6_map_fd, keys[0], nr_cpus) == 0) {
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
+            SCFree(keys[0]);
+            return 0;
+        }
+        keys[1]= SCCalloc(1, sizeof(struct flowv6_keys));
+        if (keys[1] == NULL) {
+            EBPFDeleteKey(v6_map_fd, keys[0]);
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
+            SCFree(keys[0]);
+            return 0;
+        }
+        for (i = 0; i < 4; i++) {
+            keys[1]->src[i] = GET_IPV6_DST_ADDR(p)[i];
+            keys[1]->dst[i] = GET_IPV6_SRC_ADDR(p)[i];
+        }
+        keys[1]->port16[0] = htons(GET_TCP_DST_PORT(p));
+        keys[1]->port16[1] = htons(GET_TCP_SRC_PORT(p));
+        keys[1]->vlan0 = p->vlan_id[0];
+        keys[1]->vlan1 = p->vlan_id[1];
+        keys[1]->ip_proto = keys[0]->ip_proto;
+        if (EBPFInsertHalfFlow(v6_map_fd, keys[1], nr_cpus) == 0) {
+            EBPFDeleteKey(v6_map_fd, keys[0]);
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
+            SCFree(keys[0]);
+            SCFree(keys[1]);
+            return 0;
+        }
+        return EBPFSetFlowStorage(p, v6_map_fd, keys[0], keys[1], AF_INET6, nr_cpus);
+    }
+    return 0;
+}
+
 void EBPFRegisterExtension(void)
 {
     g_livedev_storage_id = LiveDevStorageRegister("bpfmap", sizeof(void *), NULL, BpfMapsInfoFree);
@@ -992,6 +1208,67 @@ void EBPFBuildCPUSet(ConfNode *node, char *iface)
                         BPF_ANY);
 }
 
+/**
+ * Get the maps used to publish the load of the workers
+ *
+ * \param iface the interface the XDP load balancer is attached to
+ * \param maps filled with the file descriptors of the maps
+ * \return 0 on success, -1 if the XDP program has no cpus_load map
+ */
+int EBPFGetCPULoadMaps(const char *iface, EBPFCPULoadMaps *maps)
+{
+    maps->load_fd = EBPFGetMapFDByName(iface, "cpus_load");
+    maps->available_fd = EBPFGetMapFDByName(iface, "cpus_available");
+    maps->count_fd = EBPFGetMapFDByName(iface, "cpus_count");
+    maps->cpu = -1;
+    maps->idx = 0;
+    if (maps->load_fd < 0 || maps->available_fd < 0 || maps->count_fd < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Publish the load of the worker running on a CPU
+ *
+ * The adaptive XDP load balancer (xdp_lb_adaptive.bpf) sends new IP pairs
+ * to the least loaded of two CPUs taken from the xdp-cpu-redirect set. The
+ * load is read from the cpus_load map that is indexed like cpus_available.
+ * The index of the CPU is looked up again only if the worker moved to
+ * another CPU.
+ *
+ * \param maps maps from EBPFGetCPULoadMaps()
+ * \param cpu the CPU the worker is running on
+ * \param load the load of the worker, in an arbitrary unit
+ * \return 0 on success, -1 on error or if the CPU is not in the set
+ */
+int EBPFSetCPULoad(EBPFCPULoadMaps *maps, uint32_t cpu, uint32_t load)
+{
+    if (maps->cpu != (int)cpu) {
+        uint32_t key0 = 0;
+        uint32_t count = 0;
+        if (bpf_map_lookup_elem(maps->count_fd, &key0, &count) != 0) {
+            return -1;
+        }
+        maps->cpu = -1;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t value;
+            if (bpf_map_lookup_elem(maps->available_fd, &i, &value) == 0 && value == cpu) {
+                maps->cpu = (int)cpu;
+                maps->idx = i;
+                break;
+            }
+        }
+        if (maps->cpu < 0) {
+            return -1;
+        }
+    }
+    if (bpf_map_update_elem(maps->load_fd, &maps->idx, &load, BPF_ANY) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
 /**
  * Setup peer interface in XDP system
  *
@@ -85,7 +85,18 @@ int EBPFCheckBypassedFlowCreate(ThreadVars *th_v, struct timespec *curtime, void
 
 void EBPFRegisterExtension(void);
 
+/** maps of the adaptive XDP load balancer, see EBPFGetCPULoadMaps() */
+typedef struct EBPFCPULoadMaps_ {
+    int load_fd;
+    int available_fd;
+    int count_fd;
+    int cpu;      /**< CPU of the last update, -1 if none */
+    uint32_t idx; /**< index of cpu in cpus_available */
+} EBPFCPULoadMaps;
+
 void EBPFBuildCPUSet(ConfNode *node, char *iface);
+int EBPFGetCPULoadMaps(const char *iface, EBPFCPULoadMaps *maps);
+int EBPFSetCPULoad(EBPFCPULoadMaps *maps, uint32_t cpu, uint32_t load);
 
 int EBPFSetPeerIface(const char *iface, const char *out_iface);
 
@@ -95,6 +106,11 @@ void EBPFBypassFree(void *data);
 
 void EBPFDeleteKey(int fd, void *key);
 
+int EBPFInsertHalfFlow(int mapd, void *key, unsigned int nr_cpus);
+int EBPFSetFlowStorage(Packet *p, int map_fd, void *key0, void *key1, int family,
+        unsigned int nr_cpus);
+int EBPFXDPBypassPacket(Packet *p, int v4_map_fd, int v6_map_fd, unsigned int nr_cpus);
+
 #ifdef BUILD_UNIX_SOCKET
 TmEcode EBPFGetBypassedStats(json_t *cmd, json_t *answer, void *data);
 #endif
@@ -388,6 +388,9 @@ const char * SCErrorToString(SCError err)
         CASE_CODE(SC_ERR_SIGNAL);
         CASE_CODE(SC_WARN_CHOWN);
         CASE_CODE(SC_ERR_HASH_ADD);
+        CASE_CODE(SC_ERR_NO_AF_XDP);
+        CASE_CODE(SC_ERR_AF_XDP_CREATE);
+        CASE_CODE(SC_ERR_AF_XDP_READ);
 
         CASE_CODE (SC_ERR_MAX);
     }
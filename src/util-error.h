@@ -378,6 +378,9 @@ typedef enum {
     SC_ERR_SIGNAL,
     SC_WARN_CHOWN,
     SC_ERR_HASH_ADD,
+    SC_ERR_NO_AF_XDP,
+    SC_ERR_AF_XDP_CREATE,
+    SC_ERR_AF_XDP_READ,
 
     SC_ERR_MAX
 } SCError;
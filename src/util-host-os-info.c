@@ -353,6 +353,9 @@ void SCHInfoLoadFromConfig(void)
             }
         }
     }
+    if (sc_hinfo_tree != NULL && SCRadixCompile(sc_hinfo_tree) < 0) {
+        SCLogWarning(SC_ERR_MEM_ALLOC, "failed to compile host os info lookup tables");
+    }
 }
 
 /*------------------------------------Unit_Tests------------------------------*/
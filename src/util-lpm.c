@@ -0,0 +1,604 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Longest prefix match using a poptrie (Asai, Ohara: "Poptrie: A Compressed
+ * Trie with Population Count for Fast and Scalable Software IP Routing Table
+ * Lookup").
+ *
+ * The first SCLPM_DIRECT_BITS bits of the key index a direct table. Each
+ * entry holds either a value (leaf) or the index of a node. A node covers
+ * the next SCLPM_STRIDE (6) bits of the key, so 64 possible positions:
+ * - bit i of 'vector' is set if position i is a child node. Children are
+ *   stored contiguously starting at 'base1'.
+ * - otherwise position i is a leaf. Consecutive leaves with the same value
+ *   are stored once: bit i of 'leafvec' is set if the leaf at i starts a
+ *   new run. Leaves are stored contiguously starting at 'base0'.
+ *
+ * Leaves hold the value of the longest prefix covering them (leaf pushing),
+ * so a lookup never has to backtrack.
+ */
+
+#include "suricata-common.h"
+#include "util-lpm.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+/** bits resolved by the direct table */
+#define SCLPM_DIRECT_BITS   16
+#define SCLPM_DIRECT_SIZE   (1 << SCLPM_DIRECT_BITS)
+/** bits resolved per node */
+#define SCLPM_STRIDE        6
+/** direct table entry flag: entry is a node index, not a value */
+#define SCLPM_DIRECT_NODE   0x80000000U
+
+typedef struct SCLpmTrieNode_ {
+    uint32_t child[2];  /**< 0: no child, as node 0 is the root */
+    uint32_t value;     /**< 0: no prefix ends here */
+} SCLpmTrieNode;
+
+struct SCLpmBuilder_ {
+    uint8_t key_bits;
+    uint32_t prefixes;
+
+    SCLpmTrieNode *nodes;
+    uint32_t nodes_cnt;
+    uint32_t nodes_size;
+    /** removed nodes, linked through child[0] */
+    uint32_t free_list;
+};
+
+typedef struct SCLpmNode_ {
+    uint64_t vector;
+    uint64_t leafvec;
+    uint32_t base0;
+    uint32_t base1;
+} SCLpmNode;
+
+struct SCLpm_ {
+    uint8_t key_bits;
+
+    uint32_t *direct;
+
+    SCLpmNode *nodes;
+    uint32_t nodes_cnt;
+    uint32_t nodes_size;
+
+    uint32_t *leaves;
+    uint32_t leaves_cnt;
+    uint32_t leaves_size;
+};
+
+static inline int KeyBit(const uint8_t *key, uint32_t bit)
+{
+    return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/** \brief get the SCLPM_STRIDE bits at offset \a off, padded with zeros
+ *         past the end of the key */
+static inline uint32_t KeyChunk(const uint8_t *key, uint32_t off, uint32_t key_bytes)
+{
+    const uint32_t byte = off >> 3;
+    uint32_t w = (uint32_t)key[byte] << 8;
+    if (byte + 1 < key_bytes)
+        w |= key[byte + 1];
+    return (w >> (16 - SCLPM_STRIDE - (off & 7))) & ((1 << SCLPM_STRIDE) - 1);
+}
+
+SCLpmBuilder *SCLpmBuilderNew(uint8_t key_bits)
+{
+    if (key_bits != 32 && key_bits != 128)
+        return NULL;
+
+    SCLpmBuilder *b = SCCalloc(1, sizeof(*b));
+    if (b == NULL)
+        return NULL;
+    b->key_bits = key_bits;
+    b->nodes_size = 64;
+    b->nodes = SCCalloc(b->nodes_size, sizeof(SCLpmTrieNode));
+    if (b->nodes == NULL) {
+        SCFree(b);
+        return NULL;
+    }
+    /* root */
+    b->nodes_cnt = 1;
+    return b;
+}
+
+void SCLpmBuilderFree(SCLpmBuilder *b)
+{
+    if (b == NULL)
+        return;
+    SCFree(b->nodes);
+    SCFree(b);
+}
+
+uint32_t SCLpmBuilderCount(const SCLpmBuilder *b)
+{
+    return b->prefixes;
+}
+
+size_t SCLpmBuilderMemorySize(const SCLpmBuilder *b)
+{
+    return sizeof(*b) + (size_t)b->nodes_size * sizeof(SCLpmTrieNode);
+}
+
+static uint32_t SCLpmBuilderNodeAlloc(SCLpmBuilder *b)
+{
+    uint32_t idx;
+    if (b->free_list != 0) {
+        idx = b->free_list;
+        b->free_list = b->nodes[idx].child[0];
+    } else {
+        if (b->nodes_cnt == b->nodes_size) {
+            if (b->nodes_size >= UINT32_MAX / 2)
+                return 0;
+            uint32_t size = b->nodes_size * 2;
+            SCLpmTrieNode *nodes = SCRealloc(b->nodes, size * sizeof(SCLpmTrieNode));
+            if (nodes == NULL)
+                return 0;
+            b->nodes = nodes;
+            b->nodes_size = size;
+        }
+        idx = b->nodes_cnt++;
+    }
+    memset(&b->nodes[idx], 0, sizeof(SCLpmTrieNode));
+    return idx;
+}
+
+/**
+ *  \brief add a prefix, replacing the value if the prefix already exists
+ *
+ *  Host bits in \a key beyond \a netmask are ignored.
+ *
+ *  \param value value for the prefix, 1 - SCLPM_VALUE_MAX
+ *  \retval 1 added
+ *  \retval 0 existing prefix updated
+ *  \retval -1 error
+ */
+int SCLpmBuilderAdd(SCLpmBuilder *b, const uint8_t *key, uint8_t netmask, uint32_t value)
+{
+    if (netmask > b->key_bits || value == 0 || value > SCLPM_VALUE_MAX)
+        return -1;
+
+    uint32_t idx = 0;
+    for (uint32_t bit = 0; bit < netmask; bit++) {
+        const int dir = KeyBit(key, bit);
+        uint32_t next = b->nodes[idx].child[dir];
+        if (next == 0) {
+            next = SCLpmBuilderNodeAlloc(b);
+            if (next == 0)
+                return -1;
+            b->nodes[idx].child[dir] = next;
+        }
+        idx = next;
+    }
+
+    const int r = b->nodes[idx].value == 0 ? 1 : 0;
+    b->nodes[idx].value = value;
+    if (r == 1)
+        b->prefixes++;
+    return r;
+}
+
+/**
+ *  \brief remove a prefix
+ *  \retval 1 removed
+ *  \retval 0 not found
+ */
+int SCLpmBuilderRemove(SCLpmBuilder *b, const uint8_t *key, uint8_t netmask)
+{
+    if (netmask > b->key_bits)
+        return 0;
+
+    uint32_t path[129];
+    uint32_t idx = 0;
+    path[0] = 0;
+    for (uint32_t bit = 0; bit < netmask; bit++) {
+        idx = b->nodes[idx].child[KeyBit(key, bit)];
+        if (idx == 0)
+            return 0;
+        path[bit + 1] = idx;
+    }
+    if (b->nodes[idx].value == 0)
+        return 0;
+    b->nodes[idx].value = 0;
+    b->prefixes--;
+
+    /* prune the now unused tail of the path, so that nodes with children
+     * always lead to a prefix. */
+    for (uint32_t depth = netmask; depth > 0; depth--) {
+        SCLpmTrieNode *n = &b->nodes[path[depth]];
+        if (n->value != 0 || n->child[0] != 0 || n->child[1] != 0)
+            break;
+        b->nodes[path[depth - 1]].child[KeyBit(key, depth - 1)] = 0;
+        n->child[0] = b->free_list;
+        b->free_list = path[depth];
+    }
+    return 1;
+}
+
+static int SCLpmBuilderWalkNode(const SCLpmBuilder *b, uint32_t idx, uint8_t *key, uint32_t depth,
+        SCLpmWalkFunc Func, void *ctx)
+{
+    const SCLpmTrieNode *n = &b->nodes[idx];
+    if (n->value != 0) {
+        if (Func(key, (uint8_t)depth, n->value, ctx) < 0)
+            return -1;
+    }
+    for (int dir = 0; dir < 2; dir++) {
+        if (n->child[dir] == 0)
+            continue;
+        if (dir)
+            key[depth >> 3] |= (uint8_t)(0x80 >> (depth & 7));
+        int r = SCLpmBuilderWalkNode(b, n->child[dir], key, depth + 1, Func, ctx);
+        key[depth >> 3] &= (uint8_t)~(0x80 >> (depth & 7));
+        if (r < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/** \brief call \a Func for each prefix in the builder */
+int SCLpmBuilderWalk(const SCLpmBuilder *b, SCLpmWalkFunc Func, void *ctx)
+{
+    uint8_t key[16];
+    memset(key, 0, sizeof(key));
+    return SCLpmBuilderWalkNode(b, 0, key, 0, Func, ctx);
+}
+
+static int SCLpmNodesReserve(SCLpm *lpm, uint32_t cnt)
+{
+    if (lpm->nodes_cnt + cnt <= lpm->nodes_size)
+        return 0;
+    uint32_t size = MAX(lpm->nodes_size * 2, lpm->nodes_cnt + cnt);
+    SCLpmNode *nodes = SCRealloc(lpm->nodes, size * sizeof(SCLpmNode));
+    if (nodes == NULL)
+        return -1;
+    lpm->nodes = nodes;
+    lpm->nodes_size = size;
+    return 0;
+}
+
+static int SCLpmLeafAppend(SCLpm *lpm, uint32_t value)
+{
+    if (lpm->leaves_cnt == lpm->leaves_size) {
+        uint32_t size = MAX(lpm->leaves_size * 2, 64);
+        uint32_t *leaves = SCRealloc(lpm->leaves, size * sizeof(uint32_t));
+        if (leaves == NULL)
+            return -1;
+        lpm->leaves = leaves;
+        lpm->leaves_size = size;
+    }
+    lpm->leaves[lpm->leaves_cnt++] = value;
+    return 0;
+}
+
+/** \brief walk \a bits bits of \a pos down from trie node \a idx
+ *
+ *  \param best in: value inherited from shorter prefixes, out: value of the
+ *              longest prefix on the path
+ *  \retval idx trie node reached, 0 if the path ends before \a bits
+ */
+static uint32_t SCLpmTrieDescend(
+        const SCLpmBuilder *b, uint32_t idx, uint32_t pos, uint32_t bits, uint32_t *best)
+{
+    for (uint32_t i = 0; i < bits; i++) {
+        const int dir = (pos >> (bits - 1 - i)) & 1;
+        idx = b->nodes[idx].child[dir];
+        if (idx == 0)
+            return 0;
+        if (b->nodes[idx].value != 0)
+            *best = b->nodes[idx].value;
+    }
+    return idx;
+}
+
+static inline bool SCLpmTrieHasChildren(const SCLpmBuilder *b, uint32_t idx)
+{
+    return (idx != 0 && (b->nodes[idx].child[0] != 0 || b->nodes[idx].child[1] != 0));
+}
+
+/** \brief fill node \a node_idx from the trie node \a trie_idx, that is at
+ *         depth \a off with \a inherited as the best value so far */
+static int SCLpmBuildNode(SCLpm *lpm, const SCLpmBuilder *b, uint32_t node_idx, uint32_t trie_idx,
+        uint32_t off, uint32_t inherited)
+{
+    uint32_t child_trie[1 << SCLPM_STRIDE];
+    uint32_t child_best[1 << SCLPM_STRIDE];
+    uint64_t vector = 0;
+    uint64_t leafvec = 0;
+    const uint32_t base0 = lpm->leaves_cnt;
+    uint32_t nchildren = 0;
+    bool have_leaf = false;
+    uint32_t prev_leaf = 0;
+
+    for (uint32_t i = 0; i < (1 << SCLPM_STRIDE); i++) {
+        uint32_t best = inherited;
+        uint32_t t = SCLpmTrieDescend(b, trie_idx, i, SCLPM_STRIDE, &best);
+        if (SCLpmTrieHasChildren(b, t)) {
+            vector |= (1ULL << i);
+            child_trie[nchildren] = t;
+            child_best[nchildren] = best;
+            nchildren++;
+        } else {
+            if (!have_leaf || best != prev_leaf) {
+                leafvec |= (1ULL << i);
+                if (SCLpmLeafAppend(lpm, best) < 0)
+                    return -1;
+                have_leaf = true;
+                prev_leaf = best;
+            }
+        }
+    }
+
+    /* children of a node are stored contiguously */
+    if (SCLpmNodesReserve(lpm, nchildren) < 0)
+        return -1;
+    const uint32_t base1 = lpm->nodes_cnt;
+    lpm->nodes_cnt += nchildren;
+
+    lpm->nodes[node_idx].vector = vector;
+    lpm->nodes[node_idx].leafvec = leafvec;
+    lpm->nodes[node_idx].base0 = base0;
+    lpm->nodes[node_idx].base1 = base1;
+
+    for (uint32_t c = 0; c < nchildren; c++) {
+        if (SCLpmBuildNode(lpm, b, base1 + c, child_trie[c], off + SCLPM_STRIDE, child_best[c]) <
+                0)
+            return -1;
+    }
+    return 0;
+}
+
+/** \brief compile the prefixes in the builder into a lookup table */
+SCLpm *SCLpmBuild(const SCLpmBuilder *b)
+{
+    SCLpm *lpm = SCCalloc(1, sizeof(*lpm));
+    if (lpm == NULL)
+        return NULL;
+    lpm->key_bits = b->key_bits;
+    lpm->direct = SCMallocAligned(SCLPM_DIRECT_SIZE * sizeof(uint32_t), CLS);
+    if (lpm->direct == NULL)
+        goto error;
+
+    const uint32_t root_value = b->nodes[0].value;
+    for (uint32_t i = 0; i < SCLPM_DIRECT_SIZE; i++) {
+        uint32_t best = root_value;
+        uint32_t t = SCLpmTrieDescend(b, 0, i, SCLPM_DIRECT_BITS, &best);
+        if (!SCLpmTrieHasChildren(b, t)) {
+            lpm->direct[i] = best;
+            continue;
+        }
+
+        if (SCLpmNodesReserve(lpm, 1) < 0)
+            goto error;
+        const uint32_t node_idx = lpm->nodes_cnt++;
+        lpm->direct[i] = SCLPM_DIRECT_NODE | node_idx;
+        if (SCLpmBuildNode(lpm, b, node_idx, t, SCLPM_DIRECT_BITS, best) < 0)
+            goto error;
+    }
+    return lpm;
+
+error:
+    SCLpmFree(lpm);
+    return NULL;
+}
+
+void SCLpmFree(SCLpm *lpm)
+{
+    if (lpm == NULL)
+        return;
+    SCFreeAligned(lpm->direct);
+    SCFree(lpm->nodes);
+    SCFree(lpm->leaves);
+    SCFree(lpm);
+}
+
+size_t SCLpmMemorySize(const SCLpm *lpm)
+{
+    return sizeof(*lpm) + SCLPM_DIRECT_SIZE * sizeof(uint32_t) +
+           (size_t)lpm->nodes_size * sizeof(SCLpmNode) + (size_t)lpm->leaves_size * sizeof(uint32_t);
+}
+
+/**
+ *  \brief find the value of the longest prefix matching \a key
+ *  \param key address in network byte order, 4 or 16 bytes depending on
+ *             the table
+ *  \retval value or 0 if no prefix matches
+ */
+uint32_t SCLpmLookup(const SCLpm *lpm, const uint8_t *key)
+{
+    const uint32_t d = lpm->direct[((uint32_t)key[0] << 8) | key[1]];
+    if (!(d & SCLPM_DIRECT_NODE))
+        return d;
+
+    const uint32_t key_bytes = lpm->key_bits / 8;
+    const SCLpmNode *n = &lpm->nodes[d & ~SCLPM_DIRECT_NODE];
+    uint32_t off = SCLPM_DIRECT_BITS;
+    for (;;) {
+        const uint32_t v = KeyChunk(key, off, key_bytes);
+        /* mask of the bits up to and including v, (2 << 63) wraps to 0 */
+        const uint64_t mask = (2ULL << v) - 1;
+        if (n->vector & (1ULL << v)) {
+            n = &lpm->nodes[n->base1 + __builtin_popcountll(n->vector & mask) - 1];
+            off += SCLPM_STRIDE;
+        } else {
+            return lpm->leaves[n->base0 + __builtin_popcountll(n->leafvec & mask) - 1];
+        }
+    }
+}
+
+#ifdef UNITTESTS
+static uint32_t LpmTestLookup4(const SCLpm *lpm, const char *str)
+{
+    struct in_addr a;
+    if (inet_pton(AF_INET, str, &a) != 1)
+        return UINT32_MAX;
+    return SCLpmLookup(lpm, (const uint8_t *)&a);
+}
+
+static int LpmTestAdd4(SCLpmBuilder *b, const char *str, uint8_t netmask, uint32_t value)
+{
+    struct in_addr a;
+    if (inet_pton(AF_INET, str, &a) != 1)
+        return -1;
+    return SCLpmBuilderAdd(b, (const uint8_t *)&a, netmask, value);
+}
+
+static int LpmTest01(void)
+{
+    SCLpmBuilder *b = SCLpmBuilderNew(32);
+    FAIL_IF_NULL(b);
+    FAIL_IF(LpmTestAdd4(b, "10.0.0.0", 8, 1) != 1);
+    FAIL_IF(LpmTestAdd4(b, "10.1.0.0", 16, 2) != 1);
+    FAIL_IF(LpmTestAdd4(b, "10.1.2.0", 24, 3) != 1);
+    FAIL_IF(LpmTestAdd4(b, "10.1.2.128", 25, 4) != 1);
+    FAIL_IF(LpmTestAdd4(b, "10.1.2.3", 32, 5) != 1);
+    FAIL_IF(LpmTestAdd4(b, "192.168.1.1", 31, 6) != 1);
+    /* update */
+    FAIL_IF(LpmTestAdd4(b, "192.168.1.0", 31, 7) != 0);
+    FAIL_IF(SCLpmBuilderCount(b) != 6);
+
+    SCLpm *lpm = SCLpmBuild(b);
+    FAIL_IF_NULL(lpm);
+    FAIL_IF(LpmTestLookup4(lpm, "9.255.255.255") != 0);
+    FAIL_IF(LpmTestLookup4(lpm, "10.0.0.1") != 1);
+    FAIL_IF(LpmTestLookup4(lpm, "10.255.255.255") != 1);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.0.1") != 2);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.2.1") != 3);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.2.2") != 3);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.2.3") != 5);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.2.4") != 3);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.2.127") != 3);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.2.128") != 4);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.2.255") != 4);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.3.0") != 2);
+    FAIL_IF(LpmTestLookup4(lpm, "192.168.1.0") != 7);
+    FAIL_IF(LpmTestLookup4(lpm, "192.168.1.1") != 7);
+    FAIL_IF(LpmTestLookup4(lpm, "192.168.1.2") != 0);
+    SCLpmFree(lpm);
+
+    /* remove the /24, the /32 and /25 in it must remain */
+    uint8_t key[4] = { 10, 1, 2, 0 };
+    FAIL_IF(SCLpmBuilderRemove(b, key, 24) != 1);
+    FAIL_IF(SCLpmBuilderRemove(b, key, 24) != 0);
+    lpm = SCLpmBuild(b);
+    FAIL_IF_NULL(lpm);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.2.1") != 2);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.2.3") != 5);
+    FAIL_IF(LpmTestLookup4(lpm, "10.1.2.200") != 4);
+    SCLpmFree(lpm);
+
+    SCLpmBuilderFree(b);
+    PASS;
+}
+
+/** \test IPv6 and default route */
+static int LpmTest02(void)
+{
+    SCLpmBuilder *b = SCLpmBuilderNew(128);
+    FAIL_IF_NULL(b);
+
+    struct in6_addr a;
+    FAIL_IF(inet_pton(AF_INET6, "::", &a) != 1);
+    FAIL_IF(SCLpmBuilderAdd(b, (uint8_t *)&a, 0, 1) != 1);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8::", &a) != 1);
+    FAIL_IF(SCLpmBuilderAdd(b, (uint8_t *)&a, 32, 2) != 1);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8::1", &a) != 1);
+    FAIL_IF(SCLpmBuilderAdd(b, (uint8_t *)&a, 128, 3) != 1);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8:0:1::", &a) != 1);
+    FAIL_IF(SCLpmBuilderAdd(b, (uint8_t *)&a, 63, 4) != 1);
+
+    SCLpm *lpm = SCLpmBuild(b);
+    FAIL_IF_NULL(lpm);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db9::1", &a) != 1);
+    FAIL_IF(SCLpmLookup(lpm, (uint8_t *)&a) != 1);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8::2", &a) != 1);
+    FAIL_IF(SCLpmLookup(lpm, (uint8_t *)&a) != 4);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8::1", &a) != 1);
+    FAIL_IF(SCLpmLookup(lpm, (uint8_t *)&a) != 3);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8:0:2::1", &a) != 1);
+    FAIL_IF(SCLpmLookup(lpm, (uint8_t *)&a) != 2);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8:0:1:ffff::1", &a) != 1);
+    FAIL_IF(SCLpmLookup(lpm, (uint8_t *)&a) != 4);
+    SCLpmFree(lpm);
+    SCLpmBuilderFree(b);
+    PASS;
+}
+
+/** \test compare against a linear scan with random prefixes */
+static int LpmTest03(void)
+{
+    SCLpmBuilder *b = SCLpmBuilderNew(32);
+    FAIL_IF_NULL(b);
+
+#define LPM_TEST_PREFIXES 2000
+    uint32_t addrs[LPM_TEST_PREFIXES];
+    uint8_t masks[LPM_TEST_PREFIXES];
+    uint32_t values[LPM_TEST_PREFIXES];
+    uint32_t seed = 1;
+    for (int i = 0; i < LPM_TEST_PREFIXES; i++) {
+        seed = seed * 1103515245 + 12345;
+        masks[i] = (uint8_t)(8 + (seed >> 16) % 25);
+        seed = seed * 1103515245 + 12345;
+        /* keep addresses clustered so that prefixes overlap */
+        uint32_t addr = 0x0a000000 | ((seed >> 8) & 0x000fffff);
+        addr &= (uint32_t)~(0xffffffffULL >> masks[i]);
+        addrs[i] = addr;
+        values[i] = (uint32_t)i + 1;
+        uint32_t n = htonl(addr);
+        FAIL_IF(SCLpmBuilderAdd(b, (uint8_t *)&n, masks[i], values[i]) < 0);
+    }
+    SCLpm *lpm = SCLpmBuild(b);
+    FAIL_IF_NULL(lpm);
+
+    for (int t = 0; t < 20000; t++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t addr = 0x0a000000 | ((seed >> 8) & 0x000fffff);
+        if (t & 1)
+            addr = addrs[t % LPM_TEST_PREFIXES] | (seed & 0xff);
+
+        uint32_t expect = 0;
+        int expect_mask = -1;
+        for (int i = 0; i < LPM_TEST_PREFIXES; i++) {
+            uint32_t m = (uint32_t)~(0xffffffffULL >> masks[i]);
+            /* later adds of the same prefix replace the value */
+            if ((addr & m) == addrs[i] && masks[i] >= expect_mask) {
+                expect = values[i];
+                expect_mask = masks[i];
+            }
+        }
+        uint32_t n = htonl(addr);
+        FAIL_IF(SCLpmLookup(lpm, (uint8_t *)&n) != expect);
+    }
+    SCLpmFree(lpm);
+    SCLpmBuilderFree(b);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void SCLpmRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LpmTest01", LpmTest01);
+    UtRegisterTest("LpmTest02", LpmTest02);
+    UtRegisterTest("LpmTest03", LpmTest03);
+#endif /* UNITTESTS */
+}
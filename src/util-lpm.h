@@ -0,0 +1,57 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Read optimized longest prefix match table for IPv4 and IPv6 addresses.
+ *
+ * Prefixes are added to a SCLpmBuilder, a plain binary trie that supports
+ * adding and removing prefixes. From the builder an immutable SCLpm is
+ * compiled for lookups. The SCLpm is a poptrie: a direct lookup table for
+ * the first 16 bits, followed by 64-ary nodes where children and leaves
+ * are stored contiguously and indexed by population count of bitmaps.
+ */
+
+#ifndef __UTIL_LPM_H__
+#define __UTIL_LPM_H__
+
+/** values stored in the table must be below this */
+#define SCLPM_VALUE_MAX 0x7fffffffU
+
+typedef struct SCLpmBuilder_ SCLpmBuilder;
+typedef struct SCLpm_ SCLpm;
+
+SCLpmBuilder *SCLpmBuilderNew(uint8_t key_bits);
+void SCLpmBuilderFree(SCLpmBuilder *b);
+int SCLpmBuilderAdd(SCLpmBuilder *b, const uint8_t *key, uint8_t netmask, uint32_t value);
+int SCLpmBuilderRemove(SCLpmBuilder *b, const uint8_t *key, uint8_t netmask);
+uint32_t SCLpmBuilderCount(const SCLpmBuilder *b);
+size_t SCLpmBuilderMemorySize(const SCLpmBuilder *b);
+
+typedef int (*SCLpmWalkFunc)(const uint8_t *key, uint8_t netmask, uint32_t value, void *ctx);
+int SCLpmBuilderWalk(const SCLpmBuilder *b, SCLpmWalkFunc Func, void *ctx);
+
+SCLpm *SCLpmBuild(const SCLpmBuilder *b);
+void SCLpmFree(SCLpm *lpm);
+size_t SCLpmMemorySize(const SCLpm *lpm);
+
+uint32_t SCLpmLookup(const SCLpm *lpm, const uint8_t *key);
+
+void SCLpmRegisterTests(void);
+
+#endif /* __UTIL_LPM_H__ */
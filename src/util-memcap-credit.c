@@ -0,0 +1,507 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memcap accounting with per thread credit.
+ *
+ * Each thread has a MemcapCreditThread with a credit slot per registered
+ * MemcapCredit. It's created on first use and linked into a global list,
+ * so that the memuse can be calculated and the credit handed back when
+ * the thread exits.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "util-memcap-credit.h"
+#include "util-unittest.h"
+#include "util-debug.h"
+#include "util-validate.h"
+
+/** with a memcap set, a thread reserves at most this fraction of it at once */
+#define MEMCAP_CREDIT_SHARE 128
+
+typedef struct MemcapCreditSlot_ {
+    /** unused credit. Only the owning thread adds to it, but other threads
+     *  read it and take it when the memcap is reached. */
+    SC_ATOMIC_DECLARE(uint64_t, credit);
+} MemcapCreditSlot;
+
+typedef struct MemcapCreditThread_ {
+    MemcapCreditSlot slots[MEMCAP_CREDIT_MAX];
+    TAILQ_ENTRY(MemcapCreditThread_) next;
+} MemcapCreditThread;
+
+/** protects registration and the thread list */
+static SCMutex memcap_credit_lock = SCMUTEX_INITIALIZER;
+static MemcapCredit *memcap_credits[MEMCAP_CREDIT_MAX];
+static int memcap_credit_cnt = 1; /**< 0 means not registered */
+static TAILQ_HEAD(, MemcapCreditThread_) memcap_credit_threads =
+        TAILQ_HEAD_INITIALIZER(memcap_credit_threads);
+/** number of threads in memcap_credit_threads, read without the lock */
+static SC_ATOMIC_DECLARE(uint32_t, memcap_credit_thread_cnt);
+
+static pthread_key_t memcap_credit_key;
+static pthread_once_t memcap_credit_key_once = PTHREAD_ONCE_INIT;
+static thread_local MemcapCreditThread *t_memcap_credit = NULL;
+
+/** \internal
+ *  \brief take all credit of a slot, leaving it empty
+ */
+static inline uint64_t MemcapCreditTake(MemcapCreditSlot *slot)
+{
+    uint64_t credit = SC_ATOMIC_GET(slot->credit);
+    while (credit > 0 && !SC_ATOMIC_CAS(&slot->credit, credit, 0))
+        ;
+    return credit;
+}
+
+/** \internal
+ *  \brief hand the credit of a slot back to the global counter
+ *  \note memcap_credit_lock must be held
+ */
+static void MemcapCreditSlotRelease(MemcapCredit *mc, MemcapCreditSlot *slot)
+{
+    const uint64_t credit = MemcapCreditTake(slot);
+    if (credit > 0) {
+        DEBUG_VALIDATE_BUG_ON(SC_ATOMIC_GET(mc->reserved) < credit);
+        (void)SC_ATOMIC_SUB(mc->reserved, credit);
+    }
+}
+
+/** \internal
+ *  \brief hand the credit of an exiting thread back to the global counters
+ */
+static void MemcapCreditThreadRelease(void *ptr)
+{
+    MemcapCreditThread *t = ptr;
+
+    SCMutexLock(&memcap_credit_lock);
+    for (int i = 1; i < memcap_credit_cnt; i++) {
+        MemcapCreditSlotRelease(memcap_credits[i], &t->slots[i]);
+    }
+    TAILQ_REMOVE(&memcap_credit_threads, t, next);
+    (void)SC_ATOMIC_SUB(memcap_credit_thread_cnt, 1);
+    SCMutexUnlock(&memcap_credit_lock);
+
+    SCFreeAligned(t);
+}
+
+static void MemcapCreditKeyCreate(void)
+{
+    if (pthread_key_create(&memcap_credit_key, MemcapCreditThreadRelease) != 0) {
+        FatalError(SC_ERR_THREAD_INIT, "failed to create memcap credit key");
+    }
+}
+
+static MemcapCreditThread *MemcapCreditThreadSetup(void)
+{
+    pthread_once(&memcap_credit_key_once, MemcapCreditKeyCreate);
+
+    MemcapCreditThread *t = SCMallocAligned(sizeof(*t), CLS);
+    if (unlikely(t == NULL))
+        return NULL;
+    memset(t, 0, sizeof(*t));
+    for (int i = 0; i < MEMCAP_CREDIT_MAX; i++) {
+        SC_ATOMIC_INIT(t->slots[i].credit);
+    }
+
+    SCMutexLock(&memcap_credit_lock);
+    TAILQ_INSERT_TAIL(&memcap_credit_threads, t, next);
+    (void)SC_ATOMIC_ADD(memcap_credit_thread_cnt, 1);
+    SCMutexUnlock(&memcap_credit_lock);
+
+    pthread_setspecific(memcap_credit_key, t);
+    t_memcap_credit = t;
+    return t;
+}
+
+/** \internal
+ *  \brief get the calling thread's credit slot for mc
+ *  \retval slot or NULL if the global counter has to be used directly
+ */
+static inline MemcapCreditSlot *MemcapCreditGet(const MemcapCredit *mc)
+{
+    if (unlikely(mc->id == 0))
+        return NULL;
+
+    MemcapCreditThread *t = t_memcap_credit;
+    if (unlikely(t == NULL)) {
+        t = MemcapCreditThreadSetup();
+        if (t == NULL)
+            return NULL;
+    }
+    return &t->slots[mc->id];
+}
+
+/** \internal
+ *  \brief size of the credit a thread keeps around
+ */
+static inline uint64_t MemcapCreditChunk(const MemcapCredit *mc, const uint64_t memcap)
+{
+    if (memcap == 0)
+        return mc->chunk;
+    return MIN((uint64_t)mc->chunk, memcap / MEMCAP_CREDIT_SHARE);
+}
+
+/**
+ *  \brief register mc or reset it if it was registered before
+ *
+ *  Resets the memuse and the credit of all threads for mc, so it should
+ *  only be called when mc is not in use.
+ *
+ *  \param chunk max size of the per thread reservations
+ *
+ *  \retval 0 ok
+ *  \retval -1 too many MemcapCredit objects, mc uses the global counter only
+ */
+int MemcapCreditInit(MemcapCredit *mc, const char *name, uint32_t chunk)
+{
+    SCMutexLock(&memcap_credit_lock);
+    if (mc->id == 0) {
+        if (memcap_credit_cnt == MEMCAP_CREDIT_MAX) {
+            SCMutexUnlock(&memcap_credit_lock);
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "can't register memcap %s: limit of %d reached",
+                    name, MEMCAP_CREDIT_MAX - 1);
+            mc->name = name;
+            SC_ATOMIC_INIT(mc->reserved);
+            return -1;
+        }
+        mc->id = memcap_credit_cnt++;
+        memcap_credits[mc->id] = mc;
+    }
+    mc->name = name;
+    mc->chunk = chunk;
+    SC_ATOMIC_INIT(mc->reserved);
+
+    MemcapCreditThread *t;
+    TAILQ_FOREACH (t, &memcap_credit_threads, next) {
+        SC_ATOMIC_SET(t->slots[mc->id].credit, 0);
+    }
+    SCMutexUnlock(&memcap_credit_lock);
+    return 0;
+}
+
+/**
+ *  \brief account for size bytes of memory that were allocated
+ *
+ *  Uses the thread's credit, reserving more from the global counter if
+ *  needed. Always succeeds, use MemcapCreditCheck() before allocating.
+ *
+ *  \param memcap current memcap, 0 for unlimited
+ */
+void MemcapCreditIncr(MemcapCredit *mc, const uint64_t memcap, const uint64_t size)
+{
+    MemcapCreditSlot *slot = MemcapCreditGet(mc);
+    if (unlikely(slot == NULL)) {
+        (void)SC_ATOMIC_ADD(mc->reserved, size);
+        return;
+    }
+
+    /* fast path: other threads only ever take all of the credit, so what
+     * we see here is at least what we have */
+    const uint64_t avail = SC_ATOMIC_GET(slot->credit);
+    if (avail >= size) {
+        uint64_t credit = avail;
+        if (SC_ATOMIC_CAS(&slot->credit, credit, avail - size))
+            return;
+    }
+
+    uint64_t credit = MemcapCreditTake(slot);
+    if (credit < size) {
+        const uint64_t need = size - credit;
+        uint64_t extra = MemcapCreditChunk(mc, memcap);
+        if (memcap != 0 && SC_ATOMIC_GET(mc->reserved) + need + extra > memcap)
+            extra = 0;
+        (void)SC_ATOMIC_ADD(mc->reserved, need + extra);
+        credit += need + extra;
+    }
+    (void)SC_ATOMIC_ADD(slot->credit, credit - size);
+}
+
+/**
+ *  \brief account for size bytes of memory that were freed
+ *
+ *  Adds to the thread's credit, handing back what exceeds twice the
+ *  chunk size to the global counter.
+ *
+ *  \param memcap current memcap, 0 for unlimited
+ */
+void MemcapCreditDecr(MemcapCredit *mc, const uint64_t memcap, const uint64_t size)
+{
+#ifdef DEBUG_VALIDATION
+    /* freeing more than was allocated. Only checked when running the unit
+     * tests, as the memuse lags behind other threads updating their credit. */
+    if (RunmodeIsUnittests()) {
+        BUG_ON(MemcapCreditMemuse(mc) < size);
+    }
+#endif
+    MemcapCreditSlot *slot = MemcapCreditGet(mc);
+    if (unlikely(slot == NULL)) {
+        DEBUG_VALIDATE_BUG_ON(SC_ATOMIC_GET(mc->reserved) < size);
+        (void)SC_ATOMIC_SUB(mc->reserved, size);
+        return;
+    }
+
+    const uint64_t keep = MemcapCreditChunk(mc, memcap);
+    if (SC_ATOMIC_ADD(slot->credit, size) + size <= keep * 2)
+        return;
+
+    uint64_t credit = MemcapCreditTake(slot);
+    if (credit > keep) {
+        const uint64_t release = credit - keep;
+        DEBUG_VALIDATE_BUG_ON(SC_ATOMIC_GET(mc->reserved) < release);
+        (void)SC_ATOMIC_SUB(mc->reserved, release);
+        credit = keep;
+    }
+    (void)SC_ATOMIC_ADD(slot->credit, credit);
+}
+
+/**
+ *  \brief Check if alloc'ing "size" would mean we're over memcap
+ *
+ *  The reserved memory, which includes the unused credit of all threads,
+ *  is checked against the memcap. If that fails, the unused credit of the
+ *  other threads is taken back before checking again, so that idle credit
+ *  doesn't make the memcap kick in early.
+ *
+ *  Taking back credit needs the global lock, so it's only done if it can
+ *  make room: a thread keeps at most twice the chunk of unused credit.
+ *  If another thread is already taking back credit, this doesn't wait
+ *  for it.
+ *
+ *  \param memcap current memcap, 0 for unlimited
+ *
+ *  \retval 1 if in bounds
+ *  \retval 0 if not in bounds
+ */
+int MemcapCreditCheck(MemcapCredit *mc, const uint64_t memcap, const uint64_t size)
+{
+    if (memcap == 0)
+        return 1;
+
+    MemcapCreditSlot *slot = MemcapCreditGet(mc);
+    const uint64_t avail = slot ? SC_ATOMIC_GET(slot->credit) : 0;
+    if (avail >= size)
+        return 1;
+
+    const uint64_t need = size - avail;
+    const uint64_t reserved = SC_ATOMIC_GET(mc->reserved);
+    if (reserved + need <= memcap)
+        return 1;
+    if (slot == NULL)
+        return 0;
+
+    const uint32_t threads = SC_ATOMIC_GET(memcap_credit_thread_cnt);
+    const uint64_t idle = (uint64_t)(threads > 0 ? threads - 1 : 0) * 2 * mc->chunk;
+    if (reserved + need > memcap + idle)
+        return 0;
+
+    if (SCMutexTrylock(&memcap_credit_lock) == 0) {
+        MemcapCreditThread *t;
+        TAILQ_FOREACH (t, &memcap_credit_threads, next) {
+            if (&t->slots[mc->id] != slot) {
+                MemcapCreditSlotRelease(mc, &t->slots[mc->id]);
+            }
+        }
+        SCMutexUnlock(&memcap_credit_lock);
+    }
+
+    if (SC_ATOMIC_GET(mc->reserved) + need <= memcap)
+        return 1;
+    return 0;
+}
+
+/**
+ *  \brief get the memory in use: the reserved memory minus the credit
+ *         the threads didn't use yet
+ *  \note not exact while other threads are updating their credit
+ */
+uint64_t MemcapCreditMemuse(MemcapCredit *mc)
+{
+    uint64_t credit = 0;
+
+    SCMutexLock(&memcap_credit_lock);
+    if (mc->id != 0) {
+        MemcapCreditThread *t;
+        TAILQ_FOREACH (t, &memcap_credit_threads, next) {
+            credit += SC_ATOMIC_GET(t->slots[mc->id].credit);
+        }
+    }
+    const uint64_t reserved = SC_ATOMIC_GET(mc->reserved);
+    SCMutexUnlock(&memcap_credit_lock);
+
+    return reserved > credit ? reserved - credit : 0;
+}
+
+#ifdef UNITTESTS
+static MemcapCredit memcap_credit_test;
+
+static int MemcapCreditTest01(void)
+{
+    MemcapCredit *mc = &memcap_credit_test;
+    FAIL_IF(MemcapCreditInit(mc, "test", 1024) != 0);
+    FAIL_IF(mc->id == 0);
+
+    MemcapCreditIncr(mc, 0, 100);
+    FAIL_IF(MemcapCreditMemuse(mc) != 100);
+    FAIL_IF(SC_ATOMIC_GET(mc->reserved) != 1124);
+
+    /* credit is kept */
+    MemcapCreditDecr(mc, 0, 100);
+    FAIL_IF(MemcapCreditMemuse(mc) != 0);
+    FAIL_IF(SC_ATOMIC_GET(mc->reserved) != 1124);
+
+    MemcapCreditIncr(mc, 0, 3000);
+    FAIL_IF(MemcapCreditMemuse(mc) != 3000);
+    FAIL_IF(SC_ATOMIC_GET(mc->reserved) != 4024);
+
+    /* excess credit is handed back */
+    MemcapCreditDecr(mc, 0, 3000);
+    FAIL_IF(MemcapCreditMemuse(mc) != 0);
+    FAIL_IF(SC_ATOMIC_GET(mc->reserved) != 1024);
+
+    /* re-init resets */
+    FAIL_IF(MemcapCreditInit(mc, "test", 1024) != 0);
+    FAIL_IF(SC_ATOMIC_GET(mc->reserved) != 0);
+    FAIL_IF(MemcapCreditMemuse(mc) != 0);
+    PASS;
+}
+
+static int MemcapCreditTest02(void)
+{
+    MemcapCredit *mc = &memcap_credit_test;
+    FAIL_IF(MemcapCreditInit(mc, "test", 1024) != 0);
+    const uint64_t memcap = 1000; /* chunk becomes 1000 / 128 = 7 */
+
+    FAIL_IF_NOT(MemcapCreditCheck(mc, memcap, 1000));
+    FAIL_IF(MemcapCreditCheck(mc, memcap, 1001));
+
+    /* no extra credit past the memcap */
+    MemcapCreditIncr(mc, memcap, 1000);
+    FAIL_IF(SC_ATOMIC_GET(mc->reserved) != 1000);
+    FAIL_IF(MemcapCreditCheck(mc, memcap, 1));
+
+    MemcapCreditDecr(mc, memcap, 500);
+    FAIL_IF(MemcapCreditMemuse(mc) != 500);
+    FAIL_IF(SC_ATOMIC_GET(mc->reserved) != 507);
+    FAIL_IF_NOT(MemcapCreditCheck(mc, memcap, 500));
+    FAIL_IF(MemcapCreditCheck(mc, memcap, 501));
+
+    MemcapCreditDecr(mc, memcap, 500);
+    FAIL_IF(MemcapCreditMemuse(mc) != 0);
+    PASS;
+}
+
+static void *MemcapCreditTestThread(void *arg)
+{
+    MemcapCredit *mc = arg;
+    MemcapCreditIncr(mc, 0, 10);
+    MemcapCreditDecr(mc, 0, 10);
+    /* leave this one to be freed by the main thread */
+    MemcapCreditIncr(mc, 0, 100);
+    return NULL;
+}
+
+/** \test credit of an exiting thread is handed back */
+static int MemcapCreditTest03(void)
+{
+    MemcapCredit *mc = &memcap_credit_test;
+    FAIL_IF(MemcapCreditInit(mc, "test", 1024) != 0);
+
+    pthread_t t;
+    FAIL_IF(pthread_create(&t, NULL, MemcapCreditTestThread, mc) != 0);
+    pthread_join(t, NULL);
+
+    FAIL_IF(SC_ATOMIC_GET(mc->reserved) != 100);
+    FAIL_IF(MemcapCreditMemuse(mc) != 100);
+
+    MemcapCreditDecr(mc, 0, 100);
+    FAIL_IF(MemcapCreditMemuse(mc) != 0);
+    PASS;
+}
+static void *MemcapCreditTestCheckThread(void *arg)
+{
+    MemcapCredit *mc = arg;
+    static int r;
+    r = MemcapCreditCheck(mc, 128000, 127000);
+    return &r;
+}
+
+/** \test idle credit of other threads is taken back at the memcap */
+static int MemcapCreditTest04(void)
+{
+    MemcapCredit *mc = &memcap_credit_test;
+    FAIL_IF(MemcapCreditInit(mc, "test", 1024) != 0);
+    const uint64_t memcap = 128000; /* chunk becomes 1000 */
+
+    MemcapCreditIncr(mc, memcap, 1000);
+    MemcapCreditDecr(mc, memcap, 1000);
+    FAIL_IF(SC_ATOMIC_GET(mc->reserved) != 2000);
+    FAIL_IF(MemcapCreditMemuse(mc) != 0);
+
+    pthread_t t;
+    void *r = NULL;
+    FAIL_IF(pthread_create(&t, NULL, MemcapCreditTestCheckThread, mc) != 0);
+    pthread_join(t, &r);
+    FAIL_IF_NULL(r);
+    FAIL_IF_NOT(*(int *)r == 1);
+    FAIL_IF(SC_ATOMIC_GET(mc->reserved) != 0);
+    FAIL_IF(SC_ATOMIC_GET(t_memcap_credit->slots[mc->id].credit) != 0);
+
+    /* outstanding memory still counts */
+    MemcapCreditIncr(mc, memcap, 1000);
+    FAIL_IF_NOT(MemcapCreditCheck(mc, memcap, 127000));
+    FAIL_IF(MemcapCreditCheck(mc, memcap, 127001));
+    MemcapCreditDecr(mc, memcap, 1000);
+    FAIL_IF(MemcapCreditMemuse(mc) != 0);
+    PASS;
+}
+
+/** \test no locking if taking back idle credit can't make room */
+static int MemcapCreditTest05(void)
+{
+    MemcapCredit *mc = &memcap_credit_test;
+    FAIL_IF(MemcapCreditInit(mc, "test", 1024) != 0);
+    const uint64_t memcap = 128000;
+
+    MemcapCreditIncr(mc, memcap, 100000);
+    FAIL_IF_NOT(SC_ATOMIC_GET(memcap_credit_thread_cnt) >= 1);
+
+    /* would block if the lock was taken */
+    SCMutexLock(&memcap_credit_lock);
+    FAIL_IF_NOT(MemcapCreditCheck(mc, memcap, 20000));
+    FAIL_IF(MemcapCreditCheck(mc, memcap, 2 * memcap));
+    SCMutexUnlock(&memcap_credit_lock);
+
+    MemcapCreditDecr(mc, memcap, 100000);
+    FAIL_IF(MemcapCreditMemuse(mc) != 0);
+    PASS;
+}
+#endif
+
+void MemcapCreditRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MemcapCreditTest01", MemcapCreditTest01);
+    UtRegisterTest("MemcapCreditTest02", MemcapCreditTest02);
+    UtRegisterTest("MemcapCreditTest03", MemcapCreditTest03);
+    UtRegisterTest("MemcapCreditTest04", MemcapCreditTest04);
+    UtRegisterTest("MemcapCreditTest05", MemcapCreditTest05);
+#endif
+}
@@ -0,0 +1,62 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memcap accounting with per thread credit.
+ *
+ * Instead of updating a global atomic memuse counter for each allocation,
+ * threads reserve memory from the global counter in chunks and account
+ * their allocations against that local credit. Frees add to the credit of
+ * the freeing thread, which hands back what exceeds its chunk. The global
+ * counter is only touched when a thread runs out of credit or has too much
+ * of it.
+ *
+ * The memuse is the reserved memory minus the unused credit of all
+ * threads. The memcap is checked against the reserved memory, so unused
+ * credit counts against it until it's handed back. When the memcap is
+ * reached the unused credit of the other threads is taken back. Credit of
+ * a thread is returned when the thread exits.
+ */
+
+#ifndef __UTIL_MEMCAP_CREDIT_H__
+#define __UTIL_MEMCAP_CREDIT_H__
+
+/** max number of MemcapCredit objects */
+#define MEMCAP_CREDIT_MAX 16
+
+/** default size of the per thread reservations */
+#define MEMCAP_CREDIT_CHUNK_DEFAULT (64 * 1024)
+
+typedef struct MemcapCredit_ {
+    const char *name;
+    int id;         /**< slot in the per thread credit, 0 if not registered */
+    uint32_t chunk; /**< max size of the per thread reservations */
+    SC_ATOMIC_DECLARE(uint64_t, reserved); /**< memory reserved by all threads */
+} MemcapCredit;
+
+int MemcapCreditInit(MemcapCredit *mc, const char *name, uint32_t chunk);
+
+void MemcapCreditIncr(MemcapCredit *mc, const uint64_t memcap, const uint64_t size);
+void MemcapCreditDecr(MemcapCredit *mc, const uint64_t memcap, const uint64_t size);
+int MemcapCreditCheck(MemcapCredit *mc, const uint64_t memcap, const uint64_t size);
+uint64_t MemcapCreditMemuse(MemcapCredit *mc);
+
+void MemcapCreditRegisterTests(void);
+
+#endif /* __UTIL_MEMCAP_CREDIT_H__ */
@@ -79,6 +79,7 @@
 #include "util-memcmp.h"
 #include "util-memcpy.h"
 #include "util-validate.h"
+#include "util-pages.h"
 #include "util-mpm-ac-ks.h"
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
@@ -714,7 +715,7 @@ static void SCACTileClubOutputStatePresenceWithDeltaTable(MpmCtx *mpm_ctx)
 
     /* Allocate next-state table. */
     int size = ctx->state_count * ctx->bytes_per_state * ctx->alphabet_storage;
-    void *state_table = SCMalloc(size);
+    void *state_table = PageLargeAlloc(size, PAGE_LARGE_MPM);
     if (unlikely(state_table == NULL)) {
         FatalError(SC_ERR_FATAL, "Error allocating memory");
     }
@@ -1070,7 +1071,7 @@ static void SCACTileDestroyInitCtx(MpmCtx *mpm_ctx)
     }
 
     if (ctx->state_table != NULL) {
-        SCFree(ctx->state_table);
+        PageLargeFree(ctx->state_table);
 
         mpm_ctx->memory_cnt--;
         mpm_ctx->memory_size -= (ctx->state_count *
@@ -1119,7 +1120,7 @@ void SCACTileDestroyCtx(MpmCtx *mpm_ctx)
     SCACTileDestroyInitCtx(mpm_ctx);
 
     /* Free Search tables */
-    SCFree(search_ctx->state_table);
+    PageLargeFree(search_ctx->state_table);
 
     if (search_ctx->pattern_list != NULL) {
         uint32_t i;
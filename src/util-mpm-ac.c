@@ -60,6 +60,7 @@
 #include "util-mpm-ac.h"
 #include "util-memcpy.h"
 #include "util-validate.h"
+#include "util-pages.h"
 
 void SCACInitCtx(MpmCtx *);
 void SCACInitThreadCtx(MpmCtx *, MpmThreadCtx *);
@@ -563,8 +564,8 @@ static inline void SCACCreateDeltaTable(MpmCtx *mpm_ctx)
     int32_t r_state = 0;
 
     if ((ctx->state_count < 32767) || construct_both_16_and_32_state_tables) {
-        ctx->state_table_u16 = SCMalloc(ctx->state_count *
-                                        sizeof(SC_AC_STATE_TYPE_U16) * 256);
+        ctx->state_table_u16 = PageLargeAlloc(
+                ctx->state_count * sizeof(SC_AC_STATE_TYPE_U16) * 256, PAGE_LARGE_MPM);
         if (ctx->state_table_u16 == NULL) {
             FatalError(SC_ERR_FATAL, "Error allocating memory");
         }
@@ -607,8 +608,8 @@ static inline void SCACCreateDeltaTable(MpmCtx *mpm_ctx)
         /* create space for the state table.  We could have used the existing goto
          * table, but since we have it set to hold 32 bit state values, we will create
          * a new state table here of type SC_AC_STATE_TYPE(current set to uint16_t) */
-        ctx->state_table_u32 = SCMalloc(ctx->state_count *
-                                        sizeof(SC_AC_STATE_TYPE_U32) * 256);
+        ctx->state_table_u32 = PageLargeAlloc(
+                ctx->state_count * sizeof(SC_AC_STATE_TYPE_U32) * 256, PAGE_LARGE_MPM);
         if (ctx->state_table_u32 == NULL) {
             FatalError(SC_ERR_FATAL, "Error allocating memory");
         }
@@ -963,7 +964,7 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
     }
 
     if (ctx->state_table_u16 != NULL) {
-        SCFree(ctx->state_table_u16);
+        PageLargeFree(ctx->state_table_u16);
         ctx->state_table_u16 = NULL;
 
         mpm_ctx->memory_cnt++;
@@ -971,7 +972,7 @@ void SCACDestroyCtx(MpmCtx *mpm_ctx)
                                  sizeof(SC_AC_STATE_TYPE_U16) * 256);
     }
     if (ctx->state_table_u32 != NULL) {
-        SCFree(ctx->state_table_u32);
+        PageLargeFree(ctx->state_table_u32);
         ctx->state_table_u32 = NULL;
 
         mpm_ctx->memory_cnt++;
@@ -0,0 +1,308 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * NUMA topology and memory placement helpers.
+ *
+ * The topology is read from sysfs, so no libnuma is needed. A thread that
+ * is pinned to a cpu gets a preferred memory policy for the node of that
+ * cpu. Code that allocates memory on behalf of another thread, like the
+ * flow spare pool or a rule reload, can temporarily switch the calling
+ * thread to the node of the thread that will use the memory.
+ *
+ * The policy only applies to pages that are faulted in after it is set,
+ * so memory reused by the allocator may still be on another node.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "tm-modules.h"
+#include "util-byte.h"
+#include "util-cpu.h"
+#include "util-debug.h"
+#include "util-numa.h"
+#include "util-unittest.h"
+
+/** set if the system has more than one node and the feature is enabled */
+static bool numa_aware = false;
+static int numa_nodes = 1;
+/** node per cpu, -1 if unknown */
+static int16_t *numa_cpu_node = NULL;
+static uint16_t numa_cpus = 0;
+/** node the calling thread allocates its memory on, -1 if not set */
+static thread_local int numa_thread_node = -1;
+
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+/* from linux/mempolicy.h */
+#define NUMA_MPOL_DEFAULT   0
+#define NUMA_MPOL_PREFERRED 1
+#define NUMA_MASK_BITS      (8 * sizeof(unsigned long))
+
+static void NumaSetMemPolicy(const int node)
+{
+    long r;
+    if (node < 0) {
+        r = syscall(SYS_set_mempolicy, NUMA_MPOL_DEFAULT, NULL, 0);
+    } else {
+        unsigned long mask[UTIL_NUMA_MAX_NODES / NUMA_MASK_BITS];
+        memset(mask, 0, sizeof(mask));
+        mask[node / NUMA_MASK_BITS] = 1UL << (node % NUMA_MASK_BITS);
+        r = syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, mask, UTIL_NUMA_MAX_NODES + 1);
+    }
+    if (r != 0) {
+        SCLogDebug("set_mempolicy for node %d failed: %s", node, strerror(errno));
+    }
+}
+#else
+static void NumaSetMemPolicy(const int node)
+{
+}
+#endif
+
+#if defined(__linux__)
+/** \internal
+ *  \brief get the node of a cpu from its sysfs 'nodeX' link */
+static int NumaReadCpuNode(const int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return -1;
+
+    int32_t node = -1;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (strncmp(de->d_name, "node", 4) == 0 && isdigit((unsigned char)de->d_name[4])) {
+            if (StringParseInt32(&node, 10, 0, de->d_name + 4) < 0)
+                node = -1;
+            break;
+        }
+    }
+    closedir(dir);
+    return node < UTIL_NUMA_MAX_NODES ? node : -1;
+}
+#endif
+
+void UtilNumaInit(void)
+{
+    /* in unix socket mode this is called once per pcap */
+    if (numa_cpu_node != NULL)
+        return;
+
+    int enabled = 1;
+    if (ConfGetBool("threading.numa-aware", &enabled) == 0) {
+        enabled = 1;
+    }
+#if defined(__linux__)
+    const uint16_t cpus = UtilCpuGetNumProcessorsConfigured();
+    if (cpus == 0)
+        return;
+    numa_cpu_node = SCCalloc(cpus, sizeof(*numa_cpu_node));
+    if (numa_cpu_node == NULL)
+        return;
+
+    int max_node = -1;
+    for (uint16_t cpu = 0; cpu < cpus; cpu++) {
+        numa_cpu_node[cpu] = (int16_t)NumaReadCpuNode(cpu);
+        max_node = MAX(max_node, numa_cpu_node[cpu]);
+    }
+    numa_cpus = cpus;
+
+    if (max_node > 0) {
+        if (enabled) {
+            numa_nodes = max_node + 1;
+            numa_aware = true;
+            SCLogConfig("NUMA aware memory allocation enabled for %d nodes", numa_nodes);
+        } else {
+            SCLogConfig("NUMA aware memory allocation disabled");
+        }
+    }
+#endif
+}
+
+/** \brief number of nodes memory is placed on, 1 if not NUMA aware */
+int UtilNumaGetNodeCount(void)
+{
+    return numa_nodes;
+}
+
+/** \brief get the node of a cpu
+ *  \retval node or -1 if unknown or not NUMA aware */
+int UtilNumaGetNodeOfCpu(const int cpu)
+{
+    if (!numa_aware || cpu < 0 || cpu >= numa_cpus)
+        return -1;
+    return numa_cpu_node[cpu];
+}
+
+/**
+ *  \brief place new memory of the calling thread on a node
+ *
+ *  \param node node to prefer or -1 for the default policy
+ *  \retval previous node of the thread, to be passed back to restore it
+ */
+int UtilNumaSetThreadNode(int node)
+{
+    const int prev = numa_thread_node;
+    if (!numa_aware)
+        return prev;
+    if (node >= numa_nodes)
+        node = -1;
+    if (node == prev)
+        return prev;
+
+    numa_thread_node = node;
+    NumaSetMemPolicy(node);
+    return prev;
+}
+
+/** \brief get the node the calling thread uses, 0 if unknown */
+int UtilNumaGetThreadNode(void)
+{
+    if (numa_thread_node >= 0)
+        return numa_thread_node;
+    if (!numa_aware)
+        return 0;
+#if defined(__linux__)
+    const int node = UtilNumaGetNodeOfCpu(sched_getcpu());
+    if (node >= 0)
+        return node;
+#endif
+    return 0;
+}
+
+/**
+ *  \brief count the flow worker threads pinned to each node
+ *
+ *  \param per_node array of UTIL_NUMA_MAX_NODES counters
+ *  \retval total number of pinned worker threads
+ */
+uint32_t UtilNumaGetWorkerThreads(uint32_t *per_node)
+{
+    uint32_t cnt = 0;
+    memset(per_node, 0, UTIL_NUMA_MAX_NODES * sizeof(*per_node));
+
+    SCMutexLock(&tv_root_lock);
+    for (ThreadVars *tv = tv_root[TVT_PPT]; tv != NULL; tv = tv->next) {
+        if ((tv->tmm_flags & TM_FLAG_STREAM_TM) == 0 || tv->numa_node < 0)
+            continue;
+        per_node[tv->numa_node]++;
+        cnt++;
+    }
+    SCMutexUnlock(&tv_root_lock);
+    return cnt;
+}
+
+/** \internal
+ *  \brief add the resident memory of a /proc/self/numa_maps line to the
+ *         per node totals */
+static void NumaMapsParseLine(char *line, uint64_t *mem)
+{
+    uint64_t pages[UTIL_NUMA_MAX_NODES];
+    memset(pages, 0, sizeof(pages));
+    uint64_t page_size = 4096;
+
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(line, " \n", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, " \n", &saveptr)) {
+        int node;
+        uint64_t v;
+        if (sscanf(tok, "N%d=%" SCNu64, &node, &v) == 2) {
+            if (node >= 0 && node < UTIL_NUMA_MAX_NODES)
+                pages[node] += v;
+        } else if (sscanf(tok, "kernelpagesize_kB=%" SCNu64, &v) == 1) {
+            page_size = v * 1024;
+        }
+    }
+    for (int n = 0; n < UTIL_NUMA_MAX_NODES; n++) {
+        mem[n] += pages[n] * page_size;
+    }
+}
+
+static bool NumaGetProcessMemory(uint64_t *mem)
+{
+    FILE *fp = fopen("/proc/self/numa_maps", "r");
+    if (fp == NULL)
+        return false;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        NumaMapsParseLine(line, mem);
+    }
+    fclose(fp);
+    return true;
+}
+
+/** \brief log the worker threads and the memory in use per node */
+void UtilNumaReport(void)
+{
+    if (!numa_aware)
+        return;
+
+    uint32_t workers[UTIL_NUMA_MAX_NODES];
+    UtilNumaGetWorkerThreads(workers);
+    uint64_t mem[UTIL_NUMA_MAX_NODES];
+    memset(mem, 0, sizeof(mem));
+    const bool have_mem = NumaGetProcessMemory(mem);
+
+    for (int n = 0; n < numa_nodes; n++) {
+        if (have_mem) {
+            SCLogConfig("NUMA node %d: %u worker threads, %" PRIu64 " MiB in use", n,
+                    workers[n], mem[n] / (1024 * 1024));
+        } else {
+            SCLogConfig("NUMA node %d: %u worker threads", n, workers[n]);
+        }
+    }
+}
+
+#ifdef UNITTESTS
+
+static int UtilNumaTest01(void)
+{
+    uint64_t mem[UTIL_NUMA_MAX_NODES];
+    memset(mem, 0, sizeof(mem));
+
+    char line1[] = "7f0a1c000000 default anon=3 dirty=3 N0=1 N1=2 kernelpagesize_kB=4\n";
+    NumaMapsParseLine(line1, mem);
+    FAIL_IF(mem[0] != 4096);
+    FAIL_IF(mem[1] != 8192);
+
+    char line2[] = "7f0a40000000 default file=/dev/hugepages/x huge N1=1 kernelpagesize_kB=2048\n";
+    NumaMapsParseLine(line2, mem);
+    FAIL_IF(mem[0] != 4096);
+    FAIL_IF(mem[1] != 8192 + 2048 * 1024);
+
+    /* lines without node information are ignored */
+    char line3[] = "7f0a50000000 default file=/usr/lib/libc.so\n";
+    NumaMapsParseLine(line3, mem);
+    FAIL_IF(mem[0] != 4096);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void UtilNumaRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("UtilNumaTest01", UtilNumaTest01);
+#endif
+}
@@ -0,0 +1,41 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * NUMA topology and memory placement helpers.
+ */
+
+#ifndef __UTIL_NUMA_H__
+#define __UTIL_NUMA_H__
+
+#define UTIL_NUMA_MAX_NODES 64
+
+void UtilNumaInit(void);
+int UtilNumaGetNodeCount(void);
+int UtilNumaGetNodeOfCpu(int cpu);
+
+int UtilNumaSetThreadNode(int node);
+int UtilNumaGetThreadNode(void);
+
+uint32_t UtilNumaGetWorkerThreads(uint32_t *per_node);
+void UtilNumaReport(void);
+
+void UtilNumaRegisterTests(void);
+
+#endif /* __UTIL_NUMA_H__ */
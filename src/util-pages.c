@@ -1,4 +1,4 @@
-/* Copyright (C) 2016 Open Information Security Foundation
+/* Copyright (C) 2016-2022 Open Information Security Foundation
  *
  * You can copy, redistribute or modify this Program under the terms of
  * the GNU General Public License version 2 as published by the Free
@@ -24,7 +24,13 @@
  */
 
 #include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "threads.h"
 #include "util-pages.h"
+#include "util-misc.h"
+#include "util-debug.h"
+#include "util-unittest.h"
 
 #ifndef HAVE_PAGESUPPORTSRWX_AS_MACRO
 
@@ -55,3 +61,334 @@ int PageSupportsRWX(void)
 }
 #endif /* HAVE_PAGESUPPORTSRWX_AS_MACRO */
 
+
+/* Large allocations
+ *
+ * Big, hot tables are placed on hugepages to reduce TLB misses. An
+ * allocation of at least 2MiB is first tried on explicitly reserved
+ * hugepages (MAP_HUGETLB). If none are available, it is mapped 2MiB aligned
+ * and advised for transparent hugepages. Smaller allocations, or all of
+ * them if hugepages are disabled, use regular cache line aligned memory.
+ */
+
+#define PAGE_LARGE_2MB (2UL * 1024 * 1024)
+#define PAGE_LARGE_1GB (1024UL * 1024 * 1024)
+#define PAGE_LARGE_ROUNDUP(s, p) (((s) + (p) - 1) & ~((p) - 1))
+/** max part of a reserved hugepage mapping lost to rounding: 1/8th */
+#define PAGE_LARGE_WASTE_DIV 8
+
+typedef struct PageLargeMapping_ {
+    void *ptr;
+    size_t size; /**< size of the mapping */
+    enum PageLargeUser user;
+    bool hugetlb; /**< explicit hugepages, otherwise transparent ones are advised */
+    struct PageLargeMapping_ *next;
+} PageLargeMapping;
+
+typedef struct PageLargeStats_ {
+    SC_ATOMIC_DECLARE(uint64_t, hugetlb);
+    SC_ATOMIC_DECLARE(uint64_t, thp);
+} PageLargeStats;
+
+static const char * const page_large_user_names[PAGE_LARGE_MAX] = {
+    "flow",
+    "packet",
+    "mpm",
+};
+
+static bool page_large_enabled = true;
+static bool page_large_1gb = false;
+static PageLargeMapping *page_large_mappings = NULL;
+static SCMutex page_large_m = SCMUTEX_INITIALIZER;
+static PageLargeStats page_large_stats[PAGE_LARGE_MAX];
+
+void PageLargeInit(void)
+{
+    int enabled = 1;
+    if (ConfGetBool("hugepages.enabled", &enabled) == 0) {
+        enabled = 1;
+    }
+    page_large_enabled = enabled != 0;
+
+    const char *str = NULL;
+    if (ConfGetValue("hugepages.size", &str) == 1 && str != NULL) {
+        uint64_t size = 0;
+        if (ParseSizeStringU64(str, &size) < 0 ||
+                (size != PAGE_LARGE_2MB && size != PAGE_LARGE_1GB)) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT,
+                    "hugepages.size must be 2mb or 1gb, using 2mb");
+        } else {
+            page_large_1gb = size == PAGE_LARGE_1GB;
+        }
+    }
+    SCLogConfig("hugepages for large allocations %s", page_large_enabled ? "enabled" : "disabled");
+}
+
+#if defined(__linux__) && defined(HAVE_SYS_MMAN_H)
+/** \internal
+ *  \brief map size bytes aligned to 2MiB so it can be backed by
+ *         transparent hugepages */
+static void *PageLargeMapAligned(const size_t size)
+{
+    const size_t align = PAGE_LARGE_2MB;
+    uint8_t *ptr = mmap(NULL, size + align, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+    uint8_t *aligned = (uint8_t *)PAGE_LARGE_ROUNDUP((uintptr_t)ptr, align);
+    if (aligned > ptr) {
+        munmap(ptr, aligned - ptr);
+    }
+    const size_t tail = (size_t)((ptr + size + align) - (aligned + size));
+    if (tail > 0) {
+        munmap(aligned + size, tail);
+    }
+#ifdef MADV_HUGEPAGE
+    (void)madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+#ifdef MAP_HUGETLB
+/** \internal
+ *  \brief pick the reserved hugepage size for an allocation
+ *
+ *  Reserved hugepages are a fixed pool and a mapping is rounded up to whole
+ *  pages, so a table just over a page boundary would use up to twice its
+ *  size. Only use them if at most 1/PAGE_LARGE_WASTE_DIV of the mapping is
+ *  wasted, otherwise the table goes on transparent hugepages.
+ *
+ *  \retval page size or 0 to not use reserved hugepages
+ */
+static size_t PageLargeReservedPageSize(const size_t size)
+{
+    if (page_large_1gb && size >= PAGE_LARGE_1GB &&
+            PAGE_LARGE_ROUNDUP(size, PAGE_LARGE_1GB) - size <= size / PAGE_LARGE_WASTE_DIV) {
+        return PAGE_LARGE_1GB;
+    }
+    if (PAGE_LARGE_ROUNDUP(size, PAGE_LARGE_2MB) - size <= size / PAGE_LARGE_WASTE_DIV) {
+        return PAGE_LARGE_2MB;
+    }
+    return 0;
+}
+#endif
+
+static void *PageLargeMap(const size_t size, const enum PageLargeUser user)
+{
+    PageLargeMapping *m = SCCalloc(1, sizeof(*m));
+    if (unlikely(m == NULL))
+        return NULL;
+
+    void *ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    const size_t page = PageLargeReservedPageSize(size);
+    if (page != 0) {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+        flags |= (page == PAGE_LARGE_1GB ? 30 : 21) << MAP_HUGE_SHIFT;
+#endif
+        m->size = PAGE_LARGE_ROUNDUP(size, page);
+        /* fails right away if not enough hugepages are reserved */
+        ptr = mmap(NULL, m->size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (ptr != MAP_FAILED) {
+            m->hugetlb = true;
+        }
+    }
+#endif
+    if (ptr == MAP_FAILED) {
+        m->size = PAGE_LARGE_ROUNDUP(size, PAGE_LARGE_2MB);
+        ptr = PageLargeMapAligned(m->size);
+        if (ptr == NULL) {
+            SCFree(m);
+            return NULL;
+        }
+    }
+    m->ptr = ptr;
+    m->user = user;
+
+    SCMutexLock(&page_large_m);
+    m->next = page_large_mappings;
+    page_large_mappings = m;
+    SCMutexUnlock(&page_large_m);
+
+    if (m->hugetlb) {
+        SC_ATOMIC_ADD(page_large_stats[user].hugetlb, m->size);
+    } else {
+        SC_ATOMIC_ADD(page_large_stats[user].thp, m->size);
+    }
+    SCLogDebug("%s: mapped %" PRIuMAX " bytes for %" PRIuMAX " byte allocation (%s)",
+            page_large_user_names[user], (uintmax_t)m->size, (uintmax_t)size,
+            m->hugetlb ? "hugetlb" : "thp");
+    return ptr;
+}
+#endif
+
+/**
+ *  \brief allocate memory for a large table, backed by hugepages if possible
+ *
+ *  The memory is cache line aligned but not zeroed. It must be freed with
+ *  PageLargeFree().
+ */
+void *PageLargeAlloc(const size_t size, const enum PageLargeUser user)
+{
+#if defined(__linux__) && defined(HAVE_SYS_MMAN_H)
+    if (page_large_enabled && size >= PAGE_LARGE_2MB) {
+        void *ptr = PageLargeMap(size, user);
+        if (ptr != NULL)
+            return ptr;
+    }
+#endif
+    return SCMallocAligned(size, CLS);
+}
+
+void PageLargeFree(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    PageLargeMapping *m = NULL;
+    SCMutexLock(&page_large_m);
+    for (PageLargeMapping **pm = &page_large_mappings; *pm != NULL; pm = &(*pm)->next) {
+        if ((*pm)->ptr == ptr) {
+            m = *pm;
+            *pm = m->next;
+            break;
+        }
+    }
+    SCMutexUnlock(&page_large_m);
+
+    if (m == NULL) {
+        SCFreeAligned(ptr);
+        return;
+    }
+#if defined(__linux__) && defined(HAVE_SYS_MMAN_H)
+    munmap(m->ptr, m->size);
+#endif
+    if (m->hugetlb) {
+        SC_ATOMIC_SUB(page_large_stats[m->user].hugetlb, m->size);
+    } else {
+        SC_ATOMIC_SUB(page_large_stats[m->user].thp, m->size);
+    }
+    SCFree(m);
+}
+
+/** \brief log the hugepage backed memory per user */
+void PageLargeReport(void)
+{
+    if (!page_large_enabled)
+        return;
+
+    for (int u = 0; u < PAGE_LARGE_MAX; u++) {
+        SCLogConfig("hugepages: %s: %" PRIu64 " bytes on reserved hugepages, %" PRIu64
+                    " bytes advised for transparent hugepages",
+                page_large_user_names[u], SC_ATOMIC_GET(page_large_stats[u].hugetlb),
+                SC_ATOMIC_GET(page_large_stats[u].thp));
+    }
+}
+
+static uint64_t PageLargeFlowCounter(void)
+{
+    return SC_ATOMIC_GET(page_large_stats[PAGE_LARGE_FLOW].hugetlb);
+}
+
+static uint64_t PageLargePacketCounter(void)
+{
+    return SC_ATOMIC_GET(page_large_stats[PAGE_LARGE_PACKET].hugetlb);
+}
+
+static uint64_t PageLargeMpmCounter(void)
+{
+    return SC_ATOMIC_GET(page_large_stats[PAGE_LARGE_MPM].hugetlb);
+}
+
+void PageLargeRegisterGlobalCounters(void)
+{
+    StatsRegisterGlobalCounter("memory.hugepages.flow", PageLargeFlowCounter);
+    StatsRegisterGlobalCounter("memory.hugepages.packet", PageLargePacketCounter);
+    StatsRegisterGlobalCounter("memory.hugepages.mpm", PageLargeMpmCounter);
+}
+
+#ifdef UNITTESTS
+
+static bool PageLargeIsMapped(const void *ptr)
+{
+    bool found = false;
+    SCMutexLock(&page_large_m);
+    for (PageLargeMapping *m = page_large_mappings; m != NULL; m = m->next) {
+        if (m->ptr == ptr) {
+            found = true;
+            break;
+        }
+    }
+    SCMutexUnlock(&page_large_m);
+    return found;
+}
+
+/** \test small allocations use regular memory */
+static int PageLargeTest01(void)
+{
+    uint8_t *ptr = PageLargeAlloc(4096, PAGE_LARGE_MPM);
+    FAIL_IF_NULL(ptr);
+    FAIL_IF(((uintptr_t)ptr & (CLS - 1)) != 0);
+    FAIL_IF(PageLargeIsMapped(ptr));
+    memset(ptr, 0xff, 4096);
+    PageLargeFree(ptr);
+    PASS;
+}
+
+/** \test large allocations are mapped and accounted until freed */
+static int PageLargeTest02(void)
+{
+    const uint64_t hugetlb = SC_ATOMIC_GET(page_large_stats[PAGE_LARGE_MPM].hugetlb);
+    const uint64_t thp = SC_ATOMIC_GET(page_large_stats[PAGE_LARGE_MPM].thp);
+
+    const size_t size = PAGE_LARGE_2MB + 1;
+    uint8_t *ptr = PageLargeAlloc(size, PAGE_LARGE_MPM);
+    FAIL_IF_NULL(ptr);
+    memset(ptr, 0xff, size);
+#if defined(__linux__) && defined(HAVE_SYS_MMAN_H)
+    FAIL_IF(((uintptr_t)ptr & (PAGE_LARGE_2MB - 1)) != 0);
+    FAIL_IF_NOT(PageLargeIsMapped(ptr));
+    const uint64_t mapped = SC_ATOMIC_GET(page_large_stats[PAGE_LARGE_MPM].hugetlb) - hugetlb +
+                            SC_ATOMIC_GET(page_large_stats[PAGE_LARGE_MPM].thp) - thp;
+    FAIL_IF(mapped != 2 * PAGE_LARGE_2MB);
+#endif
+    PageLargeFree(ptr);
+    FAIL_IF(PageLargeIsMapped(ptr));
+    FAIL_IF(SC_ATOMIC_GET(page_large_stats[PAGE_LARGE_MPM].hugetlb) != hugetlb);
+    FAIL_IF(SC_ATOMIC_GET(page_large_stats[PAGE_LARGE_MPM].thp) != thp);
+    PASS;
+}
+
+#if defined(__linux__) && defined(HAVE_SYS_MMAN_H) && defined(MAP_HUGETLB)
+/** \test reserved hugepages are only used if little is lost to rounding */
+static int PageLargeTest03(void)
+{
+    const bool use_1gb = page_large_1gb;
+    page_large_1gb = false;
+    FAIL_IF(PageLargeReservedPageSize(PAGE_LARGE_2MB) != PAGE_LARGE_2MB);
+    FAIL_IF(PageLargeReservedPageSize(PAGE_LARGE_2MB + 1) != 0);
+    FAIL_IF(PageLargeReservedPageSize(9 * PAGE_LARGE_2MB - 4096) != PAGE_LARGE_2MB);
+    FAIL_IF(PageLargeReservedPageSize(PAGE_LARGE_1GB + 1) != PAGE_LARGE_2MB);
+
+    page_large_1gb = true;
+    FAIL_IF(PageLargeReservedPageSize(PAGE_LARGE_1GB) != PAGE_LARGE_1GB);
+    FAIL_IF(PageLargeReservedPageSize(PAGE_LARGE_1GB + 1) != PAGE_LARGE_2MB);
+    page_large_1gb = use_1gb;
+    PASS;
+}
+#endif
+
+#endif /* UNITTESTS */
+
+void PageLargeRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PageLargeTest01", PageLargeTest01);
+    UtRegisterTest("PageLargeTest02", PageLargeTest02);
+#if defined(__linux__) && defined(HAVE_SYS_MMAN_H) && defined(MAP_HUGETLB)
+    UtRegisterTest("PageLargeTest03", PageLargeTest03);
+#endif
+#endif
+}
@@ -41,4 +41,19 @@
     #endif /* HAVE_SYS_MMAN_H */
 #endif
 
+/** users of large allocations, for the hugepage reporting */
+enum PageLargeUser {
+    PAGE_LARGE_FLOW = 0, /**< flow hash buckets */
+    PAGE_LARGE_PACKET,   /**< packet pools */
+    PAGE_LARGE_MPM,      /**< multi pattern matcher state tables */
+    PAGE_LARGE_MAX,
+};
+
+void PageLargeInit(void);
+void *PageLargeAlloc(const size_t size, const enum PageLargeUser user);
+void PageLargeFree(void *ptr);
+void PageLargeReport(void);
+void PageLargeRegisterGlobalCounters(void);
+void PageLargeRegisterTests(void);
+
 #endif /* __UTIL_PAGES_H__ */
@@ -34,6 +34,105 @@
 #include "util-pool-thread.h"
 #include "util-unittest.h"
 #include "util-debug.h"
+#include "util-validate.h"
+
+/** initial size of the return stack, doubled when full */
+#define POOL_THREAD_RETURN_STACK_SIZE 64
+
+/** source of the per thread owner tokens */
+static SC_ATOMIC_DECLARE(uint64_t, pool_thread_tokens);
+/** token of the calling thread, 0 until first used. Unlike a pthread_t it
+ *  is never reused, so a new thread can't be mistaken for an exited owner. */
+static thread_local uint64_t pool_thread_token = 0;
+
+static inline uint64_t PoolThreadSelf(void)
+{
+    if (unlikely(pool_thread_token == 0)) {
+        pool_thread_token = SC_ATOMIC_ADD(pool_thread_tokens, 1) + 1;
+    }
+    return pool_thread_token;
+}
+
+static inline bool PoolThreadIsOwner(const PoolThreadElement *e)
+{
+    return e->owner == PoolThreadSelf();
+}
+
+/** \internal
+ *  \brief put data on the return stack of a pool owned by another thread
+ *  \note e->lock must be held
+ */
+static void PoolThreadPushReturn(PoolThreadElement *e, void *data)
+{
+    if (e->return_stack_cnt == e->return_stack_size) {
+        uint32_t newsize = e->return_stack_size ? e->return_stack_size * 2
+                                                : POOL_THREAD_RETURN_STACK_SIZE;
+        void **ptmp = SCRealloc(e->return_stack, newsize * sizeof(void *));
+        if (ptmp == NULL) {
+            /* can't hand it back to the owner, so free it here. The
+             * owner updates the pool accounting when reclaiming. */
+            Pool *p = e->pool;
+            if (p->Cleanup != NULL)
+                p->Cleanup(data);
+            if (PoolDataPreAllocated(p, data) == 0) {
+                if (p->Free)
+                    p->Free(data);
+                else
+                    SCFree(data);
+            }
+            e->return_freed++;
+            SC_ATOMIC_SET(e->return_cnt, e->return_stack_cnt + e->return_freed);
+            return;
+        }
+        e->return_stack = ptmp;
+        e->return_stack_size = newsize;
+    }
+    e->return_stack[e->return_stack_cnt++] = data;
+    SC_ATOMIC_SET(e->return_cnt, e->return_stack_cnt + e->return_freed);
+}
+
+/** \internal
+ *  \brief move the data returned by other threads back into the pool
+ *  \note e->lock must be held
+ */
+static void PoolThreadReclaimLocked(PoolThreadElement *e)
+{
+    SCLogDebug("reclaiming %u returned, %u freed", e->return_stack_cnt, e->return_freed);
+    for (uint32_t i = 0; i < e->return_stack_cnt; i++) {
+        PoolReturn(e->pool, e->return_stack[i]);
+    }
+    e->return_stack_cnt = 0;
+    e->pool->allocated -= e->return_freed;
+    e->pool->outstanding -= e->return_freed;
+    e->return_freed = 0;
+    SC_ATOMIC_SET(e->return_cnt, 0);
+}
+
+/** \internal
+ *  \brief move the data returned by other threads back into the pool
+ *  \note to be called by the owner, or when no other threads are left
+ */
+static void PoolThreadReclaim(PoolThreadElement *e)
+{
+    SCMutexLock(&e->lock);
+    PoolThreadReclaimLocked(e);
+    SCMutexUnlock(&e->lock);
+}
+
+/** \internal
+ *  \brief return data to a pool owned by another thread, or to a pool
+ *          without owner
+ *  \note e->lock must be held
+ */
+static void PoolThreadReturnRemote(PoolThreadElement *e, void *data)
+{
+    /* nobody would reclaim the return stack */
+    if (e->owner == 0) {
+        PoolReturn(e->pool, data);
+        return;
+    }
+    PoolThreadPushReturn(e, data);
+}
 
 /**
  *  \brief per thread Pool, initialization function
@@ -66,6 +165,9 @@ PoolThread *PoolThreadInit(int threads, uint32_t size, uint32_t prealloc_size,
     for (int i = 0; i < threads; i++) {
         PoolThreadElement *e = &pt->array[i];
 
+        memset(e, 0x00, sizeof(*e));
+        e->owner = PoolThreadSelf();
+        SC_ATOMIC_INIT(e->return_cnt);
         SCMutexInit(&e->lock, NULL);
         SCMutexLock(&e->lock);
 //        SCLogDebug("size %u prealloc_size %u elt_size %u Alloc %p Init %p InitData %p Cleanup %p Free %p",
@@ -126,6 +228,8 @@ int PoolThreadExpand(PoolThread *pt)
 
     e = &pt->array[newsize - 1];
     memset(e, 0x00, sizeof(*e));
+    e->owner = PoolThreadSelf();
+    SC_ATOMIC_INIT(e->return_cnt);
     SCMutexInit(&e->lock, NULL);
     SCMutexLock(&e->lock);
     e->pool = PoolInit(settings.max_buckets, settings.preallocated,
@@ -155,8 +259,11 @@ void PoolThreadFree(PoolThread *pt)
     if (pt->array != NULL) {
         for (int i = 0; i < (int)pt->size; i++) {
             PoolThreadElement *e = &pt->array[i];
+            if (e->pool != NULL)
+                PoolThreadReclaim(e);
             SCMutexLock(&e->lock);
             PoolFree(e->pool);
+            SCFree(e->return_stack);
             SCMutexUnlock(&e->lock);
             SCMutexDestroy(&e->lock);
         }
@@ -173,9 +280,11 @@ void *PoolThreadGetById(PoolThread *pt, uint16_t id)
         return NULL;
 
     PoolThreadElement *e = &pt->array[id];
-    SCMutexLock(&e->lock);
+    DEBUG_VALIDATE_BUG_ON(!PoolThreadIsOwner(e));
+    if (e->pool->alloc_stack == NULL && SC_ATOMIC_GET(e->return_cnt) > 0) {
+        PoolThreadReclaim(e);
+    }
     data = PoolGet(e->pool);
-    SCMutexUnlock(&e->lock);
     if (data) {
         PoolThreadReserved *did = data;
         *did = id;
@@ -194,11 +303,70 @@ void PoolThreadReturn(PoolThread *pt, void *data)
     SCLogDebug("returning to id %u", *id);
 
     PoolThreadElement *e = &pt->array[*id];
+    if (PoolThreadIsOwner(e)) {
+        PoolReturn(e->pool, data);
+        return;
+    }
+
     SCMutexLock(&e->lock);
-    PoolReturn(e->pool, data);
+    PoolThreadReturnRemote(e, data);
     SCMutexUnlock(&e->lock);
 }
 
+void PoolThreadReturnBatch(PoolThread *pt, void **data, uint32_t cnt)
+{
+    if (pt == NULL)
+        return;
+
+    uint32_t i = 0;
+    while (i < cnt) {
+        const PoolThreadReserved id = *(PoolThreadReserved *)data[i];
+        if (id >= pt->size) {
+            i++;
+            continue;
+        }
+
+        PoolThreadElement *e = &pt->array[id];
+        if (PoolThreadIsOwner(e)) {
+            for (; i < cnt && *(PoolThreadReserved *)data[i] == id; i++) {
+                PoolReturn(e->pool, data[i]);
+            }
+            continue;
+        }
+
+        /* push the whole run for this pool under a single lock */
+        SCMutexLock(&e->lock);
+        for (; i < cnt && *(PoolThreadReserved *)data[i] == id; i++) {
+            PoolThreadReturnRemote(e, data[i]);
+        }
+        SCMutexUnlock(&e->lock);
+    }
+}
+
+void PoolThreadRelease(PoolThread *pt, uint16_t id)
+{
+    if (pt == NULL || id >= pt->size)
+        return;
+
+    PoolThreadElement *e = &pt->array[id];
+    DEBUG_VALIDATE_BUG_ON(!PoolThreadIsOwner(e));
+    SCMutexLock(&e->lock);
+    PoolThreadReclaimLocked(e);
+    e->owner = 0;
+    SCMutexUnlock(&e->lock);
+}
+
+uint32_t PoolThreadInUse(PoolThread *pt, uint16_t id)
+{
+    if (pt == NULL || id >= pt->size)
+        return 0;
+
+    PoolThreadElement *e = &pt->array[id];
+    const uint32_t returned = SC_ATOMIC_GET(e->return_cnt);
+    const uint32_t outstanding = e->pool->outstanding;
+    return outstanding > returned ? outstanding - returned : 0;
+}
+
 #ifdef UNITTESTS
 struct PoolThreadTestData {
     PoolThreadReserved res;
@@ -370,6 +538,162 @@ static int PoolThreadTestGrow03(void)
     PASS;
 }
 
+struct PoolThreadTestReturnCtx {
+    PoolThread *pt;
+    void **data;
+    uint32_t cnt;
+};
+
+static void *PoolThreadTestReturner(void *arg)
+{
+    struct PoolThreadTestReturnCtx *ctx = arg;
+    if (ctx->cnt == 1)
+        PoolThreadReturn(ctx->pt, ctx->data[0]);
+    else
+        PoolThreadReturnBatch(ctx->pt, ctx->data, ctx->cnt);
+    return NULL;
+}
+
+/** \test return from another thread goes through the return stack */
+static int PoolThreadTestReturnRemote01(void)
+{
+    int i = 123;
+
+    PoolThread *pt = PoolThreadInit(2, /* threads */
+                                    10, 0, 10, PoolThreadTestAlloc,
+                                    PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
+    FAIL_IF_NULL(pt);
+
+    void *data = PoolThreadGetById(pt, 1);
+    FAIL_IF_NULL(data);
+    FAIL_IF_NOT(PoolThreadInUse(pt, 1) == 1);
+
+    struct PoolThreadTestReturnCtx ctx = { pt, &data, 1 };
+    pthread_t t;
+    FAIL_IF(pthread_create(&t, NULL, PoolThreadTestReturner, &ctx) != 0);
+    pthread_join(t, NULL);
+
+    /* not in the pool yet, but no longer in use */
+    FAIL_IF_NOT(pt->array[1].return_stack_cnt == 1);
+    FAIL_IF_NOT(pt->array[1].pool->outstanding == 1);
+    FAIL_IF_NOT(PoolThreadInUse(pt, 1) == 0);
+
+    /* pool is empty, so the get reclaims the returned data */
+    void *data2 = PoolThreadGetById(pt, 1);
+    FAIL_IF_NOT(data2 == data);
+    FAIL_IF_NOT(pt->array[1].return_stack_cnt == 0);
+    FAIL_IF_NOT(pt->array[1].pool->outstanding == 1);
+
+    PoolThreadReturn(pt, data2);
+    FAIL_IF_NOT(pt->array[1].pool->outstanding == 0);
+
+    PoolThreadFree(pt);
+    PASS;
+}
+
+/** \test batched return from another thread */
+static int PoolThreadTestReturnBatch01(void)
+{
+    int i = 123;
+
+    PoolThread *pt = PoolThreadInit(2, /* threads */
+                                    10, 0, 10, PoolThreadTestAlloc,
+                                    PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
+    FAIL_IF_NULL(pt);
+
+    void *data[6];
+    for (int x = 0; x < 6; x++) {
+        data[x] = PoolThreadGetById(pt, x < 4 ? 0 : 1);
+        FAIL_IF_NULL(data[x]);
+    }
+    FAIL_IF_NOT(PoolThreadInUse(pt, 0) == 4);
+    FAIL_IF_NOT(PoolThreadInUse(pt, 1) == 2);
+
+    struct PoolThreadTestReturnCtx ctx = { pt, data, 6 };
+    pthread_t t;
+    FAIL_IF(pthread_create(&t, NULL, PoolThreadTestReturner, &ctx) != 0);
+    pthread_join(t, NULL);
+
+    FAIL_IF_NOT(pt->array[0].return_stack_cnt == 4);
+    FAIL_IF_NOT(pt->array[1].return_stack_cnt == 2);
+    FAIL_IF_NOT(PoolThreadInUse(pt, 0) == 0);
+    FAIL_IF_NOT(PoolThreadInUse(pt, 1) == 0);
+
+    /* returns by the owner don't use the return stack */
+    void *d = PoolThreadGetById(pt, 0);
+    FAIL_IF_NULL(d);
+    FAIL_IF_NOT(pt->array[0].return_stack_cnt == 0);
+    PoolThreadReturnBatch(pt, &d, 1);
+    FAIL_IF_NOT(pt->array[0].return_stack_cnt == 0);
+    FAIL_IF_NOT(pt->array[0].pool->outstanding == 0);
+
+    /* data still on the return stack is released by PoolThreadFree */
+    PoolThreadFree(pt);
+    PASS;
+}
+
+struct PoolThreadTestOwnerCtx {
+    PoolThread *pt;
+    int id;
+    void *data;
+};
+
+static void *PoolThreadTestOwner(void *arg)
+{
+    struct PoolThreadTestOwnerCtx *ctx = arg;
+    ctx->id = PoolThreadExpand(ctx->pt);
+    if (ctx->id >= 0)
+        ctx->data = PoolThreadGetById(ctx->pt, (uint16_t)ctx->id);
+    return NULL;
+}
+
+/** \test pools of exited threads */
+static int PoolThreadTestRelease01(void)
+{
+    int i = 123;
+
+    PoolThread *pt = PoolThreadInit(1, /* threads */
+                                    10, 0, 10, PoolThreadTestAlloc,
+                                    PoolThreadTestInit, &i, PoolThreadTestFree, NULL);
+    FAIL_IF_NULL(pt);
+
+    /* a thread that owned a pool exited without releasing it: a new
+     * thread, which may get the same pthread_t, is no owner */
+    struct PoolThreadTestOwnerCtx octx = { pt, -1, NULL };
+    pthread_t t;
+    FAIL_IF(pthread_create(&t, NULL, PoolThreadTestOwner, &octx) != 0);
+    pthread_join(t, NULL);
+    FAIL_IF_NOT(octx.id == 1);
+    FAIL_IF_NULL(octx.data);
+    struct PoolThreadTestReturnCtx ctx = { pt, &octx.data, 1 };
+    FAIL_IF(pthread_create(&t, NULL, PoolThreadTestReturner, &ctx) != 0);
+    pthread_join(t, NULL);
+    FAIL_IF_NOT(pt->array[1].return_stack_cnt == 1);
+
+    /* release by the owner drains the return stack */
+    void *data = PoolThreadGetById(pt, 0);
+    FAIL_IF_NULL(data);
+    void *data2 = PoolThreadGetById(pt, 0);
+    FAIL_IF_NULL(data2);
+    ctx.data = &data;
+    FAIL_IF(pthread_create(&t, NULL, PoolThreadTestReturner, &ctx) != 0);
+    pthread_join(t, NULL);
+    FAIL_IF_NOT(pt->array[0].return_stack_cnt == 1);
+    PoolThreadRelease(pt, 0);
+    FAIL_IF_NOT(pt->array[0].return_stack_cnt == 0);
+    FAIL_IF_NOT(pt->array[0].pool->outstanding == 1);
+
+    /* later returns go straight into the released pool */
+    ctx.data = &data2;
+    FAIL_IF(pthread_create(&t, NULL, PoolThreadTestReturner, &ctx) != 0);
+    pthread_join(t, NULL);
+    FAIL_IF_NOT(pt->array[0].return_stack_cnt == 0);
+    FAIL_IF_NOT(pt->array[0].pool->outstanding == 0);
+
+    PoolThreadFree(pt);
+    PASS;
+}
+
 #endif
 
 void PoolThreadRegisterTests(void)
@@ -382,6 +706,9 @@ void PoolThreadRegisterTests(void)
     UtRegisterTest("PoolThreadTestGet02", PoolThreadTestGet02);
 
     UtRegisterTest("PoolThreadTestReturn01", PoolThreadTestReturn01);
+    UtRegisterTest("PoolThreadTestReturnRemote01", PoolThreadTestReturnRemote01);
+    UtRegisterTest("PoolThreadTestReturnBatch01", PoolThreadTestReturnBatch01);
+    UtRegisterTest("PoolThreadTestRelease01", PoolThreadTestRelease01);
 
     UtRegisterTest("PoolThreadTestGrow01", PoolThreadTestGrow01);
     UtRegisterTest("PoolThreadTestGrow02", PoolThreadTestGrow02);
@@ -34,14 +34,28 @@
  *
  *  It's purpose is to make sure thread X can return data to a pool
  *  from thread Y.
+ *
+ *  Each pool is owned by the thread that created it with PoolThreadInit()
+ *  or PoolThreadExpand(). The owner gets and returns data without
+ *  locking. Data returned by other threads is put on the pool's return
+ *  stack, which the owner moves back into its pool in one go when it runs
+ *  out of data. When the owner exits it releases its pool with
+ *  PoolThreadRelease(), after which other threads return directly into it.
  */
 
 #ifndef __UTIL_POOL_THREAD_H__
 #define __UTIL_POOL_THREAD_H__
 
 struct PoolThreadElement_ {
-    SCMutex lock;                   /**< lock, should have low contention */
-    Pool *pool;                     /**< actual pool */
+    SCMutex lock;                   /**< lock for the return stack, should have low contention */
+    Pool *pool;                     /**< actual pool, only used by the owner */
+    uint64_t owner;                 /**< token of the thread owning the pool, 0 once released */
+
+    void **return_stack;            /**< data returned by other threads */
+    uint32_t return_stack_cnt;
+    uint32_t return_stack_size;
+    uint32_t return_freed;          /**< data other threads had to free directly */
+    SC_ATOMIC_DECLARE(uint32_t, return_cnt); /**< lockless check for pending returns */
 };
 // __attribute__((aligned(CLS))); <- VJ: breaks on clang 32bit, segv in PoolThreadTestGrow01
 
@@ -88,6 +102,27 @@ void *PoolThreadGetById(PoolThread *pt, uint16_t id);
  *  \param data memory block to return, with PoolThreadReserved as it's first member */
 void PoolThreadReturn(PoolThread *pt, void *data);
 
+/** \brief return a batch of data to thread pool
+ *  \note locks each foreign pool once per run of data belonging to it
+ *  \param pt thread pool
+ *  \param data array of memory blocks to return
+ *  \param cnt number of blocks in data */
+void PoolThreadReturnBatch(PoolThread *pt, void **data, uint32_t cnt);
+
+/** \brief give up ownership of a thread's pool
+ *  \note to be called by the owner when it exits. Data returned later is
+ *        put back into the pool directly.
+ *  \param pt thread pool
+ *  \param id thread id */
+void PoolThreadRelease(PoolThread *pt, uint16_t id);
+
+/** \brief get number of data items of a thread's pool that are in use
+ *  \note to be called by the owner of the pool
+ *  \param pt thread pool
+ *  \param id thread id
+ *  \retval cnt items handed out and not yet returned */
+uint32_t PoolThreadInUse(PoolThread *pt, uint16_t id);
+
 /** \brief get size of PoolThread (number of 'threads', so array elements)
  *  \param pt thread pool
  *  \retval size or -1 on error */
@@ -55,7 +55,7 @@ static int PoolMemset(void *pitem, void *initdata)
 /**
  * \brief Check if data is preallocated
  * \retval 0 if not inside the prealloc'd block, 1 if inside */
-static int PoolDataPreAllocated(Pool *p, void *data)
+int PoolDataPreAllocated(Pool *p, void *data)
 {
     ptrdiff_t delta = data - p->data_buffer;
     if ((delta < 0) || (delta > p->data_buffer_size)) {
@@ -79,6 +79,7 @@ void PoolPrintSaturation(Pool *p);
 
 void *PoolGet(Pool *);
 void PoolReturn(Pool *, void *);
+int PoolDataPreAllocated(Pool *p, void *data);
 
 void PoolRegisterTests(void);
 
@@ -68,6 +68,15 @@ void SCDropMainThreadCaps(uint32_t userid, uint32_t groupid)
                     CAP_NET_ADMIN,
                     -1);
             break;
+        case RUNMODE_AFXDP_DEV:
+            capng_updatev(CAPNG_ADD, CAPNG_EFFECTIVE|CAPNG_PERMITTED,
+                    CAP_NET_RAW,            /* needed for AF_XDP sockets */
+                    CAP_SYS_NICE,
+                    CAP_NET_ADMIN,
+                    CAP_IPC_LOCK,           /* UMEM is locked memory */
+                    CAP_SYS_ADMIN,          /* XDP program and map access */
+                    -1);
+            break;
         case RUNMODE_PFRING:
             capng_updatev(CAPNG_ADD, CAPNG_EFFECTIVE|CAPNG_PERMITTED,
                     CAP_NET_ADMIN, CAP_NET_RAW, CAP_SYS_NICE,
@@ -0,0 +1,670 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled profiling of the detection engine.
+ *
+ * In builds without --enable-profiling the rule, keyword, prefilter and
+ * rule group profiling hooks only take timestamps while the detection of a
+ * sampled packet is running. About one packet in 'rate' is sampled per
+ * detect thread, at a randomized interval so that periodic traffic can't
+ * align with the sampling. The per thread results are merged into the
+ * detect engine once per second and scaled by packets / sampled packets
+ * when exported through the unix socket and the stats EVE records.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "detect.h"
+#include "detect-engine.h"
+#include "detect-engine-prefilter.h"
+#include "conf.h"
+
+#include "util-byte.h"
+#include "util-unittest.h"
+#include "util-profiling-sampling.h"
+
+#define PROFILING_SAMPLE_DEFAULT_RATE 1000
+#define PROFILING_SAMPLE_DEFAULT_LIMIT 20
+
+typedef struct SCProfileSampleData_ {
+    uint64_t checks;
+    uint64_t matches;
+    uint64_t ticks;
+} SCProfileSampleData;
+
+typedef struct SCProfileSampleSghData_ {
+    uint64_t checks;
+    uint64_t post_prefilter_sigs;
+    uint64_t mpm_matches;
+} SCProfileSampleSghData;
+
+typedef struct SCProfileSampleStore_ {
+    uint64_t packets; /**< packets seen by detect */
+    uint64_t sampled; /**< packets that were profiled */
+    SCProfileSampleData *rules;     /**< indexed by Signature::num */
+    SCProfileSampleData *prefilter; /**< indexed by PrefilterEngine::gid */
+    SCProfileSampleSghData *sghs;   /**< indexed by SigGroupHead::id */
+    SCProfileSampleData keywords[DETECT_TBLSIZE];
+} SCProfileSampleStore;
+
+typedef struct SCProfileSampleDetectCtx_ {
+    uint32_t rules_size;
+    uint32_t prefilter_size;
+    uint32_t sghs_size;
+    const char **prefilter_names;
+    SCMutex m; /**< protects store */
+    SCProfileSampleStore store;
+} SCProfileSampleDetectCtx;
+
+typedef struct SCProfileSampleThreadData_ {
+    SCProfileSampleDetectCtx *ctx;
+    uint32_t countdown; /**< packets until the next sampled one */
+    uint32_t rnd;
+    time_t last_merge;
+    SCProfileSampleStore store;
+} SCProfileSampleThreadData;
+
+typedef struct SCProfileSampleSummary_ {
+    uint32_t idx;
+    uint64_t checks;
+    uint64_t matches;
+    uint64_t ticks;
+} SCProfileSampleSummary;
+
+int profiling_sample_enabled = 0;
+thread_local int profiling_sample_active = 0;
+static uint32_t profiling_sample_rate = PROFILING_SAMPLE_DEFAULT_RATE;
+static uint32_t profiling_sample_limit = PROFILING_SAMPLE_DEFAULT_LIMIT;
+
+void SCProfilingSampleGlobalInit(void)
+{
+    ConfNode *conf = ConfGetNode("profiling.sampling");
+    if (conf == NULL || !ConfNodeChildValueIsTrue(conf, "enabled"))
+        return;
+
+#ifdef PROFILING
+    SCLogWarning(SC_ERR_INVALID_ARGUMENT, "profiling.sampling is not supported in "
+                                          "--enable-profiling builds, use profiling.rules, "
+                                          "profiling.keywords, etc instead");
+    return;
+#endif
+
+    const char *val = ConfNodeLookupChildValue(conf, "rate");
+    if (val != NULL) {
+        if (StringParseU32RangeCheck(&profiling_sample_rate, 10, 0, val, 1, 1000000) < 0) {
+            FatalError(SC_ERR_INVALID_ARGUMENT,
+                    "invalid profiling.sampling.rate %s, must be between 1 and 1000000", val);
+        }
+    }
+    val = ConfNodeLookupChildValue(conf, "limit");
+    if (val != NULL) {
+        if (StringParseUint32(&profiling_sample_limit, 10, 0, val) < 0) {
+            FatalError(SC_ERR_INVALID_ARGUMENT, "invalid profiling.sampling.limit %s", val);
+        }
+    }
+
+    profiling_sample_enabled = 1;
+    SCLogConfig("sampled profiling enabled: 1 in %u packets, top %u entries exported",
+            profiling_sample_rate, profiling_sample_limit);
+}
+
+static int SampleStoreAlloc(SCProfileSampleStore *store, const SCProfileSampleDetectCtx *ctx)
+{
+    memset(store, 0, sizeof(*store));
+    if (ctx->rules_size > 0) {
+        store->rules = SCCalloc(ctx->rules_size, sizeof(SCProfileSampleData));
+        if (store->rules == NULL)
+            return -1;
+    }
+    if (ctx->prefilter_size > 0) {
+        store->prefilter = SCCalloc(ctx->prefilter_size, sizeof(SCProfileSampleData));
+        if (store->prefilter == NULL)
+            return -1;
+    }
+    if (ctx->sghs_size > 0) {
+        store->sghs = SCCalloc(ctx->sghs_size, sizeof(SCProfileSampleSghData));
+        if (store->sghs == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+static void SampleStoreFree(SCProfileSampleStore *store)
+{
+    SCFree(store->rules);
+    SCFree(store->prefilter);
+    SCFree(store->sghs);
+    memset(store, 0, sizeof(*store));
+}
+
+static inline void SampleDataMerge(SCProfileSampleData *dst, SCProfileSampleData *src)
+{
+    dst->checks += src->checks;
+    dst->matches += src->matches;
+    dst->ticks += src->ticks;
+    memset(src, 0, sizeof(*src));
+}
+
+/** \internal
+ *  \brief add the counters of src to dst and reset src */
+static void SampleStoreMerge(
+        const SCProfileSampleDetectCtx *ctx, SCProfileSampleStore *dst, SCProfileSampleStore *src)
+{
+    dst->packets += src->packets;
+    dst->sampled += src->sampled;
+    src->packets = src->sampled = 0;
+
+    for (uint32_t i = 0; i < ctx->rules_size; i++) {
+        if (src->rules[i].checks)
+            SampleDataMerge(&dst->rules[i], &src->rules[i]);
+    }
+    for (uint32_t i = 0; i < ctx->prefilter_size; i++) {
+        if (src->prefilter[i].checks)
+            SampleDataMerge(&dst->prefilter[i], &src->prefilter[i]);
+    }
+    for (int i = 0; i < DETECT_TBLSIZE; i++) {
+        if (src->keywords[i].checks)
+            SampleDataMerge(&dst->keywords[i], &src->keywords[i]);
+    }
+    for (uint32_t i = 0; i < ctx->sghs_size; i++) {
+        if (src->sghs[i].checks) {
+            dst->sghs[i].checks += src->sghs[i].checks;
+            dst->sghs[i].post_prefilter_sigs += src->sghs[i].post_prefilter_sigs;
+            dst->sghs[i].mpm_matches += src->sghs[i].mpm_matches;
+            memset(&src->sghs[i], 0, sizeof(src->sghs[i]));
+        }
+    }
+}
+
+/** \internal
+ *  \brief get the number of packets until the next sampled one
+ *
+ *  Uniform in [1, 2 * rate - 1] so the mean interval is 'rate'. */
+static uint32_t SampleNextCountdown(uint32_t *rnd, const uint32_t rate)
+{
+    if (rate <= 1)
+        return 1;
+
+    /* xorshift32 */
+    uint32_t x = *rnd;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *rnd = x;
+    return 1 + x % (2 * rate - 1);
+}
+
+void SCProfilingSampleInitCounters(DetectEngineCtx *de_ctx)
+{
+    if (!profiling_sample_enabled)
+        return;
+
+    SCProfileSampleDetectCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (ctx == NULL)
+        goto error;
+    SCMutexInit(&ctx->m, NULL);
+    ctx->rules_size = de_ctx->sig_array_len;
+    ctx->prefilter_size = de_ctx->prefilter_id;
+    ctx->sghs_size = de_ctx->sgh_array_cnt;
+
+    if (ctx->prefilter_size > 0) {
+        ctx->prefilter_names = SCCalloc(ctx->prefilter_size, sizeof(char *));
+        if (ctx->prefilter_names == NULL)
+            goto error;
+        HashListTableBucket *hb = HashListTableGetListHead(de_ctx->prefilter_hash_table);
+        for (; hb != NULL; hb = HashListTableGetListNext(hb)) {
+            PrefilterStore *pf = HashListTableGetListData(hb);
+            if (pf->id < ctx->prefilter_size)
+                ctx->prefilter_names[pf->id] = pf->name;
+        }
+    }
+    if (SampleStoreAlloc(&ctx->store, ctx) < 0)
+        goto error;
+
+    de_ctx->profile_sample_ctx = ctx;
+    SCLogPerf("sampled profiling set up for %u rules, %u prefilter engines and %u rule groups",
+            ctx->rules_size, ctx->prefilter_size, ctx->sghs_size);
+    return;
+error:
+    FatalError(SC_ERR_MEM_ALLOC, "failed to allocate sampled profiling context");
+}
+
+void SCProfilingSampleDestroyCtx(DetectEngineCtx *de_ctx)
+{
+    SCProfileSampleDetectCtx *ctx = de_ctx->profile_sample_ctx;
+    if (ctx == NULL)
+        return;
+
+    SampleStoreFree(&ctx->store);
+    SCFree(ctx->prefilter_names);
+    SCMutexDestroy(&ctx->m);
+    SCFree(ctx);
+    de_ctx->profile_sample_ctx = NULL;
+}
+
+void SCProfilingSampleThreadSetup(DetectEngineCtx *de_ctx, DetectEngineThreadCtx *det_ctx)
+{
+    SCProfileSampleDetectCtx *ctx = de_ctx->profile_sample_ctx;
+    if (ctx == NULL)
+        return;
+
+    SCProfileSampleThreadData *td = SCCalloc(1, sizeof(*td));
+    if (td == NULL || SampleStoreAlloc(&td->store, ctx) < 0) {
+        FatalError(SC_ERR_MEM_ALLOC, "failed to allocate sampled profiling thread data");
+    }
+    td->ctx = ctx;
+    /* seed per thread so the threads don't sample in lockstep */
+    td->rnd = ((uint32_t)(uintptr_t)td * 2654435761U) ^ (uint32_t)time(NULL);
+    if (td->rnd == 0)
+        td->rnd = 1;
+    td->countdown = SampleNextCountdown(&td->rnd, profiling_sample_rate);
+    det_ctx->profile_sample_data = td;
+}
+
+void SCProfilingSampleThreadCleanup(DetectEngineThreadCtx *det_ctx)
+{
+    SCProfileSampleThreadData *td = det_ctx->profile_sample_data;
+    if (td == NULL)
+        return;
+
+    SCMutexLock(&td->ctx->m);
+    SampleStoreMerge(td->ctx, &td->ctx->store, &td->store);
+    SCMutexUnlock(&td->ctx->m);
+
+    SampleStoreFree(&td->store);
+    SCFree(td);
+    det_ctx->profile_sample_data = NULL;
+}
+
+/**
+ *  \brief account a packet and decide if its detection is profiled
+ *
+ *  \retval 1 packet is sampled, SCProfilingSampleEnd() must be called
+ *  \retval 0 packet is not sampled
+ */
+int SCProfilingSampleStart(DetectEngineThreadCtx *det_ctx)
+{
+    SCProfileSampleThreadData *td = det_ctx->profile_sample_data;
+    td->store.packets++;
+    if (--td->countdown > 0)
+        return 0;
+
+    td->countdown = SampleNextCountdown(&td->rnd, profiling_sample_rate);
+    td->store.sampled++;
+    profiling_sample_active = 1;
+    return 1;
+}
+
+void SCProfilingSampleEnd(DetectEngineThreadCtx *det_ctx, const Packet *p)
+{
+    profiling_sample_active = 0;
+
+    SCProfileSampleThreadData *td = det_ctx->profile_sample_data;
+    if (p->ts.tv_sec != td->last_merge) {
+        SCMutexLock(&td->ctx->m);
+        SampleStoreMerge(td->ctx, &td->ctx->store, &td->store);
+        SCMutexUnlock(&td->ctx->m);
+        td->last_merge = p->ts.tv_sec;
+    }
+}
+
+void SCProfilingSampleRuleUpdateCounter(
+        DetectEngineThreadCtx *det_ctx, uint32_t num, uint64_t ticks, int match)
+{
+    SCProfileSampleThreadData *td = det_ctx->profile_sample_data;
+    if (td != NULL && num < td->ctx->rules_size) {
+        SCProfileSampleData *d = &td->store.rules[num];
+        d->checks++;
+        d->matches += (match != 0);
+        d->ticks += ticks;
+    }
+}
+
+void SCProfilingSampleKeywordUpdateCounter(
+        DetectEngineThreadCtx *det_ctx, int type, uint64_t ticks, int match)
+{
+    SCProfileSampleThreadData *td = det_ctx->profile_sample_data;
+    if (td != NULL && type >= 0 && type < DETECT_TBLSIZE) {
+        SCProfileSampleData *d = &td->store.keywords[type];
+        d->checks++;
+        d->matches += (match != 0);
+        d->ticks += ticks;
+    }
+}
+
+void SCProfilingSamplePrefilterUpdateCounter(DetectEngineThreadCtx *det_ctx, int id, uint64_t ticks)
+{
+    SCProfileSampleThreadData *td = det_ctx->profile_sample_data;
+    if (td != NULL && id >= 0 && (uint32_t)id < td->ctx->prefilter_size) {
+        SCProfileSampleData *d = &td->store.prefilter[id];
+        d->checks++;
+        d->ticks += ticks;
+    }
+}
+
+void SCProfilingSampleSghUpdateCounter(DetectEngineThreadCtx *det_ctx, const SigGroupHead *sgh)
+{
+    SCProfileSampleThreadData *td = det_ctx->profile_sample_data;
+    if (td != NULL && sgh->id < td->ctx->sghs_size) {
+        SCProfileSampleSghData *d = &td->store.sghs[sgh->id];
+        d->checks++;
+        d->post_prefilter_sigs += det_ctx->match_array_cnt;
+        d->mpm_matches += det_ctx->pmq.rule_id_array_cnt;
+    }
+}
+
+/** \internal
+ *  \brief scale a counter of the sampled packets to all packets */
+static inline uint64_t SampleScale(uint64_t v, uint64_t packets, uint64_t sampled)
+{
+    if (sampled == 0)
+        return 0;
+    return (uint64_t)((long double)v * packets / sampled);
+}
+
+static int SampleSummaryCompare(const void *a, const void *b)
+{
+    const SCProfileSampleSummary *s0 = a;
+    const SCProfileSampleSummary *s1 = b;
+    if (s1->ticks == s0->ticks)
+        return 0;
+    return s1->ticks > s0->ticks ? 1 : -1;
+}
+
+/** \internal
+ *  \brief get the used entries of data, sorted by ticks
+ *  \retval cnt number of entries in *out */
+static uint32_t SampleSummarize(
+        const SCProfileSampleData *data, uint32_t size, SCProfileSampleSummary **out)
+{
+    *out = NULL;
+    uint32_t cnt = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        if (data[i].checks)
+            cnt++;
+    }
+    if (cnt == 0)
+        return 0;
+
+    SCProfileSampleSummary *summary = SCCalloc(cnt, sizeof(*summary));
+    if (summary == NULL)
+        return 0;
+    cnt = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        if (data[i].checks) {
+            summary[cnt].idx = i;
+            summary[cnt].checks = data[i].checks;
+            summary[cnt].matches = data[i].matches;
+            summary[cnt].ticks = data[i].ticks;
+            cnt++;
+        }
+    }
+    qsort(summary, cnt, sizeof(*summary), SampleSummaryCompare);
+    *out = summary;
+    return cnt;
+}
+
+/** \internal
+ *  \brief add the scaled counters of the top entries of data to an array
+ *
+ *  \param Name callback adding the fields identifying entry 'idx' to 'js'
+ */
+static json_t *SampleDataToJSON(const SCProfileSampleData *data, uint32_t size,
+        const SCProfileSampleStore *store, bool with_matches,
+        void (*Name)(json_t *js, uint32_t idx, const void *name_data), const void *name_data)
+{
+    json_t *jsa = json_array();
+    if (jsa == NULL)
+        return NULL;
+
+    SCProfileSampleSummary *summary = NULL;
+    const uint32_t cnt = SampleSummarize(data, size, &summary);
+    uint64_t total_ticks = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+        total_ticks += summary[i].ticks;
+    }
+
+    for (uint32_t i = 0; i < cnt && i < profiling_sample_limit; i++) {
+        json_t *jsm = json_object();
+        if (jsm == NULL)
+            break;
+        Name(jsm, summary[i].idx, name_data);
+        json_object_set_new(jsm, "checks",
+                json_integer(SampleScale(summary[i].checks, store->packets, store->sampled)));
+        if (with_matches) {
+            json_object_set_new(jsm, "matches",
+                    json_integer(SampleScale(summary[i].matches, store->packets, store->sampled)));
+        }
+        json_object_set_new(jsm, "ticks_total",
+                json_integer(SampleScale(summary[i].ticks, store->packets, store->sampled)));
+        json_object_set_new(jsm, "ticks_avg", json_integer(summary[i].ticks / summary[i].checks));
+        json_object_set_new(jsm, "percent",
+                json_real(total_ticks ? (double)summary[i].ticks * 100.0 / total_ticks : 0.0));
+        json_array_append_new(jsa, jsm);
+    }
+    SCFree(summary);
+    return jsa;
+}
+
+static void SampleRuleName(json_t *js, uint32_t idx, const void *name_data)
+{
+    const DetectEngineCtx *de_ctx = name_data;
+    const Signature *s = de_ctx->sig_array[idx];
+    if (s != NULL) {
+        json_object_set_new(js, "signature_id", json_integer(s->id));
+        json_object_set_new(js, "gid", json_integer(s->gid));
+        json_object_set_new(js, "rev", json_integer(s->rev));
+    }
+}
+
+static void SampleKeywordName(json_t *js, uint32_t idx, const void *name_data)
+{
+    json_object_set_new(js, "keyword", json_string(sigmatch_table[idx].name));
+}
+
+static void SamplePrefilterName(json_t *js, uint32_t idx, const void *name_data)
+{
+    const char * const *names = name_data;
+    json_object_set_new(js, "engine", json_string(names[idx] ? names[idx] : "unknown"));
+}
+
+static json_t *SampleSghsToJSON(const SCProfileSampleDetectCtx *ctx, const SCProfileSampleStore *store)
+{
+    json_t *jsa = json_array();
+    if (jsa == NULL)
+        return NULL;
+
+    /* rule groups have no ticks, so rank them by checks */
+    SCProfileSampleSummary *summary = NULL;
+    uint32_t cnt = 0;
+    for (uint32_t i = 0; i < ctx->sghs_size; i++) {
+        if (store->sghs[i].checks)
+            cnt++;
+    }
+    if (cnt > 0)
+        summary = SCCalloc(cnt, sizeof(*summary));
+    if (summary == NULL)
+        return jsa;
+    cnt = 0;
+    for (uint32_t i = 0; i < ctx->sghs_size; i++) {
+        if (store->sghs[i].checks) {
+            summary[cnt].idx = i;
+            summary[cnt].ticks = store->sghs[i].checks;
+            cnt++;
+        }
+    }
+    qsort(summary, cnt, sizeof(*summary), SampleSummaryCompare);
+
+    for (uint32_t i = 0; i < cnt && i < profiling_sample_limit; i++) {
+        const SCProfileSampleSghData *d = &store->sghs[summary[i].idx];
+        json_t *jsm = json_object();
+        if (jsm == NULL)
+            break;
+        json_object_set_new(jsm, "id", json_integer(summary[i].idx));
+        json_object_set_new(
+                jsm, "checks", json_integer(SampleScale(d->checks, store->packets, store->sampled)));
+        json_object_set_new(jsm, "avgmpms", json_real((double)d->mpm_matches / d->checks));
+        json_object_set_new(jsm, "avgsigs", json_real((double)d->post_prefilter_sigs / d->checks));
+        json_array_append_new(jsa, jsm);
+    }
+    SCFree(summary);
+    return jsa;
+}
+
+/**
+ *  \brief get the scaled sampled profiling results of a detect engine
+ *
+ *  \retval js object, or NULL if sampled profiling is disabled
+ */
+json_t *SCProfilingSampleToJSON(const DetectEngineCtx *de_ctx)
+{
+    SCProfileSampleDetectCtx *ctx = de_ctx->profile_sample_ctx;
+    if (ctx == NULL)
+        return NULL;
+
+    /* work on a copy so the workers are not held up while sorting */
+    SCProfileSampleStore store;
+    if (SampleStoreAlloc(&store, ctx) < 0) {
+        SampleStoreFree(&store);
+        return NULL;
+    }
+    SCMutexLock(&ctx->m);
+    SampleStoreMerge(ctx, &store, &ctx->store);
+    SCMutexUnlock(&ctx->m);
+
+    json_t *js = json_object();
+    if (js == NULL) {
+        SampleStoreFree(&store);
+        return NULL;
+    }
+    json_object_set_new(js, "rate", json_integer(profiling_sample_rate));
+    json_object_set_new(js, "packets", json_integer(store.packets));
+    json_object_set_new(js, "sampled_packets", json_integer(store.sampled));
+    json_object_set_new(js, "rules",
+            SampleDataToJSON(store.rules, ctx->rules_size, &store, true, SampleRuleName, de_ctx));
+    json_object_set_new(js, "keywords",
+            SampleDataToJSON(store.keywords, DETECT_TBLSIZE, &store, true, SampleKeywordName, NULL));
+    json_object_set_new(js, "prefilter",
+            SampleDataToJSON(store.prefilter, ctx->prefilter_size, &store, false,
+                    SamplePrefilterName, ctx->prefilter_names));
+    json_object_set_new(js, "rule_groups", SampleSghsToJSON(ctx, &store));
+
+    /* put the counts back, the results are cumulative */
+    SCMutexLock(&ctx->m);
+    SampleStoreMerge(ctx, &ctx->store, &store);
+    SCMutexUnlock(&ctx->m);
+
+    SampleStoreFree(&store);
+    return js;
+}
+
+#ifdef UNITTESTS
+
+static int ProfilingSampleTest01(void)
+{
+    uint32_t rnd = 1;
+    uint64_t sum = 0;
+    for (int i = 0; i < 100000; i++) {
+        uint32_t c = SampleNextCountdown(&rnd, 100);
+        FAIL_IF(c < 1 || c > 199);
+        sum += c;
+    }
+    /* mean interval should be close to the rate */
+    FAIL_IF(sum / 100000 < 95 || sum / 100000 > 105);
+
+    FAIL_IF(SampleNextCountdown(&rnd, 1) != 1);
+    FAIL_IF(SampleNextCountdown(&rnd, 0) != 1);
+    PASS;
+}
+
+static int ProfilingSampleTest02(void)
+{
+    SCProfileSampleDetectCtx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.rules_size = 4;
+    ctx.prefilter_size = 2;
+    ctx.sghs_size = 3;
+
+    SCProfileSampleStore dst, src;
+    FAIL_IF(SampleStoreAlloc(&dst, &ctx) < 0);
+    FAIL_IF(SampleStoreAlloc(&src, &ctx) < 0);
+
+    src.packets = 1000;
+    src.sampled = 2;
+    src.rules[3].checks = 2;
+    src.rules[3].matches = 1;
+    src.rules[3].ticks = 500;
+    src.keywords[1].checks = 5;
+    src.prefilter[1].checks = 1;
+    src.sghs[2].checks = 2;
+    src.sghs[2].mpm_matches = 6;
+    dst.rules[3].checks = 1;
+
+    SampleStoreMerge(&ctx, &dst, &src);
+    FAIL_IF(dst.packets != 1000 || dst.sampled != 2);
+    FAIL_IF(dst.rules[3].checks != 3 || dst.rules[3].matches != 1 || dst.rules[3].ticks != 500);
+    FAIL_IF(dst.keywords[1].checks != 5);
+    FAIL_IF(dst.prefilter[1].checks != 1);
+    FAIL_IF(dst.sghs[2].checks != 2 || dst.sghs[2].mpm_matches != 6);
+
+    /* source is reset */
+    FAIL_IF(src.packets != 0 || src.sampled != 0);
+    FAIL_IF(src.rules[3].checks != 0 || src.keywords[1].checks != 0);
+    FAIL_IF(src.sghs[2].checks != 0);
+
+    SampleStoreFree(&dst);
+    SampleStoreFree(&src);
+    PASS;
+}
+
+static int ProfilingSampleTest03(void)
+{
+    FAIL_IF(SampleScale(3, 1000, 0) != 0);
+    FAIL_IF(SampleScale(3, 1000, 2) != 1500);
+    FAIL_IF(SampleScale(7, 7, 7) != 7);
+
+    SCProfileSampleData data[4];
+    memset(data, 0, sizeof(data));
+    data[0].checks = 1;
+    data[0].ticks = 10;
+    data[2].checks = 1;
+    data[2].ticks = 30;
+    data[3].checks = 1;
+    data[3].ticks = 20;
+
+    SCProfileSampleSummary *summary = NULL;
+    uint32_t cnt = SampleSummarize(data, 4, &summary);
+    FAIL_IF_NULL(summary);
+    FAIL_IF(cnt != 3);
+    FAIL_IF(summary[0].idx != 2 || summary[1].idx != 3 || summary[2].idx != 0);
+    SCFree(summary);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void SCProfilingSampleRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ProfilingSampleTest01", ProfilingSampleTest01);
+    UtRegisterTest("ProfilingSampleTest02", ProfilingSampleTest02);
+    UtRegisterTest("ProfilingSampleTest03", ProfilingSampleTest03);
+#endif
+}
@@ -0,0 +1,59 @@
+/* Copyright (C) 2022 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Sampled rule, keyword, prefilter and rule group profiling for builds
+ * without --enable-profiling.
+ */
+
+#ifndef __UTIL_PROFILING_SAMPLING_H__
+#define __UTIL_PROFILING_SAMPLING_H__
+
+struct DetectEngineCtx_;
+struct DetectEngineThreadCtx_;
+struct SigGroupHead_;
+struct Packet_;
+
+extern int profiling_sample_enabled;
+/** set while the detection of a sampled packet is running */
+extern thread_local int profiling_sample_active;
+
+void SCProfilingSampleGlobalInit(void);
+void SCProfilingSampleInitCounters(struct DetectEngineCtx_ *);
+void SCProfilingSampleDestroyCtx(struct DetectEngineCtx_ *);
+void SCProfilingSampleThreadSetup(struct DetectEngineCtx_ *, struct DetectEngineThreadCtx_ *);
+void SCProfilingSampleThreadCleanup(struct DetectEngineThreadCtx_ *);
+
+int SCProfilingSampleStart(struct DetectEngineThreadCtx_ *);
+void SCProfilingSampleEnd(struct DetectEngineThreadCtx_ *, const struct Packet_ *);
+
+void SCProfilingSampleRuleUpdateCounter(
+        struct DetectEngineThreadCtx_ *, uint32_t num, uint64_t ticks, int match);
+void SCProfilingSampleKeywordUpdateCounter(
+        struct DetectEngineThreadCtx_ *, int type, uint64_t ticks, int match);
+void SCProfilingSamplePrefilterUpdateCounter(
+        struct DetectEngineThreadCtx_ *, int id, uint64_t ticks);
+void SCProfilingSampleSghUpdateCounter(
+        struct DetectEngineThreadCtx_ *, const struct SigGroupHead_ *);
+
+json_t *SCProfilingSampleToJSON(const struct DetectEngineCtx_ *);
+
+void SCProfilingSampleRegisterTests(void);
+
+#endif /* __UTIL_PROFILING_SAMPLING_H__ */
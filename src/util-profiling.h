@@ -25,6 +25,8 @@
 #ifndef __UTIL_PROFILE_H__
 #define __UTIL_PROFILE_H__
 
+#include "util-profiling-sampling.h"
+
 #ifdef PROFILING
 
 #include "util-profiling-locks.h"
@@ -335,12 +337,40 @@ void SCProfilingDump(void);
 
 #else
 
-#define RULE_PROFILING_START(p)
-#define RULE_PROFILING_END(a,b,c,p)
+#include "util-cpu.h"
+
+/* without --enable-profiling the rule, keyword, prefilter and rule group
+ * hooks only take timestamps for the packets picked by the sampled
+ * profiling, see util-profiling-sampling.c */
+
+#define RULE_PROFILING_START(p) \
+    uint64_t profile_rule_start_ = 0; \
+    if (unlikely(profiling_sample_active)) { \
+        profile_rule_start_ = UtilCpuGetTicks(); \
+    }
+
+#define RULE_PROFILING_END(ctx, r, m, p) \
+    if (unlikely(profiling_sample_active)) { \
+        SCProfilingSampleRuleUpdateCounter( \
+                (ctx), (r)->num, UtilCpuGetTicks() - profile_rule_start_, (m)); \
+    }
 
 #define KEYWORD_PROFILING_SET_LIST(a,b)
-#define KEYWORD_PROFILING_START
-#define KEYWORD_PROFILING_END(a,b,c)
+
+#define KEYWORD_PROFILING_START \
+    uint64_t profile_keyword_start_ = 0; \
+    if (unlikely(profiling_sample_active)) { \
+        profile_keyword_start_ = UtilCpuGetTicks(); \
+    }
+
+/* like with full profiling the macro may be called more than once per
+ * start, only the first call is accounted for */
+#define KEYWORD_PROFILING_END(ctx, type, m) \
+    if (unlikely(profiling_sample_active) && profile_keyword_start_ != 0) { \
+        SCProfilingSampleKeywordUpdateCounter( \
+                (ctx), (type), UtilCpuGetTicks() - profile_keyword_start_, (m)); \
+        profile_keyword_start_ = 0; \
+    }
 
 #define PACKET_PROFILING_START(p)
 #define PACKET_PROFILING_RESTART(p)
@@ -365,13 +395,26 @@ void SCProfilingDump(void);
 #define PACKET_PROFILING_LOGGER_START(p, id)
 #define PACKET_PROFILING_LOGGER_END(p, id)
 
-#define SGH_PROFILING_RECORD(det_ctx, sgh)
+#define SGH_PROFILING_RECORD(det_ctx, sgh) \
+    if (unlikely(profiling_sample_active)) { \
+        SCProfilingSampleSghUpdateCounter((det_ctx), (sgh)); \
+    }
 
 #define FLOWWORKER_PROFILING_START(p, id)
 #define FLOWWORKER_PROFILING_END(p, id)
 
-#define PREFILTER_PROFILING_START
-#define PREFILTER_PROFILING_END(ctx, profile_id)
+#define PREFILTER_PROFILING_START \
+    uint64_t profile_prefilter_start_ = 0; \
+    if (unlikely(profiling_sample_active)) { \
+        profile_prefilter_start_ = UtilCpuGetTicks(); \
+    }
+
+#define PREFILTER_PROFILING_END(ctx, profile_id) \
+    if (unlikely(profiling_sample_active) && profile_prefilter_start_ != 0) { \
+        SCProfilingSamplePrefilterUpdateCounter( \
+                (ctx), (profile_id), UtilCpuGetTicks() - profile_prefilter_start_); \
+        profile_prefilter_start_ = 0; \
+    }
 
 #endif /* PROFILING */
 
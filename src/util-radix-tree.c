@@ -33,6 +33,7 @@
 #include "util-byte.h"
 #include "util-cidr.h"
 #include "util-print.h"
+#include "util-lpm.h"
 
 /**
  * \brief Allocates and returns a new instance of SCRadixUserData.
@@ -439,6 +440,139 @@ SCRadixTree *SCRadixCreateRadixTree(void (*Free)(void*), void (*PrintData)(void*
     return tree;
 }
 
+/**
+ * \brief Read-only lookup tables for the IPv4 and IPv6 keys of a tree
+ */
+typedef struct SCRadixCompiled_ {
+    /* LPM tables for IPv4 and IPv6. The value is the index + 1 of the
+     * matching netblock in the arrays below. NULL if the tree has no keys
+     * for the family. */
+    SCLpm *lpm[2];
+
+    SCRadixNode **nodes;
+    void **user;
+    uint32_t cnt;
+    uint32_t size;
+} SCRadixCompiled;
+
+static void SCRadixCompiledFree(SCRadixTree *tree)
+{
+    SCRadixCompiled *c = tree->compiled;
+    if (c == NULL)
+        return;
+
+    SCLpmFree(c->lpm[0]);
+    SCLpmFree(c->lpm[1]);
+    SCFree(c->nodes);
+    SCFree(c->user);
+    SCFree(c);
+    tree->compiled = NULL;
+}
+
+static int SCRadixCompileSubtree(SCRadixNode *node, SCRadixCompiled *c, SCLpmBuilder **b)
+{
+    if (node == NULL)
+        return 0;
+
+    SCRadixPrefix *prefix = node->prefix;
+    if (prefix != NULL && (prefix->bitlen == 32 || prefix->bitlen == 128)) {
+        const int f = prefix->bitlen == 32 ? 0 : 1;
+        for (SCRadixUserData *ud = prefix->user_data; ud != NULL; ud = ud->next) {
+            /* not an ip netblock */
+            if (ud->netmask > prefix->bitlen)
+                continue;
+
+            if (c->cnt == c->size) {
+                uint32_t size = c->size ? c->size * 2 : 64;
+                SCRadixNode **nodes = SCRealloc(c->nodes, size * sizeof(SCRadixNode *));
+                if (nodes == NULL)
+                    return -1;
+                c->nodes = nodes;
+                void **user = SCRealloc(c->user, size * sizeof(void *));
+                if (user == NULL)
+                    return -1;
+                c->user = user;
+                c->size = size;
+            }
+            c->nodes[c->cnt] = node;
+            c->user[c->cnt] = ud->user;
+            c->cnt++;
+
+            if (b[f] == NULL && (b[f] = SCLpmBuilderNew((uint8_t)prefix->bitlen)) == NULL)
+                return -1;
+            if (SCLpmBuilderAdd(b[f], prefix->stream, ud->netmask, c->cnt) < 0)
+                return -1;
+        }
+    }
+
+    if (SCRadixCompileSubtree(node->left, c, b) < 0)
+        return -1;
+    return SCRadixCompileSubtree(node->right, c, b);
+}
+
+/**
+ * \brief Compiles the IPv4 and IPv6 netblocks in the tree into read-only
+ *        longest prefix match tables, that are used by
+ *        SCRadixFindKeyIPV4BestMatch and SCRadixFindKeyIPV6BestMatch.
+ *
+ *        Should be called once the tree is fully set up. Adding or removing
+ *        keys afterwards drops the tables, lookups then fall back to walking
+ *        the tree.
+ *
+ * \param tree Pointer to the Radix tree
+ *
+ * \retval 0 on success
+ * \retval -1 on failure, lookups keep using the tree
+ */
+int SCRadixCompile(SCRadixTree *tree)
+{
+    SCLpmBuilder *b[2] = { NULL, NULL };
+
+    SCRadixCompiledFree(tree);
+
+    SCRadixCompiled *c = SCCalloc(1, sizeof(*c));
+    if (c == NULL)
+        return -1;
+
+    if (SCRadixCompileSubtree(tree->head, c, b) < 0)
+        goto error;
+    for (int f = 0; f < 2; f++) {
+        if (b[f] == NULL)
+            continue;
+        c->lpm[f] = SCLpmBuild(b[f]);
+        if (c->lpm[f] == NULL)
+            goto error;
+        SCLpmBuilderFree(b[f]);
+        b[f] = NULL;
+    }
+
+    SCLogDebug("compiled %u netblocks", c->cnt);
+    tree->compiled = c;
+    return 0;
+
+error:
+    SCLpmBuilderFree(b[0]);
+    SCLpmBuilderFree(b[1]);
+    tree->compiled = c;
+    SCRadixCompiledFree(tree);
+    return -1;
+}
+
+static SCRadixNode *SCRadixCompiledFindBestMatch(const SCRadixCompiled *c,
+        const uint8_t *key_stream, uint8_t key_bitlen, void **user_data_result)
+{
+    const SCLpm *lpm = c->lpm[key_bitlen == 32 ? 0 : 1];
+    const uint32_t v = lpm ? SCLpmLookup(lpm, key_stream) : 0;
+    if (v == 0) {
+        if (user_data_result != NULL)
+            *user_data_result = NULL;
+        return NULL;
+    }
+    if (user_data_result != NULL)
+        *user_data_result = c->user[v - 1];
+    return c->nodes[v - 1];
+}
+
 /**
  * \brief Internal helper function used by SCRadixReleaseRadixTree to free a
  *        subtree
@@ -467,6 +601,7 @@ void SCRadixReleaseRadixTree(SCRadixTree *tree)
     if (tree == NULL)
         return;
 
+    SCRadixCompiledFree(tree);
     SCRadixReleaseRadixSubtree(tree->head, tree);
     tree->head = NULL;
     SCFree(tree);
@@ -498,6 +633,8 @@ static SCRadixNode *SCRadixAddKey(
     SCRadixNode *bottom_node = NULL;
     void *ptmp;
 
+    SCRadixCompiledFree(tree);
+
     uint8_t *stream = NULL;
     uint8_t bitlen = 0;
 
@@ -1189,6 +1326,8 @@ static void SCRadixRemoveKey(uint8_t *key_stream, uint16_t key_bitlen,
     if (node == NULL)
         return;
 
+    SCRadixCompiledFree(tree);
+
     if ( (prefix = SCRadixCreatePrefix(key_stream, key_bitlen, NULL, 255)) == NULL)
         return;
 
@@ -1468,6 +1607,10 @@ static SCRadixNode *SCRadixFindKey(uint8_t *key_stream, uint8_t key_bitlen, uint
     if (tree == NULL || tree->head == NULL)
         return NULL;
 
+    if (!exact_match && tree->compiled != NULL)
+        return SCRadixCompiledFindBestMatch(
+                tree->compiled, key_stream, key_bitlen, user_data_result);
+
     SCRadixNode *node = tree->head;
     uint32_t mask = 0;
     int bytes = 0;
@@ -3744,6 +3887,175 @@ static int SCRadixTestIPV4NetblockInsertion26(void)
     PASS;
 }
 
+
+static uint32_t SCRadixTestRand(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/** \brief fill a tree with \a cnt random IPv4 netblocks and return the
+ *         addresses in \a addrs for later lookups */
+static int SCRadixTestAddRandomIPV4(SCRadixTree *tree, uint32_t cnt, uint32_t *addrs, uint32_t *seed)
+{
+    for (uint32_t i = 0; i < cnt; i++) {
+        uint8_t netmask = (uint8_t)(8 + SCRadixTestRand(seed) % 25);
+        uint32_t addr = (SCRadixTestRand(seed) << 8) ^ SCRadixTestRand(seed);
+        addrs[i] = addr;
+        addr &= (uint32_t)~(0xffffffffULL >> netmask);
+        addr = htonl(addr);
+        if (netmask == 32) {
+            if (SCRadixAddKeyIPV4((uint8_t *)&addr, tree, (void *)(uintptr_t)(i + 1)) == NULL)
+                return -1;
+        } else {
+            if (SCRadixAddKeyIPV4Netblock(
+                        (uint8_t *)&addr, tree, (void *)(uintptr_t)(i + 1), netmask) == NULL)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * \test SCRadixTestCompile27 compare best match lookups on the compiled
+ *       tables against walking the tree
+ */
+static int SCRadixTestCompile27(void)
+{
+    const uint32_t cnt = 5000;
+    uint32_t seed = 27;
+
+    uint32_t *addrs = SCCalloc(cnt, sizeof(uint32_t));
+    FAIL_IF_NULL(addrs);
+    uint32_t *keys = SCCalloc(cnt * 2, sizeof(uint32_t));
+    FAIL_IF_NULL(keys);
+    void **expect = SCCalloc(cnt * 2, sizeof(void *));
+    FAIL_IF_NULL(expect);
+
+    SCRadixTree *tree = SCRadixCreateRadixTree(NULL, NULL);
+    FAIL_IF_NULL(tree);
+    FAIL_IF(SCRadixTestAddRandomIPV4(tree, cnt, addrs, &seed) != 0);
+
+    struct in6_addr a6;
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8::", &a6) != 1);
+    FAIL_IF_NULL(SCRadixAddKeyIPV6Netblock((uint8_t *)&a6, tree, (void *)(uintptr_t)1, 32));
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8:1::", &a6) != 1);
+    FAIL_IF_NULL(SCRadixAddKeyIPV6Netblock((uint8_t *)&a6, tree, (void *)(uintptr_t)2, 48));
+
+    /* addresses inside the netblocks and random ones */
+    for (uint32_t i = 0; i < cnt * 2; i++) {
+        keys[i] = htonl(i < cnt ? addrs[i] : SCRadixTestRand(&seed) << 8);
+        expect[i] = NULL;
+        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&keys[i], tree, &expect[i]);
+    }
+
+    FAIL_IF(SCRadixCompile(tree) != 0);
+    FAIL_IF_NULL(tree->compiled);
+
+    for (uint32_t i = 0; i < cnt * 2; i++) {
+        void *user = NULL;
+        (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&keys[i], tree, &user);
+        FAIL_IF(user != expect[i]);
+    }
+
+    void *user = NULL;
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8:1::1", &a6) != 1);
+    FAIL_IF_NULL(SCRadixFindKeyIPV6BestMatch((uint8_t *)&a6, tree, &user));
+    FAIL_IF(user != (void *)(uintptr_t)2);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db8:2::1", &a6) != 1);
+    FAIL_IF_NULL(SCRadixFindKeyIPV6BestMatch((uint8_t *)&a6, tree, &user));
+    FAIL_IF(user != (void *)(uintptr_t)1);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db9::1", &a6) != 1);
+    FAIL_IF_NOT_NULL(SCRadixFindKeyIPV6BestMatch((uint8_t *)&a6, tree, &user));
+    FAIL_IF_NOT_NULL(user);
+
+    /* modifying the tree drops the compiled tables */
+    FAIL_IF(inet_pton(AF_INET6, "2001:db9::", &a6) != 1);
+    FAIL_IF_NULL(SCRadixAddKeyIPV6Netblock((uint8_t *)&a6, tree, (void *)(uintptr_t)3, 32));
+    FAIL_IF_NOT_NULL(tree->compiled);
+    FAIL_IF(inet_pton(AF_INET6, "2001:db9::1", &a6) != 1);
+    FAIL_IF_NULL(SCRadixFindKeyIPV6BestMatch((uint8_t *)&a6, tree, &user));
+    FAIL_IF(user != (void *)(uintptr_t)3);
+
+    SCRadixReleaseRadixTree(tree);
+    SCFree(expect);
+    SCFree(keys);
+    SCFree(addrs);
+    PASS;
+}
+
+static uint64_t SCRadixTestBenchmarkRun(
+        SCRadixTree *tree, const uint32_t *addrs, uint32_t cnt, uint32_t rounds)
+{
+    struct timeval start, end;
+    uintptr_t sum = 0;
+
+    gettimeofday(&start, NULL);
+    for (uint32_t r = 0; r < rounds; r++) {
+        for (uint32_t i = 0; i < cnt; i++) {
+            uint32_t a = htonl(addrs[i] ^ r);
+            void *user = NULL;
+            (void)SCRadixFindKeyIPV4BestMatch((uint8_t *)&a, tree, &user);
+            sum += (uintptr_t)user;
+        }
+    }
+    gettimeofday(&end, NULL);
+
+    uint64_t usec = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+                    (uint64_t)(end.tv_usec - start.tv_usec);
+    SCLogDebug("sum %" PRIuMAX, (uintmax_t)sum);
+    return usec ? (uint64_t)cnt * rounds * 1000000 / usec : 0;
+}
+
+/**
+ * \test SCRadixTestBenchmark28 measure IPv4 best match lookups per second
+ *       walking the tree and using the compiled tables.
+ *
+ *       Only registered if SC_UNITTEST_BENCHMARKS is set. Uses 10000
+ *       prefixes by default, set SC_RADIX_BENCH_PREFIXES to use more, e.g.:
+ *       SC_UNITTEST_BENCHMARKS=1 SC_RADIX_BENCH_PREFIXES=1000000 \
+ *           suricata -u -U SCRadixTestBenchmark28
+ */
+static int SCRadixTestBenchmark28(void)
+{
+    uint32_t cnt = 10000;
+    const char *env = getenv("SC_RADIX_BENCH_PREFIXES");
+    if (env != NULL) {
+        FAIL_IF(StringParseUint32(&cnt, 10, 0, env) <= 0);
+        FAIL_IF(cnt == 0);
+    }
+    uint32_t seed = 28;
+
+    uint32_t *addrs = SCCalloc(cnt, sizeof(uint32_t));
+    FAIL_IF_NULL(addrs);
+    SCRadixTree *tree = SCRadixCreateRadixTree(NULL, NULL);
+    FAIL_IF_NULL(tree);
+    FAIL_IF(SCRadixTestAddRandomIPV4(tree, cnt, addrs, &seed) != 0);
+
+    const uint32_t rounds = MAX(1, 10000000 / cnt);
+    uint64_t tree_lps = SCRadixTestBenchmarkRun(tree, addrs, cnt, rounds);
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    FAIL_IF(SCRadixCompile(tree) != 0);
+    gettimeofday(&end, NULL);
+    uint64_t compile_ms = ((uint64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+                                  (uint64_t)(end.tv_usec - start.tv_usec)) /
+                          1000;
+
+    uint64_t compiled_lps = SCRadixTestBenchmarkRun(tree, addrs, cnt, rounds);
+
+    SCLogInfo("%u prefixes: tree %" PRIu64 " lookups/sec, compiled %" PRIu64
+              " lookups/sec (compiled in %" PRIu64 "ms, %" PRIuMAX " bytes)",
+            cnt, tree_lps, compiled_lps, compile_ms,
+            (uintmax_t)(SCLpmMemorySize(tree->compiled->lpm[0]) +
+                        tree->compiled->size * (sizeof(SCRadixNode *) + sizeof(void *))));
+
+    SCRadixReleaseRadixTree(tree);
+    SCFree(addrs);
+    PASS;
+}
+
 #endif
 
 void SCRadixRegisterTests(void)
@@ -3793,6 +4105,10 @@ void SCRadixRegisterTests(void)
                    SCRadixTestIPV4NetblockInsertion25);
     UtRegisterTest("SCRadixTestIPV4NetblockInsertion26",
                    SCRadixTestIPV4NetblockInsertion26);
+    UtRegisterTest("SCRadixTestCompile27", SCRadixTestCompile27);
+    if (UtBenchmarksEnabled()) {
+        UtRegisterTest("SCRadixTestBenchmark28", SCRadixTestBenchmark28);
+    }
 #endif
 
     return;
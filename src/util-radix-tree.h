@@ -91,6 +91,10 @@ typedef struct SCRadixTree_ {
      * held by the user field of SCRadixNode */
     void (*PrintData)(void *);
     void (*Free)(void *);
+
+    /* read-only lookup tables compiled from the tree by SCRadixCompile().
+     * Used by the BestMatch lookups. Dropped when the tree is modified. */
+    struct SCRadixCompiled_ *compiled;
 } SCRadixTree;
 
 
@@ -100,6 +104,7 @@ void SCRadixChopIPAddressAgainstNetmask(uint8_t *, uint8_t, uint16_t);
 
 SCRadixTree *SCRadixCreateRadixTree(void (*Free)(void*), void (*PrintData)(void*));
 void SCRadixReleaseRadixTree(SCRadixTree *);
+int SCRadixCompile(SCRadixTree *);
 
 SCRadixNode *SCRadixAddKeyIPV4(uint8_t *, SCRadixTree *, void *);
 SCRadixNode *SCRadixAddKeyIPV6(uint8_t *, SCRadixTree *, void *);
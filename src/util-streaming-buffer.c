@@ -134,8 +134,9 @@ void StreamingBufferClear(StreamingBuffer *sb)
 
         SBBFree(sb);
         if (sb->buf != NULL) {
-            FREE(sb->cfg, sb->buf, sb->buf_size);
+            FREE(sb->cfg, sb->buf - sb->buf_gap, sb->buf_size + sb->buf_gap);
             sb->buf = NULL;
+            sb->buf_gap = 0;
         }
     }
 }
@@ -439,9 +440,30 @@ static void SBBPrune(StreamingBuffer *sb)
     }
 }
 
+/** \internal
+ *  \brief move the data back to the start of the memory block, reclaiming
+ *         the space that was slid out
+ */
+static void Compact(StreamingBuffer *sb)
+{
+    if (sb->buf_gap == 0)
+        return;
+
+    uint8_t *base = sb->buf - sb->buf_gap;
+    SCLogDebug("compacting: moving %u bytes back %u", sb->buf_offset, sb->buf_gap);
+    memmove(base, sb->buf, sb->buf_offset);
+    sb->buf = base;
+    sb->buf_size += sb->buf_gap;
+    sb->buf_gap = 0;
+}
+
 static int WARN_UNUSED
 GrowToSize(StreamingBuffer *sb, uint32_t size)
 {
+    Compact(sb);
+    if (size <= sb->buf_size)
+        return 0;
+
     /* try to grow in multiples of sb->cfg->buf_size */
     uint32_t x = sb->cfg->buf_size ? size % sb->cfg->buf_size : 0;
     uint32_t base = size - x;
@@ -470,11 +492,20 @@ GrowToSize(StreamingBuffer *sb, uint32_t size)
 
 /** \internal
  *  \brief try to double the buffer size
+ *
+ *  If data was slid out of the buffer, reclaim that space first
+ *  instead of growing.
+ *
  *  \retval 0 ok
  *  \retval -1 failed, buffer unchanged
  */
 static int WARN_UNUSED Grow(StreamingBuffer *sb)
 {
+    if (sb->buf_gap > 0) {
+        Compact(sb);
+        return 0;
+    }
+
     uint32_t grow = sb->buf_size * 2;
     void *ptr = REALLOC(sb->cfg, sb->buf, sb->buf_size, grow);
     if (ptr == NULL)
@@ -509,7 +540,9 @@ void StreamingBufferSlideToOffset(StreamingBuffer *sb, uint64_t offset)
         uint32_t slide = offset - sb->stream_offset;
         uint32_t size = sb->buf_offset - slide;
         SCLogDebug("sliding %u forward, size of original buffer left after slide %u", slide, size);
-        memmove(sb->buf, sb->buf+slide, size);
+        sb->buf += slide;
+        sb->buf_size -= slide;
+        sb->buf_gap += slide;
         sb->stream_offset += slide;
         sb->buf_offset = size;
         SBBPrune(sb);
@@ -520,7 +553,9 @@ void StreamingBufferSlide(StreamingBuffer *sb, uint32_t slide)
 {
     uint32_t size = sb->buf_offset - slide;
     SCLogDebug("sliding %u forward, size of original buffer left after slide %u", slide, size);
-    memmove(sb->buf, sb->buf+slide, size);
+    sb->buf += slide;
+    sb->buf_size -= slide;
+    sb->buf_gap += slide;
     sb->stream_offset += slide;
     sb->buf_offset = size;
     SBBPrune(sb);
@@ -1397,6 +1432,61 @@ static int StreamingBufferTest10(void)
     PASS;
 }
 
+static int StreamingBufferHasData(const StreamingBuffer *sb, const char *str)
+{
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    uint64_t offset = 0;
+    StreamingBufferGetData(sb, &data, &data_len, &offset);
+    return (data != NULL && data_len == strlen(str) && memcmp(data, str, data_len) == 0);
+}
+
+/** \test slides don't move data, the space is reclaimed before growing */
+static int StreamingBufferTest11(void)
+{
+    StreamingBufferConfig cfg = { 8, 24, NULL, NULL, NULL };
+    StreamingBuffer *sb = StreamingBufferInit(&cfg);
+    FAIL_IF(sb == NULL);
+
+    FAIL_IF(StreamingBufferAppendNoTrack(sb, (const uint8_t *)"ABCDEFGH01234567", 16) != 0);
+    const uint8_t *base = sb->buf;
+
+    StreamingBufferSlideToOffset(sb, 6);
+    FAIL_IF(sb->stream_offset != 6);
+    FAIL_IF(sb->buf_offset != 10);
+    FAIL_IF(sb->buf_gap != 6);
+    FAIL_IF(sb->buf_size != 18);
+    FAIL_IF(sb->buf != base + 6);
+    FAIL_IF_NOT(StreamingBufferHasData(sb, "GH01234567"));
+
+    /* still fits without reclaiming the gap */
+    FAIL_IF(StreamingBufferAppendNoTrack(sb, (const uint8_t *)"abcdefgh", 8) != 0);
+    FAIL_IF(sb->buf_gap != 6);
+    FAIL_IF(sb->buf_offset != 18);
+
+    /* doesn't fit: data is moved back, buffer not grown */
+    FAIL_IF(StreamingBufferAppendNoTrack(sb, (const uint8_t *)"XYZ", 3) != 0);
+    FAIL_IF(sb->buf_gap != 0);
+    FAIL_IF(sb->buf_size != 24);
+    FAIL_IF(sb->buf != base);
+    FAIL_IF(sb->stream_offset != 6);
+    FAIL_IF_NOT(StreamingBufferHasData(sb, "GH01234567abcdefghXYZ"));
+
+    /* slide everything out, then insert past the old size */
+    StreamingBufferSlideToOffset(sb, 27);
+    FAIL_IF(sb->buf_size != 3);
+    FAIL_IF(sb->buf_offset != 0);
+    StreamingBufferSegment seg;
+    FAIL_IF(StreamingBufferInsertAt(sb, &seg, (const uint8_t *)"0123456789", 10, 27) != 0);
+    FAIL_IF(sb->buf_gap != 0);
+    FAIL_IF(sb->buf_size != 24);
+    FAIL_IF(sb->stream_offset != 27);
+    FAIL_IF_NOT(StreamingBufferHasData(sb, "0123456789"));
+
+    StreamingBufferFree(sb);
+    PASS;
+}
+
 #endif
 
 void StreamingBufferRegisterTests(void)
@@ -1410,5 +1500,6 @@ void StreamingBufferRegisterTests(void)
     UtRegisterTest("StreamingBufferTest08", StreamingBufferTest08);
     UtRegisterTest("StreamingBufferTest09", StreamingBufferTest09);
     UtRegisterTest("StreamingBufferTest10", StreamingBufferTest10);
+    UtRegisterTest("StreamingBufferTest11", StreamingBufferTest11);
 #endif
 }
@@ -34,6 +34,12 @@
  *
  * Using the segments is optional.
  *
+ * Sliding doesn't move the data. StreamingBuffer::buf is advanced into
+ * the memory block instead and the slid out part is tracked in
+ * StreamingBuffer::buf_gap. The data is only moved back to the start of
+ * the memory block when an append or insert needs the space. This saves
+ * a memmove of the remaining data on every slide.
+ *
  *
  * stream_offset            buf_offset          stream_offset + buf_size
  * ^                        ^                   ^
@@ -97,6 +103,7 @@ typedef struct StreamingBuffer_ {
     uint8_t *buf;           /**< memory block for reassembly */
     uint32_t buf_size;      /**< size of memory block */
     uint32_t buf_offset;    /**< how far we are in buf_size */
+    uint32_t buf_gap;       /**< slid out bytes in front of buf, reclaimed on grow */
 
     struct SBB sbb_tree;    /**< red black tree of Stream Buffer Blocks */
     StreamingBufferBlock *head; /**< head, should always be the same as RB_MIN */
@@ -114,12 +121,13 @@ typedef struct StreamingBuffer_ {
         NULL,                                                                                      \
         0,                                                                                         \
         0,                                                                                         \
+        0,                                                                                         \
         { NULL },                                                                                  \
         NULL,                                                                                      \
         0,                                                                                         \
     };
 #else
-#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, { NULL }, NULL, 0, 0 };
+#define STREAMING_BUFFER_INITIALIZER(cfg) { (cfg), 0, NULL, 0, 0, 0, { NULL }, NULL, 0, 0 };
 #endif
 
 typedef struct StreamingBufferSegment_ {
@@ -56,6 +56,14 @@ static inline bool TimevalEarlier(struct timeval *first, struct timeval *second)
     return !timercmp(first, second, >);
 }
 
+/** \brief get a monotonic time in nanoseconds, to measure durations */
+static inline uint64_t TimeGetMonotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
 #ifndef timeradd
 #define timeradd(a, b, r)                                                                          \
     do {                                                                                           \
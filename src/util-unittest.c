@@ -114,6 +114,19 @@ void UtRegisterTest(const char *name, int(*TestFn)(void))
     UtAppendTest(&ut_list, ut);
 }
 
+/**
+ * \brief Check if benchmarks should be registered with the unit tests
+ *
+ * Benchmarks take long and only report numbers, so they are skipped unless
+ * the SC_UNITTEST_BENCHMARKS environment variable is set.
+ *
+ * \retval true if benchmarks are enabled
+ */
+bool UtBenchmarksEnabled(void)
+{
+    return getenv("SC_UNITTEST_BENCHMARKS") != NULL;
+}
+
 /**
  * \brief Compile a regex to run a specific unit test
  *
@@ -51,6 +51,7 @@ void UtCleanup(void);
 int UtRunSelftest (const char *regex_arg);
 void UtListTests(const char *regex_arg);
 void UtRunModeRegister(void);
+bool UtBenchmarksEnabled(void);
 
 extern int unittests_fatal;
 